@@ -14,6 +14,8 @@
 #include <fcntl.h>
 #include <errno.h>
 
+#include "config.h"
+
 // Debug macros
 #define DEBUG 1
 #if DEBUG
@@ -31,6 +33,7 @@
 #define MiB (1024 * KiB)
 #define GiB (1024 * MiB)
 #define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
 #define CACHE_LINE_SIZE 64
 
 // Utility functions
@@ -46,6 +49,33 @@ static inline uint64_t get_time_us(void) {
     return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
+static inline uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Deterministic RNG: splitmix64 as the generator, and a seed for stream
+// `index` derived from a base seed so parallel jobs are reproducible
+static inline uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rng_stream_seed(uint64_t base, uint64_t index) {
+    uint64_t state = base ^ (index * 0xD1B54A32D192ED03ULL);
+    return splitmix64(&state);
+}
+
+// Parallel execution (src/common/parallel.c). Runs fn(ctx, i, worker) for
+// every i in [0, count) on a work-stealing pool; threads <= 0 uses every
+// online CPU. Returns 0 on success.
+typedef void (*ParallelFn)(void* ctx, size_t index, int worker);
+int parallel_default_threads(void);
+int parallel_for(size_t count, int threads, ParallelFn fn, void* ctx);
+
 // Bit manipulation
 #define BIT(n) (1ULL << (n))
 #define SET_BIT(var, bit) ((var) |= BIT(bit))
@@ -64,6 +94,79 @@ static inline uint64_t get_time_us(void) {
 // Array size
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
+// Sparse guest memory (src/common/guest_memory.c): a two-level map of
+// PAGE_SIZE pages, each allocated on its first non-zero write. Untouched
+// pages read from one shared zero page, so an address space costs only the
+// pages it dirties. Safe for concurrent use; callers keep accesses inside
+// [0, size).
+#define GMEM_TABLE_BITS 10                      // pages per second-level table
+#define GMEM_TABLE_PAGES (1u << GMEM_TABLE_BITS)
+
+typedef struct {
+    uint64_t size;
+    uint8_t*** tables;          // tables[dir][page], NULL until touched
+    uint64_t** shared;          // shared[dir]: bit per page lent by gmem_share
+    uint64_t table_count;
+    uint64_t resident_pages;    // owned pages only
+    uint64_t shared_pages;
+} GuestMemory;
+
+extern const uint8_t gmem_zero_page[PAGE_SIZE];
+
+GuestMemory* gmem_create(uint64_t size);
+void gmem_destroy(GuestMemory* mem);
+uint8_t* gmem_populate(GuestMemory* mem, uint64_t addr);
+void gmem_read(const GuestMemory* mem, uint64_t addr, void* buf, size_t len);
+void gmem_write(GuestMemory* mem, uint64_t addr, const void* buf, size_t len);
+void gmem_discard(GuestMemory* mem, uint64_t addr, uint64_t len);
+int gmem_share(GuestMemory* mem, uint64_t addr, uint8_t* page);
+
+// Page holding addr for reading; the zero page when untouched
+static inline const uint8_t* gmem_page(const GuestMemory* mem, uint64_t addr) {
+    uint8_t** table = __atomic_load_n(&mem->tables[addr >> (PAGE_SHIFT + GMEM_TABLE_BITS)],
+                                      __ATOMIC_ACQUIRE);
+    if (!table) return gmem_zero_page;
+    uint8_t* page = __atomic_load_n(&table[(addr >> PAGE_SHIFT) & (GMEM_TABLE_PAGES - 1)],
+                                    __ATOMIC_ACQUIRE);
+    return page ? page : gmem_zero_page;
+}
+
+// Page holding addr for writing, allocated on first touch; NULL when out
+// of host memory
+static inline uint8_t* gmem_page_mut(GuestMemory* mem, uint64_t addr) {
+    const uint8_t* page = gmem_page(mem, addr);
+    return page != gmem_zero_page ? (uint8_t*)page : gmem_populate(mem, addr);
+}
+
+// Aligned 8-byte accesses never straddle a page and take the fast path
+static inline uint64_t gmem_load64(const GuestMemory* mem, uint64_t addr) {
+    uint64_t value;
+    if ((addr & 7) == 0) {
+        memcpy(&value, gmem_page(mem, addr) + (addr & (PAGE_SIZE - 1)), sizeof(value));
+    } else {
+        gmem_read(mem, addr, &value, sizeof(value));
+    }
+    return value;
+}
+
+static inline void gmem_store64(GuestMemory* mem, uint64_t addr, uint64_t value) {
+    if ((addr & 7) == 0) {
+        const uint8_t* page = gmem_page(mem, addr);
+        if (page == gmem_zero_page) {
+            if (value == 0) return;     // already zero, stay unpopulated
+            page = gmem_populate(mem, addr);
+            if (!page) return;
+        }
+        memcpy((uint8_t*)page + (addr & (PAGE_SIZE - 1)), &value, sizeof(value));
+    } else {
+        gmem_write(mem, addr, &value, sizeof(value));
+    }
+}
+
+// Checkpoint files, see snapshot.h
+typedef struct SnapshotWriter SnapshotWriter;
+typedef struct Snapshot Snapshot;
+
 // Assert macro
 #ifdef NDEBUG
 #define ASSERT(expr) ((void)0)
@@ -12,21 +12,45 @@
 #define DEFAULT_CACHE_L1_SIZE (32 * 1024)       // 32KB
 #define DEFAULT_CACHE_L2_SIZE (256 * 1024)      // 256KB
 #define DEFAULT_BRANCH_PREDICTOR_SIZE 4096
+#define DEFAULT_BTB_ENTRIES 1024                // power of two
+#define DEFAULT_PREDECODE_BLOCKS 512            // basic blocks
+#define DEFAULT_OOO_ROB_SIZE 128
+#define DEFAULT_OOO_RS_COUNT 48
+#define DEFAULT_OOO_WIDTH 4                     // dispatch/issue/commit
+#define DEFAULT_NUM_CORES 4
+#define DEFAULT_QUANTUM_CYCLES 1000             // cycles between core barriers
+#define DEFAULT_L2_BANKS 8
+#define DEFAULT_L2_LATENCY 10
+#define DEFAULT_MEMORY_LATENCY 100
 
 // Kernel configuration
-#define MAX_PROCESSES 64
+#define MAX_PROCESSES 65536
 #define MAX_THREADS_PER_PROCESS 16
 #define MAX_OPEN_FILES_PER_PROCESS 32
 #define MAX_MESSAGE_QUEUES 32
+#define DEFAULT_TLB_L1_ENTRIES 64
+#define DEFAULT_TLB_L1_WAYS 4
+#define DEFAULT_TLB_L2_ENTRIES 1024
+#define DEFAULT_TLB_L2_WAYS 8
+#define SWAP_RECLAIM_BATCH 16           // frames one reclaim pass frees
+#define SWAP_WRITEBACK_BATCH 16         // dirty pages gathered per swap file write
+#define SWAP_WSCLOCK_WINDOW 4096        // translations a page stays in the working set
 
 // Embedded configuration
 #define MAX_RT_TASKS 16
 #define MAX_VIRTUAL_SENSORS 8
 #define MAX_VIRTUAL_TIMERS 8
 #define GPIO_PIN_COUNT 32
+#define PM_IDLE_WAKEUP_US 10            // wake-up latency of each power state
+#define PM_SLEEP_WAKEUP_US 200
+#define PM_DEEP_SLEEP_WAKEUP_US 2000
+#define RTOS_MAX_SLEEP_MS 1000          // tickless idle rechecks rtos->running this often
 
 // Performance tuning
 #define SCHEDULER_TICK_MS 10
+#define SCHEDULER_BOOST_TICKS 1000     // MLFQ moves everything to the top level this often
+#define SCHEDULER_MIGRATION_TICKS 5     // cold-cache ticks after moving to another CPU
+#define KERNEL_REALTIME_TICK_US 100     // wall time per tick when kernel_set_realtime is on
 #define CACHE_HIT_LATENCY 1
 #define CACHE_MISS_LATENCY 10
 #define BRANCH_MISPREDICT_PENALTY 3
@@ -37,17 +61,24 @@
 #define DEBUG_SCHEDULER 0
 #define DEBUG_RTOS 0
 #define DEBUG_POWER 0
+#ifndef ENABLE_PROFILER
+#define ENABLE_PROFILER 0   // Host-time and stall hooks in the pipeline (make profile)
+#endif
 
 // Feature flags
 #define FEATURE_OUT_OF_ORDER 0
 #define FEATURE_MULTICORE 0
 #define FEATURE_VIRTUALIZATION 0
 #define FEATURE_SECURITY 0
+#ifndef HAVE_LZ4
+#define HAVE_LZ4 0          // LZ4-compressed trace blocks (make LZ4=1)
+#endif
 
 // Optimization flags
 #define OPTIMIZE_FOR_SIZE 0
 #define OPTIMIZE_FOR_SPEED 1
-#define USE_SIMD 0
+#define USE_SIMD 1          // Vector way search in cache_access (runtime-detected)
+#define USE_THREADED_DISPATCH 1  // Computed-goto functional interpreter (GCC/Clang)
 #define USE_JIT 0
 
 #endif
\ No newline at end of file
@@ -25,9 +25,71 @@ typedef enum {
     INST_RET,
     INST_CMP,
     INST_MOV,
-    INST_HLT
+    INST_HLT,
+    INST_COUNT
 } InstructionType;
 
+// Instruction formats
+typedef enum {
+    FORMAT_R,    // Register
+    FORMAT_I,    // Immediate
+    FORMAT_M,    // Memory
+    FORMAT_J,    // Jump
+    FORMAT_S     // System
+} InstructionFormat;
+
+// Decoded instruction
+typedef struct {
+    InstructionType type;
+    InstructionFormat format;
+    uint8_t opcode;
+    uint8_t rd;      // Destination register
+    uint8_t rs1;     // Source register 1
+    uint8_t rs2;     // Source register 2
+    uint8_t size;    // Encoded length in bytes
+    uint64_t imm;    // Immediate value
+    uint64_t address;
+    uint64_t pc;
+} DecodedInstruction;
+
+// Predecoded basic block: straight-line instructions from start_pc up to
+// and including the first control transfer
+#define PREDECODE_BLOCK_MAX 16
+
+typedef struct {
+    bool valid;
+    uint8_t count;
+    uint64_t start_pc;
+    uint64_t end_pc;            // one past the last byte decoded
+    DecodedInstruction insts[PREDECODE_BLOCK_MAX];
+} DecodedBlock;
+
+// Direct-mapped block cache keyed by start PC. Pages holding decoded bytes
+// are tracked in a bitmap so stores outside code pages stay cheap.
+typedef struct {
+    DecodedBlock* blocks;
+    int block_count;            // power of two
+    const GuestMemory* memory;
+    uint64_t mem_size;
+    uint64_t* code_pages;       // one bit per PAGE_SIZE page
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+} PredecodeCache;
+
+// Execute dispatch engines for functional mode (src/cpu/dispatch.c)
+typedef enum {
+    DISPATCH_SWITCH,            // switch per instruction
+    DISPATCH_TABLE,             // handler table, portable
+    DISPATCH_THREADED           // computed goto; table where unsupported
+} DispatchMode;
+
+// Per-opcode result from the rs1/rs2 values, immediate and fall-through
+// pc; branches return the next pc. Shared by every execution model.
+typedef uint64_t (*ExecHandler)(uint64_t a, uint64_t b, uint64_t imm, uint64_t next_pc);
+extern const ExecHandler exec_handlers[INST_COUNT];
+
 // Pipeline stages
 typedef enum {
     STAGE_FETCH,
@@ -54,35 +116,148 @@ typedef struct {
     int num_sets;
     int hit_time;       // cycles
     int miss_penalty;   // cycles
-    
-    uint64_t** tags;
-    bool** valid;
-    uint64_t* lru_counters;
-    
+
+    // Tag store: one line-aligned block holding a fixed-stride record per
+    // set, laid out as tags[way_stride] | lru[way_stride] | valid bitmap.
+    uint64_t* store;
+    int way_stride;     // ways per record, padded for line alignment
+    int valid_words;    // 64-bit words in the valid bitmap
+    int set_stride;     // words per set record
+
+    // Index decode; shift/mask when line_size and num_sets are powers of two
+    bool pow2_index;
+    int line_shift;
+    int set_shift;
+    uint64_t set_mask;
+
+    // Way search kernels over way_stride ways, selected at create time
+    int (*find_way)(const uint64_t* tags, const uint64_t* valid,
+                    int ways, uint64_t tag);
+    int (*find_lru)(const uint64_t* lru, int ways);
+    const char* search_kernel;
+
     uint64_t hits;
     uint64_t misses;
     uint64_t accesses;
 } Cache;
 
+// Cache geometry, as accepted by cache_create()
+typedef struct {
+    CacheType type;
+    int size;
+    int line_size;
+    int associativity;
+} CacheConfig;
+
 // Branch predictor types
 typedef enum {
     PREDICTOR_ALWAYS_TAKEN,
     PREDICTOR_ALWAYS_NOT_TAKEN,
     PREDICTOR_BIMODAL,
-    PREDICTOR_GSHARE
+    PREDICTOR_GSHARE,
+    PREDICTOR_TAGE,             // TAGE with a loop predictor
+    PREDICTOR_PERCEPTRON        // hashed perceptron
 } PredictorType;
 
-// Branch predictor
+#define TAGE_TABLES 6
+#define TAGE_MAX_HISTORY 256    // longest history; power of two
+#define TAGE_TAG_BITS 11
+#define LOOP_ENTRIES 64
+#define PERCEPTRON_TABLES 8
+#define RAS_DEPTH 16
+
+typedef struct {
+    int8_t ctr;                 // -4..3, taken when >= 0
+    uint8_t u;                  // usefulness, 0..3
+    uint16_t tag;
+} TageEntry;
+
+// Global history folded down to `width` bits, updated incrementally
+typedef struct {
+    uint32_t comp;
+    int length;
+    int width;
+    int outpoint;               // length % width, where the oldest bit folds in
+} FoldedHistory;
+
+typedef struct {
+    uint16_t tag;
+    uint16_t past;              // iterations of the last complete run
+    uint16_t current;
+    uint8_t confidence;         // 3 = predicting
+    uint8_t age;
+    bool dir;                   // body direction; the exit goes the other way
+} LoopEntry;
+
+typedef struct {
+    TageEntry* entries;         // TAGE_TABLES x (1 << table_bits)
+    int table_bits;
+    int lengths[TAGE_TABLES];
+    FoldedHistory index_fold[TAGE_TABLES];
+    FoldedHistory tag_fold[2][TAGE_TABLES];
+    uint8_t history[TAGE_MAX_HISTORY];  // outcome ring, newest at head
+    int head;
+    uint32_t path;
+    int8_t use_alt;             // trust altpred over a new provider when >= 0
+    uint32_t tick;              // usefulness aging clock
+    uint64_t seed;              // allocation choice
+    LoopEntry loops[LOOP_ENTRIES];
+    int8_t loop_use;
+} TageState;
+
+typedef struct {
+    int8_t* weights;            // PERCEPTRON_TABLES x rows
+    int row_bits;
+    int history_length;         // table t hashes the newest t/(T-1) of it
+    int theta;                  // training threshold, adapted online
+    int theta_count;
+} PerceptronState;
+
+typedef struct {
+    uint64_t pc;
+    uint64_t target;
+} BTBEntry;
+
+// Branch predictor. Table sizes are rounded up to powers of two.
+// bp_predict has no side effects; bp_update trains and counts.
 typedef struct {
     PredictorType type;
-    int bhr_size;           // Branch history register size
-    int pht_size;           // Pattern history table size
-    uint32_t bhr;           // Branch history register
+    int bhr_size;           // Branch history length (TAGE: longest history)
+    int pht_size;           // Pattern history table size (TAGE: base table)
+    uint64_t bhr;           // Branch history register
     uint8_t* pht;           // Pattern history table
+    uint32_t pht_mask;
+    TageState* tage;
+    PerceptronState* perceptron;
+
+    // Target prediction, exercised by trace replay
+    BTBEntry* btb;
+    uint32_t btb_mask;
+    uint64_t ras[RAS_DEPTH];
+    int ras_top;
+    uint64_t target_correct;
+    uint64_t target_total;
+
     uint64_t correct;
     uint64_t total;
 } BranchPredictor;
 
+typedef enum {
+    BRANCH_CONDITIONAL,
+    BRANCH_JUMP,
+    BRANCH_CALL,
+    BRANCH_RETURN
+} BranchKind;
+
+// One branch outcome, as replayed through a predictor
+typedef struct {
+    uint64_t pc;
+    uint64_t target;
+    bool taken;
+    uint8_t kind;           // BranchKind
+    uint8_t size;           // instruction bytes; calls return to pc + size
+} BranchRecord;
+
 // Pipeline register
 typedef struct {
     uint64_t pc;
@@ -92,6 +267,8 @@ typedef struct {
     uint64_t src2;
     uint64_t dest;
     uint64_t immediate;
+    uint64_t next_pc;
+    uint64_t predicted_pc;      // where fetch went next
     uint64_t result;
     uint64_t mem_addr;
     uint64_t mem_data;
@@ -100,6 +277,11 @@ typedef struct {
     uint64_t cycle_entered;
 } PipelineRegister;
 
+typedef struct TomasuloCPU TomasuloCPU;
+typedef struct MulticoreSystem MulticoreSystem;
+typedef struct Profiler Profiler;
+typedef struct TraceWriter TraceWriter;
+
 // CPU core
 typedef struct {
     // Registers
@@ -109,7 +291,7 @@ typedef struct {
     uint64_t flags;             // Status flags
     
     // Memory
-    uint8_t* memory;
+    GuestMemory* memory;
     uint64_t mem_size;
     
     // Caches
@@ -119,22 +301,123 @@ typedef struct {
     // Branch predictor
     BranchPredictor* bp;
     
+    // Functional mode engine
+    DispatchMode dispatch;
+    
+    bool owns_memory;           // false for cores sharing a system's memory
+    
+    // Owning multicore system, NULL for a standalone CPU. Memory accesses
+    // then go through cpu_mem_access() to the coherent hierarchy.
+    MulticoreSystem* system;
+    int core_id;
+    uint64_t mem_stall;         // cycles left on the current memory access
+    
+    // Out-of-order core; cpu_run uses it instead of the in-order pipeline
+    // when FEATURE_OUT_OF_ORDER is set
+    TomasuloCPU* ooo;
+    
+    // Execution capture, NULL when off; owned and closed by the caller
+    TraceWriter* trace;
+    
+    // Predecoded instructions; fetch walks the current block by slot
+    PredecodeCache* predecode;
+    const DecodedBlock* fetch_block;
+    int fetch_slot;
+    
     // Pipeline
     PipelineRegister pipeline[6];  // One for each stage
     PipelineStage current_stage;
+    bool halted;                // HLT fetched; cleared by a redirect
+    bool draining;              // fetch stopped for a mode handoff
     
     // Performance counters
     uint64_t cycles;
     uint64_t instructions;
+    uint64_t functional_instructions;
     uint64_t stalls;
     uint64_t bubbles;
     
     // Statistics
     uint64_t start_time;
+#if ENABLE_PROFILER
+    Profiler* prof;
+#endif
 } CPU;
 
+// Out-of-order core geometry
+typedef struct {
+    int rob_size;               // at most 65535
+    int rs_count;
+    int dispatch_width;         // renamed into RS/ROB per cycle
+    int issue_width;            // RS entries sent to execute per cycle
+    int commit_width;
+} OoOConfig;
+
+// Reservation station. Operand tags are producing ROB index + 1, 0 when
+// the value is present.
+typedef struct {
+    InstructionType op;
+    uint16_t rob;               // ROB index of this instruction
+    uint16_t qj, qk;
+    uint64_t vj, vk;
+} ReservationStation;
+
+// Reorder buffer entry
+typedef struct {
+    bool busy;
+    bool done;                  // result written back
+    bool writes_reg;
+    InstructionType op;
+    uint8_t dest;
+    int32_t rs;                 // holding RS, -1 once issued
+    int32_t next_event;         // completion wheel link, ROB index or -1
+    uint64_t complete_at;       // cycle the result is written back
+    uint64_t pc;
+    uint64_t next_pc;
+    uint64_t predicted_pc;
+    uint64_t imm;
+    uint64_t address;
+    uint64_t result;            // value; next pc for branches; data for stores
+    uint64_t store_seq;         // loads: stores that must commit first
+} ROBEntry;
+
+// Tomasulo core driving a CPU's architectural state. Wakeup goes through a
+// per-ROB-entry bitmap of waiting RS slots, selection through a ready
+// bitmap, and completions through a timing wheel, so per-cycle work scales
+// with the widths rather than RS x ROB.
+struct TomasuloCPU {
+    CPU* cpu;
+    OoOConfig config;
+
+    ReservationStation* rs;
+    ROBEntry* rob;
+    uint64_t* consumers;        // rob_size x rs_words bitmap
+    uint64_t* rs_free;          // rs_words bitmap
+    uint64_t* rs_ready;
+    int rs_words;
+    uint16_t reg_status[16];    // youngest producer ROB index + 1
+
+    int rob_head;
+    int rob_tail;
+    int rob_count;
+
+    int32_t* wheel;             // completion list heads per cycle slot
+    uint64_t fetch_stall_until;
+    uint64_t stores_dispatched;
+    uint64_t stores_committed;
+
+    uint64_t dispatched;
+    uint64_t issued;
+    uint64_t committed;
+    uint64_t squashed;
+    uint64_t mispredicts;
+    uint64_t rob_full_cycles;
+    uint64_t rs_full_cycles;
+};
+
 // Function prototypes
 CPU* cpu_create(uint64_t mem_size);
+CPU* cpu_create_shared(GuestMemory* memory);
 void cpu_destroy(CPU* cpu);
 void cpu_reset(CPU* cpu);
 int cpu_load_program(CPU* cpu, uint8_t* program, uint64_t size, uint64_t address);
@@ -143,18 +426,420 @@ void cpu_run(CPU* cpu, uint64_t cycles);
 void cpu_print_stats(CPU* cpu);
 void cpu_print_registers(CPU* cpu);
 void cpu_print_pipeline(CPU* cpu);
+void cpu_drain_pipeline(CPU* cpu);
+int cpu_mem_access(CPU* cpu, uint64_t addr, bool is_write);
+
+// Checkpoints (src/cpu/snapshot.c, format in snapshot.h): standalone CPUs
+// only, and out-of-order ones with nothing in flight
+int cpu_snapshot(SnapshotWriter* writer, const CPU* cpu);
+CPU* cpu_restore(Snapshot* snapshot, uint32_t index);
+
+// Host-side profiler (src/cpu/profiler.c). Built in with ENABLE_PROFILER,
+// when every CPU owns one; otherwise the PROF_* hooks reduce to their
+// statement and the CPU has no profiler at all. Cache time is also counted
+// in the stage that made the access.
+#define PROF_CACHE (STAGE_COMMIT + 1)
+#define PROF_REGIONS (PROF_CACHE + 1)
+#define PROF_RESIDENCY_BUCKETS 16   // cycles in a stage; the last is 15+
+#define PROF_PC_SLOTS 4096          // power of two
+
+typedef struct {
+    uint64_t pc;
+    uint64_t stalls;            // decode hazard cycles
+    uint64_t flushes;           // mispredicts resolved at this branch
+    uint64_t mem_cycles;        // cycles blocked on this access
+} ProfilePC;
+
+struct Profiler {
+    uint64_t ticks[PROF_REGIONS];
+    uint64_t calls[PROF_REGIONS];
+    uint64_t residency[STAGE_COMMIT][PROF_RESIDENCY_BUCKETS];
+    ProfilePC pcs[PROF_PC_SLOTS];
+    int pc_count;
+    ProfilePC other;            // PCs that found the table full
+
+    uint64_t start_ticks;       // for the tick rate at export
+    uint64_t start_us;
+};
+
+// Host timestamp: the TSC on x86, the virtual counter on AArch64
+static inline uint64_t profiler_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+Profiler* profiler_create(void);
+void profiler_destroy(Profiler* prof);
+void profiler_reset(Profiler* prof);
+ProfilePC* profiler_pc(Profiler* prof, uint64_t pc);
+void profiler_print(Profiler* prof);
+int profiler_export(Profiler* prof, const char* path);
+
+#if ENABLE_PROFILER
+#define PROF_REGION(cpu, region, stmt) do { \
+    uint64_t prof_start_ = profiler_ticks(); \
+    stmt; \
+    if ((cpu)->prof) { \
+        (cpu)->prof->ticks[region] += profiler_ticks() - prof_start_; \
+        (cpu)->prof->calls[region]++; \
+    } \
+} while (0)
+#define PROF_PC(cpu, pc, field, n) do { \
+    if ((cpu)->prof) profiler_pc((cpu)->prof, pc)->field += (n); \
+} while (0)
+#define PROF_RESIDENCY(cpu, stage, cycles) do { \
+    if ((cpu)->prof) { \
+        (cpu)->prof->residency[stage][MIN((cycles), PROF_RESIDENCY_BUCKETS - 1)]++; \
+    } \
+} while (0)
+#else
+#define PROF_REGION(cpu, region, stmt) stmt
+#define PROF_PC(cpu, pc, field, n) ((void)0)
+#define PROF_RESIDENCY(cpu, stage, cycles) ((void)0)
+#endif
+
+// Out-of-order core functions
+TomasuloCPU* tomasulo_create(CPU* cpu, const OoOConfig* config);
+void tomasulo_destroy(TomasuloCPU* ooo);
+void tomasulo_reset(TomasuloCPU* ooo);
+void tomasulo_step(TomasuloCPU* ooo);
+void tomasulo_run(TomasuloCPU* ooo, uint64_t cycles);
+void tomasulo_flush(TomasuloCPU* ooo);
+void tomasulo_print_stats(TomasuloCPU* ooo);
+
+// Functional execution (src/cpu/functional.c): updates architectural state
+// only, optionally warming caches and the branch predictor without counting
+// into their statistics. cpu_fast_forward drains the pipeline first and
+// leaves it empty, so cpu_run continues in detail from cpu->pc.
+#define WARM_NONE       0
+#define WARM_CACHES     BIT(0)
+#define WARM_PREDICTOR  BIT(1)
+#define NO_STOP_PC      UINT64_MAX
+
+// Stop after max_instructions (0 = no limit), before executing stop_pc, or
+// at HLT. Returns the number of instructions executed.
+uint64_t cpu_fast_forward(CPU* cpu, uint64_t max_instructions, uint64_t stop_pc,
+                          uint32_t warm);
+
+// Run predecoded instructions with the given engine from cpu->pc; same
+// stop conditions as cpu_fast_forward, without draining or warm-up
+// bookkeeping. Updates cpu->pc and returns the instructions executed.
+uint64_t dispatch_run(CPU* cpu, DispatchMode mode, uint64_t max_instructions,
+                      uint64_t stop_pc, uint32_t warm);
+DispatchMode dispatch_default_mode(void);
+const char* dispatch_mode_name(DispatchMode mode);
+
+// Periodic sampling, SMARTS style: each sample fast-forwards, runs warmup
+// detailed cycles unmeasured, then measures detail_cycles
+typedef struct {
+    uint64_t fast_forward;      // instructions between samples
+    uint64_t warmup_cycles;
+    uint64_t detail_cycles;
+    int samples;
+    uint32_t warm;              // WARM_* during fast-forward
+} SamplingConfig;
+
+typedef struct {
+    int samples;
+    uint64_t functional_instructions;
+    uint64_t detailed_cycles;
+    uint64_t detailed_instructions;
+    double cpi;                 // measured cycles / measured instructions
+    double cpi_stddev;          // across samples
+} SamplingStats;
+
+int cpu_run_sampled(CPU* cpu, const SamplingConfig* config, SamplingStats* stats);
+void sampling_print_stats(const SamplingStats* stats);
+
+// Instruction set functions
+DecodedInstruction decode_instruction(uint8_t* mem, uint64_t pc);
+uint32_t encode_instruction(DecodedInstruction inst, uint8_t* buffer);
+const char* disassemble_instruction(uint8_t* mem, uint64_t pc);
+uint32_t get_instruction_size(uint8_t* mem, uint64_t pc);
+bool instruction_ends_block(InstructionType type);
+bool instruction_writes_register(InstructionType type);
+
+// Predecode cache functions. Anything that writes guest memory behind the
+// CPU's back must call predecode_invalidate for the written range.
+PredecodeCache* predecode_create(const GuestMemory* memory, int block_count);
+void predecode_destroy(PredecodeCache* pc);
+const DecodedBlock* predecode_lookup(PredecodeCache* pc, uint64_t addr);
+void predecode_invalidate(PredecodeCache* pc, uint64_t addr, uint64_t size);
+void predecode_flush(PredecodeCache* pc);
+void predecode_print_stats(PredecodeCache* pc);
 
 // Cache functions
 Cache* cache_create(CacheType type, int size, int line_size, int associativity);
 void cache_destroy(Cache* cache);
 int cache_access(Cache* cache, uint64_t addr, bool is_write);
+// Trace replay; both return the summed latency, per-access values are
+// written to latencies_out when non-NULL. The hierarchy variant sends L1
+// misses on to l2 and adds the L2 latency to theirs.
+uint64_t cache_access_batch(Cache* cache, const uint64_t* addrs,
+                            const uint8_t* is_write, size_t n,
+                            uint32_t* latencies_out);
+uint64_t cache_hierarchy_batch(Cache* l1, Cache* l2, const uint64_t* addrs,
+                               const uint8_t* is_write, size_t n,
+                               uint32_t* latencies_out);
 void cache_print_stats(Cache* cache);
+int cache_line_count(Cache* cache);
+int cache_lookup_line(Cache* cache, uint64_t addr, bool touch);
+int cache_fill_line(Cache* cache, uint64_t addr, uint64_t* evicted);
+void cache_invalidate_line(Cache* cache, int line);
 
 // Branch predictor functions
 BranchPredictor* bp_create(PredictorType type, int bhr_size, int pht_size);
 void bp_destroy(BranchPredictor* bp);
 bool bp_predict(BranchPredictor* bp, uint64_t pc);
 void bp_update(BranchPredictor* bp, uint64_t pc, bool taken, bool predicted);
+uint64_t bp_replay_batch(BranchPredictor* bp, const BranchRecord* records, size_t n);
 void bp_print_stats(BranchPredictor* bp);
 
+// Execution traces (src/cpu/trace.c). A trace file holds three streams,
+// each cut into independently decodable blocks of at most block_records
+// records: a little-endian TraceHeader, the blocks, then a TraceBlock
+// index. Values are delta-encoded against the previous record of the
+// same block as zigzag varints, then optionally LZ4-compressed.
+#define TRACE_MAGIC 0x3145525443455053ULL     // "SPECTRE1"
+#define TRACE_VERSION 1
+#define TRACE_BLOCK_RECORDS 65536
+
+typedef enum {
+    TRACE_FETCH,                // fetch pcs
+    TRACE_MEM,                  // data addresses with a write bit
+    TRACE_BRANCH,               // resolved branches
+    TRACE_STREAMS
+} TraceStream;
+
+typedef enum {
+    TRACE_CODEC_VARINT,
+    TRACE_CODEC_LZ4             // varint bytes through LZ4 (HAVE_LZ4)
+} TraceCodec;
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t block_records;
+    uint64_t counts[TRACE_STREAMS];
+    uint64_t block_count;
+    uint64_t index_offset;
+} TraceHeader;
+
+typedef struct {
+    uint64_t offset;
+    uint32_t size;              // bytes in the file
+    uint32_t raw_size;          // varint bytes before compression
+    uint32_t count;
+    uint8_t stream;
+    uint8_t codec;
+    uint16_t reserved;
+} TraceBlock;
+
+struct TraceWriter {
+    FILE* file;
+    TraceHeader header;
+    TraceBlock* index;
+    size_t index_capacity;
+    int codec;
+    uint64_t* values[TRACE_MEM + 1];    // pending pcs, addr << 1 | is_write
+    BranchRecord* branches;             // pending branches
+    uint32_t pending[TRACE_STREAMS];
+    uint8_t* scratch;           // encoded block
+    uint8_t* packed;            // compressed block
+    size_t scratch_size;
+    uint64_t bytes;
+    bool failed;
+};
+
+// Read-only once opened, so any number of cursors and threads can share it
+typedef struct {
+    const uint8_t* map;
+    size_t map_size;
+    TraceHeader header;
+    TraceBlock* index;
+    uint32_t* blocks[TRACE_STREAMS];    // index positions, per stream
+    uint64_t block_count[TRACE_STREAMS];
+} TraceReader;
+
+// Walks one stream a block at a time, decoding into its own buffers
+typedef struct {
+    const TraceReader* reader;
+    TraceStream stream;
+    uint64_t next;              // next block of the stream
+    uint64_t* addrs;            // fetch pcs or data addresses
+    uint8_t* is_write;
+    BranchRecord* branches;
+    uint8_t* unpacked;          // LZ4 output
+} TraceCursor;
+
+TraceWriter* trace_writer_create(const char* path, uint32_t block_records, TraceCodec codec);
+void trace_write_fetch(TraceWriter* writer, uint64_t pc);
+void trace_write_mem(TraceWriter* writer, uint64_t addr, bool is_write);
+void trace_write_branch(TraceWriter* writer, const BranchRecord* record);
+int trace_writer_close(TraceWriter* writer);
+TraceReader* trace_open(const char* path);
+void trace_close(TraceReader* reader);
+int trace_cursor_init(TraceCursor* cursor, const TraceReader* reader, TraceStream stream);
+void trace_cursor_destroy(TraceCursor* cursor);
+size_t trace_next_block(TraceCursor* cursor);
+
+// Parameter sweep (src/cpu/sweep.c)
+typedef enum {
+    SWEEP_CACHE,
+    SWEEP_PREDICTOR
+} SweepKind;
+
+// Address stream for cache jobs: a shared trace, or a synthetic pattern
+// sized from the cache under test and seeded per job
+typedef enum {
+    PATTERN_TRACE,
+    PATTERN_SEQUENTIAL,
+    PATTERN_RANDOM,
+    PATTERN_STRIDED
+} AccessPattern;
+
+// Read-only input shared by every job in a sweep
+typedef struct {
+    const uint64_t* addrs;
+    const uint8_t* is_write;
+    size_t addr_count;
+    const BranchRecord* branches;
+    size_t branch_count;
+    const TraceReader* file;    // streams TRACE_MEM and TRACE_BRANCH instead
+} SweepTrace;
+
+typedef struct {
+    SweepKind kind;
+    CacheConfig cache;
+    AccessPattern pattern;
+    uint64_t length;            // synthetic pattern length
+    PredictorType predictor;
+    int bhr_size;
+    int pht_size;
+    uint64_t seed;
+
+    // Results
+    uint64_t events;            // accesses or predictions
+    uint64_t hits;              // cache hits or correct predictions
+    uint64_t cycles;            // summed access latency (cache jobs)
+    uint64_t elapsed_us;
+    bool failed;
+} SweepJob;
+
+typedef struct {
+    SweepJob* jobs;
+    size_t job_count;
+    size_t capacity;
+    const SweepTrace* trace;
+    uint64_t seed;
+    int threads_used;
+    uint64_t elapsed_us;
+} Sweep;
+
+Sweep* sweep_create(const SweepTrace* trace, uint64_t seed);
+void sweep_destroy(Sweep* sweep);
+int sweep_add_cache(Sweep* sweep, CacheConfig config, AccessPattern pattern,
+                    uint64_t length);
+int sweep_add_cache_matrix(Sweep* sweep, const CacheConfig* configs, size_t config_count,
+                           const AccessPattern* patterns, size_t pattern_count,
+                           uint64_t length);
+int sweep_add_predictor(Sweep* sweep, PredictorType type, int bhr_size, int pht_size);
+int sweep_run(Sweep* sweep, int threads);
+int sweep_write_csv(Sweep* sweep, const char* path);
+int sweep_write_json(Sweep* sweep, const char* path);
+void sweep_print(Sweep* sweep);
+
+// Multicore system (src/cpu/multicore.c). Cores share guest memory, keep
+// private L1s and reach a banked shared L2 through a full-map MESI
+// directory. Each host thread runs a fixed subset of cores for one
+// quantum, then waits at a barrier, so cores never drift apart by more
+// than a quantum. Cross-core ordering inside a quantum follows host
+// timing; it is deterministic only with one thread.
+#define MULTICORE_MAX_CORES 64
+
+typedef enum {
+    MESI_INVALID,
+    MESI_SHARED,
+    MESI_EXCLUSIVE,
+    MESI_MODIFIED
+} MESIState;
+
+typedef struct {
+    int cores;                  // at most MULTICORE_MAX_CORES
+    int threads;                // host threads, <= 0 for every online CPU
+    uint64_t quantum;           // cycles per core between barriers
+    CacheConfig l2;             // whole shared L2, split across the banks
+    int l2_banks;               // power of two
+    int l2_latency;
+    int memory_latency;
+} MulticoreConfig;
+
+// Directory entry per guest memory line
+typedef struct {
+    uint64_t sharers;           // cores holding the line
+    uint8_t state;              // MESIState of the holders
+    uint8_t owner;              // holder in E or M
+} DirectoryEntry;
+
+// A bank owns every line whose index maps to it: its slice of the L2 and
+// of the directory, both under one lock
+typedef struct {
+    pthread_mutex_t lock;
+    Cache* cache;
+    uint64_t accesses;
+    uint64_t contended;         // lock was held on arrival
+} L2Bank;
+
+// Per-core coherence state, padded so cores on different host threads
+// never share a line. Invalidations and downgrades from other cores queue
+// in the inbox and are applied by the owning core on its next access.
+typedef struct {
+    uint8_t* l1_state;          // MESIState per L1 line handle
+    pthread_mutex_t inbox_lock;
+    uint64_t* inbox;            // line index << 1 | downgrade
+    size_t inbox_count;
+    size_t inbox_capacity;
+
+    uint64_t upgrades;          // write hits on a shared line
+    uint64_t invalidations;     // lines taken away by other cores
+    uint64_t transfers;         // misses served from another core's M line
+    uint64_t stall_cycles;      // latency beyond an L1 hit
+} __attribute__((aligned(CACHE_LINE_SIZE))) CoreContext;
+
+struct MulticoreSystem {
+    MulticoreConfig config;
+    GuestMemory* memory;
+    uint64_t mem_size;
+
+    CPU** cores;
+    CoreContext* contexts;
+    L2Bank* banks;
+    DirectoryEntry* directory;
+    uint64_t lines;
+    int line_shift;
+
+    uint64_t cycles;
+    uint64_t quanta;
+    uint64_t elapsed_us;
+    int threads_used;
+};
+
+MulticoreSystem* multicore_create(uint64_t mem_size, const MulticoreConfig* config);
+void multicore_destroy(MulticoreSystem* sys);
+void multicore_reset(MulticoreSystem* sys);
+int multicore_load_program(MulticoreSystem* sys, uint8_t* program, uint64_t size,
+                           uint64_t address);
+int multicore_access(MulticoreSystem* sys, int core, uint64_t addr, bool is_write);
+uint64_t multicore_run(MulticoreSystem* sys, uint64_t max_cycles);
+void multicore_print_stats(MulticoreSystem* sys);
+
 #endif
\ No newline at end of file
@@ -8,6 +8,18 @@
 #define MAX_SENSORS 4
 #define GPIO_PINS 32
 
+// Peripheral rings; sizes are rounded up to a power of two
+#define UART_RING_SIZE 256         // default rx and tx ring, in bytes
+#define UART_DMA_QUEUE 8           // descriptors queued per direction
+#define GPIO_EVENT_RING 64         // interrupts waiting for the scheduler
+#define GPIO_EVENT_BATCH 16        // events popped at a time by gpio_dispatch
+
+// Timer wheel: TIMER_WHEEL_LEVELS levels of 2^TIMER_WHEEL_BITS slots, each
+// level covering 2^TIMER_WHEEL_BITS times the span of the one below
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
 // Task states
 typedef enum {
     TASK_READY,
@@ -27,6 +39,12 @@ typedef enum {
     PRIO_MAX = 15
 } TaskPriority;
 
+// How rtos_schedule picks among released tasks
+typedef enum {
+    RTOS_FIXED_PRIORITY,   // highest priority first, ties to the lower id
+    RTOS_EDF               // earliest absolute deadline first
+} RTOSPolicy;
+
 // Real-time task
 typedef struct {
     uint32_t id;
@@ -44,40 +62,112 @@ typedef struct {
     uint32_t executions;
     uint32_t misses;
     uint64_t total_time;
+    
+    // Energy drawn since the previous job finished, idle stretch included
+    uint64_t energy;           // in microjoules
+    uint64_t wake_latency;     // release to start, summed, in us
+    uint64_t max_wake_latency;
 } RTTask;
 
-// Virtual GPIO
+// Single-producer/single-consumer ring of fixed-size elements, lock-free:
+// only the producer moves tail and only the consumer moves head, each
+// keeping its last view of the other side (as MessageQueue does), with the
+// two sides a cache line apart
+typedef struct {
+    uint8_t* data;
+    uint32_t mask;             // capacity - 1
+    uint32_t elem;             // element size in bytes
+    
+    uint64_t tail;             // producer
+    uint64_t cached_head;
+    uint64_t dropped;          // elements that found the ring full
+    uint8_t pad[CACHE_LINE_SIZE];
+    uint64_t head;             // consumer
+    uint64_t cached_tail;
+} SPSCRing;
+
+typedef struct {
+    uint32_t pin;
+    uint32_t value;
+} GPIOEvent;
+
+// Virtual GPIO. Inputs are driven from the host side with gpio_drive, which
+// may run on its own thread; edges on interrupt_mask pins are queued and
+// handed to callback by gpio_dispatch at the next scheduler boundary.
 typedef struct {
     uint32_t direction;    // 1 = output, 0 = input
     uint32_t value;        // current pin values
     uint32_t pull;         // pull-up/down configuration
     uint32_t interrupt_mask; // which pins generate interrupts
     void (*callback)(uint32_t pin, uint32_t value);
+    
+    SPSCRing events;       // input edges: host produces, scheduler consumes
+    SPSCRing loopback;     // output edges from gpio_write, firmware only
+    uint64_t delivered;
 } VirtualGPIO;
 
-// Virtual UART
+// DMA descriptor: length bytes between buffer and a UART ring, moved by
+// uart_dma_service as the ring allows. complete, if set, is called once
+// the whole buffer has been moved.
+typedef struct UARTDMA {
+    uint8_t* buffer;
+    uint32_t length;
+    uint32_t transferred;
+    bool done;
+    void (*complete)(struct UARTDMA* desc, void* arg);
+    void* arg;
+} UARTDMA;
+
 typedef struct {
-    uint8_t rx_buffer[256];
-    uint8_t tx_buffer[256];
-    uint32_t rx_head;
-    uint32_t rx_tail;
-    uint32_t tx_head;
-    uint32_t tx_tail;
+    UARTDMA* queue[UART_DMA_QUEUE];
+    uint32_t first;
+    uint32_t count;
+} UARTDMAQueue;
+
+// Virtual UART. The firmware side (uart_write, uart_read, DMA) and the line
+// side (uart_line_send, uart_line_receive) may run on different threads.
+typedef struct {
+    SPSCRing rx;               // line -> firmware
+    SPSCRing tx;               // firmware -> line
+    UARTDMAQueue rx_dma;       // firmware side only
+    UARTDMAQueue tx_dma;
+    uint64_t dma_completed;
     uint32_t baud_rate;
-    bool tx_busy;
-    bool rx_ready;
 } VirtualUART;
 
 // Virtual Timer
-typedef struct {
+typedef struct VirtualTimer {
     uint64_t counter;
     uint64_t compare;
     uint64_t prescaler;
     bool enabled;
     bool auto_reload;
     void (*callback)(void);
+    
+    // Set when the timer is driven by an RTOS timer wheel instead of timer_tick
+    struct TimerWheel* wheel;
+    struct VirtualTimer* next;
+    struct VirtualTimer** pprev;
+    uint64_t start;        // wheel tick the counter last restarted at
+    uint64_t expires;      // wheel tick it fires on
 } VirtualTimer;
 
+// Hierarchical timer wheel: advancing one tick touches only the timers due
+// on it, plus a cascade of one higher-level slot every TIMER_WHEEL_SLOTS ticks
+typedef struct TimerWheel {
+    VirtualTimer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t now;
+    uint32_t armed;
+    uint64_t fired;
+    uint64_t cascaded;
+} TimerWheel;
+
+// Virtual devices read time from their RTOS's virtual clock (in us) when
+// it has one, else from the host clock
+static inline uint64_t device_time_ms(const uint64_t* clock) {
+    return clock ? *clock / 1000 : get_time_ms();
+}
+
 // Virtual Sensor
 typedef struct {
     float temperature;
@@ -86,32 +176,187 @@ typedef struct {
     float acceleration[3];
     uint32_t light_level;
     uint64_t last_update;
+    
+    // Per-sensor state, so sensors on different threads never share any
+    uint64_t rng;
+    uint64_t last_movement;
+    const uint64_t* clock;
 } VirtualSensor;
 
+// Bank of sensors stored as arrays (src/embedded/sensor_bank.c), generated
+// a whole sample at a time by a vector kernel. Noise comes from a hash of
+// (seed, sample, channel, sensor), so any sample of any sensor can be
+// recomputed and kernels agree regardless of lane width. Arrays are padded
+// to SENSOR_BANK_LANES.
+#define SENSOR_BANK_LANES 8
+
+typedef struct SensorBank {
+    uint32_t count;
+    uint32_t stride;           // count rounded up to SENSOR_BANK_LANES
+    uint32_t seed;
+    uint64_t sample;           // samples taken so far
+    uint64_t last_time;        // ms of the previous sample
+    
+    float* phase;              // daily cycle offset, in days
+    float* temperature;
+    float* humidity;
+    float* pressure;
+    float* acceleration[3];
+    uint32_t* light_level;
+    
+    void (*generate)(struct SensorBank* bank, float day, float move, const uint32_t* keys);
+    const char* kernel;
+} SensorBank;
+
+// Streaming aggregation over one channel of a bank: running min, max and
+// mean per sensor, closed every window samples, and edge-triggered crossings
+// out of [low, high]. Raw samples are never kept.
+typedef struct SensorStream {
+    uint32_t count;
+    uint32_t stride;
+    uint32_t window;
+    float low;
+    float high;
+    
+    uint32_t filled;           // samples in the open window
+    float* min;
+    float* max;
+    float* sum;
+    int32_t* zone;             // -1 below low, 0 inside, 1 above high
+    uint32_t* crossings;       // per sensor; cleared by whoever reports them
+    
+    // Last closed window
+    float* window_min;
+    float* window_max;
+    float* window_mean;
+    
+    uint64_t samples;
+    uint64_t windows;
+    uint64_t total_crossings;
+    
+    // Folds values into min/max/sum and zones, returns the new crossings
+    uint32_t (*fold)(struct SensorStream* stream, const float* values, bool first);
+    const char* kernel;
+} SensorStream;
+
+// Power states
+typedef enum {
+    POWER_RUN,      // Full power
+    POWER_IDLE,     // CPU idle, peripherals active
+    POWER_SLEEP,    // CPU stopped, some peripherals active
+    POWER_DEEP_SLEEP, // CPU stopped, minimal peripherals
+    POWER_OFF       // Complete power off
+} PowerState;
+
+// Power management unit
+typedef struct {
+    PowerState state;
+    uint64_t transition_time;
+    uint64_t wakeup_source;
+    float voltage;
+    float current;
+    float temperature;
+    
+    // Power domains
+    bool cpu_powered;
+    bool memory_powered;
+    bool peripherals_powered;
+    
+    // Wakeup sources
+    uint32_t wakeup_pins;
+    uint32_t wakeup_timers;
+    bool wakeup_on_uart;
+    
+    // Statistics
+    uint64_t time_in_state[5];
+    uint64_t state_entries[5];
+    uint64_t total_energy;  // in microjoules
+    
+    const uint64_t* clock;  // see device_time_ms
+} PowerManager;
+
 // Real-Time OS
 typedef struct {
     RTTask tasks[MAX_TASKS];
     uint32_t task_count;
     RTTask* current_task;
     
+    // Task indices: released tasks by policy order, waiting ones by next_run
+    RTOSPolicy policy;
+    uint8_t ready[MAX_TASKS];
+    uint32_t ready_count;
+    uint8_t pending[MAX_TASKS];
+    uint32_t pending_count;
+    
     VirtualGPIO gpio;
     VirtualUART uart;
     VirtualTimer timers[MAX_TIMERS];
+    TimerWheel wheel;
+    uint64_t wheel_origin;     // system_time of wheel tick 0; a tick is 1 ms
     VirtualSensor sensors[MAX_SENSORS];
     
     uint64_t system_time;
     uint64_t idle_time;
     bool running;
     
-    // Power management
+    // With virtual_clock set, time is clock_us: it only moves when a job
+    // runs (by its wcet) or the RTOS sleeps, so a run never waits on the host
+    bool virtual_clock;
+    uint64_t clock_us;
+    uint64_t seed;
+    
+    // Time spent in rtos_schedule outside task functions
+    uint64_t schedule_calls;
+    uint64_t overhead_ns;
+    uint64_t max_overhead_ns;
+    
+    // Power management; with tickless set, rtos_start sleeps between
+    // events instead of polling every millisecond
+    bool tickless;
+    PowerManager* pm;
     uint32_t sleep_mode;
     uint64_t wakeup_time;
+    uint64_t sleeps;
+    uint64_t sleep_us;
+    uint64_t energy_mark;
 } RTOS;
 
+static inline uint64_t rtos_time_us(const RTOS* rtos) {
+    return rtos->virtual_clock ? rtos->clock_us : get_time_us();
+}
+
+// Fleet of independent RTOS nodes (src/embedded/fleet.c) in one arena. Each
+// node has its own virtual clock and RNG streams, so nodes can be stepped on
+// any thread in any order and the results depend only on the seed.
+typedef void (*FleetSetup)(RTOS* node, uint32_t index, void* arg);
+
+typedef struct {
+    RTOS* nodes;
+    PowerManager* power;       // power[i] drives nodes[i]'s tickless idle
+    uint32_t count;
+    uint64_t seed;
+    uint64_t time_ms;          // virtual time every node has reached
+    
+    // Totals over every node, refreshed by fleet_run
+    uint64_t executions;
+    uint64_t misses;
+    uint64_t energy;           // in microjoules
+    uint64_t sleeps;
+    uint64_t max_wake_latency;
+    uint32_t nodes_missing;    // nodes with at least one miss
+    
+    int threads_used;
+    uint64_t elapsed_us;       // host time spent in fleet_run
+} RTOSFleet;
+
 // Function prototypes
 RTOS* rtos_create();
 void rtos_destroy(RTOS* rtos);
 void rtos_init(RTOS* rtos);
+void rtos_release(RTOS* rtos);  // rtos_destroy without freeing rtos
+void rtos_set_virtual_clock(RTOS* rtos, uint64_t start_ms);
+void rtos_seed(RTOS* rtos, uint64_t seed);
+void rtos_advance(RTOS* rtos, uint64_t ms);
 
 // Task management
 uint32_t rtos_create_task(RTOS* rtos, void (*func)(void*), void* arg,
@@ -119,28 +364,91 @@ uint32_t rtos_create_task(RTOS* rtos, void (*func)(void*), void* arg,
 void rtos_start(RTOS* rtos);
 void rtos_stop(RTOS* rtos);
 void rtos_schedule(RTOS* rtos);
-bool rtos_schedulable(RTOS* rtos);  // Rate monotonic analysis
+void rtos_set_policy(RTOS* rtos, RTOSPolicy policy);
+bool rtos_schedulable(RTOS* rtos);  // Response-time / EDF demand analysis
+uint32_t rtos_response_time(RTOS* rtos, uint32_t task_id);
+
+// Virtual hardware (src/embedded/peripherals.c)
+int spsc_ring_init(SPSCRing* ring, uint32_t capacity, uint32_t elem);
+void spsc_ring_destroy(SPSCRing* ring);
+uint32_t spsc_ring_push(SPSCRing* ring, const void* src, uint32_t count);
+uint32_t spsc_ring_pop(SPSCRing* ring, void* dst, uint32_t count);
+uint32_t spsc_ring_count(SPSCRing* ring);
 
-// Virtual hardware
 void gpio_init(VirtualGPIO* gpio);
+void gpio_destroy(VirtualGPIO* gpio);
 void gpio_set_direction(VirtualGPIO* gpio, uint32_t pin, bool output);
 void gpio_write(VirtualGPIO* gpio, uint32_t pin, bool value);
 bool gpio_read(VirtualGPIO* gpio, uint32_t pin);
+void gpio_drive(VirtualGPIO* gpio, uint32_t pin, bool value);  // host side
+uint32_t gpio_dispatch(VirtualGPIO* gpio);
 
 void uart_init(VirtualUART* uart, uint32_t baud_rate);
-void uart_write(VirtualUART* uart, uint8_t* data, uint32_t len);
+int uart_configure(VirtualUART* uart, uint32_t baud_rate, uint32_t rx_size, uint32_t tx_size);
+void uart_destroy(VirtualUART* uart);
+uint32_t uart_write(VirtualUART* uart, const uint8_t* data, uint32_t len);
 uint32_t uart_read(VirtualUART* uart, uint8_t* buffer, uint32_t len);
+uint32_t uart_line_send(VirtualUART* uart, const uint8_t* data, uint32_t len);
+uint32_t uart_line_receive(VirtualUART* uart, uint8_t* buffer, uint32_t len);
+int uart_dma_rx(VirtualUART* uart, UARTDMA* desc);
+int uart_dma_tx(VirtualUART* uart, UARTDMA* desc);
+uint32_t uart_dma_service(VirtualUART* uart);
 
 void timer_init(VirtualTimer* timer, uint64_t prescaler, bool auto_reload);
 void timer_start(VirtualTimer* timer, uint64_t compare_value);
 void timer_stop(VirtualTimer* timer);
+void timer_set_callback(VirtualTimer* timer, void (*callback)(void));
+uint64_t timer_get_value(VirtualTimer* timer);
+bool timer_is_running(VirtualTimer* timer);
+void timer_tick(VirtualTimer* timer);
+
+void timer_wheel_init(TimerWheel* wheel);
+void timer_wheel_attach(TimerWheel* wheel, VirtualTimer* timer);
+void timer_wheel_advance(TimerWheel* wheel, uint64_t ticks);
+uint64_t timer_wheel_next_expiry(TimerWheel* wheel);
 
 void sensor_update(VirtualSensor* sensor);
 
+SensorBank* sensor_bank_create(uint32_t count, uint64_t seed);
+void sensor_bank_destroy(SensorBank* bank);
+int sensor_bank_set_kernel(SensorBank* bank, const char* kernel);
+void sensor_bank_generate(SensorBank* bank, uint64_t time_ms);
+void sensor_bank_read(const SensorBank* bank, uint32_t index, VirtualSensor* sensor);
+
+SensorStream* sensor_stream_create(uint32_t count, uint32_t window, float low, float high);
+void sensor_stream_destroy(SensorStream* stream);
+void sensor_stream_push(SensorStream* stream, const float* values);
+
 // Power management
+PowerManager* pm_create(void);
+void pm_init(PowerManager* pm);
+void pm_destroy(PowerManager* pm);
+void pm_set_clock(PowerManager* pm, const uint64_t* clock);
+void pm_enter_state(PowerManager* pm, PowerState new_state);
+void pm_update(PowerManager* pm);
+void pm_set_wakeup_source(PowerManager* pm, uint32_t source_type, uint32_t source_id);
+bool pm_check_wakeup(PowerManager* pm, VirtualGPIO* gpio, VirtualTimer* timers);
+uint32_t pm_wakeup_latency(PowerState state);
+PowerState pm_deepest_state(uint64_t slack_us);
+void pm_print_stats(PowerManager* pm);
+
+void rtos_set_tickless(RTOS* rtos, bool tickless, PowerManager* pm);
+uint64_t rtos_next_wakeup(RTOS* rtos);
+void rtos_idle(RTOS* rtos);
 void rtos_enter_sleep(RTOS* rtos, uint32_t mode);
 void rtos_wakeup(RTOS* rtos);
 
+// Fleets
+RTOSFleet* fleet_create(uint32_t count, uint64_t seed, FleetSetup setup, void* arg);
+void fleet_destroy(RTOSFleet* fleet);
+int fleet_run(RTOSFleet* fleet, uint64_t ms, int threads);
+void fleet_sensor_node(RTOS* node, uint32_t index, void* arg);
+void fleet_print_stats(RTOSFleet* fleet);
+
+// Checkpoints (src/embedded/snapshot.c, format in snapshot.h)
+int rtos_snapshot(SnapshotWriter* writer, const RTOS* rtos);
+RTOS* rtos_restore(Snapshot* snapshot, uint32_t index);
+
 // Analysis and monitoring
 void rtos_print_stats(RTOS* rtos);
 void rtos_print_schedule(RTOS* rtos, uint32_t duration);
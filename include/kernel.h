@@ -3,8 +3,6 @@
 
 #include "common.h"
 
-#define MAX_PROCESSES 64
-#define MAX_PAGES 1024
 #define MAX_QUEUES 32
 #define MAX_FILES 128
 #define MAX_NAME_LEN 32
@@ -18,47 +16,162 @@ typedef enum {
     PROC_TERMINATED
 } ProcessState;
 
-// Message structure
+// Message structure. Payloads up to MSG_INLINE_SIZE travel inside the
+// message; larger ones are granted: the data pointer, and with it ownership
+// of the malloc'd buffer, moves from sender to receiver without a copy.
+#define MSG_INLINE_SIZE 48
+#define MSG_GRANT 0x1
+
 typedef struct {
     uint32_t src_pid;
     uint32_t dst_pid;
     uint32_t msg_id;
+    uint32_t flags;
     uint64_t timestamp;
     void* data;
     size_t size;
+    uint8_t inline_data[MSG_INLINE_SIZE];
 } Message;
 
-// Message queue
+static inline const void* msg_payload(const Message* msg) {
+    return (msg->flags & MSG_GRANT) ? msg->data : msg->inline_data;
+}
+
+// Message queue: a bounded lock-free ring. SPSC queues only publish head
+// and tail; MPMC queues add a sequence number per slot so producers and
+// consumers can claim slots with a compare-and-swap. Timeouts are in ms:
+// 0 polls once, MQ_WAIT_FOREVER never gives up.
+#define MQ_WAIT_FOREVER -1
+
+typedef enum {
+    MQ_SPSC,
+    MQ_MPMC
+} MQMode;
+
 typedef struct {
-    Message* messages;
-    int capacity;
-    int head;
-    int tail;
-    int count;
-    sem_t mutex;
-    sem_t slots;
-    sem_t items;
+    uint64_t tail __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint64_t cached_head;       // SPSC producer's last view of head
+    uint64_t head __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint64_t cached_tail;       // SPSC consumer's last view of tail
+    
+    Message* messages __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint64_t* seqs;             // MPMC only
+    uint64_t mask;              // capacity - 1, capacity a power of two
+    MQMode mode;
+    
+    uint64_t send_waits;        // calls that found the queue full
+    uint64_t receive_waits;     // calls that found it empty
 } MessageQueue;
 
-// Virtual file
+// Virtual file, stored as page-sized chunks allocated on first write: the
+// file grows without copying what it holds, holes read as zeros, and
+// vfs_mmap can map the chunks themselves into an address space. Chunks are
+// carved from extents that double up to VFS_EXTENT_CHUNKS as the file grows.
+#define VFS_CHUNK_SIZE PAGE_SIZE
+#define VFS_EXTENT_CHUNKS 16
+
 typedef struct {
     char name[MAX_NAME_LEN];
-    uint8_t* data;
+    uint8_t** chunks;       // NULL where nothing was written yet
+    uint64_t chunk_slots;   // length of chunks, grown by doubling
+    uint64_t chunk_count;   // chunks allocated
+    
+    uint8_t** extents;      // allocations the chunks come from
+    uint64_t extent_count;
+    uint64_t extent_slots;
+    uint8_t* spare;         // unused chunks left in the last extent
+    uint32_t spare_chunks;
+    
     size_t size;
-    size_t capacity;
     uint64_t timestamp;
-    bool is_open;
+    uint32_t open_count;
+    uint64_t mapped_pages;  // chunks mapped by vfs_mmap; they live as long as the VFS
 } VFile;
 
-// Virtual filesystem
+// Open file description: each vfs_open_file gets its own offset
+typedef struct {
+    int file;               // index into files, or -1 while free
+    uint64_t offset;
+    int next_free;
+} VFileHandle;
+
+// Virtual filesystem. Names are found through an open-addressed hash index
+// of file numbers; neither files nor descriptors have a fixed limit.
 typedef struct {
-    VFile files[MAX_FILES];
+    VFile** files;
     int file_count;
+    int file_slots;
+    
+    int* index;             // file number per slot, -1 when empty
+    uint32_t index_mask;    // slots - 1; kept at most half full
+    
+    VFileHandle* fds;
+    int fd_count;           // descriptors ever handed out
+    int fd_slots;
+    int free_fd;            // head of the closed descriptors, or -1
+    
     char current_dir[MAX_NAME_LEN];
 } VFS;
 
-// Process Control Block
+// System call numbers
+typedef enum {
+    SYS_EXIT = 0,
+    SYS_FORK,
+    SYS_READ,
+    SYS_WRITE,
+    SYS_OPEN,
+    SYS_CLOSE,
+    SYS_EXEC,
+    SYS_WAIT,
+    SYS_BRK,
+    SYS_MMAP,
+    SYS_MUNMAP,
+    SYS_GETPID,
+    SYS_GETTIME,
+    SYS_SLEEP,
+    SYS_YIELD,
+    SYS_SEND,
+    SYS_RECV,
+    SYS_IOCTL,
+    SYS_RING_ENTER,     // run everything queued on the caller's syscall ring
+    SYS_MAX
+} SyscallNumber;
+
+// Submission/completion ring a process shares with the kernel, after
+// io_uring: the process queues calls, one SYS_RING_ENTER runs them all in
+// order, and each result comes back tagged with its entry's user_data.
+// Indices only grow; both queues have mask + 1 entries.
+typedef struct {
+    uint32_t num;
+    uint64_t args[4];
+    uint64_t user_data;
+} SyscallEntry;
+
 typedef struct {
+    uint64_t user_data;
+    uint64_t result;
+} SyscallCompletion;
+
+typedef struct SyscallRing {
+    uint32_t mask;
+    uint32_t sq_head;           // next entry the kernel runs
+    uint32_t sq_tail;           // next entry the process fills
+    uint32_t cq_head;           // next completion the process reaps
+    uint32_t cq_tail;
+    uint64_t overflows;         // drains cut short by a full completion queue
+    SyscallEntry* sq;
+    SyscallCompletion* cq;
+} SyscallRing;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t batched;           // of those, run from a ring
+    uint64_t total_ns;
+    uint64_t max_ns;
+} SyscallStats;
+
+// Process Control Block
+typedef struct PCB {
     uint32_t pid;
     ProcessState state;
     uint8_t priority;
@@ -80,62 +193,281 @@ typedef struct {
     // Resources
     int open_files[MAX_FILES];
     int message_queues[MAX_QUEUES];
+    SyscallRing* ring;      // one allocation, freed with the PCB
     
     // Statistics
     uint64_t start_time;
     uint64_t cpu_time;
     uint64_t wakeups;
+    uint64_t migrations;
+    
+    // SMP placement
+    uint64_t affinity;              // bit per CPU the process may run on
+    int cpu;                        // run queue it is on or last ran from
+    uint32_t migration_penalty;     // cold-cache ticks left after a migration
+    
+    // Ready queue links, owned by the scheduler
+    struct PCB* next;
+    struct PCB* prev;
+    uint64_t ready_since;   // system_time when it was last queued
+    uint32_t boost_epoch;   // priority is stale once the scheduler's epoch moves on
+    bool queued;
+    
+    // Blocking, owned by the kernel clock
+    uint64_t wait_token;    // bumped on every block; older wakeups are stale
+    int wait_queue;         // queue waited on, or -1
 } PCB;
 
-// Page table entry
+// Page tables: four-level radix tree over a 48-bit virtual address space,
+// 512 entries per level as on x86-64. Upper-level entries hold a host
+// pointer to the next table; leaf entries hold a physical address.
+#define PT_LEVELS 4
+#define PT_INDEX_BITS 9
+#define PT_ENTRIES (1 << PT_INDEX_BITS)
+#define VA_BITS (PAGE_SHIFT + PT_LEVELS * PT_INDEX_BITS)
+#define HUGE_PAGE_SHIFT (PAGE_SHIFT + PT_INDEX_BITS)
+#define HUGE_PAGE_SIZE (1ULL << HUGE_PAGE_SHIFT)    // 2MB, mapped one level up
+
+#define PTE_PRESENT  (1ULL << 0)
+#define PTE_WRITABLE (1ULL << 1)
+#define PTE_ACCESSED (1ULL << 5)
+#define PTE_DIRTY    (1ULL << 6)
+#define PTE_HUGE     (1ULL << 7)
+#define PTE_COW      (1ULL << 9)    // read-only until the first write copies it
+#define PTE_HOST     (1ULL << 10)   // frame backed by a host page; forks share it writable
+#define PTE_SWAPPED  (1ULL << 11)   // not present: the address bits hold a swap slot
+#define PTE_ADDR_MASK (~(uint64_t)(PAGE_SIZE - 1))
+
+typedef struct PageTable {
+    uint64_t entries[PT_ENTRIES];
+} PageTable;
+
+// Set-associative TLB tagged by ASID (the PID). 4KB and 2MB translations
+// share the array; each is indexed by its own page number.
 typedef struct {
-    uint64_t virtual_addr;
-    uint64_t physical_addr;
-    bool present;
-    bool writable;
-    bool accessed;
-    bool dirty;
-    uint64_t timestamp;
-} PageTableEntry;
+    uint64_t vpn;           // vaddr >> PAGE_SHIFT, or >> HUGE_PAGE_SHIFT if huge
+    uint64_t frame;         // physical base address
+    uint64_t last_used;
+    uint16_t asid;
+    bool valid;
+    bool huge;
+    bool writable;          // writable and already dirty: writes need no walk
+} TlbEntry;
+
+typedef struct {
+    TlbEntry* entries;      // sets * ways, one set after another
+    uint32_t sets;
+    uint32_t ways;
+    uint64_t clock;
+    uint64_t hits;
+    uint64_t misses;
+} Tlb;
 
 // Scheduler
+#define MLFQ_LEVELS 16
+
+typedef struct {
+    PCB* head;
+    PCB* tail;
+    int count;
+} ReadyQueue;
+
+// One run queue per simulated CPU, up to as many as the multicore model
+// has cores
+#define SCHED_MAX_CPUS 64
+#define SCHED_STEAL_SCAN 8          // queued processes checked for affinity per steal
+#define SCHED_LATENCY_BUCKETS 32    // log2 histogram of ticks spent ready
+
 typedef struct {
-    PCB* processes[MAX_PROCESSES];
-    PCB* current_process;
+    PCB* current;
+    
+    // Ready queues for each priority level (0 = highest); bit n of
+    // ready_bitmap is set while level n is non-empty
+    ReadyQueue ready_queues[MLFQ_LEVELS];
+    uint16_t ready_bitmap;
+    int nr_ready;
+    
+    uint64_t busy_ticks;
+    uint64_t migration_ticks;       // busy, but paying a migration's cache refill
+    uint64_t idle_ticks;
+    uint64_t dispatches;
+    uint64_t steals;
+} __attribute__((aligned(CACHE_LINE_SIZE))) RunQueue;
+
+typedef struct {
+    PCB** processes;            // grown as processes are added
     int process_count;
+    int process_capacity;
     
-    // Ready queues for each priority level (0 = highest)
-    PCB* ready_queues[16][MAX_PROCESSES];
-    int queue_counts[16];
+    RunQueue cpus[SCHED_MAX_CPUS];
+    int cpu_count;
     
+    uint32_t boost_epoch;
+    uint64_t next_boost;
     uint64_t system_time;
+    uint64_t skipped_ticks;     // advanced without a full scheduler_tick
     uint64_t next_pid;
+    
+    uint64_t migrations;
+    uint64_t latency_hist[SCHED_LATENCY_BUCKETS];
+    uint64_t max_latency;
 } Scheduler;
 
+// Buddy allocator over physical frames. Free blocks are 2^order frames,
+// naturally aligned, on one intrusive list per order; per-frame arrays are
+// calloc'd so untouched frames cost nothing.
+#define BUDDY_MAX_ORDER 20              // largest block: 4GB
+#define FRAME_NONE UINT32_MAX
+
+typedef struct {
+    uint32_t* next;                     // list links, valid for free block heads
+    uint32_t* prev;
+    uint8_t* free_order;                // order + 1 at a free block head, else 0
+    uint32_t heads[BUDDY_MAX_ORDER + 1];
+    uint64_t blocks[BUDDY_MAX_ORDER + 1];
+    uint32_t nonempty;                  // bit per order with a free block
+    uint64_t frame_count;
+} BuddyAllocator;
+
+// Single frames a process freed, reused by its next demand faults without
+// touching the buddy lists
+#define FRAME_CACHE_SIZE 32
+#define FRAME_CACHE_BATCH_ORDER 4       // refill 16 frames at a time
+
+typedef struct {
+    uint32_t frames[FRAME_CACHE_SIZE];
+    uint32_t count;
+} FrameCache;
+
+// Per-PID memory state, allocated the first time a PID needs any and freed
+// by mm_free_pages
+typedef struct {
+    PageTable* root;        // radix root, or NULL
+    uint64_t heap_pages;    // next virtual page mm_allocate_pages hands out
+    FrameCache cache;
+    uint32_t pid;
+    uint32_t live_index;    // position in MemoryManager.live
+} AddressSpace;
+
+// Reverse map for page replacement, kept for every 4KB leaf. owner and
+// vpage are a hint, checked against the owner's page table before use.
+typedef struct {
+    uint32_t owner;         // PID + 1, or 0
+    uint32_t slot;          // swap slot + 1 holding a clean copy, or 0
+    uint64_t vpage;
+    uint64_t last_use;      // translation count when last seen referenced
+    bool writeback;         // queued for write-back
+} FrameInfo;
+
+typedef enum {
+    SWAP_CLOCK,             // second chance: evict the first page not referenced
+    SWAP_WSCLOCK            // evict only pages out of the working set; clean dirty ones ahead
+} SwapPolicy;
+
+typedef struct {
+    uint32_t frame;
+    bool evict;             // evict once written, unless written to again
+} SwapWriteback;
+
+// Swap area: a VFS file of page-sized slots. Dirty pages are queued and
+// written in batches, gathered into runs of consecutive slots.
+typedef struct {
+    VFS* vfs;
+    int fd;
+    SwapPolicy policy;
+    uint64_t window;            // WSClock: translations before an unreferenced page is old
+    uint64_t* slot_used;        // bit per slot
+    uint32_t* slot_shares;      // per slot: swapped mappings beyond the first, from forks
+    uint32_t slot_count;
+    uint32_t slots_used;
+    uint32_t next_slot;
+    uint64_t hand;              // next frame the clock looks at
+    SwapWriteback queue[SWAP_WRITEBACK_BATCH];
+    uint32_t queued;
+    uint8_t* staging;           // SWAP_WRITEBACK_BATCH pages
+    
+    uint64_t swap_ins;          // faults served from a slot
+    uint64_t swap_outs;         // pages written to a slot
+    uint64_t writes;            // swap file writes those took
+    uint64_t evictions;
+    uint64_t dropped;           // evicted pages never written: free to refault as zero
+    uint64_t scanned;           // frames the clock looked at
+} SwapArea;
+
 // Memory Manager
 typedef struct {
-    uint8_t* physical_memory;
+    GuestMemory* physical_memory;   // sparse; pages cost host memory once written
     uint64_t mem_size;
     
-    PageTableEntry* page_tables[MAX_PROCESSES];
-    uint32_t page_table_sizes[MAX_PROCESSES];
+    AddressSpace** spaces;      // by PID, NULL for none; as long as the largest PID seen
+    uint32_t space_capacity;
+    AddressSpace** live;        // the spaces that exist, packed, for scans over PIDs
+    uint32_t live_count;
+    uint64_t table_count;       // host PageTables across all PIDs
     
-    uint64_t free_pages;
+    uint64_t free_pages;        // in the buddy lists or a frame cache
     uint64_t total_pages;
-    bool* page_bitmap;
+    BuddyAllocator buddy;
+    uint64_t cached_frames;     // of free_pages, those in a frame cache
+    uint32_t* frame_shares;     // per frame: mappings beyond the first, from forks
+    FrameInfo* frame_info;
+    SwapArea* swap;             // NULL: a fault with no free frame fails
+    
+    Tlb l1_tlb;
+    Tlb l2_tlb;
     
     uint64_t page_faults;
-    uint64_t tlb_hits;
-    uint64_t tlb_misses;
+    uint64_t cow_faults;    // writes to a copy-on-write page
+    uint64_t cow_copies;    // those that had to copy; the rest were the last mapping
+    uint64_t tlb_hits;      // L1 or L2
+    uint64_t tlb_misses;    // both missed; a page walk followed
+    uint64_t walk_levels;   // page table levels read by those walks
+    uint64_t huge_pages;    // 2MB mappings currently installed
 } MemoryManager;
 
-// Microkernel
+// Discrete-event kernel clock. Timed events sit in a binary min-heap
+// ordered by virtual tick, then by insertion; the clock jumps from one to
+// the next instead of stepping through the ticks in between.
+struct Microkernel;
+typedef void (*TimerHandler)(struct Microkernel* kernel, void* arg);
+
+typedef enum {
+    EVENT_WAKEUP,       // end of a sleep or wait, or a message for a waiter
+    EVENT_TIMER         // timer interrupt, re-armed every period ticks
+} EventType;
+
+typedef struct {
+    uint64_t time;
+    uint64_t seq;
+    EventType type;
+    PCB* pcb;               // EVENT_WAKEUP
+    uint64_t token;         // pcb->wait_token when the event was queued
+    uint64_t period;        // EVENT_TIMER; 0 fires once
+    TimerHandler handler;
+    void* arg;
+} KernelEvent;
+
 typedef struct {
-    Scheduler* scheduler;
+    KernelEvent* heap;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t next_seq;
+} EventQueue;
+
+// Microkernel
+typedef struct Microkernel {
+    Scheduler* scheduler;       // DEFAULT_NUM_CORES CPUs unless kernel_set_cpus says otherwise
     MemoryManager* mm;
     MessageQueue* queues[MAX_QUEUES];
+    PCB* queue_waiters[MAX_QUEUES];     // blocked in kernel_wait_message, linked by next
     VFS* filesystem;
     
+    EventQueue events;
+    uint64_t events_dispatched;
+    bool realtime;              // pace the clock at KERNEL_REALTIME_TICK_US per tick
+    
+    SyscallStats syscall_stats[SYS_MAX];
+    
     int queue_count;
     bool running;
 } Microkernel;
@@ -145,41 +477,114 @@ Microkernel* kernel_create(uint64_t mem_size);
 void kernel_destroy(Microkernel* kernel);
 void kernel_init(Microkernel* kernel);
 void kernel_run(Microkernel* kernel, uint64_t cycles);
+int kernel_set_cpus(Microkernel* kernel, int cpus);
+
+// Checkpoints (src/kernel/snapshot.c, format in snapshot.h), taken and
+// restored while nothing runs in the kernel
+int kernel_snapshot(SnapshotWriter* writer, const Microkernel* kernel);
+Microkernel* kernel_restore(Snapshot* snapshot, uint32_t index);
 
 // Process management
 uint32_t kernel_create_process(Microkernel* kernel, void* entry_point);
+uint32_t kernel_fork_process(Microkernel* kernel, uint32_t pid);
+PCB* kernel_find_process(Microkernel* kernel, uint32_t pid);
 void kernel_terminate_process(Microkernel* kernel, uint32_t pid);
 void kernel_suspend_process(Microkernel* kernel, uint32_t pid);
 void kernel_resume_process(Microkernel* kernel, uint32_t pid);
 
+// Virtual clock
+int event_queue_init(EventQueue* eq, uint32_t capacity);
+void event_queue_destroy(EventQueue* eq);
+int event_queue_push(EventQueue* eq, KernelEvent* ev);
+bool event_queue_pop(EventQueue* eq, KernelEvent* ev);
+
+void kernel_advance(Microkernel* kernel, uint64_t ticks);
+void kernel_set_realtime(Microkernel* kernel, bool realtime);
+int kernel_add_timer(Microkernel* kernel, uint64_t delay, uint64_t period,
+                     TimerHandler handler, void* arg);
+int kernel_sleep_process(Microkernel* kernel, uint32_t pid, uint64_t ticks);
+int kernel_wait_message(Microkernel* kernel, int qid, uint32_t pid, int timeout);
+void kernel_notify_queue(Microkernel* kernel, int qid, int messages);
+
+PCB* pcb_create(uint32_t pid, void* entry_point);
+void pcb_destroy(PCB* pcb);
+
 // Scheduling
 void scheduler_init(Scheduler* sched);
+void scheduler_destroy(Scheduler* sched);
+int scheduler_reserve(Scheduler* sched, int count);
+int scheduler_set_cpus(Scheduler* sched, int cpus);
 void scheduler_add_process(Scheduler* sched, PCB* pcb);
-PCB* scheduler_next_process(Scheduler* sched);
+void scheduler_remove_process(Scheduler* sched, PCB* pcb);
+void scheduler_set_affinity(Scheduler* sched, PCB* pcb, uint64_t affinity);
+int scheduler_priority(const Scheduler* sched, const PCB* pcb);
+PCB* scheduler_next_process(Scheduler* sched, int cpu);
+void scheduler_wake_process(Scheduler* sched, PCB* pcb);
 void scheduler_tick(Scheduler* sched);
+uint64_t scheduler_next_event(const Scheduler* sched);
+void scheduler_advance(Scheduler* sched, uint64_t ticks);
+uint64_t scheduler_latency_percentile(const Scheduler* sched, double fraction);
 void scheduler_print(Scheduler* sched);
+void scheduler_print_stats(Scheduler* sched);
 
 // Memory management
 MemoryManager* mm_create(uint64_t mem_size);
 void mm_destroy(MemoryManager* mm);
 uint64_t mm_allocate_pages(MemoryManager* mm, uint32_t pid, uint32_t pages);
 void mm_free_pages(MemoryManager* mm, uint32_t pid);
+AddressSpace* mm_space(MemoryManager* mm, uint32_t pid, bool create);
+int mm_unmap_page(MemoryManager* mm, uint32_t pid, uint64_t vaddr);
+int mm_reserve_pages(MemoryManager* mm, uint32_t pid, uint64_t pages, uint64_t* vaddr);
+int mm_fork(MemoryManager* mm, uint32_t parent, uint32_t child);
+int mm_enable_swap(MemoryManager* mm, VFS* vfs, const char* name, uint32_t slots, SwapPolicy policy);
+void mm_swap_flush(MemoryManager* mm);
+uint64_t mm_working_set(MemoryManager* mm, uint32_t pid, uint64_t window);
+double mm_fragmentation(MemoryManager* mm);
 uint64_t mm_translate_address(MemoryManager* mm, uint32_t pid, uint64_t vaddr);
+uint64_t mm_translate_write(MemoryManager* mm, uint32_t pid, uint64_t vaddr);
+void mm_flush_tlb(MemoryManager* mm, uint32_t pid);
+int mm_map_host_pages(MemoryManager* mm, uint32_t pid, uint8_t* const* pages, uint32_t count,
+                      uint64_t* vaddr);
 void mm_print_stats(MemoryManager* mm);
 
 // IPC
-int kernel_create_queue(Microkernel* kernel);
+MessageQueue* mq_create(int capacity, MQMode mode);
+void mq_destroy(MessageQueue* mq);
+int mq_send(MessageQueue* mq, const Message* msg, int timeout);
+int mq_receive(MessageQueue* mq, Message* msg, int timeout);
+int mq_send_batch(MessageQueue* mq, const Message* msgs, int count, int timeout);
+int mq_receive_batch(MessageQueue* mq, Message* msgs, int count, int timeout);
+void msg_set_payload(Message* msg, void* data, size_t size);
+
+int kernel_create_queue(Microkernel* kernel, MQMode mode);
 int kernel_send_message(Microkernel* kernel, int qid, Message* msg);
 int kernel_receive_message(Microkernel* kernel, int qid, Message* msg, int timeout);
+int kernel_send_batch(Microkernel* kernel, int qid, Message* msgs, int count);
+int kernel_receive_batch(Microkernel* kernel, int qid, Message* msgs, int count, int timeout);
 void kernel_destroy_queue(Microkernel* kernel, int qid);
 
+// System calls
+uint64_t syscall_invoke(Microkernel* kernel, PCB* pcb, uint64_t num,
+                        uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4);
+int syscall_ring_setup(PCB* pcb, uint32_t entries);
+int syscall_ring_submit(SyscallRing* ring, uint32_t num, uint64_t arg1, uint64_t arg2,
+                        uint64_t arg3, uint64_t arg4, uint64_t user_data);
+int syscall_ring_reap(SyscallRing* ring, SyscallCompletion* out, int max);
+int syscall_ring_drain(Microkernel* kernel, PCB* pcb);
+void syscall_print_stats(Microkernel* kernel);
+
 // Filesystem
 VFS* vfs_create();
 void vfs_destroy(VFS* vfs);
 int vfs_create_file(VFS* vfs, const char* name, size_t size);
 int vfs_open_file(VFS* vfs, const char* name);
+int vfs_close_file(VFS* vfs, int fd);
+int vfs_dup_file(VFS* vfs, int fd);
 int vfs_read_file(VFS* vfs, int fd, void* buffer, size_t size);
 int vfs_write_file(VFS* vfs, int fd, void* data, size_t size);
+int64_t vfs_seek(VFS* vfs, int fd, int64_t offset, int whence);
+int vfs_mmap(VFS* vfs, MemoryManager* mm, uint32_t pid, int fd, uint64_t offset, size_t length,
+             uint64_t* vaddr);
 void vfs_list_files(VFS* vfs);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "common.h"
+
+// Checkpoint files (src/common/snapshot.c). A file holds a SnapshotHeader,
+// tagged sections in the order written, then a SnapshotSection table.
+// Sections are plain struct images with their pointers re-encoded; bulk
+// data (guest memory, physical memory) sits on page boundaries so restore
+// can back pages with the file's copy-on-write mapping instead of reading
+// them. Images are raw structs, so a file only restores into the binary
+// that wrote it.
+#define SNAPSHOT_MAGIC 0x50414E5343455053ULL  // "SPECSNAP"
+#define SNAPSHOT_VERSION 1
+
+typedef enum {
+    SNAP_CPU = 1,
+    SNAP_KERNEL,
+    SNAP_RTOS
+} SnapshotTag;
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t build;             // hash of the writer's build id
+    uint64_t table_offset;
+    uint32_t section_count;
+    uint32_t reserved;
+} SnapshotHeader;
+
+typedef struct {
+    uint32_t tag;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+} SnapshotSection;
+
+struct SnapshotWriter {
+    FILE* file;
+    uint64_t bytes;
+    SnapshotSection* sections;
+    uint32_t section_count;
+    uint32_t section_slots;
+    bool failed;
+};
+
+// Mapped MAP_PRIVATE and writable: restored pages point into a mapping,
+// and the first write to one copies it. Each restore gets a mapping of its
+// own, so systems restored from one Snapshot never see each other's
+// writes. Everything restored from a snapshot must be destroyed before it
+// is closed.
+struct Snapshot {
+    uint8_t* map;               // read at open, then lent to the first restore
+    size_t map_size;
+    int fd;
+    uint8_t** views;            // mappings made for later restores
+    uint32_t view_count;
+    bool map_lent;
+    SnapshotHeader header;
+    SnapshotSection* sections;
+};
+
+// Reads one section front to back; a short section sets failed
+typedef struct {
+    Snapshot* snapshot;
+    uint8_t* base;              // this restore's mapping of the file
+    uint64_t offset;
+    uint64_t end;
+    bool failed;
+} SnapshotCursor;
+
+SnapshotWriter* snapshot_create(const char* path);
+void snapshot_begin(SnapshotWriter* writer, SnapshotTag tag);
+void snapshot_write(SnapshotWriter* writer, const void* data, size_t size);
+void snapshot_align(SnapshotWriter* writer);
+int snapshot_finish(SnapshotWriter* writer);
+
+Snapshot* snapshot_open(const char* path);
+void snapshot_close(Snapshot* snapshot);
+int snapshot_find(Snapshot* snapshot, SnapshotTag tag, uint32_t index, SnapshotCursor* cursor);
+bool snapshot_read(SnapshotCursor* cursor, void* out, size_t size);
+uint8_t* snapshot_pages(SnapshotCursor* cursor, size_t size);
+
+// Guest memory as its size, the populated page addresses, then the pages.
+// The restored memory is backed by the mapping until pages are written.
+void snapshot_write_memory(SnapshotWriter* writer, const GuestMemory* mem);
+GuestMemory* snapshot_read_memory(SnapshotCursor* cursor);
+
+// In-place re-encoding of pointer-sized fields of an image. Data pointers
+// into [base, base + size) become offsets and are loaded against the new
+// base; other data pointers are kept as they are, so they only mean
+// something to the process that wrote them. Code pointers become offsets
+// into this binary's text.
+void snapshot_save_pointer(void* field, const void* base, size_t size);
+void snapshot_load_pointer(void* field, const void* base);
+void snapshot_save_code(void* field);
+void snapshot_load_code(void* field);
+
+#endif
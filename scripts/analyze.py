@@ -2,10 +2,9 @@
 import json
 import csv
 import statistics
-import numpy as np
 from dataclasses import dataclass
-from typing import List, Dict, Any
-import matplotlib.pyplot as plt
+from pathlib import Path
+from typing import List, Dict, Any, Optional
 
 @dataclass
 class PerformanceMetrics:
@@ -153,8 +152,102 @@ class PerformanceAnalyzer:
                     'memory_usage_mb': metric.memory_usage
                 })
 
+def load_sweep_results(path: str) -> List[Dict[str, Any]]:
+    """Load a parameter sweep table written by sweep_write_csv/sweep_write_json"""
+    if path.endswith('.json'):
+        with open(path, 'r') as f:
+            return json.load(f)['jobs']
+    
+    numeric = {'job', 'size', 'line_size', 'associativity', 'bhr_size', 'pht_size',
+               'seed', 'events', 'hits', 'cycles', 'elapsed_us'}
+    rows = []
+    with open(path, 'r', newline='') as f:
+        for row in csv.DictReader(f):
+            for key, value in row.items():
+                if value == '':
+                    row[key] = None
+                elif key in numeric:
+                    row[key] = int(value)
+                elif key == 'hit_rate':
+                    row[key] = float(value)
+            rows.append(row)
+    return rows
+
+def summarize_sweep(rows: List[Dict[str, Any]]) -> Dict[str, Any]:
+    """Best cache geometry per access pattern and predictor ranking"""
+    summary = {'best_cache': {}, 'predictors': []}
+    
+    for row in rows:
+        if row['kind'] != 'cache':
+            continue
+        best = summary['best_cache'].get(row['pattern'])
+        if best is None or row['hit_rate'] > best['hit_rate']:
+            summary['best_cache'][row['pattern']] = row
+    
+    summary['predictors'] = sorted((r for r in rows if r['kind'] == 'predictor'),
+                                   key=lambda r: r['hit_rate'], reverse=True)
+    
+    print(f"Sweep: {len(rows)} jobs")
+    print("\nBest cache per pattern:")
+    for pattern, row in summary['best_cache'].items():
+        print(f"  {pattern:<12} {row['size'] // 1024}KB {row['associativity']}-way "
+              f"{row['cache_type']}: {row['hit_rate']:.2f}%")
+    
+    if summary['predictors']:
+        print("\nPredictors by accuracy:")
+        for row in summary['predictors']:
+            print(f"  {row['predictor']:<18} pht={row['pht_size']}: {row['hit_rate']:.2f}%")
+    
+    return summary
+
+def load_bench(path: str) -> Dict[str, Dict[str, Any]]:
+    """Load a benchmark run written by spectre_bench, keyed by benchmark name"""
+    with open(path, 'r') as f:
+        return {b['name']: b for b in json.load(f)['benchmarks']}
+
+def compare_bench(current: Dict[str, Dict[str, Any]], baseline: Optional[Dict[str, Dict[str, Any]]],
+                  threshold: float) -> List[str]:
+    """Print a run against its baseline; returns the benchmarks whose median
+    slowed down by more than threshold percent"""
+    regressions = []
+    
+    print(f"{'Benchmark':<10} {'Median ms':>10} {'p99 ms':>9} {'CI ms':>8} {'Mops/s':>9} "
+          f"{'MIPS':>7} {'Base ms':>9} {'Change':>8}")
+    print("-" * 78)
+    for name, bench in current.items():
+        line = (f"{name:<10} {bench['median_ns'] / 1e6:>10.3f} {bench['p99_ns'] / 1e6:>9.3f} "
+                f"{bench['ci95_ns'] / 1e6:>8.3f} {bench['ops_per_sec'] / 1e6:>9.2f} "
+                f"{bench['mips'] if bench['instructions'] else '-':>7}")
+        base = baseline.get(name) if baseline else None
+        if base is None:
+            print(f"{line} {'-':>9} {'-':>8}")
+            continue
+        if base['ops'] != bench['ops'] or base['instructions'] != bench['instructions']:
+            print(f"{line} {base['median_ns'] / 1e6:>9.3f} {'work':>8}  (simulated work changed)")
+            continue
+        
+        change = 100.0 * (bench['median_ns'] - base['median_ns']) / base['median_ns']
+        # Within both runs' noise it is not a slowdown, whatever the threshold
+        noise = bench['median_ns'] - bench['ci95_ns'] <= base['median_ns'] + base['ci95_ns']
+        flag = ''
+        if change > threshold and not noise:
+            flag = '  REGRESSION'
+            regressions.append(name)
+        elif change < -threshold:
+            flag = '  faster'
+        print(f"{line} {base['median_ns'] / 1e6:>9.3f} {change:>+7.1f}%{flag}")
+    
+    if baseline:
+        for name in baseline:
+            if name not in current:
+                print(f"{name:<10} missing from this run")
+    return regressions
+
 def analyze_correlations():
     """Analyze correlations between different metrics"""
+    import numpy as np
+    import matplotlib.pyplot as plt
+    
     # Simulated data for demonstration
     np.random.seed(42)
     
@@ -209,8 +302,34 @@ def main():
     
     if len(sys.argv) < 2:
         print("Usage: python analyze.py <logfile>")
+        print("       python analyze.py --sweep <sweep_results.csv|json>")
+        print("       python analyze.py --bench <bench.json> [baseline.json] [--threshold PERCENT]")
         sys.exit(1)
     
+    if sys.argv[1] == '--sweep' and len(sys.argv) > 2:
+        summarize_sweep(load_sweep_results(sys.argv[2]))
+        return
+    
+    if sys.argv[1] == '--bench' and len(sys.argv) > 2:
+        args = sys.argv[2:]
+        threshold = 10.0
+        if '--threshold' in args:
+            i = args.index('--threshold')
+            threshold = float(args[i + 1])
+            del args[i:i + 2]
+        baseline = None
+        if len(args) > 1:
+            if Path(args[1]).exists():
+                baseline = load_bench(args[1])
+            else:
+                print(f"{args[1]} not found; `make bench_baseline` records one")
+        regressions = compare_bench(load_bench(args[0]), baseline, threshold)
+        if regressions:
+            print(f"\n{len(regressions)} benchmark(s) slower than the baseline by over "
+                  f"{threshold:g}%: {', '.join(regressions)}")
+            sys.exit(1)
+        return
+    
     logfile = sys.argv[1]
     
     print(f"Analyzing performance data from {logfile}")
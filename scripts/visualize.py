@@ -229,14 +229,56 @@ def plot_power_states():
     plt.savefig('power_analysis.png', dpi=150)
     print("Saved power_analysis.png")
 
+def plot_profile(path):
+    """Plot host time per region and stage residency from profile.json"""
+    with open(path) as f:
+        profile = json.load(f)
+
+    fig, axes = plt.subplots(1, 2, figsize=(14, 6))
+
+    # Host time per region
+    rate = profile['ticks_per_us']
+    names = [r['name'] for r in profile['regions']]
+    ns = [r['ticks'] * 1000.0 / rate / max(r['calls'], 1) if rate > 0 else 0.0
+          for r in profile['regions']]
+    axes[0].bar(names, ns, color='skyblue')
+    axes[0].set_xlabel('Region')
+    axes[0].set_ylabel('Host ns per call')
+    axes[0].set_title('Simulator Host Time')
+    axes[0].grid(True, alpha=0.3, axis='y')
+
+    # Residency histograms, one line per stage
+    for stage, histogram in profile['residency'].items():
+        total = sum(histogram)
+        if total:
+            axes[1].plot(range(len(histogram)), [100.0 * c / total for c in histogram],
+                         marker='o', label=stage)
+    axes[1].set_xlabel('Cycles in stage (last bucket is open-ended)')
+    axes[1].set_ylabel('Instructions (%)')
+    axes[1].set_title('Stage Residency')
+    axes[1].set_yscale('symlog', linthresh=1)
+    axes[1].legend()
+    axes[1].grid(True, alpha=0.3)
+
+    plt.tight_layout()
+    plt.savefig('profile.png', dpi=150)
+    print("Saved profile.png")
+
 def main():
     """Generate all visualizations"""
     print("Generating performance visualizations...")
     
+    # Profile from `make profile`, resolved before moving into plots/
+    profile = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else 'profile.json')
+    
     # Create output directory
     os.makedirs('plots', exist_ok=True)
     os.chdir('plots')
     
+    has_profile = os.path.exists(profile)
+    if has_profile:
+        plot_profile(profile)
+    
     plot_cache_performance()
     plot_pipeline_timeline()
     plot_rtos_schedule()
@@ -245,9 +287,9 @@ def main():
     print("\nAll visualizations saved in 'plots/' directory")
     
     # Create HTML report
-    create_html_report()
+    create_html_report(has_profile)
 
-def create_html_report():
+def create_html_report(has_profile=False):
     """Create HTML report with all visualizations"""
     html = '''
     <!DOCTYPE html>
@@ -277,6 +319,8 @@ def create_html_report():
             </div>
         </div>
         
+        {profile_section}
+        
         <div class="plot">
             <h2>Cache Performance</h2>
             <img src="cache_performance.png" alt="Cache Performance">
@@ -314,6 +358,13 @@ def create_html_report():
     </html>
     '''
     
+    profile_section = '''<div class="plot">
+            <h2>Pipeline Profile</h2>
+            <img src="profile.png" alt="Pipeline Profile">
+            <p>Host time per simulator region and per-stage residency, from profile.json.</p>
+        </div>''' if has_profile else ''
+    html = html.replace('{profile_section}', profile_section)
+    
     with open('report.html', 'w') as f:
         f.write(html)
     
@@ -0,0 +1,544 @@
+#include "cpu.h"
+#include "kernel.h"
+#include "embedded.h"
+#include <math.h>
+
+// Timed benchmark suite behind `make bench`. Each benchmark registered in
+// benchmarks[] has a setup, one repetition and a teardown; the harness runs
+// warm-up repetitions, times every other one with get_time_ns and writes
+// median, p99 and a 95% confidence interval of the mean as JSON for
+// scripts/analyze.py to compare against a baseline. A repetition does the
+// same simulated work every time, so only the host time may move.
+
+#define BENCH_WARMUP 3
+#define BENCH_REPETITIONS 30
+#define BENCH_MAX_REPETITIONS 10000
+#define BENCH_OUTPUT "bench.json"
+
+// What one repetition did
+typedef struct {
+    uint64_t ops;               // in the benchmark's unit
+    uint64_t instructions;      // simulated instructions retired, for MIPS; 0 if none
+} BenchWork;
+
+typedef struct {
+    const char* name;
+    const char* unit;           // what ops counts
+    void* (*setup)(void);
+    BenchWork (*run)(void* state);
+    void (*teardown)(void* state);
+} Benchmark;
+
+typedef struct {
+    BenchWork work;             // of the last timed repetition
+    uint64_t median_ns;
+    uint64_t p99_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    double mean_ns;
+    double stdev_ns;
+    double ci95_ns;             // half-width around mean_ns
+    double ops_per_sec;         // ops over the median
+    double mips;
+} BenchStats;
+
+// ---- Cache: a pseudo-random walk over 4x the L1 in 64B lines ----
+
+#define CACHE_BENCH_ACCESSES 1000000
+
+typedef struct {
+    Cache* cache;
+    uint64_t* addrs;
+} CacheBench;
+
+static void* cache_setup(void) {
+    CacheBench* b = (CacheBench*)malloc(sizeof(CacheBench));
+    if (!b) return NULL;
+    b->cache = cache_create(CACHE_SET_ASSOC, 32 * KiB, 64, 8);
+    b->addrs = (uint64_t*)malloc(CACHE_BENCH_ACCESSES * sizeof(uint64_t));
+    if (!b->cache || !b->addrs) {
+        cache_destroy(b->cache);
+        free(b->addrs);
+        free(b);
+        return NULL;
+    }
+    uint64_t rng = 42;
+    for (int i = 0; i < CACHE_BENCH_ACCESSES; i++) {
+        b->addrs[i] = (splitmix64(&rng) % (128 * KiB)) & ~63ULL;
+    }
+    return b;
+}
+
+static BenchWork cache_run(void* state) {
+    CacheBench* b = (CacheBench*)state;
+    for (int i = 0; i < CACHE_BENCH_ACCESSES; i++) {
+        cache_access(b->cache, b->addrs[i], (i & 7) == 0);
+    }
+    return (BenchWork){ .ops = CACHE_BENCH_ACCESSES };
+}
+
+static void cache_teardown(void* state) {
+    CacheBench* b = (CacheBench*)state;
+    cache_destroy(b->cache);
+    free(b->addrs);
+    free(b);
+}
+
+// ---- Predictor: TAGE on nested loops and a data-dependent branch ----
+
+#define PREDICTOR_BENCH_BRANCHES 250000
+
+static void* predictor_setup(void) {
+    return bp_create(PREDICTOR_TAGE, 12, 4096);
+}
+
+static BenchWork predictor_run(void* state) {
+    BranchPredictor* bp = (BranchPredictor*)state;
+    uint64_t rng = 7;
+    for (int i = 0; i < PREDICTOR_BENCH_BRANCHES; i++) {
+        uint64_t pc = 0x1000 + (i % 3) * 0x40;
+        bool taken = (i % 3 == 0) ? (i / 3) % 8 != 7
+                   : (i % 3 == 1) ? (i / 3) % 3 == 0
+                   : (splitmix64(&rng) & 3) != 0;
+        bp_update(bp, pc, taken, bp_predict(bp, pc));
+    }
+    return (BenchWork){ .ops = PREDICTOR_BENCH_BRANCHES };
+}
+
+static void predictor_teardown(void* state) {
+    bp_destroy((BranchPredictor*)state);
+}
+
+// ---- Pipeline and Tomasulo: a summing loop run to HLT ----
+
+#define PIPELINE_BENCH_ITERATIONS 100000
+
+static uint32_t emit(uint8_t* buf, InstructionType type, InstructionFormat format,
+                     uint8_t rd, uint8_t rs1, uint8_t rs2, uint64_t value) {
+    DecodedInstruction inst = { .type = type, .format = format,
+                                .rd = rd, .rs1 = rs1, .rs2 = rs2,
+                                .imm = value, .address = value };
+    return encode_instruction(inst, buf);
+}
+
+// r0 = n, r3 = 1; loop: r2 += r0; r0 -= r3; jnz loop; [0x110] = r2; hlt
+static void load_sum_program(CPU* cpu, uint64_t count) {
+    uint8_t program[64];
+    uint32_t n = 0;
+    n += emit(program + n, INST_LD, FORMAT_M, 0, 0, 0, 0x100);
+    n += emit(program + n, INST_LD, FORMAT_M, 3, 0, 0, 0x108);
+    uint64_t loop = 0x1000 + n;
+    n += emit(program + n, INST_ADD, FORMAT_R, 2, 2, 0, 0);
+    n += emit(program + n, INST_SUB, FORMAT_R, 0, 0, 3, 0);
+    n += emit(program + n, INST_JNZ, FORMAT_J, 0, 0, 0, loop);
+    n += emit(program + n, INST_ST, FORMAT_M, 2, 0, 0, 0x110);
+    n += emit(program + n, INST_HLT, FORMAT_S, 0, 0, 0, 0);
+
+    cpu_reset(cpu);
+    memset(cpu->registers, 0, sizeof(cpu->registers));
+    gmem_store64(cpu->memory, 0x100, count);
+    gmem_store64(cpu->memory, 0x108, 1);
+    cpu_load_program(cpu, program, n, 0x1000);
+}
+
+static void* pipeline_setup(void) {
+    CPU* cpu = cpu_create(64 * KiB);
+    if (cpu && cpu->ooo) {
+        tomasulo_destroy(cpu->ooo);
+        cpu->ooo = NULL;
+    }
+    return cpu;
+}
+
+static BenchWork pipeline_run(void* state) {
+    CPU* cpu = (CPU*)state;
+    load_sum_program(cpu, PIPELINE_BENCH_ITERATIONS);
+    while (!cpu->halted) cpu_step(cpu);
+    cpu_drain_pipeline(cpu);
+    return (BenchWork){ .ops = cpu->cycles, .instructions = cpu->instructions };
+}
+
+static void* tomasulo_setup(void) {
+    CPU* cpu = cpu_create(64 * KiB);
+    if (!cpu) return NULL;
+    if (!cpu->ooo) {
+        OoOConfig config = {
+            .rob_size = DEFAULT_OOO_ROB_SIZE,
+            .rs_count = DEFAULT_OOO_RS_COUNT,
+            .dispatch_width = DEFAULT_OOO_WIDTH,
+            .issue_width = DEFAULT_OOO_WIDTH,
+            .commit_width = DEFAULT_OOO_WIDTH,
+        };
+        cpu->ooo = tomasulo_create(cpu, &config);
+    }
+    if (!cpu->ooo) {
+        cpu_destroy(cpu);
+        return NULL;
+    }
+    return cpu;
+}
+
+static BenchWork tomasulo_bench_run(void* state) {
+    CPU* cpu = (CPU*)state;
+    load_sum_program(cpu, PIPELINE_BENCH_ITERATIONS);
+    while (!cpu->halted || cpu->ooo->rob_count > 0) tomasulo_step(cpu->ooo);
+    return (BenchWork){ .ops = cpu->cycles, .instructions = cpu->instructions };
+}
+
+static void cpu_teardown(void* state) {
+    cpu_destroy((CPU*)state);
+}
+
+// ---- Scheduler: 64 processes on 4 CPUs, ticked one at a time ----
+
+#define SCHEDULER_BENCH_TICKS 1000000
+
+static void* scheduler_setup(void) {
+    Scheduler* sched = (Scheduler*)malloc(sizeof(Scheduler));
+    if (!sched) return NULL;
+    scheduler_init(sched);
+    scheduler_set_cpus(sched, 4);
+    for (uint32_t pid = 1; pid <= 64; pid++) {
+        PCB* pcb = pcb_create(pid, NULL);
+        if (!pcb) break;
+        pcb->priority = pid % 4;
+        scheduler_add_process(sched, pcb);
+    }
+    return sched;
+}
+
+static BenchWork scheduler_run(void* state) {
+    Scheduler* sched = (Scheduler*)state;
+    for (int t = 0; t < SCHEDULER_BENCH_TICKS; t++) {
+        scheduler_tick(sched);
+    }
+    return (BenchWork){ .ops = SCHEDULER_BENCH_TICKS };
+}
+
+static void scheduler_teardown(void* state) {
+    Scheduler* sched = (Scheduler*)state;
+    for (int i = 0; i < sched->process_count; i++) {
+        pcb_destroy(sched->processes[i]);
+    }
+    scheduler_destroy(sched);
+    free(sched);
+}
+
+// ---- Memory manager: demand-fault 16MB, translate at random, free ----
+
+#define MM_BENCH_PAGES 4096
+#define MM_BENCH_TRANSLATIONS 500000
+
+static void* mm_setup(void) {
+    return mm_create(64 * MiB);
+}
+
+static BenchWork mm_run(void* state) {
+    MemoryManager* mm = (MemoryManager*)state;
+    for (uint64_t page = 0; page < MM_BENCH_PAGES; page++) {
+        mm_translate_write(mm, 1, page * PAGE_SIZE);
+    }
+    uint64_t rng = 3;
+    for (int i = 0; i < MM_BENCH_TRANSLATIONS; i++) {
+        mm_translate_address(mm, 1, (splitmix64(&rng) % MM_BENCH_PAGES) * PAGE_SIZE);
+    }
+    mm_free_pages(mm, 1);
+    return (BenchWork){ .ops = MM_BENCH_PAGES + MM_BENCH_TRANSLATIONS };
+}
+
+static void mm_teardown(void* state) {
+    mm_destroy((MemoryManager*)state);
+}
+
+// ---- IPC: batches of 32 inline messages through an MPMC queue ----
+
+#define IPC_BENCH_MESSAGES 1000000
+#define IPC_BENCH_BATCH 32
+
+static void* ipc_setup(void) {
+    return mq_create(1024, MQ_MPMC);
+}
+
+static BenchWork ipc_run(void* state) {
+    MessageQueue* mq = (MessageQueue*)state;
+    Message msgs[IPC_BENCH_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < IPC_BENCH_MESSAGES; i += IPC_BENCH_BATCH) {
+        for (int j = 0; j < IPC_BENCH_BATCH; j++) {
+            msgs[j].msg_id = i + j;
+            msgs[j].size = sizeof(uint64_t);
+        }
+        mq_send_batch(mq, msgs, IPC_BENCH_BATCH, 0);
+        mq_receive_batch(mq, msgs, IPC_BENCH_BATCH, 0);
+    }
+    return (BenchWork){ .ops = IPC_BENCH_MESSAGES };
+}
+
+static void ipc_teardown(void* state) {
+    mq_destroy((MessageQueue*)state);
+}
+
+// ---- VFS: write 16MB in 512B records, then read it back ----
+
+#define VFS_BENCH_BYTES (16 * MiB)
+#define VFS_BENCH_RECORD 512
+
+typedef struct {
+    VFS* vfs;
+    int fd;
+} VfsBench;
+
+static void* vfs_setup(void) {
+    VfsBench* b = (VfsBench*)malloc(sizeof(VfsBench));
+    if (!b) return NULL;
+    b->vfs = vfs_create();
+    b->fd = b->vfs ? vfs_create_file(b->vfs, "bench.dat", 0) : -1;
+    if (b->fd < 0) {
+        vfs_destroy(b->vfs);
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+static BenchWork vfs_run(void* state) {
+    VfsBench* b = (VfsBench*)state;
+    char record[VFS_BENCH_RECORD];
+    memset(record, 'v', sizeof(record));
+    vfs_seek(b->vfs, b->fd, 0, SEEK_SET);
+    for (size_t done = 0; done < VFS_BENCH_BYTES; done += sizeof(record)) {
+        vfs_write_file(b->vfs, b->fd, record, sizeof(record));
+    }
+    vfs_seek(b->vfs, b->fd, 0, SEEK_SET);
+    for (size_t done = 0; done < VFS_BENCH_BYTES; done += sizeof(record)) {
+        vfs_read_file(b->vfs, b->fd, record, sizeof(record));
+    }
+    return (BenchWork){ .ops = 2 * VFS_BENCH_BYTES };
+}
+
+static void vfs_teardown(void* state) {
+    VfsBench* b = (VfsBench*)state;
+    vfs_destroy(b->vfs);
+    free(b);
+}
+
+// ---- RTOS: a tickless fleet sensor node for 1000s of virtual time ----
+
+#define RTOS_BENCH_MS 1000000
+
+typedef struct {
+    RTOS* rtos;
+    PowerManager* pm;
+} RtosBench;
+
+static void* rtos_setup(void) {
+    RtosBench* b = (RtosBench*)malloc(sizeof(RtosBench));
+    if (!b) return NULL;
+    b->rtos = rtos_create();
+    b->pm = pm_create();
+    if (!b->rtos || !b->pm) {
+        rtos_destroy(b->rtos);
+        pm_destroy(b->pm);
+        free(b);
+        return NULL;
+    }
+    rtos_set_virtual_clock(b->rtos, 0);
+    rtos_seed(b->rtos, 42);
+    rtos_set_tickless(b->rtos, true, b->pm);
+    fleet_sensor_node(b->rtos, 0, NULL);
+    return b;
+}
+
+static BenchWork rtos_run(void* state) {
+    RtosBench* b = (RtosBench*)state;
+    rtos_advance(b->rtos, RTOS_BENCH_MS);
+    return (BenchWork){ .ops = RTOS_BENCH_MS };
+}
+
+static void rtos_teardown(void* state) {
+    RtosBench* b = (RtosBench*)state;
+    rtos_destroy(b->rtos);
+    pm_destroy(b->pm);
+    free(b);
+}
+
+static const Benchmark benchmarks[] = {
+    { "cache",     "accesses",   cache_setup,     cache_run,          cache_teardown },
+    { "predictor", "branches",   predictor_setup, predictor_run,      predictor_teardown },
+    { "pipeline",  "cycles",     pipeline_setup,  pipeline_run,       cpu_teardown },
+    { "tomasulo",  "cycles",     tomasulo_setup,  tomasulo_bench_run, cpu_teardown },
+    { "scheduler", "ticks",      scheduler_setup, scheduler_run,      scheduler_teardown },
+    { "mm",        "faults+translations", mm_setup, mm_run,           mm_teardown },
+    { "ipc",       "messages",   ipc_setup,       ipc_run,            ipc_teardown },
+    { "vfs",       "bytes",      vfs_setup,       vfs_run,            vfs_teardown },
+    { "rtos",      "virtual ms", rtos_setup,      rtos_run,           rtos_teardown },
+};
+
+// ---- Statistics ----
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Two-sided 95% Student t for df degrees of freedom
+static double t95(int df) {
+    static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    if (df < 1) return 0.0;
+    return df <= (int)ARRAY_SIZE(table) ? table[df - 1] : 1.960;
+}
+
+// Sorts samples. p99 is the nearest rank.
+static void bench_stats(uint64_t* samples, int n, BenchWork work, BenchStats* stats) {
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) sum += samples[i];
+    double mean = sum / n;
+    double sq = 0.0;
+    for (int i = 0; i < n; i++) sq += (samples[i] - mean) * (samples[i] - mean);
+    double stdev = n > 1 ? sqrt(sq / (n - 1)) : 0.0;
+
+    stats->work = work;
+    stats->median_ns = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    stats->p99_ns = samples[(int)ceil(0.99 * n) - 1];
+    stats->min_ns = samples[0];
+    stats->max_ns = samples[n - 1];
+    stats->mean_ns = mean;
+    stats->stdev_ns = stdev;
+    stats->ci95_ns = t95(n - 1) * stdev / sqrt(n);
+
+    double seconds = MAX(stats->median_ns, 1) / 1e9;
+    stats->ops_per_sec = work.ops / seconds;
+    stats->mips = work.instructions / seconds / 1e6;
+}
+
+// Returns -1 when setup fails
+static int bench_run(const Benchmark* bench, int warmup, int repetitions, uint64_t* samples,
+                     BenchStats* stats) {
+    void* state = bench->setup();
+    if (!state) {
+        ERROR("Setup failed for benchmark %s\n", bench->name);
+        return -1;
+    }
+
+    BenchWork work = {0};
+    for (int i = 0; i < warmup; i++) {
+        bench->run(state);
+    }
+    for (int i = 0; i < repetitions; i++) {
+        uint64_t start = get_time_ns();
+        work = bench->run(state);
+        samples[i] = get_time_ns() - start;
+    }
+    bench->teardown(state);
+
+    bench_stats(samples, repetitions, work, stats);
+    return 0;
+}
+
+static void write_json(FILE* f, int warmup, int repetitions, const Benchmark** run,
+                       const BenchStats* stats, uint64_t* const* samples, int count) {
+    fprintf(f, "{\n  \"suite\": \"spectre\",\n  \"compiler\": \"%s\",\n"
+               "  \"warmup\": %d,\n  \"repetitions\": %d,\n  \"benchmarks\": [\n",
+            __VERSION__, warmup, repetitions);
+    for (int b = 0; b < count; b++) {
+        const BenchStats* s = &stats[b];
+        fprintf(f, "    {\"name\": \"%s\", \"unit\": \"%s\", \"ops\": %lu, \"instructions\": %lu, "
+                   "\"median_ns\": %lu, \"p99_ns\": %lu, \"min_ns\": %lu, \"max_ns\": %lu, "
+                   "\"mean_ns\": %.1f, \"stdev_ns\": %.1f, \"ci95_ns\": %.1f, "
+                   "\"ops_per_sec\": %.1f, \"mips\": %.3f, \"samples_ns\": [",
+                run[b]->name, run[b]->unit, s->work.ops, s->work.instructions,
+                s->median_ns, s->p99_ns, s->min_ns, s->max_ns, s->mean_ns, s->stdev_ns,
+                s->ci95_ns, s->ops_per_sec, s->mips);
+        for (int i = 0; i < repetitions; i++) {
+            fprintf(f, "%s%lu", i ? ", " : "", samples[b][i]);
+        }
+        fprintf(f, "]}%s\n", b + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+static void usage(const char* prog) {
+    printf("Usage: %s [--warmup N] [--repetitions N] [--filter NAME] [--output FILE] [--list]\n",
+           prog);
+}
+
+int main(int argc, char** argv) {
+    int warmup = BENCH_WARMUP;
+    int repetitions = BENCH_REPETITIONS;
+    const char* filter = NULL;
+    const char* output = BENCH_OUTPUT;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--warmup") == 0 && has_value) {
+            warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--repetitions") == 0 && has_value) {
+            repetitions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--list") == 0) {
+            for (size_t b = 0; b < ARRAY_SIZE(benchmarks); b++) {
+                printf("%-10s %s\n", benchmarks[b].name, benchmarks[b].unit);
+            }
+            return 0;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (warmup < 0 || repetitions < 1 || repetitions > BENCH_MAX_REPETITIONS) {
+        ERROR("Repetitions must be 1..%d and warm-up at least 0\n", BENCH_MAX_REPETITIONS);
+        return 1;
+    }
+
+    const Benchmark* run[ARRAY_SIZE(benchmarks)];
+    BenchStats stats[ARRAY_SIZE(benchmarks)];
+    uint64_t* samples[ARRAY_SIZE(benchmarks)];
+    int count = 0;
+    int failed = 0;
+
+    printf("=== Spectre Benchmark Suite (%d warm-up, %d timed) ===\n", warmup, repetitions);
+    printf("%-10s %-12s %-12s %-12s %-14s %-8s\n", "Benchmark", "Median ms", "p99 ms",
+           "+/- CI ms", "Mops/s", "MIPS");
+    for (size_t b = 0; b < ARRAY_SIZE(benchmarks); b++) {
+        const Benchmark* bench = &benchmarks[b];
+        if (filter && !strstr(bench->name, filter)) continue;
+
+        samples[count] = (uint64_t*)malloc(repetitions * sizeof(uint64_t));
+        if (!samples[count] || bench_run(bench, warmup, repetitions, samples[count], &stats[count]) != 0) {
+            free(samples[count]);
+            failed++;
+            continue;
+        }
+        const BenchStats* s = &stats[count];
+        printf("%-10s %-12.3f %-12.3f %-12.3f %-14.2f ", bench->name, s->median_ns / 1e6,
+               s->p99_ns / 1e6, s->ci95_ns / 1e6, s->ops_per_sec / 1e6);
+        if (s->work.instructions) printf("%-8.2f\n", s->mips);
+        else printf("%-8s\n", "-");
+        run[count++] = bench;
+    }
+
+    FILE* f = fopen(output, "w");
+    if (!f) {
+        ERROR("Cannot open %s: %s\n", output, strerror(errno));
+        failed++;
+    } else {
+        write_json(f, warmup, repetitions, run, stats, samples, count);
+        fclose(f);
+        printf("Results written to %s\n", output);
+    }
+
+    for (int b = 0; b < count; b++) {
+        free(samples[b]);
+    }
+    return failed ? 1 : 0;
+}
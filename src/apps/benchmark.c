@@ -1,29 +1,120 @@
 #include "cpu.h"
 #include "kernel.h"
 #include "embedded.h"
+#include <sched.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// Encodings as decoded by instruction_set.c: R is opcode, rd|rs1, rs2;
+// M adds a 64-bit address, J is opcode, rd, 64-bit target
+#define ENC64(v) (uint8_t)(v), (uint8_t)((uint64_t)(v) >> 8), \
+                 (uint8_t)((uint64_t)(v) >> 16), (uint8_t)((uint64_t)(v) >> 24), \
+                 (uint8_t)((uint64_t)(v) >> 32), (uint8_t)((uint64_t)(v) >> 40), \
+                 (uint8_t)((uint64_t)(v) >> 48), (uint8_t)((uint64_t)(v) >> 56)
+#define ENC_R(op, rd, rs1, rs2) op, ((rd) << 4) | (rs1), (rs2) << 4
+#define ENC_M(op, rd, addr)     op, (rd) << 4, 0, ENC64(addr)
+#define ENC_J(op, target)       op, 0, ENC64(target)
+
+#define PROGRAM_BASE 0x1000
+
+// Fibonacci: iteration count at FIB_N, fib(n) stored to FIB_RESULT
+#define FIB_N      0x200
+#define FIB_ONE    0x208
+#define FIB_RESULT 0x210
+#define FIB_LOOP   (PROGRAM_BASE + 33)
+
+// 2x2 matrix multiply C = A * B, repeated MAT_REPS times; 64-bit elements
+#define MAT_A      0x200
+#define MAT_B      0x220
+#define MAT_C      0x240
+#define MAT_REPS   0x260
+#define MAT_ONE    0x268
+#define MAT_LOOP   (PROGRAM_BASE + 22)
 
 // Benchmark programs
 uint8_t fibonacci_program[] = {
-    // Calculate fibonacci(10)
-    INST_MOV, 10,    // R0 = 10 (n)
-    INST_MOV, 0,     // R1 = 0 (a)
-    INST_MOV, 1,     // R2 = 1 (b)
-    0, 0, 0, 0,      // Padding
+    ENC_M(INST_LD, 0, FIB_N),       // R0 = n
+    ENC_M(INST_LD, 2, FIB_ONE),     // R2 = 1 (b), R1 = 0 (a)
+    ENC_M(INST_LD, 3, FIB_ONE),     // R3 = 1
+    ENC_R(INST_ADD, 4, 1, 2),       // FIB_LOOP: R4 = a + b
+    ENC_R(INST_MOV, 1, 2, 0),       // a = b
+    ENC_R(INST_MOV, 2, 4, 0),       // b = R4
+    ENC_R(INST_SUB, 0, 0, 3),       // n--
+    ENC_J(INST_JNZ, FIB_LOOP),      // loop while R0 != 0
+    ENC_M(INST_ST, 1, FIB_RESULT),
+    INST_HLT
 };
 
 uint8_t matrix_multiply[] = {
-    // Simple 2x2 matrix multiplication
-    INST_LD, 0, 0,   // Load matrix A[0][0]
-    INST_LD, 1, 4,   // Load matrix A[0][1]
-    INST_LD, 2, 8,   // Load matrix B[0][0]
-    INST_LD, 3, 12,  // Load matrix B[1][0]
-    INST_MUL, 0, 2,  // R4 = A00 * B00
-    INST_MUL, 1, 3,  // R5 = A01 * B10
-    INST_ADD, 4, 5,  // R6 = R4 + R5
-    INST_ST, 6, 16,  // Store result
+    ENC_M(INST_LD, 0, MAT_REPS),    // R0 = repetitions
+    ENC_M(INST_LD, 15, MAT_ONE),    // R15 = 1
+    ENC_M(INST_LD, 1, MAT_A),       // MAT_LOOP: R1-R4 = A
+    ENC_M(INST_LD, 2, MAT_A + 8),
+    ENC_M(INST_LD, 3, MAT_A + 16),
+    ENC_M(INST_LD, 4, MAT_A + 24),
+    ENC_M(INST_LD, 5, MAT_B),       // R5-R8 = B
+    ENC_M(INST_LD, 6, MAT_B + 8),
+    ENC_M(INST_LD, 7, MAT_B + 16),
+    ENC_M(INST_LD, 8, MAT_B + 24),
+    ENC_R(INST_MUL, 9, 1, 5),       // C00 = A00*B00 + A01*B10
+    ENC_R(INST_MUL, 10, 2, 7),
+    ENC_R(INST_ADD, 9, 9, 10),
+    ENC_M(INST_ST, 9, MAT_C),
+    ENC_R(INST_MUL, 9, 1, 6),       // C01 = A00*B01 + A01*B11
+    ENC_R(INST_MUL, 10, 2, 8),
+    ENC_R(INST_ADD, 9, 9, 10),
+    ENC_M(INST_ST, 9, MAT_C + 8),
+    ENC_R(INST_MUL, 9, 3, 5),       // C10 = A10*B00 + A11*B10
+    ENC_R(INST_MUL, 10, 4, 7),
+    ENC_R(INST_ADD, 9, 9, 10),
+    ENC_M(INST_ST, 9, MAT_C + 16),
+    ENC_R(INST_MUL, 9, 3, 6),       // C11 = A10*B01 + A11*B11
+    ENC_R(INST_MUL, 10, 4, 8),
+    ENC_R(INST_ADD, 9, 9, 10),
+    ENC_M(INST_ST, 9, MAT_C + 24),
+    ENC_R(INST_SUB, 0, 0, 15),
+    ENC_J(INST_JNZ, MAT_LOOP),
     INST_HLT
 };
 
+static void store_u64(CPU* cpu, uint64_t addr, uint64_t value) {
+    gmem_store64(cpu->memory, addr, value);
+}
+
+static uint64_t load_u64(CPU* cpu, uint64_t addr) {
+    return gmem_load64(cpu->memory, addr);
+}
+
+static void setup_fibonacci(CPU* cpu, uint64_t n) {
+    cpu_reset(cpu);
+    store_u64(cpu, FIB_N, n);
+    store_u64(cpu, FIB_ONE, 1);
+    cpu_load_program(cpu, fibonacci_program, sizeof(fibonacci_program), PROGRAM_BASE);
+}
+
+static void setup_matrix(CPU* cpu, uint64_t reps) {
+    cpu_reset(cpu);
+    for (int i = 0; i < 4; i++) {
+        store_u64(cpu, MAT_A + i * 8, i + 1);   // A = [1 2; 3 4]
+        store_u64(cpu, MAT_B + i * 8, i + 5);   // B = [5 6; 7 8]
+    }
+    store_u64(cpu, MAT_REPS, reps);
+    store_u64(cpu, MAT_ONE, 1);
+    cpu_load_program(cpu, matrix_multiply, sizeof(matrix_multiply), PROGRAM_BASE);
+}
+
+// Run the pipeline until HLT is fetched, then let it retire
+static void run_to_halt(CPU* cpu, uint64_t max_cycles) {
+    while (!cpu->halted && cpu->cycles < max_cycles) {
+        cpu_step(cpu);
+    }
+    cpu_drain_pipeline(cpu);
+}
+
 void benchmark_cpu() {
     printf("\n=== CPU Benchmark ===\n");
     
@@ -31,40 +122,305 @@ void benchmark_cpu() {
     
     // Test 1: Fibonacci calculation
     printf("Test 1: Fibonacci calculation\n");
-    cpu_reset(cpu);
-    cpu_load_program(cpu, fibonacci_program, sizeof(fibonacci_program), 0x1000);
+    setup_fibonacci(cpu, 10);
     
     uint64_t start = get_time_ms();
-    cpu_run(cpu, 1000);
+    run_to_halt(cpu, 100000);
     uint64_t end = get_time_ms();
     
     cpu_print_stats(cpu);
+    printf("Result: %lu (expected: 55)\n", load_u64(cpu, FIB_RESULT));
     printf("Execution time: %lu ms\n", end - start);
     printf("Performance: %.2f instructions/ms\n", 
-           (float)cpu->instructions / (end - start));
+           (float)cpu->instructions / MAX(end - start, 1));
     
     // Test 2: Matrix multiplication
     printf("\nTest 2: Matrix multiplication\n");
-    cpu_reset(cpu);
-    cpu_load_program(cpu, matrix_multiply, sizeof(matrix_multiply), 0x1000);
-    
-    // Initialize matrices in memory
-    uint32_t* mem = (uint32_t*)cpu->memory;
-    mem[0] = 1; mem[1] = 2;  // A = [1 2; 3 4]
-    mem[2] = 3; mem[3] = 4;
-    mem[4] = 5; mem[5] = 6;  // B = [5 6; 7 8]
-    mem[6] = 7; mem[7] = 8;
+    setup_matrix(cpu, 1);
     
     start = get_time_ms();
-    cpu_run(cpu, 500);
+    run_to_halt(cpu, 100000);
     end = get_time_ms();
     
     cpu_print_stats(cpu);
-    printf("Result: %u (expected: 19)\n", mem[8]);
+    printf("Result: %lu (expected: 19)\n", load_u64(cpu, MAT_C));
+    
+    cpu_destroy(cpu);
+}
+
+// Host instruction counter for the calling thread; -1 when perf events are
+// unavailable, in which case only time is reported
+static int host_counter_open(void) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void host_counter_start(int fd) {
+#ifdef __linux__
+    if (fd < 0) return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#else
+    (void)fd;
+#endif
+}
+
+static uint64_t host_counter_stop(int fd) {
+    uint64_t count = 0;
+#ifdef __linux__
+    if (fd < 0) return 0;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+#else
+    (void)fd;
+#endif
+    return count;
+}
+
+static void report_dispatch(const char* program, const char* engine, uint64_t sim_insts,
+                            uint64_t host_insts, uint64_t elapsed_us, int fd) {
+    double per_inst = sim_insts ? (double)host_insts / sim_insts : 0.0;
+    double ns = sim_insts ? 1000.0 * elapsed_us / sim_insts : 0.0;
+    if (fd >= 0) {
+        printf("%-10s %-20s %-12lu %-16.1f %-10.2f\n",
+               program, engine, sim_insts, per_inst, ns);
+    } else {
+        printf("%-10s %-20s %-12lu %-16s %-10.2f\n",
+               program, engine, sim_insts, "n/a", ns);
+    }
+}
+
+// Host instructions per simulated instruction for each functional dispatch
+// engine (switch is the pre-table baseline) and the detailed pipeline
+void benchmark_dispatch() {
+    printf("\n=== Dispatch Benchmark ===\n");
+    
+    CPU* cpu = cpu_create(64 * KiB);
+    int fd = host_counter_open();
+    if (fd < 0) {
+        printf("Host instruction counter unavailable, reporting time only\n");
+    }
     
+    DispatchMode modes[] = { DISPATCH_SWITCH, DISPATCH_TABLE, DISPATCH_THREADED };
+    const char* programs[] = { "fibonacci", "matrix" };
+    uint64_t sizes[] = { 2000000, 200000 };
+    uint64_t detailed_sizes[] = { 100000, 10000 };
+    
+    printf("%-10s %-20s %-12s %-16s %-10s\n",
+           "Program", "Engine", "Sim insts", "Host insts/inst", "ns/inst");
+    
+    for (int p = 0; p < 2; p++) {
+        for (size_t m = 0; m < ARRAY_SIZE(modes); m++) {
+            if (p == 0) setup_fibonacci(cpu, sizes[p]);
+            else setup_matrix(cpu, sizes[p]);
+            cpu->dispatch = modes[m];
+            
+            uint64_t start = get_time_us();
+            host_counter_start(fd);
+            uint64_t executed = cpu_fast_forward(cpu, 0, NO_STOP_PC, WARM_NONE);
+            uint64_t host = host_counter_stop(fd);
+            uint64_t elapsed = get_time_us() - start;
+            
+            char engine[32];
+            snprintf(engine, sizeof(engine), "functional/%s", dispatch_mode_name(modes[m]));
+            report_dispatch(programs[p], engine, executed, host, elapsed, fd);
+        }
+        
+        if (p == 0) setup_fibonacci(cpu, detailed_sizes[p]);
+        else setup_matrix(cpu, detailed_sizes[p]);
+        
+        uint64_t start = get_time_us();
+        host_counter_start(fd);
+        run_to_halt(cpu, UINT64_MAX);
+        uint64_t host = host_counter_stop(fd);
+        uint64_t elapsed = get_time_us() - start;
+        report_dispatch(programs[p], "pipeline", cpu->instructions, host, elapsed, fd);
+    }
+    
+#if ENABLE_PROFILER
+    // Covers the detailed runs of both programs
+    profiler_print(cpu->prof);
+    if (profiler_export(cpu->prof, "profile.json") == 0) {
+        printf("Profile written to profile.json\n");
+    }
+#endif
+    
+    if (fd >= 0) close(fd);
+    cpu->dispatch = dispatch_default_mode();
     cpu_destroy(cpu);
 }
 
+// Every core runs the matrix kernel on the shared matrices; the stores to
+// C keep its lines bouncing between cores
+void benchmark_multicore() {
+    printf("\n=== Multicore Benchmark ===\n");
+    printf("%-6s %-8s %-12s %-12s %-10s %-10s %-10s\n", "Cores", "Threads",
+           "Cycles", "Insts", "Host ms", "M inst/s", "Invals");
+    
+    int core_counts[] = { 1, 2, 4, 8, 16 };
+    for (size_t i = 0; i < ARRAY_SIZE(core_counts); i++) {
+        MulticoreConfig config = {
+            .cores = core_counts[i],
+            .threads = 0,
+            .quantum = DEFAULT_QUANTUM_CYCLES,
+            .l2 = { CACHE_SET_ASSOC, DEFAULT_CACHE_L2_SIZE * 4, 64, 16 },
+            .l2_banks = DEFAULT_L2_BANKS,
+            .l2_latency = DEFAULT_L2_LATENCY,
+            .memory_latency = DEFAULT_MEMORY_LATENCY,
+        };
+        MulticoreSystem* sys = multicore_create(64 * KiB, &config);
+        if (!sys) continue;
+        
+        CPU* cpu = sys->cores[0];
+        for (int k = 0; k < 4; k++) {
+            store_u64(cpu, MAT_A + k * 8, k + 1);
+            store_u64(cpu, MAT_B + k * 8, k + 5);
+        }
+        store_u64(cpu, MAT_REPS, 2000);
+        store_u64(cpu, MAT_ONE, 1);
+        multicore_load_program(sys, matrix_multiply, sizeof(matrix_multiply), PROGRAM_BASE);
+        
+        multicore_run(sys, 0);
+        
+        uint64_t instructions = 0, invalidations = 0;
+        for (int c = 0; c < config.cores; c++) {
+            instructions += sys->cores[c]->instructions;
+            invalidations += sys->contexts[c].invalidations;
+        }
+        printf("%-6d %-8d %-12lu %-12lu %-10.2f %-10.2f %-10lu\n", config.cores,
+               sys->threads_used, sys->cycles, instructions, sys->elapsed_us / 1000.0,
+               sys->elapsed_us > 0 ? (double)instructions / sys->elapsed_us : 0.0,
+               invalidations);
+        multicore_destroy(sys);
+    }
+}
+
+void benchmark_branch_replay() {
+    printf("\n=== Branch Trace Replay Benchmark ===\n");
+    printf("%-12s %-12s %-10s %-10s %-10s\n", "Predictor", "Branches", "Accuracy",
+           "Host ms", "M br/s");
+    
+    // Loops with data-dependent and correlated branches, plus call/return pairs
+    size_t count = 4 * 1000 * 1000;
+    BranchRecord* trace = (BranchRecord*)calloc(count, sizeof(BranchRecord));
+    if (!trace) return;
+    uint64_t state = 0xB7A9C4;
+    bool last = false;
+    for (size_t i = 0; i < count; i++) {
+        BranchRecord* r = &trace[i];
+        uint64_t site = (i / 4) % 256;
+        r->size = 8;
+        switch (i % 4) {
+            case 0:
+                r->pc = 0x10000 + site * 32;
+                r->taken = last = (splitmix64(&state) & 3) != 0;
+                break;
+            case 1:
+                r->pc = 0x10008 + site * 32;
+                r->taken = !last;
+                break;
+            case 2:
+                r->pc = 0x10010 + (site % 8) * 32;
+                r->taken = (i / 4) % 16 != 15;
+                break;
+            default:
+                r->pc = 0x10018 + (site % 32) * 32;
+                r->kind = (i / 4) % 2 ? BRANCH_RETURN : BRANCH_CALL;
+                r->taken = true;
+                break;
+        }
+        r->target = r->kind == BRANCH_RETURN ? trace[i - 4].pc + 8 : r->pc + 0x100;
+    }
+    
+    PredictorType types[] = { PREDICTOR_BIMODAL, PREDICTOR_GSHARE,
+                              PREDICTOR_TAGE, PREDICTOR_PERCEPTRON };
+    const char* names[] = { "bimodal", "gshare", "tage", "perceptron" };
+    for (size_t t = 0; t < ARRAY_SIZE(types); t++) {
+        BranchPredictor* bp = bp_create(types[t], types[t] >= PREDICTOR_TAGE ? 64 : 12, 4096);
+        if (!bp) continue;
+        
+        uint64_t start = get_time_us();
+        bp_replay_batch(bp, trace, count);
+        uint64_t elapsed = get_time_us() - start;
+        
+        printf("%-12s %-12zu %-10.2f %-10.2f %-10.2f\n", names[t], count,
+               100.0 * bp->correct / bp->total, elapsed / 1000.0,
+               elapsed > 0 ? (double)count / elapsed : 0.0);
+        bp_destroy(bp);
+    }
+    free(trace);
+}
+
+void benchmark_trace() {
+    printf("\n=== Trace Capture and Replay Benchmark ===\n");
+    
+    // Capture the matrix kernel once through the pipeline
+    const char* path = "benchmark.trace";
+    CPU* cpu = cpu_create(64 * KiB);
+    if (!cpu) return;
+    setup_matrix(cpu, 20000);
+    cpu->trace = trace_writer_create(path, 0, HAVE_LZ4 ? TRACE_CODEC_LZ4 : TRACE_CODEC_VARINT);
+    if (!cpu->trace) {
+        cpu_destroy(cpu);
+        return;
+    }
+    uint64_t start = get_time_us();
+    run_to_halt(cpu, 10000000);
+    int closed = trace_writer_close(cpu->trace);
+    uint64_t capture_us = get_time_us() - start;
+    cpu->trace = NULL;
+    cpu_destroy(cpu);
+    
+    TraceReader* reader = closed == 0 ? trace_open(path) : NULL;
+    if (!reader) return;
+    uint64_t records = 0;
+    for (int s = 0; s < TRACE_STREAMS; s++) records += reader->header.counts[s];
+    printf("Captured %lu records in %.2f ms, %.2f bytes/record\n", records,
+           capture_us / 1000.0, (double)reader->map_size / records);
+    
+    // Replay the data stream through a cache and the branches through TAGE
+    Cache* cache = cache_create(CACHE_SET_ASSOC, 8 * KiB, 64, 4);
+    BranchPredictor* bp = bp_create(PREDICTOR_TAGE, 64, 4096);
+    TraceCursor mem, br;
+    if (cache && bp && trace_cursor_init(&mem, reader, TRACE_MEM) == 0) {
+        if (trace_cursor_init(&br, reader, TRACE_BRANCH) == 0) {
+            size_t n;
+            start = get_time_us();
+            while ((n = trace_next_block(&mem)) > 0) {
+                cache_access_batch(cache, mem.addrs, mem.is_write, n, NULL);
+            }
+            while ((n = trace_next_block(&br)) > 0) {
+                bp_replay_batch(bp, br.branches, n);
+            }
+            uint64_t replay_us = get_time_us() - start;
+            uint64_t replayed = reader->header.counts[TRACE_MEM] +
+                                reader->header.counts[TRACE_BRANCH];
+            printf("Replayed %lu records in %.2f ms (%.2f M/s): %.2f%% hits, %.2f%% correct\n",
+                   replayed, replay_us / 1000.0,
+                   replay_us > 0 ? (double)replayed / replay_us : 0.0,
+                   cache->accesses ? 100.0 * cache->hits / cache->accesses : 0.0,
+                   bp->total ? 100.0 * bp->correct / bp->total : 0.0);
+            trace_cursor_destroy(&br);
+        }
+        trace_cursor_destroy(&mem);
+    }
+    bp_destroy(bp);
+    cache_destroy(cache);
+    trace_close(reader);
+    remove(path);
+}
+
 void benchmark_cache() {
     printf("\n=== Cache Benchmark ===\n");
     
@@ -101,46 +457,378 @@ void benchmark_cache() {
     }
 }
 
+// Start pcb on CPU 0, as if forked there, but let any CPU run it
+static void spawn_on_cpu0(Scheduler* sched, PCB* pcb) {
+    pcb->affinity = 1;
+    scheduler_add_process(sched, pcb);
+    scheduler_set_affinity(sched, pcb, ~0ULL);
+}
+
+// Churn through short-lived processes, each needing a random amount of CPU
+// time, on 1 to SCHED_MAX_CPUS simulated CPUs. Every process is created on
+// CPU 0, so the others only get work by stealing it.
+static void scheduler_run_cpus(int cpus) {
+    const int live = 96;
+    const int ticks = 20000;
+    
+    Scheduler* sched = (Scheduler*)malloc(sizeof(Scheduler));
+    if (!sched) return;
+    scheduler_init(sched);
+    scheduler_set_cpus(sched, cpus);
+    
+    uint64_t state = 0x5C4ED;
+    for (int i = 0; i < live; i++) {
+        PCB* pcb = pcb_create(sched->next_pid++, NULL);
+        pcb->priority = splitmix64(&state) % 4;
+        pcb->quantum = 5 + splitmix64(&state) % 20;
+        pcb->registers[0] = 50 + splitmix64(&state) % 2000;  // work left
+        spawn_on_cpu0(sched, pcb);
+    }
+    
+    uint64_t completed = 0;
+    uint64_t start = get_time_us();
+    for (int t = 0; t < ticks; t++) {
+        scheduler_tick(sched);
+        
+        // Replace finished processes so the load stays constant
+        for (int cpu = 0; cpu < cpus; cpu++) {
+            PCB* pcb = sched->cpus[cpu].current;
+            if (!pcb || pcb->cpu_time < pcb->registers[0]) continue;
+            
+            scheduler_remove_process(sched, pcb);
+            pcb->state = PROC_TERMINATED;
+            completed++;
+            
+            PCB* next = pcb_create(sched->next_pid++, NULL);
+            next->priority = 0;
+            next->quantum = 5 + splitmix64(&state) % 20;
+            next->registers[0] = 50 + splitmix64(&state) % 2000;
+            spawn_on_cpu0(sched, next);
+        }
+    }
+    uint64_t elapsed = get_time_us() - start;
+    
+    uint64_t busy = 0, cold = 0, steals = 0;
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        busy += sched->cpus[cpu].busy_ticks;
+        cold += sched->cpus[cpu].migration_ticks;
+        steals += sched->cpus[cpu].steals;
+    }
+    printf("%-6d %-10lu %-10.2f %-8lu %-8lu %-10lu %-10.1f\n", cpus, completed,
+           (double)(busy - cold) / ticks, scheduler_latency_percentile(sched, 0.50),
+           scheduler_latency_percentile(sched, 0.99), steals, 1000.0 * elapsed / ticks);
+    
+    for (int i = 0; i < sched->process_count; i++) {
+        pcb_destroy(sched->processes[i]);
+    }
+    scheduler_destroy(sched);
+    free(sched);
+}
+
 void benchmark_scheduler() {
-    printf("\n=== Scheduler Benchmark ===\n");
+    printf("\n=== SMP Scheduler Benchmark ===\n");
+    printf("%-6s %-10s %-10s %-8s %-8s %-10s %-10s\n", "CPUs", "Completed", "Work/tick",
+           "p50", "p99", "Steals", "ns/tick");
     
-    Scheduler sched;
-    scheduler_init(&sched);
+    for (int cpus = 1; cpus <= SCHED_MAX_CPUS; cpus *= 2) {
+        scheduler_run_cpus(cpus);
+    }
+}
+
+typedef struct {
+    MessageQueue* mq;
+    int batch;
+    int count;
+} IpcBenchArgs;
+
+static void* ipc_bench_producer(void* arg) {
+    IpcBenchArgs* a = (IpcBenchArgs*)arg;
+    Message msgs[64] = {0};
+    for (int sent = 0; sent < a->count;) {
+        sent += mq_send_batch(a->mq, msgs, MIN(a->batch, a->count - sent), MQ_WAIT_FOREVER);
+    }
+    return NULL;
+}
+
+static void* ipc_bench_consumer(void* arg) {
+    IpcBenchArgs* a = (IpcBenchArgs*)arg;
+    Message msgs[64];
+    for (int got = 0; got < a->count;) {
+        got += mq_receive_batch(a->mq, msgs, MIN(a->batch, a->count - got), MQ_WAIT_FOREVER);
+    }
+    return NULL;
+}
+
+// Move messages between pairs of threads sharing one queue
+static void ipc_run(MQMode mode, int pairs, int batch) {
+    const int per_thread = 200000;
     
-    // Create some test processes
-    for (int i = 0; i < 10; i++) {
-        PCB* pcb = pcb_create(sched.next_pid++, NULL);
-        pcb->priority = i % 4;
-        pcb->quantum = 50 + (i * 10);
-        scheduler_add_process(&sched, pcb);
+    MessageQueue* mq = mq_create(1024, mode);
+    if (!mq) return;
+    
+    IpcBenchArgs args = {mq, batch, per_thread};
+    pthread_t tids[8];
+    uint64_t start = get_time_us();
+    for (int i = 0; i < pairs; i++) {
+        pthread_create(&tids[2 * i], NULL, ipc_bench_producer, &args);
+        pthread_create(&tids[2 * i + 1], NULL, ipc_bench_consumer, &args);
+    }
+    for (int i = 0; i < 2 * pairs; i++) {
+        pthread_join(tids[i], NULL);
     }
+    uint64_t elapsed = get_time_us() - start;
     
-    printf("Running scheduler for 1000 ticks...\n");
+    printf("%-6s %-7d %-7d %-12.2f %-10lu %-10lu\n", mode == MQ_SPSC ? "SPSC" : "MPMC",
+           pairs, batch, (double)pairs * per_thread / MAX(elapsed, 1),
+           mq->send_waits, mq->receive_waits);
+    mq_destroy(mq);
+}
+
+void benchmark_ipc() {
+    printf("\n=== IPC Benchmark ===\n");
+    printf("%-6s %-7s %-7s %-12s %-10s %-10s\n", "Queue", "Pairs", "Batch", "Mmsgs/s",
+           "Send wait", "Recv wait");
     
-    uint64_t start = get_time_ms();
-    for (int i = 0; i < 1000; i++) {
-        scheduler_tick(&sched);
+    for (int batch = 1; batch <= 64; batch *= 8) {
+        ipc_run(MQ_SPSC, 1, batch);
+        ipc_run(MQ_MPMC, 1, batch);
+        ipc_run(MQ_MPMC, 4, batch);
     }
-    uint64_t end = get_time_ms();
+}
+
+// One process over a footprint larger than memory: most accesses go to a
+// hot set, a quarter are writes
+static void swap_run(SwapPolicy policy, uint64_t hot, uint64_t footprint, int hot_percent) {
+    const int accesses = 2000000;
+    
+    MemoryManager* mm = mm_create(16 * MiB);
+    VFS* vfs = vfs_create();
+    if (!mm || !vfs || mm_enable_swap(mm, vfs, "swap", 65536, policy) != 0) return;
+    
+    uint64_t rng = 42;
+    uint64_t start = get_time_ns();
+    for (int i = 0; i < accesses; i++) {
+        uint64_t r = splitmix64(&rng);
+        uint64_t page = (int)(r % 100) < hot_percent ? (r >> 8) % hot : hot + (r >> 8) % (footprint - hot);
+        uint64_t vaddr = page * PAGE_SIZE;
+        if (((r >> 40) & 3) == 0) {
+            gmem_store64(mm->physical_memory, mm_translate_write(mm, 1, vaddr), page);
+        } else {
+            gmem_load64(mm->physical_memory, mm_translate_address(mm, 1, vaddr));
+        }
+    }
+    uint64_t elapsed = get_time_ns() - start;
+    
+    const SwapArea* swap = mm->swap;
+    printf("%-8s %-6lu %-9lu %-9.2f %-9lu %-9lu %-8lu %-8lu %-8.0f\n",
+           policy == SWAP_WSCLOCK ? "WSClock" : "CLOCK", hot, footprint,
+           1000.0 * mm->page_faults / accesses, swap->swap_ins, swap->swap_outs, swap->writes,
+           mm_working_set(mm, 1, swap->window), (double)elapsed / accesses);
+    mm_destroy(mm);
+    vfs_destroy(vfs);
+}
+
+void benchmark_swap() {
+    printf("\n=== Swap Benchmark (16MB, 4096 frames) ===\n");
+    printf("%-8s %-6s %-9s %-9s %-9s %-9s %-8s %-8s %-8s\n", "Policy", "Hot", "Footprint",
+           "Faults/k", "Swap in", "Swap out", "Writes", "WS", "ns/acc");
+    
+    swap_run(SWAP_CLOCK, 3000, 12000, 90);
+    swap_run(SWAP_WSCLOCK, 3000, 12000, 90);
+    swap_run(SWAP_CLOCK, 1000, 40000, 70);
+    swap_run(SWAP_WSCLOCK, 1000, 40000, 70);
+}
+
+// The same calls issued one syscall_invoke each, then through the ring
+static void syscall_run(const char* name, uint32_t num, int batch) {
+    const int calls = 1000000;
+    
+    Microkernel* kernel = kernel_create(16 * MiB);
+    if (!kernel) return;
+    PCB* pcb = kernel_find_process(kernel, kernel_create_process(kernel, NULL));
+    vfs_create_file(kernel->filesystem, "bench.log", 0);
+    uint64_t fd = syscall_invoke(kernel, pcb, SYS_OPEN, (uint64_t)"bench.log", 0, 0, 0);
+    char line[64] = {0};
+    uint64_t args[3] = {(uint64_t)line, fd, sizeof(line)};
+    
+    uint64_t start = get_time_ns();
+    for (int i = 0; i < calls; i++) {
+        syscall_invoke(kernel, pcb, num, args[0], args[1], args[2], 0);
+    }
+    uint64_t direct = get_time_ns() - start;
+    
+    syscall_ring_setup(pcb, batch);
+    SyscallCompletion done[256];
+    start = get_time_ns();
+    for (int i = 0; i < calls; i += batch) {
+        for (int j = 0; j < batch; j++) {
+            syscall_ring_submit(pcb->ring, num, args[0], args[1], args[2], 0, j);
+        }
+        syscall_invoke(kernel, pcb, SYS_RING_ENTER, 0, 0, 0, 0);
+        syscall_ring_reap(pcb->ring, done, batch);
+    }
+    uint64_t ring = get_time_ns() - start;
+    
+    printf("%-8s %-7d %-12.1f %-12.1f %-10lu\n", name, batch, (double)direct / calls,
+           (double)ring / calls, kernel->syscall_stats[num].max_ns);
+    kernel_destroy(kernel);
+}
+
+void benchmark_syscalls() {
+    printf("\n=== System Call Benchmark ===\n");
+    printf("%-8s %-7s %-12s %-12s %-10s\n", "Call", "Batch", "Direct ns", "Ring ns", "Max ns");
     
-    scheduler_print(&sched);
-    printf("Scheduling time: %lu ms\n", end - start);
+    for (int batch = 8; batch <= 256; batch *= 4) {
+        syscall_run("getpid", SYS_GETPID, batch);
+        syscall_run("write", SYS_WRITE, batch);
+    }
+}
+
+// Bank generation alone, then with every channel-sample folded into a
+// temperature stream as an ingest pipeline would
+void benchmark_sensors() {
+    printf("\n=== Sensor Bank Benchmark ===\n");
+    printf("%-8s %-10s %-12s %-14s %-14s\n", "Kernel", "Sensors", "Samples",
+           "M samples/s", "+stream M/s");
     
-    // Cleanup
-    for (int i = 0; i < sched.process_count; i++) {
-        pcb_destroy(sched.processes[i]);
+    const char* kernels[] = { "scalar", "avx2" };
+    const uint32_t sensors = 65536;
+    const int rounds = 200;
+    for (size_t k = 0; k < ARRAY_SIZE(kernels); k++) {
+        SensorBank* bank = sensor_bank_create(sensors, 1);
+        SensorStream* stream = sensor_stream_create(sensors, 60, 10.0, 30.0);
+        if (!bank || !stream || sensor_bank_set_kernel(bank, kernels[k]) != 0) {
+            sensor_bank_destroy(bank);
+            sensor_stream_destroy(stream);
+            continue;
+        }
+        
+        uint64_t start = get_time_ns();
+        for (int r = 0; r < rounds; r++) {
+            sensor_bank_generate(bank, (uint64_t)r * 1000);
+        }
+        uint64_t generate_ns = get_time_ns() - start;
+        
+        start = get_time_ns();
+        for (int r = 0; r < rounds; r++) {
+            sensor_bank_generate(bank, (uint64_t)r * 1000);
+            sensor_stream_push(stream, bank->temperature);
+        }
+        uint64_t stream_ns = get_time_ns() - start;
+        
+        uint64_t samples = (uint64_t)sensors * rounds;
+        printf("%-8s %-10u %-12lu %-14.1f %-14.1f\n", bank->kernel, sensors, samples,
+               samples * 1000.0 / generate_ns, samples * 1000.0 / stream_ns);
+        sensor_bank_destroy(bank);
+        sensor_stream_destroy(stream);
     }
 }
 
+typedef struct {
+    VirtualUART* uart;
+    uint64_t bytes;
+} UARTLine;
+
+static void* uart_line(void* arg) {
+    UARTLine* line = (UARTLine*)arg;
+    uint8_t chunk[4096];
+    memset(chunk, 0x55, sizeof(chunk));
+    for (uint64_t sent = 0; sent < line->bytes;) {
+        uint32_t n = uart_line_send(line->uart, chunk, (uint32_t)MIN(sizeof(chunk), line->bytes - sent));
+        if (n == 0) sched_yield();
+        sent += n;
+    }
+    return NULL;
+}
+
+// A host thread streams into the rx ring while the scheduler drains it by
+// DMA; the scheduler should never wait on the line
+void benchmark_uart() {
+    printf("\n=== UART Ring Benchmark ===\n");
+    printf("%-10s %-10s %-12s %-14s %-14s\n", "Ring", "MB", "MB/s",
+           "Sched passes", "Overhead ns");
+    
+    uint32_t sizes[] = { 256, 4096, 65536 };
+    const uint64_t bytes = 64ULL << 20;
+    static uint8_t buffer[65536];
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        RTOS* rtos = rtos_create();
+        if (!rtos || uart_configure(&rtos->uart, 12000000, sizes[i], UART_RING_SIZE) != 0) {
+            rtos_destroy(rtos);
+            continue;
+        }
+        
+        UARTLine line = { .uart = &rtos->uart, .bytes = bytes };
+        UARTDMA desc = { .buffer = buffer, .length = sizeof(buffer) };
+        uint64_t received = 0;
+        pthread_t thread;
+        
+        uint64_t start = get_time_ns();
+        pthread_create(&thread, NULL, uart_line, &line);
+        while (received < bytes) {
+            desc.length = (uint32_t)MIN(sizeof(buffer), bytes - received);
+            uart_dma_rx(&rtos->uart, &desc);
+            while (!desc.done) {
+                rtos_schedule(rtos);
+                if (!desc.done && spsc_ring_count(&rtos->uart.rx) == 0) sched_yield();
+            }
+            received += desc.length;
+        }
+        pthread_join(thread, NULL);
+        uint64_t elapsed = get_time_ns() - start;
+        
+        printf("%-10u %-10lu %-12.1f %-14lu %-14.0f\n", sizes[i], bytes >> 20,
+               bytes * 1000.0 / elapsed, rtos->schedule_calls,
+               (double)rtos->overhead_ns / rtos->schedule_calls);
+        rtos_destroy(rtos);
+    }
+}
+
+// A minute of virtual time for every node; nodes are independent, so the
+// rate should scale with threads
+void benchmark_fleet() {
+    printf("\n=== RTOS Fleet Benchmark ===\n");
+    printf("%-8s %-8s %-10s %-10s %-12s %-12s\n", "Nodes", "Threads", "Host ms",
+           "Misses", "uJ/job", "Node-s/s");
+    
+    uint32_t sizes[] = { 1000, 10000 };
+    int threads[] = { 1, 0 };
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        for (size_t t = 0; t < ARRAY_SIZE(threads); t++) {
+            RTOSFleet* fleet = fleet_create(sizes[i], 1, NULL, NULL);
+            if (!fleet) continue;
+            
+            fleet_run(fleet, 60000, threads[t]);
+            printf("%-8u %-8d %-10.2f %-10lu %-12.1f %-12.0f\n", fleet->count,
+                   fleet->threads_used, fleet->elapsed_us / 1000.0, fleet->misses,
+                   fleet->executions > 0 ? (double)fleet->energy / fleet->executions : 0.0,
+                   (double)fleet->count * fleet->time_ms * 1000.0 / fleet->elapsed_us);
+            fleet_destroy(fleet);
+        }
+    }
+}
+
+#ifndef BENCHMARK_NO_MAIN
 int main() {
     printf("=== Spectre Simulator Benchmark Suite ===\n");
     
     benchmark_cpu();
+    benchmark_dispatch();
+    benchmark_multicore();
+    benchmark_branch_replay();
+    benchmark_trace();
     benchmark_cache();
     benchmark_scheduler();
+    benchmark_ipc();
+    benchmark_syscalls();
+    benchmark_swap();
+    benchmark_fleet();
+    benchmark_sensors();
+    benchmark_uart();
     
     printf("\n=== Demo: Traffic Light Controller ===\n");
     demo_traffic_light();
     
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,13 @@
+#include "embedded.h"
+
+void demo_traffic_light();
+void demo_sensor_monitor();
+
+int main() {
+    printf("=== Spectre Embedded Demos ===\n");
+    
+    demo_traffic_light();
+    demo_sensor_monitor();
+    
+    return 0;
+}
@@ -5,6 +5,190 @@
 
 #define TEST_ITERATIONS 1000
 
+// Reference copy of the original pointer-per-set tag store, kept so the
+// flat layout in cache.c can be measured against it.
+typedef struct {
+    int line_size;
+    int associativity;
+    int num_sets;
+    uint64_t** tags;
+    bool** valid;
+    uint64_t* lru_counters;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t accesses;
+} LegacyCache;
+
+static LegacyCache* legacy_cache_create(int size, int line_size, int associativity) {
+    LegacyCache* cache = (LegacyCache*)calloc(1, sizeof(LegacyCache));
+    if (!cache) return NULL;
+
+    cache->line_size = line_size;
+    cache->associativity = associativity;
+    cache->num_sets = (size / line_size) / associativity;
+
+    cache->tags = (uint64_t**)malloc(cache->num_sets * sizeof(uint64_t*));
+    cache->valid = (bool**)malloc(cache->num_sets * sizeof(bool*));
+    for (int i = 0; i < cache->num_sets; i++) {
+        cache->tags[i] = (uint64_t*)calloc(associativity, sizeof(uint64_t));
+        cache->valid[i] = (bool*)calloc(associativity, sizeof(bool));
+    }
+    cache->lru_counters = (uint64_t*)calloc(cache->num_sets * associativity,
+                                            sizeof(uint64_t));
+    return cache;
+}
+
+static void legacy_cache_destroy(LegacyCache* cache) {
+    for (int i = 0; i < cache->num_sets; i++) {
+        free(cache->tags[i]);
+        free(cache->valid[i]);
+    }
+    free(cache->tags);
+    free(cache->valid);
+    free(cache->lru_counters);
+    free(cache);
+}
+
+static int legacy_cache_access(LegacyCache* cache, uint64_t addr) {
+    cache->accesses++;
+
+    uint64_t line_addr = addr / cache->line_size;
+    int set_index = line_addr % cache->num_sets;
+    uint64_t tag = line_addr / cache->num_sets;
+
+    for (int i = 0; i < cache->associativity; i++) {
+        if (cache->valid[set_index][i] && cache->tags[set_index][i] == tag) {
+            cache->hits++;
+            cache->lru_counters[set_index * cache->associativity + i] = cache->accesses;
+            return 1;
+        }
+    }
+
+    cache->misses++;
+
+    int victim = 0;
+    uint64_t min_lru = UINT64_MAX;
+    for (int i = 0; i < cache->associativity; i++) {
+        if (!cache->valid[set_index][i]) {
+            victim = i;
+            break;
+        }
+        uint64_t lru = cache->lru_counters[set_index * cache->associativity + i];
+        if (lru < min_lru) {
+            min_lru = lru;
+            victim = i;
+        }
+    }
+
+    cache->valid[set_index][victim] = true;
+    cache->tags[set_index][victim] = tag;
+    cache->lru_counters[set_index * cache->associativity + victim] = cache->accesses;
+    return 10;
+}
+
+// Replay the same address stream through both tag store layouts
+static void compare_cache_layouts(const CacheConfig* config, const char* name) {
+    const uint64_t n = TEST_ITERATIONS * 1000;
+    uint64_t* addrs = (uint64_t*)malloc(n * sizeof(uint64_t));
+    if (!addrs) return;
+
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (uint64_t i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        addrs[i] = x % ((uint64_t)config->size * 4);
+    }
+
+    LegacyCache* legacy = legacy_cache_create(config->size, config->line_size,
+                                              config->associativity);
+    Cache* cache = cache_create(config->type, config->size, config->line_size,
+                                config->associativity);
+
+    uint64_t start = get_time_us();
+    for (uint64_t i = 0; i < n; i++) {
+        legacy_cache_access(legacy, addrs[i]);
+    }
+    uint64_t legacy_us = get_time_us() - start;
+
+    start = get_time_us();
+    for (uint64_t i = 0; i < n; i++) {
+        cache_access(cache, addrs[i], false);
+    }
+    uint64_t flat_us = get_time_us() - start;
+
+    printf("%-15s %-12.2f %-12.2f %-9.2f %s\n",
+           name,
+           legacy_us / 1000.0,
+           flat_us / 1000.0,
+           flat_us > 0 ? (double)legacy_us / flat_us : 0.0,
+           legacy->hits == cache->hits ? "match" : "MISMATCH");
+
+    legacy_cache_destroy(legacy);
+    cache_destroy(cache);
+    free(addrs);
+}
+
+// Per-call versus batched replay, single level and L1->L2
+static void compare_batch_replay(void) {
+    const size_t n = TEST_ITERATIONS * 1000;
+    uint64_t* addrs = (uint64_t*)malloc(n * sizeof(uint64_t));
+    if (!addrs) return;
+
+    uint64_t x = 0x2545F4914F6CDD1DULL;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        addrs[i] = x % (64 * MiB);
+    }
+
+    Cache* a = cache_create(CACHE_SET_ASSOC, 8 * MiB, 64, 16);
+    Cache* b = cache_create(CACHE_SET_ASSOC, 8 * MiB, 64, 16);
+
+    uint64_t start = get_time_us();
+    for (size_t i = 0; i < n; i++) {
+        cache_access(a, addrs[i], false);
+    }
+    uint64_t call_us = get_time_us() - start;
+
+    start = get_time_us();
+    cache_access_batch(b, addrs, NULL, n, NULL);
+    uint64_t batch_us = get_time_us() - start;
+
+    printf("%-15s %-12.2f %-12.2f %-9.2f %s\n", "8MB 16-way",
+           call_us / 1000.0, batch_us / 1000.0,
+           batch_us > 0 ? (double)call_us / batch_us : 0.0,
+           a->hits == b->hits ? "match" : "MISMATCH");
+
+    cache_destroy(a);
+    cache_destroy(b);
+
+    Cache* l1 = cache_create(CACHE_SET_ASSOC, 32 * KiB, 64, 8);
+    Cache* l2 = cache_create(CACHE_SET_ASSOC, 8 * MiB, 64, 16);
+    Cache* r1 = cache_create(CACHE_SET_ASSOC, 32 * KiB, 64, 8);
+    Cache* r2 = cache_create(CACHE_SET_ASSOC, 8 * MiB, 64, 16);
+
+    start = get_time_us();
+    for (size_t i = 0; i < n; i++) {
+        if (cache_access(r1, addrs[i], false) != r1->hit_time) {
+            cache_access(r2, addrs[i], false);
+        }
+    }
+    call_us = get_time_us() - start;
+
+    start = get_time_us();
+    cache_hierarchy_batch(l1, l2, addrs, NULL, n, NULL);
+    batch_us = get_time_us() - start;
+
+    printf("%-15s %-12.2f %-12.2f %-9.2f %s\n", "L1->L2",
+           call_us / 1000.0, batch_us / 1000.0,
+           batch_us > 0 ? (double)call_us / batch_us : 0.0,
+           r2->hits == l2->hits ? "match" : "MISMATCH");
+
+    cache_destroy(l1);
+    cache_destroy(l2);
+    cache_destroy(r1);
+    cache_destroy(r2);
+    free(addrs);
+}
+
 void performance_test_cpu() {
     printf("\n=== CPU Performance Test ===\n");
     
@@ -40,11 +224,11 @@ void performance_test_cpu() {
         }
     }
     
-    // Random access
+    // Random access, seeded from the cache geometry so runs are repeatable
     void rand_access(Cache* cache, uint64_t iterations) {
-        srand(time(NULL));
+        uint64_t state = rng_stream_seed(0x5EC7E, (uint64_t)cache->size * cache->associativity);
         for (uint64_t i = 0; i < iterations; i++) {
-            uint64_t addr = rand() % (cache->size * 16);  // Large address space
+            uint64_t addr = splitmix64(&state) % (cache->size * 16);  // Large address space
             cache_access(cache, addr, false);
         }
     }
@@ -95,41 +279,118 @@ void performance_test_cpu() {
         }
         printf("\n");
     }
+
+    printf("\nTag Store Layout (per-set arrays vs flat):\n");
+    printf("%-15s %-12s %-12s %-9s %s\n",
+           "Config", "Legacy(ms)", "Flat(ms)", "Speedup", "Hits");
+    printf("------------------------------------------------------------\n");
+    for (int c = 0; c < 5; c++) {
+        compare_cache_layouts(&configs[c], config_names[c]);
+    }
+
+    printf("\nTrace Replay (per-call vs cache_access_batch):\n");
+    printf("%-15s %-12s %-12s %-9s %s\n",
+           "Config", "Call(ms)", "Batch(ms)", "Speedup", "Hits");
+    printf("------------------------------------------------------------\n");
+    compare_batch_replay();
+}
+
+void performance_test_sweep() {
+    printf("\n=== Design Space Sweep ===\n");
+
+    CacheConfig configs[] = {
+        {CACHE_DIRECT_MAPPED, 4 * KiB, 64, 1},
+        {CACHE_DIRECT_MAPPED, 8 * KiB, 64, 1},
+        {CACHE_SET_ASSOC, 8 * KiB, 64, 4},
+        {CACHE_SET_ASSOC, 16 * KiB, 64, 8},
+        {CACHE_SET_ASSOC, 32 * KiB, 64, 16},
+        {CACHE_FULL_ASSOC, 32 * KiB, 64, 512},
+    };
+    AccessPattern patterns[] = {
+        PATTERN_SEQUENTIAL, PATTERN_RANDOM, PATTERN_STRIDED
+    };
+    PredictorType predictors[] = {
+        PREDICTOR_ALWAYS_TAKEN, PREDICTOR_ALWAYS_NOT_TAKEN,
+        PREDICTOR_BIMODAL, PREDICTOR_GSHARE,
+        PREDICTOR_TAGE, PREDICTOR_PERCEPTRON
+    };
+
+    // Synthetic branch trace: loop back-edges with a data-dependent branch
+    size_t branch_count = TEST_ITERATIONS * 100;
+    BranchRecord* branches = (BranchRecord*)malloc(branch_count * sizeof(BranchRecord));
+    if (!branches) return;
+    uint64_t state = 42;
+    for (size_t i = 0; i < branch_count; i++) {
+        bool back_edge = (i % 2) == 0;
+        branches[i].pc = back_edge ? 0x1000 + (i % 64) * 16 : 0x4000 + (i % 16) * 8;
+        branches[i].taken = back_edge ? (i % 32) != 0 : (splitmix64(&state) & 3) != 0;
+        branches[i].target = branches[i].pc - 64;
+        branches[i].kind = BRANCH_CONDITIONAL;
+        branches[i].size = 8;
+    }
+
+    SweepTrace trace = { .branches = branches, .branch_count = branch_count };
+    Sweep* sweep = sweep_create(&trace, 0x5EC7E);
+    if (!sweep) {
+        free(branches);
+        return;
+    }
+
+    sweep_add_cache_matrix(sweep, configs, ARRAY_SIZE(configs),
+                           patterns, ARRAY_SIZE(patterns), TEST_ITERATIONS * 100);
+    for (size_t p = 0; p < ARRAY_SIZE(predictors); p++) {
+        // Global-history predictors get a longer history to work with
+        int history = predictors[p] >= PREDICTOR_TAGE ? 64 : 12;
+        sweep_add_predictor(sweep, predictors[p], history, 4096);
+    }
+
+    sweep_run(sweep, 0);
+    sweep_print(sweep);
+    sweep_write_csv(sweep, "sweep_results.csv");
+    sweep_write_json(sweep, "sweep_results.json");
+    printf("Wrote sweep_results.csv and sweep_results.json\n");
+
+    sweep_destroy(sweep);
+    free(branches);
 }
 
 void performance_test_scheduler() {
     printf("\n=== Scheduler Performance Test ===\n");
     
-    // Test with increasing number of processes
-    for (int num_procs = 10; num_procs <= 100; num_procs += 10) {
-        Scheduler sched;
-        scheduler_init(&sched);
+    // Test with increasing number of processes, up to MAX_PROCESSES
+    for (int num_procs = 16; num_procs <= MAX_PROCESSES; num_procs *= 16) {
+        Scheduler* sched = (Scheduler*)malloc(sizeof(Scheduler));
+        if (!sched) return;
+        scheduler_init(sched);
         
         // Create processes with different priorities
         for (int i = 0; i < num_procs; i++) {
-            PCB* pcb = pcb_create(sched.next_pid++, NULL);
+            PCB* pcb = pcb_create(sched->next_pid++, NULL);
             pcb->priority = i % 5;  // Mix of priorities
             pcb->quantum = 10 + (i % 20);
-            scheduler_add_process(&sched, pcb);
+            scheduler_add_process(sched, pcb);
         }
         
         clock_t start = clock();
         
         // Run scheduler for fixed number of ticks
-        for (int tick = 0; tick < 1000; tick++) {
-            scheduler_tick(&sched);
+        const int ticks = 1000000;
+        for (int tick = 0; tick < ticks; tick++) {
+            scheduler_tick(sched);
         }
         
         clock_t end = clock();
         double time_ms = ((double)(end - start) / CLOCKS_PER_SEC) * 1000;
         
-        printf("Processes: %3d, Time: %6.2f ms, Avg time per context switch: %.3f ms\n",
-               num_procs, time_ms, time_ms / 1000);
+        printf("Processes: %5d, Time: %6.2f ms, Avg time per tick: %.1f ns\n",
+               num_procs, time_ms, time_ms * 1e6 / ticks);
         
         // Cleanup
-        for (int i = 0; i < sched.process_count; i++) {
-            pcb_destroy(sched.processes[i]);
+        for (int i = 0; i < sched->process_count; i++) {
+            pcb_destroy(sched->processes[i]);
         }
+        scheduler_destroy(sched);
+        free(sched);
     }
 }
 
@@ -148,12 +409,12 @@ void performance_test_memory() {
     clock_t end = clock();
     double alloc_time = ((double)(end - start) / CLOCKS_PER_SEC) * 1000;
     
-    // Test translation speed
+    // Test translation speed, walking the mapped pages a cache line at a time
     start = clock();
     
     uint64_t total_translations = 0;
     for (int i = 0; i < 100000; i++) {
-        mm_translate_address(mm, 0, i * PAGE_SIZE);
+        mm_translate_address(mm, 0, (uint64_t)i * CACHE_LINE_SIZE);
         total_translations++;
     }
     
@@ -177,6 +438,7 @@ int main() {
     printf("=== Performance Test Suite ===\n");
     
     performance_test_cpu();
+    performance_test_sweep();
     performance_test_scheduler();
     performance_test_memory();
     
@@ -4,15 +4,25 @@ typedef struct {
     RTOS* rtos;
     uint32_t update_interval;
     bool display_raw;
+    
+    // Fed by sensor_task, reported by threshold_check_task
+    SensorStream* temperature;
+    SensorStream* humidity;
 } SensorMonitor;
 
 void sensor_task(void* arg) {
     SensorMonitor* monitor = (SensorMonitor*)arg;
+    float temperature[MAX_SENSORS];
+    float humidity[MAX_SENSORS];
     
     // Update all sensors
     for (int i = 0; i < MAX_SENSORS; i++) {
         sensor_update(&monitor->rtos->sensors[i]);
+        temperature[i] = monitor->rtos->sensors[i].temperature;
+        humidity[i] = monitor->rtos->sensors[i].humidity;
     }
+    sensor_stream_push(monitor->temperature, temperature);
+    sensor_stream_push(monitor->humidity, humidity);
     
     // Display readings
     if (monitor->display_raw) {
@@ -27,30 +37,33 @@ void sensor_task(void* arg) {
     }
 }
 
+// Reports threshold crossings since the last check, so an excursion
+// between two checks is not missed, with the last window's range
 void threshold_check_task(void* arg) {
     SensorMonitor* monitor = (SensorMonitor*)arg;
+    SensorStream* t = monitor->temperature;
+    SensorStream* h = monitor->humidity;
     
-    // Check temperature thresholds
     for (int i = 0; i < MAX_SENSORS; i++) {
-        VirtualSensor* s = &monitor->rtos->sensors[i];
-        
-        if (s->temperature > 30.0) {
-            printf("[ALERT] Sensor %d temperature high: %.1f°C\n", 
-                   i, s->temperature);
-        }
-        
-        if (s->temperature < 10.0) {
-            printf("[ALERT] Sensor %d temperature low: %.1f°C\n", 
-                   i, s->temperature);
+        if (t->crossings[i] > 0) {
+            printf("[ALERT] Sensor %d temperature left %.0f..%.0f°C %u time(s), window %.1f..%.1f°C (mean %.1f)\n",
+                   i, t->low, t->high, t->crossings[i],
+                   t->window_min[i], t->window_max[i], t->window_mean[i]);
+            t->crossings[i] = 0;
         }
         
-        if (s->humidity > 80.0) {
-            printf("[WARNING] Sensor %d humidity high: %.1f%%\n", 
-                   i, s->humidity);
+        if (h->crossings[i] > 0) {
+            printf("[WARNING] Sensor %d humidity high %u time(s), window max %.1f%%\n",
+                   i, h->crossings[i], h->window_max[i]);
+            h->crossings[i] = 0;
         }
     }
 }
 
+static void system_check_callback(void) {
+    printf("[SYSTEM] Periodic check at %lu ms\n", get_time_ms());
+}
+
 void demo_sensor_monitor() {
     printf("\n=== Sensor Monitoring System ===\n");
     
@@ -58,7 +71,10 @@ void demo_sensor_monitor() {
     SensorMonitor monitor = {
         .rtos = rtos,
         .update_interval = 1000,  // 1 second
-        .display_raw = true
+        .display_raw = true,
+        // One window per threshold check
+        .temperature = sensor_stream_create(MAX_SENSORS, 5, 10.0, 30.0),
+        .humidity = sensor_stream_create(MAX_SENSORS, 5, 0.0, 80.0)
     };
     
     // Create sensor monitoring tasks
@@ -69,26 +85,22 @@ void demo_sensor_monitor() {
                     PRIO_LOW, monitor.update_interval * 5, 10);
     
     // Create a timer for periodic system check
-    timer_set_callback(&rtos->timers[0], []() {
-        printf("[SYSTEM] Periodic check at %lu ms\n", get_time_ms());
-    });
+    timer_set_callback(&rtos->timers[0], system_check_callback);
     timer_start(&rtos->timers[0], 10000);  // Every 10 seconds
     
     printf("Starting sensor monitor for 60 seconds...\n");
     
     uint64_t start = get_time_ms();
     while (get_time_ms() - start < 60000) {
+        // Also advances the timer wheel
         rtos_schedule(rtos);
         
-        // Update timers
-        for (int i = 0; i < MAX_TIMERS; i++) {
-            timer_tick(&rtos->timers[i]);
-        }
-        
         struct timespec ts = {0, 1000000};  // 1ms
         nanosleep(&ts, NULL);
     }
     
     rtos_print_stats(rtos);
+    sensor_stream_destroy(monitor.temperature);
+    sensor_stream_destroy(monitor.humidity);
     rtos_destroy(rtos);
 }
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "common.h"
+
+const uint8_t gmem_zero_page[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+GuestMemory* gmem_create(uint64_t size) {
+    GuestMemory* mem = (GuestMemory*)calloc(1, sizeof(GuestMemory));
+    if (!mem) return NULL;
+
+    mem->size = size;
+    mem->table_count = (size + ((uint64_t)PAGE_SIZE << GMEM_TABLE_BITS) - 1) >>
+                       (PAGE_SHIFT + GMEM_TABLE_BITS);
+    mem->tables = (uint8_t***)calloc(mem->table_count ? mem->table_count : 1, sizeof(uint8_t**));
+    mem->shared = (uint64_t**)calloc(mem->table_count ? mem->table_count : 1, sizeof(uint64_t*));
+    if (!mem->tables || !mem->shared) {
+        free(mem->tables);
+        free(mem->shared);
+        free(mem);
+        return NULL;
+    }
+    return mem;
+}
+
+static bool is_shared(const GuestMemory* mem, uint64_t addr) {
+    const uint64_t* bits = mem->shared[addr >> (PAGE_SHIFT + GMEM_TABLE_BITS)];
+    uint64_t page = (addr >> PAGE_SHIFT) & (GMEM_TABLE_PAGES - 1);
+    return bits && (bits[page / 64] & (1ULL << (page % 64)));
+}
+
+void gmem_destroy(GuestMemory* mem) {
+    if (mem) {
+        for (uint64_t t = 0; t < mem->table_count; t++) {
+            if (!mem->tables[t]) continue;
+            for (uint32_t p = 0; p < GMEM_TABLE_PAGES; p++) {
+                if (!is_shared(mem, ((t << GMEM_TABLE_BITS) + p) * PAGE_SIZE)) {
+                    free(mem->tables[t][p]);
+                }
+            }
+            free(mem->tables[t]);
+            free(mem->shared[t]);
+        }
+        free(mem->tables);
+        free(mem->shared);
+        free(mem);
+    }
+}
+
+// Install a zeroed page for addr. Racing writers each allocate and one
+// compare-and-swap wins; the losers free theirs and use the winner's.
+uint8_t* gmem_populate(GuestMemory* mem, uint64_t addr) {
+    uint8_t*** slot = &mem->tables[addr >> (PAGE_SHIFT + GMEM_TABLE_BITS)];
+    uint8_t** table = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (!table) {
+        uint8_t** fresh = (uint8_t**)calloc(GMEM_TABLE_PAGES, sizeof(uint8_t*));
+        if (!fresh) return NULL;
+        if (__atomic_compare_exchange_n(slot, &table, fresh, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            table = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+
+    uint8_t** entry = &table[(addr >> PAGE_SHIFT) & (GMEM_TABLE_PAGES - 1)];
+    uint8_t* page = __atomic_load_n(entry, __ATOMIC_ACQUIRE);
+    if (page) return page;
+
+    uint8_t* fresh = (uint8_t*)aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+    if (!fresh) {
+        ERROR("Out of host memory for guest page 0x%lx\n", addr & ~(uint64_t)(PAGE_SIZE - 1));
+        return NULL;
+    }
+    memset(fresh, 0, PAGE_SIZE);
+    if (__atomic_compare_exchange_n(entry, &page, fresh, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        __atomic_fetch_add(&mem->resident_pages, 1, __ATOMIC_RELAXED);
+        return fresh;
+    }
+    free(fresh);
+    return page;
+}
+
+// Bytes past the end of guest memory read as zero
+void gmem_read(const GuestMemory* mem, uint64_t addr, void* buf, size_t len) {
+    uint8_t* out = (uint8_t*)buf;
+    while (len > 0) {
+        size_t chunk = MIN(len, PAGE_SIZE - (addr & (PAGE_SIZE - 1)));
+        if (addr < mem->size) {
+            size_t valid = MIN(chunk, mem->size - addr);
+            memcpy(out, gmem_page(mem, addr) + (addr & (PAGE_SIZE - 1)), valid);
+            memset(out + valid, 0, chunk - valid);
+        } else {
+            memset(out, 0, chunk);
+        }
+        out += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+}
+
+// Writes past the end of guest memory are dropped
+void gmem_write(GuestMemory* mem, uint64_t addr, const void* buf, size_t len) {
+    const uint8_t* in = (const uint8_t*)buf;
+    while (len > 0 && addr < mem->size) {
+        size_t chunk = MIN(MIN(len, PAGE_SIZE - (addr & (PAGE_SIZE - 1))), mem->size - addr);
+        uint8_t* page = gmem_page_mut(mem, addr);
+        if (!page) return;
+        memcpy(page + (addr & (PAGE_SIZE - 1)), in, chunk);
+        in += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+}
+
+// Return whole pages inside [addr, addr + len) to the zero page. Not safe
+// against concurrent access to those pages.
+void gmem_discard(GuestMemory* mem, uint64_t addr, uint64_t len) {
+    uint64_t end = MIN(addr + len, mem->size);
+    for (uint64_t page = ALIGN_UP(addr, PAGE_SIZE); page + PAGE_SIZE <= end; page += PAGE_SIZE) {
+        uint8_t** table = mem->tables[page >> (PAGE_SHIFT + GMEM_TABLE_BITS)];
+        if (!table) {
+            // Skip the rest of an untouched table
+            page = ALIGN_DOWN(page, (uint64_t)PAGE_SIZE << GMEM_TABLE_BITS) +
+                   ((uint64_t)PAGE_SIZE << GMEM_TABLE_BITS) - PAGE_SIZE;
+            continue;
+        }
+        uint8_t** entry = &table[(page >> PAGE_SHIFT) & (GMEM_TABLE_PAGES - 1)];
+        if (!*entry) continue;
+        if (is_shared(mem, page)) {
+            // Lent by gmem_share: just hand it back
+            uint64_t index = (page >> PAGE_SHIFT) & (GMEM_TABLE_PAGES - 1);
+            mem->shared[page >> (PAGE_SHIFT + GMEM_TABLE_BITS)][index / 64] &= ~(1ULL << (index % 64));
+            mem->shared_pages--;
+        } else {
+            free(*entry);
+            mem->resident_pages--;
+        }
+        *entry = NULL;
+    }
+}
+
+// Back the page at addr with page, a page-aligned PAGE_SIZE buffer the
+// caller still owns, e.g. a file chunk: accesses go straight to it until
+// gmem_discard returns it. Any page addr had is freed. Not safe against
+// concurrent access to that page.
+int gmem_share(GuestMemory* mem, uint64_t addr, uint8_t* page) {
+    if (addr >= mem->size || ((uintptr_t)page & (PAGE_SIZE - 1))) return -1;
+
+    uint64_t dir = addr >> (PAGE_SHIFT + GMEM_TABLE_BITS);
+    uint64_t index = (addr >> PAGE_SHIFT) & (GMEM_TABLE_PAGES - 1);
+    if (!mem->tables[dir]) {
+        mem->tables[dir] = (uint8_t**)calloc(GMEM_TABLE_PAGES, sizeof(uint8_t*));
+        if (!mem->tables[dir]) return -1;
+    }
+    if (!mem->shared[dir]) {
+        mem->shared[dir] = (uint64_t*)calloc(GMEM_TABLE_PAGES / 64, sizeof(uint64_t));
+        if (!mem->shared[dir]) return -1;
+    }
+
+    uint8_t** entry = &mem->tables[dir][index];
+    if (is_shared(mem, addr)) {
+        mem->shared_pages--;
+    } else if (*entry) {
+        free(*entry);
+        mem->resident_pages--;
+    }
+    __atomic_store_n(entry, page, __ATOMIC_RELEASE);
+    mem->shared[dir][index / 64] |= 1ULL << (index % 64);
+    mem->shared_pages++;
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include "common.h"
+
+// Each worker owns a contiguous slice of the index space. Owners take from
+// the front of their slice; an idle worker steals the back half of the
+// largest remaining slice. Slices only ever shrink or split, so the loop is
+// done once every slice is empty.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t lo;
+    size_t hi;
+} WorkRange;
+
+typedef struct {
+    WorkRange* ranges;
+    int workers;
+    ParallelFn fn;
+    void* ctx;
+} WorkPool;
+
+typedef struct {
+    WorkPool* pool;
+    int id;
+} WorkerArg;
+
+int parallel_default_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static bool pool_take(WorkRange* range, size_t* index) {
+    bool found = false;
+    pthread_mutex_lock(&range->lock);
+    if (range->lo < range->hi) {
+        *index = range->lo;
+        __atomic_store_n(&range->lo, range->lo + 1, __ATOMIC_RELAXED);
+        found = true;
+    }
+    pthread_mutex_unlock(&range->lock);
+    return found;
+}
+
+static bool pool_steal(WorkPool* pool, int self) {
+    // Pick the victim with the most work left. The sizes are read without
+    // the lock, so every write to lo/hi is atomic too; the split itself is
+    // done under the victim's lock
+    int victim = -1;
+    size_t most = 0;
+    for (int i = 0; i < pool->workers; i++) {
+        if (i == self) continue;
+        size_t lo = __atomic_load_n(&pool->ranges[i].lo, __ATOMIC_RELAXED);
+        size_t hi = __atomic_load_n(&pool->ranges[i].hi, __ATOMIC_RELAXED);
+        size_t left = hi > lo ? hi - lo : 0;
+        if (left > most) {
+            most = left;
+            victim = i;
+        }
+    }
+    // A slice with one job left cannot be split; its owner is already on it
+    if (victim < 0 || most < 2) return false;
+
+    WorkRange* from = &pool->ranges[victim];
+    size_t lo = 0, hi = 0;
+    pthread_mutex_lock(&from->lock);
+    if (from->lo < from->hi) {
+        size_t mid = from->lo + (from->hi - from->lo) / 2;
+        lo = mid;
+        hi = from->hi;
+        __atomic_store_n(&from->hi, mid, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&from->lock);
+
+    // Lost a race with the owner; look again
+    if (lo >= hi) return true;
+
+    WorkRange* to = &pool->ranges[self];
+    pthread_mutex_lock(&to->lock);
+    __atomic_store_n(&to->lo, lo, __ATOMIC_RELAXED);
+    __atomic_store_n(&to->hi, hi, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&to->lock);
+    return true;
+}
+
+static void* pool_worker(void* arg) {
+    WorkerArg* w = (WorkerArg*)arg;
+    WorkPool* pool = w->pool;
+    size_t index;
+
+    for (;;) {
+        while (pool_take(&pool->ranges[w->id], &index)) {
+            pool->fn(pool->ctx, index, w->id);
+        }
+        if (!pool_steal(pool, w->id)) break;
+    }
+    return NULL;
+}
+
+int parallel_for(size_t count, int threads, ParallelFn fn, void* ctx) {
+    if (!fn) return -1;
+    if (count == 0) return 0;
+
+    if (threads <= 0) threads = parallel_default_threads();
+    if ((size_t)threads > count) threads = (int)count;
+
+    if (threads == 1) {
+        for (size_t i = 0; i < count; i++) fn(ctx, i, 0);
+        return 0;
+    }
+
+    WorkPool pool = { .workers = threads, .fn = fn, .ctx = ctx };
+    pool.ranges = (WorkRange*)calloc(threads, sizeof(WorkRange));
+    pthread_t* tids = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    WorkerArg* args = (WorkerArg*)calloc(threads, sizeof(WorkerArg));
+    if (!pool.ranges || !tids || !args) {
+        free(pool.ranges);
+        free(tids);
+        free(args);
+        return -1;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&pool.ranges[i].lock, NULL);
+        pool.ranges[i].lo = count * i / threads;
+        pool.ranges[i].hi = count * (i + 1) / threads;
+        args[i].pool = &pool;
+        args[i].id = i;
+    }
+
+    // Worker 0 runs on the calling thread
+    int started = 1;
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&tids[i], NULL, pool_worker, &args[i]) != 0) break;
+        started++;
+    }
+    pool_worker(&args[0]);
+
+    for (int i = 1; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    // Slices of workers that failed to start are only partly stolen (the
+    // last job of a slice never is); drain what is left here
+    for (int i = started; i < threads; i++) {
+        size_t index;
+        while (pool_take(&pool.ranges[i], &index)) fn(ctx, index, 0);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&pool.ranges[i].lock);
+    }
+    free(pool.ranges);
+    free(tids);
+    free(args);
+    return 0;
+}
@@ -0,0 +1,384 @@
+#define _GNU_SOURCE     // dl_iterate_phdr
+#include "snapshot.h"
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_RELATIVE (1ULL << 63)  // set on no user-space address
+
+_Static_assert(sizeof(void*) == sizeof(uint64_t), "pointer fields are re-encoded as uint64_t");
+
+// FNV-1a over the executable's GNU build id; 0 when it was linked without one
+static int hash_build_id(struct dl_phdr_info* info, size_t size, void* data) {
+    (void)size;
+    uint64_t* hash = (uint64_t*)data;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_NOTE) continue;
+
+        const uint8_t* p = (const uint8_t*)(info->dlpi_addr + ph->p_vaddr);
+        const uint8_t* end = p + ph->p_memsz;
+        while (p + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr)* note = (const ElfW(Nhdr)*)p;
+            const uint8_t* desc = p + sizeof(ElfW(Nhdr)) + ALIGN_UP(note->n_namesz, 4);
+            if (note->n_type == NT_GNU_BUILD_ID && desc + note->n_descsz <= end) {
+                *hash = 0xCBF29CE484222325ULL;
+                for (uint32_t b = 0; b < note->n_descsz; b++) {
+                    *hash = (*hash ^ desc[b]) * 0x100000001B3ULL;
+                }
+                return 1;
+            }
+            p = desc + ALIGN_UP(note->n_descsz, 4);
+        }
+    }
+    return 1;   // the executable comes first; shared objects do not matter
+}
+
+static uint64_t build_id(void) {
+    uint64_t hash = 0;
+    dl_iterate_phdr(hash_build_id, &hash);
+    return hash;
+}
+
+// ---- Writer ----
+
+SnapshotWriter* snapshot_create(const char* path) {
+    SnapshotWriter* writer = (SnapshotWriter*)calloc(1, sizeof(SnapshotWriter));
+    if (!writer) return NULL;
+
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        ERROR("Cannot create %s: %s\n", path, strerror(errno));
+        free(writer);
+        return NULL;
+    }
+
+    // Rewritten by snapshot_finish once the table is placed
+    SnapshotHeader header = {0};
+    snapshot_write(writer, &header, sizeof(header));
+    return writer;
+}
+
+void snapshot_write(SnapshotWriter* writer, const void* data, size_t size) {
+    if (writer->failed || size == 0) return;
+    if (fwrite(data, 1, size, writer->file) != size) {
+        ERROR("Snapshot write failed: %s\n", strerror(errno));
+        writer->failed = true;
+        return;
+    }
+    writer->bytes += size;
+}
+
+static void pad_to(SnapshotWriter* writer, uint64_t align) {
+    snapshot_write(writer, gmem_zero_page, ALIGN_UP(writer->bytes, align) - writer->bytes);
+}
+
+// Pad to a page boundary; the reader's snapshot_pages skips the same
+void snapshot_align(SnapshotWriter* writer) {
+    pad_to(writer, PAGE_SIZE);
+}
+
+static void end_section(SnapshotWriter* writer) {
+    if (writer->section_count > 0) {
+        SnapshotSection* section = &writer->sections[writer->section_count - 1];
+        section->size = writer->bytes - section->offset;
+    }
+}
+
+// Everything written from here to the next snapshot_begin is one section
+void snapshot_begin(SnapshotWriter* writer, SnapshotTag tag) {
+    end_section(writer);
+    pad_to(writer, sizeof(uint64_t));
+
+    if (writer->section_count == writer->section_slots) {
+        uint32_t slots = MAX(2 * writer->section_slots, 8);
+        SnapshotSection* sections = (SnapshotSection*)realloc(writer->sections,
+                                                              slots * sizeof(SnapshotSection));
+        if (!sections) {
+            writer->failed = true;
+            return;
+        }
+        writer->sections = sections;
+        writer->section_slots = slots;
+    }
+
+    SnapshotSection* section = &writer->sections[writer->section_count++];
+    section->tag = tag;
+    section->reserved = 0;
+    section->offset = writer->bytes;
+    section->size = 0;
+}
+
+// Writes the table and header, and frees the writer
+int snapshot_finish(SnapshotWriter* writer) {
+    if (!writer) return -1;
+
+    end_section(writer);
+    pad_to(writer, sizeof(uint64_t));
+    SnapshotHeader header = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .page_size = PAGE_SIZE,
+        .build = build_id(),
+        .table_offset = writer->bytes,
+        .section_count = writer->section_count,
+    };
+    snapshot_write(writer, writer->sections, writer->section_count * sizeof(SnapshotSection));
+    if (!writer->failed &&
+        (fseek(writer->file, 0, SEEK_SET) != 0 ||
+         fwrite(&header, sizeof(SnapshotHeader), 1, writer->file) != 1)) {
+        ERROR("Snapshot write failed: %s\n", strerror(errno));
+        writer->failed = true;
+    }
+    if (fclose(writer->file) != 0) writer->failed = true;
+
+    int result = writer->failed ? -1 : 0;
+    free(writer->sections);
+    free(writer);
+    return result;
+}
+
+// ---- Reader ----
+
+Snapshot* snapshot_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        ERROR("Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        ERROR("%s is not a snapshot\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    // Private and writable: a restored page is copied on its first write
+    // and the file never changes
+    void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        ERROR("Cannot map %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    Snapshot* snapshot = (Snapshot*)calloc(1, sizeof(Snapshot));
+    if (!snapshot) {
+        munmap(map, st.st_size);
+        close(fd);
+        return NULL;
+    }
+    snapshot->map = (uint8_t*)map;
+    snapshot->map_size = st.st_size;
+    snapshot->fd = fd;      // kept for the mappings of later restores
+    memcpy(&snapshot->header, map, sizeof(SnapshotHeader));
+
+    const SnapshotHeader* h = &snapshot->header;
+    if (h->magic != SNAPSHOT_MAGIC || h->version != SNAPSHOT_VERSION ||
+        h->page_size != PAGE_SIZE || h->table_offset > snapshot->map_size ||
+        h->section_count > (snapshot->map_size - h->table_offset) / sizeof(SnapshotSection)) {
+        ERROR("%s: bad snapshot header\n", path);
+        snapshot_close(snapshot);
+        return NULL;
+    }
+    if (h->build != build_id()) {
+        ERROR("%s was written by another build\n", path);
+        snapshot_close(snapshot);
+        return NULL;
+    }
+
+    snapshot->sections = (SnapshotSection*)malloc((h->section_count + 1) * sizeof(SnapshotSection));
+    if (!snapshot->sections) {
+        snapshot_close(snapshot);
+        return NULL;
+    }
+    memcpy(snapshot->sections, snapshot->map + h->table_offset,
+           h->section_count * sizeof(SnapshotSection));
+
+    for (uint32_t i = 0; i < h->section_count; i++) {
+        const SnapshotSection* s = &snapshot->sections[i];
+        if (s->offset > h->table_offset || s->size > h->table_offset - s->offset) {
+            ERROR("%s: bad snapshot section %u\n", path, i);
+            snapshot_close(snapshot);
+            return NULL;
+        }
+    }
+
+    return snapshot;
+}
+
+void snapshot_close(Snapshot* snapshot) {
+    if (snapshot) {
+        for (uint32_t i = 0; i < snapshot->view_count; i++) {
+            munmap(snapshot->views[i], snapshot->map_size);
+        }
+        free(snapshot->views);
+        free(snapshot->sections);
+        munmap(snapshot->map, snapshot->map_size);
+        close(snapshot->fd);
+        free(snapshot);
+    }
+}
+
+// A private mapping no other restore has pages in. Views share the page
+// cache, so one costs address space until its pages are written.
+static uint8_t* snapshot_view(Snapshot* snapshot) {
+    if (!snapshot->map_lent) {
+        snapshot->map_lent = true;
+        return snapshot->map;
+    }
+
+    uint8_t** views = (uint8_t**)realloc(snapshot->views,
+                                         (snapshot->view_count + 1) * sizeof(uint8_t*));
+    if (!views) return NULL;
+    snapshot->views = views;
+    void* view = mmap(NULL, snapshot->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                      snapshot->fd, 0);
+    if (view == MAP_FAILED) {
+        ERROR("Cannot map snapshot: %s\n", strerror(errno));
+        return NULL;
+    }
+    views[snapshot->view_count++] = (uint8_t*)view;
+    return (uint8_t*)view;
+}
+
+// Cursor over the index-th section tagged tag, in the order written. Each
+// call is one restore and reads from a mapping of its own.
+int snapshot_find(Snapshot* snapshot, SnapshotTag tag, uint32_t index, SnapshotCursor* cursor) {
+    for (uint32_t i = 0; i < snapshot->header.section_count; i++) {
+        const SnapshotSection* s = &snapshot->sections[i];
+        if (s->tag == (uint32_t)tag && index-- == 0) {
+            cursor->base = snapshot_view(snapshot);
+            if (!cursor->base) return -1;
+            cursor->snapshot = snapshot;
+            cursor->offset = s->offset;
+            cursor->end = s->offset + s->size;
+            cursor->failed = false;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Copied out, since images sit at any offset
+bool snapshot_read(SnapshotCursor* cursor, void* out, size_t size) {
+    if (cursor->failed || size > cursor->end - cursor->offset) {
+        cursor->failed = true;
+        return false;
+    }
+    memcpy(out, cursor->base + cursor->offset, size);
+    cursor->offset += size;
+    return true;
+}
+
+// size bytes after the next page boundary, in place in the mapping
+uint8_t* snapshot_pages(SnapshotCursor* cursor, size_t size) {
+    uint64_t offset = ALIGN_UP(cursor->offset, PAGE_SIZE);
+    if (cursor->failed || offset > cursor->end || size > cursor->end - offset) {
+        cursor->failed = true;
+        return NULL;
+    }
+    cursor->offset = offset + size;
+    return cursor->base + offset;
+}
+
+// ---- Guest memory ----
+
+// Populated pages, owned or lent by gmem_share; addrs is filled when set
+static uint64_t populated_pages(const GuestMemory* mem, uint64_t* addrs) {
+    uint64_t count = 0;
+    for (uint64_t t = 0; t < mem->table_count; t++) {
+        if (!mem->tables[t]) continue;
+        for (uint32_t p = 0; p < GMEM_TABLE_PAGES; p++) {
+            if (!mem->tables[t][p]) continue;
+            if (addrs) addrs[count] = ((t << GMEM_TABLE_BITS) + p) * PAGE_SIZE;
+            count++;
+        }
+    }
+    return count;
+}
+
+void snapshot_write_memory(SnapshotWriter* writer, const GuestMemory* mem) {
+    uint64_t count = populated_pages(mem, NULL);
+    uint64_t* addrs = (uint64_t*)malloc(MAX(count, 1) * sizeof(uint64_t));
+    if (!addrs) {
+        writer->failed = true;
+        return;
+    }
+    populated_pages(mem, addrs);
+
+    snapshot_write(writer, &mem->size, sizeof(mem->size));
+    snapshot_write(writer, &count, sizeof(count));
+    snapshot_write(writer, addrs, count * sizeof(uint64_t));
+    snapshot_align(writer);
+    for (uint64_t i = 0; i < count; i++) {
+        snapshot_write(writer, gmem_page(mem, addrs[i]), PAGE_SIZE);
+    }
+    free(addrs);
+}
+
+// Every page is lent from the mapping, so restore costs a table entry per
+// page and nothing is read until it is touched
+GuestMemory* snapshot_read_memory(SnapshotCursor* cursor) {
+    uint64_t size, count;
+    if (!snapshot_read(cursor, &size, sizeof(size)) || !snapshot_read(cursor, &count, sizeof(count)) ||
+        count > (cursor->end - cursor->offset) / sizeof(uint64_t)) {
+        cursor->failed = true;
+        return NULL;
+    }
+
+    uint64_t* addrs = (uint64_t*)malloc(MAX(count, 1) * sizeof(uint64_t));
+    GuestMemory* mem = gmem_create(size);
+    uint8_t* pages = NULL;
+    if (addrs && mem && snapshot_read(cursor, addrs, count * sizeof(uint64_t))) {
+        pages = snapshot_pages(cursor, count * PAGE_SIZE);
+    }
+    for (uint64_t i = 0; pages && i < count; i++) {
+        if (gmem_share(mem, addrs[i], pages + i * PAGE_SIZE) != 0) pages = NULL;
+    }
+    free(addrs);
+
+    if (!pages) {
+        cursor->failed = true;
+        gmem_destroy(mem);
+        return NULL;
+    }
+    return mem;
+}
+
+// ---- Pointer fields ----
+
+void snapshot_save_pointer(void* field, const void* base, size_t size) {
+    uintptr_t p;
+    memcpy(&p, field, sizeof(p));
+    uint64_t value = p;
+    if (p >= (uintptr_t)base && p - (uintptr_t)base < size) {
+        value = (p - (uintptr_t)base) | SNAPSHOT_RELATIVE;
+    }
+    memcpy(field, &value, sizeof(value));
+}
+
+void snapshot_load_pointer(void* field, const void* base) {
+    uint64_t value;
+    memcpy(&value, field, sizeof(value));
+    uintptr_t p = (value & SNAPSHOT_RELATIVE) ? (uintptr_t)base + (value & ~SNAPSHOT_RELATIVE)
+                                              : (uintptr_t)value;
+    memcpy(field, &p, sizeof(p));
+}
+
+// Offsets from snapshot_create, so they hold wherever the binary was
+// loaded; 0 stays NULL, as no callback is snapshot_create itself
+void snapshot_save_code(void* field) {
+    uintptr_t fn;
+    memcpy(&fn, field, sizeof(fn));
+    uint64_t value = fn ? fn - (uintptr_t)&snapshot_create : 0;
+    memcpy(field, &value, sizeof(value));
+}
+
+void snapshot_load_code(void* field) {
+    uint64_t value;
+    memcpy(&value, field, sizeof(value));
+    uintptr_t fn = value ? (uintptr_t)&snapshot_create + value : 0;
+    memcpy(field, &fn, sizeof(fn));
+}
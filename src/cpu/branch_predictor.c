@@ -1,102 +1,507 @@
 #include "cpu.h"
 
+#define TAGE_MIN_HISTORY 4
+#define TAGE_CTR_MIN -4
+#define TAGE_CTR_MAX 3
+#define TAGE_AGING_PERIOD (1u << 18)    // updates between usefulness halvings
+#define LOOP_TAG_BITS 14
+#define LOOP_ALLOC_AGE 63
+#define PERCEPTRON_MAX_HISTORY 64
+
+static const char* predictor_names[] = {
+    "always_taken", "always_not_taken", "bimodal", "gshare", "tage", "perceptron"
+};
+
+static uint32_t round_pow2(int n) {
+    uint32_t size = 1;
+    while (size < (uint32_t)n) size <<= 1;
+    return size;
+}
+
+static int log2_u32(uint32_t n) {
+    int bits = 0;
+    while ((1u << bits) < n) bits++;
+    return bits;
+}
+
+static inline int sat(int value, int lo, int hi) {
+    return value < lo ? lo : value > hi ? hi : value;
+}
+
+static inline void counter_update(uint8_t* counter, bool taken) {
+    if (taken) {
+        if (*counter < 3) (*counter)++;
+    } else {
+        if (*counter > 0) (*counter)--;
+    }
+}
+
+static inline uint64_t history_bits(uint64_t history, int length) {
+    return length >= 64 ? history : history & ((1ULL << length) - 1);
+}
+
+// ---- TAGE ----
+
+// Everything one prediction looked at, so training reuses it
+typedef struct {
+    uint32_t index[TAGE_TABLES];
+    uint16_t tag[TAGE_TABLES];
+    int provider;               // -1 when only the base table matched
+    int alt;
+    bool provider_pred;
+    bool alt_pred;
+    bool weak;                  // provider counter is 0 or -1
+    bool tage_pred;
+    int loop;
+    bool loop_hit;
+    bool loop_valid;
+    bool loop_pred;
+    bool pred;
+} TageLookup;
+
+static inline TageEntry* tage_entry(TageState* t, int table, uint32_t index) {
+    return &t->entries[((size_t)table << t->table_bits) + index];
+}
+
+static void fold_init(FoldedHistory* f, int length, int width) {
+    f->comp = 0;
+    f->length = length;
+    f->width = width;
+    f->outpoint = length % width;
+}
+
+// Shift in the newest outcome and fold out the one leaving the window
+static inline void fold_update(FoldedHistory* f, uint32_t in, uint32_t out) {
+    f->comp = (f->comp << 1) | in;
+    f->comp ^= out << f->outpoint;
+    f->comp ^= f->comp >> f->width;
+    f->comp &= (1u << f->width) - 1;
+}
+
+static TageState* tage_create(int max_history, int pht_bits) {
+    TageState* t = (TageState*)calloc(1, sizeof(TageState));
+    if (!t) return NULL;
+
+    t->table_bits = MAX(pht_bits - 1, 6);
+    t->entries = (TageEntry*)calloc((size_t)TAGE_TABLES << t->table_bits, sizeof(TageEntry));
+    if (!t->entries) {
+        free(t);
+        return NULL;
+    }
+
+    // Geometric history lengths from TAGE_MIN_HISTORY up to max_history
+    max_history = sat(max_history, TAGE_MIN_HISTORY + TAGE_TABLES, TAGE_MAX_HISTORY - 1);
+    double ratio = pow((double)max_history / TAGE_MIN_HISTORY, 1.0 / (TAGE_TABLES - 1));
+    for (int i = 0; i < TAGE_TABLES; i++) {
+        int length = (int)(TAGE_MIN_HISTORY * pow(ratio, i) + 0.5);
+        if (i > 0 && length <= t->lengths[i - 1]) length = t->lengths[i - 1] + 1;
+        t->lengths[i] = MIN(length, max_history);
+        fold_init(&t->index_fold[i], t->lengths[i], t->table_bits);
+        fold_init(&t->tag_fold[0][i], t->lengths[i], TAGE_TAG_BITS);
+        fold_init(&t->tag_fold[1][i], t->lengths[i], TAGE_TAG_BITS - 1);
+    }
+
+    t->seed = 0x9E3779B97F4A7C15ULL;
+    return t;
+}
+
+static void tage_destroy(TageState* t) {
+    if (t) {
+        free(t->entries);
+        free(t);
+    }
+}
+
+static inline void tage_lookup(BranchPredictor* bp, uint64_t pc, TageLookup* l) {
+    TageState* t = bp->tage;
+    uint32_t mask = (1u << t->table_bits) - 1;
+    uint32_t p = (uint32_t)(pc ^ (pc >> 16));
+    uint32_t path = t->path ^ (t->path >> t->table_bits);
+
+    l->provider = -1;
+    l->alt = -1;
+    for (int i = 0; i < TAGE_TABLES; i++) {
+        l->index[i] = (p ^ (p >> (t->table_bits - i)) ^ t->index_fold[i].comp ^
+                       (path >> i)) & mask;
+        l->tag[i] = (p ^ t->tag_fold[0][i].comp ^ (t->tag_fold[1][i].comp << 1)) &
+                    ((1u << TAGE_TAG_BITS) - 1);
+    }
+    for (int i = TAGE_TABLES - 1; i >= 0; i--) {
+        if (tage_entry(t, i, l->index[i])->tag != l->tag[i]) continue;
+        if (l->provider < 0) {
+            l->provider = i;
+        } else {
+            l->alt = i;
+            break;
+        }
+    }
+
+    bool base = bp->pht[pc & bp->pht_mask] >= 2;
+    l->alt_pred = l->alt >= 0 ? tage_entry(t, l->alt, l->index[l->alt])->ctr >= 0 : base;
+    if (l->provider >= 0) {
+        int8_t ctr = tage_entry(t, l->provider, l->index[l->provider])->ctr;
+        l->provider_pred = ctr >= 0;
+        l->weak = ctr == 0 || ctr == -1;
+        l->tage_pred = l->weak && t->use_alt >= 0 ? l->alt_pred : l->provider_pred;
+    } else {
+        l->provider_pred = l->alt_pred;
+        l->weak = false;
+        l->tage_pred = l->alt_pred;
+    }
+
+    // Loop predictor: a run of `past` body outcomes, then the exit
+    l->loop = (int)((pc ^ (pc >> 6)) & (LOOP_ENTRIES - 1));
+    LoopEntry* e = &t->loops[l->loop];
+    l->loop_hit = e->age > 0 && e->tag == ((pc >> 6) & ((1u << LOOP_TAG_BITS) - 1));
+    l->loop_valid = l->loop_hit && e->confidence == 3;
+    l->loop_pred = e->current == e->past ? !e->dir : e->dir;
+
+    l->pred = l->loop_valid && t->loop_use >= 0 ? l->loop_pred : l->tage_pred;
+}
+
+static void loop_train(TageState* t, uint64_t pc, const TageLookup* l, bool taken) {
+    LoopEntry* e = &t->loops[l->loop];
+
+    if (!l->loop_hit) {
+        // Claim the slot for a branch TAGE keeps missing
+        if (l->tage_pred == taken) return;
+        if (e->age > 0) {
+            e->age--;
+            return;
+        }
+        e->tag = (pc >> 6) & ((1u << LOOP_TAG_BITS) - 1);
+        e->past = 0;
+        e->current = 0;
+        e->confidence = 0;
+        e->age = LOOP_ALLOC_AGE;
+        e->dir = !taken;
+        return;
+    }
+
+    if (l->loop_valid && l->loop_pred != l->tage_pred) {
+        t->loop_use = sat(t->loop_use + (l->loop_pred == taken ? 1 : -1), -8, 7);
+    }
+
+    if (taken == e->dir) {
+        if (e->current < UINT16_MAX) e->current++;
+        if (e->past && e->current > e->past) e->confidence = 0;
+        return;
+    }
+
+    // Exit: the same trip count again builds confidence
+    if (e->current == e->past) {
+        if (e->confidence < 3) e->confidence++;
+        if (e->age < UINT8_MAX) e->age++;
+    } else {
+        e->past = e->current;
+        e->confidence = 0;
+    }
+    e->current = 0;
+}
+
+static void tage_train(BranchPredictor* bp, uint64_t pc, const TageLookup* l, bool taken) {
+    TageState* t = bp->tage;
+    loop_train(t, pc, l, taken);
+
+    // On a miss, allocate one longer-history entry whose slot is not useful
+    if (l->tage_pred != taken && l->provider < TAGE_TABLES - 1) {
+        int start = l->provider + 1;
+        t->seed = t->seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        if (start < TAGE_TABLES - 1 && ((t->seed >> 33) & 1)) start++;
+
+        bool allocated = false;
+        for (int i = start; i < TAGE_TABLES && !allocated; i++) {
+            TageEntry* e = tage_entry(t, i, l->index[i]);
+            if (e->u == 0) {
+                e->tag = l->tag[i];
+                e->ctr = taken ? 0 : -1;
+                allocated = true;
+            }
+        }
+        if (!allocated) {
+            for (int i = start; i < TAGE_TABLES; i++) {
+                TageEntry* e = tage_entry(t, i, l->index[i]);
+                if (e->u > 0) e->u--;
+            }
+        }
+    }
+
+    if (l->provider >= 0) {
+        TageEntry* e = tage_entry(t, l->provider, l->index[l->provider]);
+        if (l->weak && l->provider_pred != l->alt_pred) {
+            t->use_alt = sat(t->use_alt + (l->alt_pred == taken ? 1 : -1), -8, 7);
+        }
+        if (l->provider_pred != l->alt_pred) {
+            e->u = sat(e->u + (l->provider_pred == taken ? 1 : -1), 0, 3);
+        }
+        e->ctr = sat(e->ctr + (taken ? 1 : -1), TAGE_CTR_MIN, TAGE_CTR_MAX);
+    } else {
+        counter_update(&bp->pht[pc & bp->pht_mask], taken);
+    }
+
+    if (++t->tick == TAGE_AGING_PERIOD) {
+        t->tick = 0;
+        size_t count = (size_t)TAGE_TABLES << t->table_bits;
+        for (size_t i = 0; i < count; i++) {
+            t->entries[i].u >>= 1;
+        }
+    }
+}
+
+static inline void tage_push_history(TageState* t, uint64_t pc, bool taken) {
+    t->head = (t->head - 1) & (TAGE_MAX_HISTORY - 1);
+    t->history[t->head] = taken;
+    t->path = ((t->path << 1) | ((pc ^ (pc >> 2)) & 1)) & 0xFFFF;
+    for (int i = 0; i < TAGE_TABLES; i++) {
+        uint32_t out = t->history[(t->head + t->lengths[i]) & (TAGE_MAX_HISTORY - 1)];
+        fold_update(&t->index_fold[i], taken, out);
+        fold_update(&t->tag_fold[0][i], taken, out);
+        fold_update(&t->tag_fold[1][i], taken, out);
+    }
+}
+
+// ---- Hashed perceptron ----
+
+static PerceptronState* perceptron_create(int history_length, int pht_bits) {
+    PerceptronState* p = (PerceptronState*)calloc(1, sizeof(PerceptronState));
+    if (!p) return NULL;
+
+    p->row_bits = pht_bits;
+    p->weights = (int8_t*)calloc((size_t)PERCEPTRON_TABLES << pht_bits, sizeof(int8_t));
+    if (!p->weights) {
+        free(p);
+        return NULL;
+    }
+    p->history_length = sat(history_length, PERCEPTRON_TABLES, PERCEPTRON_MAX_HISTORY);
+    p->theta = 2 * PERCEPTRON_TABLES + 14;
+    return p;
+}
+
+static void perceptron_destroy(PerceptronState* p) {
+    if (p) {
+        free(p->weights);
+        free(p);
+    }
+}
+
+// Table 0 is indexed by pc alone; table t by pc and the newest
+// t * history_length / (T - 1) outcomes
+static inline int perceptron_sum(const PerceptronState* p, uint64_t pc, uint64_t history,
+                                 uint32_t* rows) {
+    int sum = 0;
+    for (int t = 0; t < PERCEPTRON_TABLES; t++) {
+        int length = t * p->history_length / (PERCEPTRON_TABLES - 1);
+        uint64_t h = (pc ^ (history_bits(history, length) << 16) ^ ((uint64_t)t << 58)) *
+                     0x9E3779B97F4A7C15ULL;
+        rows[t] = ((uint32_t)t << p->row_bits) | (uint32_t)(h >> (64 - p->row_bits));
+        sum += p->weights[rows[t]];
+    }
+    return sum;
+}
+
+static void perceptron_train(PerceptronState* p, const uint32_t* rows, int sum, bool taken) {
+    bool predicted = sum >= 0;
+    int magnitude = sum < 0 ? -sum : sum;
+    if (predicted == taken && magnitude > p->theta) return;
+
+    for (int t = 0; t < PERCEPTRON_TABLES; t++) {
+        p->weights[rows[t]] = sat(p->weights[rows[t]] + (taken ? 1 : -1), -127, 127);
+    }
+
+    // Raise theta when mispredicts dominate, lower it when weak correct ones do
+    if (predicted != taken) {
+        if (++p->theta_count >= 32) {
+            p->theta++;
+            p->theta_count = 0;
+        }
+    } else if (--p->theta_count <= -32) {
+        if (p->theta > 0) p->theta--;
+        p->theta_count = 0;
+    }
+}
+
+// ---- Direction steps: predict, train and advance history in one pass ----
+
+static inline bool bimodal_step(BranchPredictor* bp, uint64_t pc, bool taken) {
+    uint8_t* counter = &bp->pht[pc & bp->pht_mask];
+    bool predicted = *counter >= 2;
+    counter_update(counter, taken);
+    return predicted;
+}
+
+static inline bool gshare_step(BranchPredictor* bp, uint64_t pc, bool taken) {
+    uint8_t* counter = &bp->pht[(pc ^ history_bits(bp->bhr, bp->bhr_size)) & bp->pht_mask];
+    bool predicted = *counter >= 2;
+    counter_update(counter, taken);
+    bp->bhr = (bp->bhr << 1) | taken;
+    return predicted;
+}
+
+static inline bool tage_step(BranchPredictor* bp, uint64_t pc, bool taken) {
+    TageLookup l;
+    tage_lookup(bp, pc, &l);
+    tage_train(bp, pc, &l, taken);
+    tage_push_history(bp->tage, pc, taken);
+    bp->bhr = (bp->bhr << 1) | taken;
+    return l.pred;
+}
+
+static inline bool perceptron_step(BranchPredictor* bp, uint64_t pc, bool taken) {
+    uint32_t rows[PERCEPTRON_TABLES];
+    int sum = perceptron_sum(bp->perceptron, pc, bp->bhr, rows);
+    perceptron_train(bp->perceptron, rows, sum, taken);
+    bp->bhr = (bp->bhr << 1) | taken;
+    return sum >= 0;
+}
+
+// ---- Public interface ----
+
 BranchPredictor* bp_create(PredictorType type, int bhr_size, int pht_size) {
-    BranchPredictor* bp = (BranchPredictor*)malloc(sizeof(BranchPredictor));
+    BranchPredictor* bp = (BranchPredictor*)calloc(1, sizeof(BranchPredictor));
     if (!bp) return NULL;
-    
+
     bp->type = type;
     bp->bhr_size = bhr_size;
-    bp->pht_size = pht_size;
-    bp->bhr = 0;
-    bp->correct = 0;
-    bp->total = 0;
-    
-    bp->pht = (uint8_t*)malloc(pht_size * sizeof(uint8_t));
-    if (!bp->pht) {
-        free(bp);
+    bp->pht_size = (int)round_pow2(pht_size);
+    bp->pht_mask = bp->pht_size - 1;
+
+    bp->pht = (uint8_t*)malloc(bp->pht_size * sizeof(uint8_t));
+    bp->btb = (BTBEntry*)calloc(DEFAULT_BTB_ENTRIES, sizeof(BTBEntry));
+    bp->btb_mask = DEFAULT_BTB_ENTRIES - 1;
+    if (type == PREDICTOR_TAGE) {
+        bp->tage = tage_create(bhr_size, log2_u32(bp->pht_size));
+    } else if (type == PREDICTOR_PERCEPTRON) {
+        bp->perceptron = perceptron_create(bhr_size, log2_u32(bp->pht_size));
+    }
+    if (!bp->pht || !bp->btb || (type == PREDICTOR_TAGE && !bp->tage) ||
+        (type == PREDICTOR_PERCEPTRON && !bp->perceptron)) {
+        bp_destroy(bp);
         return NULL;
     }
-    
+
     // Initialize PHT entries to weakly taken (2)
-    for (int i = 0; i < pht_size; i++) {
-        bp->pht[i] = 2;
-    }
-    
+    memset(bp->pht, 2, bp->pht_size);
+
     return bp;
 }
 
 void bp_destroy(BranchPredictor* bp) {
     if (bp) {
+        tage_destroy(bp->tage);
+        perceptron_destroy(bp->perceptron);
+        free(bp->btb);
         free(bp->pht);
         free(bp);
     }
 }
 
 bool bp_predict(BranchPredictor* bp, uint64_t pc) {
-    bp->total++;
-    
     switch (bp->type) {
         case PREDICTOR_ALWAYS_TAKEN:
             return true;
-            
+
         case PREDICTOR_ALWAYS_NOT_TAKEN:
             return false;
-            
-        case PREDICTOR_BIMODAL: {
-            uint32_t index = pc % bp->pht_size;
-            return bp->pht[index] >= 2;
+
+        case PREDICTOR_BIMODAL:
+            return bp->pht[pc & bp->pht_mask] >= 2;
+
+        case PREDICTOR_GSHARE:
+            return bp->pht[(pc ^ history_bits(bp->bhr, bp->bhr_size)) & bp->pht_mask] >= 2;
+
+        case PREDICTOR_TAGE: {
+            TageLookup l;
+            tage_lookup(bp, pc, &l);
+            return l.pred;
         }
-            
-        case PREDICTOR_GSHARE: {
-            uint32_t index = (pc ^ bp->bhr) % bp->pht_size;
-            return bp->pht[index] >= 2;
+
+        case PREDICTOR_PERCEPTRON: {
+            uint32_t rows[PERCEPTRON_TABLES];
+            return perceptron_sum(bp->perceptron, pc, bp->bhr, rows) >= 0;
         }
-            
+
         default:
             return false;
     }
 }
 
 void bp_update(BranchPredictor* bp, uint64_t pc, bool taken, bool predicted) {
+    bp->total++;
     if (taken == predicted) {
         bp->correct++;
     }
-    
+
     switch (bp->type) {
-        case PREDICTOR_BIMODAL: {
-            uint32_t index = pc % bp->pht_size;
-            if (taken) {
-                if (bp->pht[index] < 3) bp->pht[index]++;
-            } else {
-                if (bp->pht[index] > 0) bp->pht[index]--;
-            }
-            break;
-        }
-            
-        case PREDICTOR_GSHARE: {
-            uint32_t index = (pc ^ bp->bhr) % bp->pht_size;
-            if (taken) {
-                if (bp->pht[index] < 3) bp->pht[index]++;
-            } else {
-                if (bp->pht[index] > 0) bp->pht[index]--;
-            }
-            
-            // Update branch history register
-            bp->bhr = (bp->bhr << 1) | (taken ? 1 : 0);
-            bp->bhr &= (1 << bp->bhr_size) - 1;
-            break;
+        case PREDICTOR_BIMODAL: bimodal_step(bp, pc, taken); break;
+        case PREDICTOR_GSHARE: gshare_step(bp, pc, taken); break;
+        case PREDICTOR_TAGE: tage_step(bp, pc, taken); break;
+        case PREDICTOR_PERCEPTRON: perceptron_step(bp, pc, taken); break;
+        default: break;
+    }
+}
+
+// Taken branches look up the BTB, returns the RAS
+static inline void replay_target(BranchPredictor* bp, const BranchRecord* r) {
+    uint64_t predicted;
+    if (r->kind == BRANCH_RETURN) {
+        bp->ras_top--;
+        predicted = bp->ras[bp->ras_top & (RAS_DEPTH - 1)];
+    } else {
+        BTBEntry* e = &bp->btb[(r->pc ^ (r->pc >> 10)) & bp->btb_mask];
+        predicted = e->pc == r->pc ? e->target : UINT64_MAX;
+        e->pc = r->pc;
+        e->target = r->target;
+        if (r->kind == BRANCH_CALL) {
+            bp->ras[bp->ras_top & (RAS_DEPTH - 1)] = r->pc + r->size;
+            bp->ras_top++;
         }
-            
-        default:
-            break;
     }
+    bp->target_total++;
+    bp->target_correct += predicted == r->target;
+}
+
+// The type switch is hoisted out of the loop so each step inlines
+#define REPLAY_LOOP(step) do { \
+    for (size_t i = 0; i < n; i++) { \
+        const BranchRecord* r = &records[i]; \
+        if (r->kind == BRANCH_CONDITIONAL) { \
+            correct += (step) == r->taken; \
+            conditional++; \
+        } \
+        if (r->taken) replay_target(bp, r); \
+    } \
+} while (0)
+
+// Replay a branch trace; conditional records drive direction prediction
+// and history, taken ones the BTB and RAS. Returns correct directions.
+uint64_t bp_replay_batch(BranchPredictor* bp, const BranchRecord* records, size_t n) {
+    uint64_t correct = 0;
+    uint64_t conditional = 0;
+
+    switch (bp->type) {
+        case PREDICTOR_ALWAYS_TAKEN: REPLAY_LOOP(true); break;
+        case PREDICTOR_ALWAYS_NOT_TAKEN: REPLAY_LOOP(false); break;
+        case PREDICTOR_BIMODAL: REPLAY_LOOP(bimodal_step(bp, r->pc, r->taken)); break;
+        case PREDICTOR_GSHARE: REPLAY_LOOP(gshare_step(bp, r->pc, r->taken)); break;
+        case PREDICTOR_TAGE: REPLAY_LOOP(tage_step(bp, r->pc, r->taken)); break;
+        case PREDICTOR_PERCEPTRON: REPLAY_LOOP(perceptron_step(bp, r->pc, r->taken)); break;
+        default: break;
+    }
+
+    bp->correct += correct;
+    bp->total += conditional;
+    return correct;
 }
 
 void bp_print_stats(BranchPredictor* bp) {
     printf("\n=== Branch Predictor Stats ===\n");
-    printf("Type: %d\n", bp->type);
+    printf("Type: %s\n", predictor_names[bp->type]);
     printf("Total predictions: %lu\n", bp->total);
     printf("Correct predictions: %lu\n", bp->correct);
-    printf("Accuracy: %.2f%%\n", 
+    printf("Accuracy: %.2f%%\n",
            bp->total > 0 ? (100.0 * bp->correct / bp->total) : 0.0);
-}
\ No newline at end of file
+    if (bp->target_total > 0) {
+        printf("Target accuracy (BTB/RAS): %.2f%% of %lu\n",
+               100.0 * bp->target_correct / bp->target_total, bp->target_total);
+    }
+}
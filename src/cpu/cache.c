@@ -1,115 +1,548 @@
 #include "cpu.h"
 
+#if USE_SIMD && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CACHE_SIMD_X86 1
+#elif USE_SIMD && defined(__aarch64__)
+#include <arm_neon.h>
+#define CACHE_SIMD_NEON 1
+#endif
+
+// Padding ways carry this LRU stamp. It is the largest value that is still
+// positive as a signed lane, so both signed and unsigned vector minimums
+// skip it; real stamps are access counts and never get near it.
+#define LRU_PAD ((uint64_t)INT64_MAX)
+
+static bool is_pow2(uint64_t x) {
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+static int log2_u64(uint64_t x) {
+    return 63 - __builtin_clzll(x);
+}
+
+// Set record accessors
+static inline uint64_t* cache_set(Cache* cache, uint64_t set_index) {
+    return cache->store + set_index * cache->set_stride;
+}
+
+static inline uint64_t* set_lru(Cache* cache, uint64_t* set) {
+    return set + cache->way_stride;
+}
+
+static inline uint64_t* set_valid(Cache* cache, uint64_t* set) {
+    return set + 2 * cache->way_stride;
+}
+
+// Split an address into set index and tag
+static inline void cache_decode(Cache* cache, uint64_t addr,
+                                uint64_t* set_index, uint64_t* tag) {
+    if (cache->pow2_index) {
+        uint64_t line_addr = addr >> cache->line_shift;
+        *set_index = line_addr & cache->set_mask;
+        *tag = line_addr >> cache->set_shift;
+    } else {
+        uint64_t line_addr = addr / cache->line_size;
+        *set_index = line_addr % cache->num_sets;
+        *tag = line_addr / cache->num_sets;
+    }
+}
+
+// Scalar way search, used for narrow sets and when no vector unit is found
+static int find_way_scalar(const uint64_t* tags, const uint64_t* valid,
+                           int ways, uint64_t tag) {
+    for (int i = 0; i < ways; i++) {
+        if (TEST_BIT(valid[i >> 6], i & 63) && tags[i] == tag) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int find_lru_scalar(const uint64_t* lru, int ways) {
+    uint64_t min_lru = UINT64_MAX;
+    int victim = 0;
+    for (int i = 0; i < ways; i++) {
+        if (lru[i] < min_lru) {
+            min_lru = lru[i];
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+// Vector kernels. All of them walk 8 ways (one cache line of tags) per
+// iteration, so they are only installed when way_stride is a multiple of 8.
+// Ties in the LRU minimum resolve to the lowest way, matching the scalar path.
+#ifdef CACHE_SIMD_X86
+__attribute__((target("avx2")))
+static int find_way_avx2(const uint64_t* tags, const uint64_t* valid,
+                         int ways, uint64_t tag) {
+    __m256i key = _mm256_set1_epi64x((long long)tag);
+    for (int w = 0; w < ways; w += 8) {
+        __m256i lo = _mm256_load_si256((const __m256i*)(tags + w));
+        __m256i hi = _mm256_load_si256((const __m256i*)(tags + w + 4));
+        uint32_t m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lo, key))) |
+                     _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(hi, key))) << 4;
+        m &= (uint32_t)(valid[w >> 6] >> (w & 63)) & 0xFF;
+        if (m) return w + __builtin_ctz(m);
+    }
+    return -1;
+}
+
+// LRU search runs in two passes: a vertical min over all ways followed by a
+// horizontal reduce, then a compare against the broadcast minimum whose
+// first set bit is the victim. Avoids carrying way indices through blends.
+__attribute__((target("avx2")))
+static inline __m256i min_epi64_avx2(__m256i a, __m256i b) {
+    return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+}
+
+__attribute__((target("avx2")))
+static int find_lru_avx2(const uint64_t* lru, int ways) {
+    __m256i best_a = _mm256_set1_epi64x(INT64_MAX);
+    __m256i best_b = best_a;
+    for (int w = 0; w < ways; w += 8) {
+        best_a = min_epi64_avx2(best_a, _mm256_load_si256((const __m256i*)(lru + w)));
+        best_b = min_epi64_avx2(best_b, _mm256_load_si256((const __m256i*)(lru + w + 4)));
+    }
+
+    __m256i m = min_epi64_avx2(best_a, best_b);
+    m = min_epi64_avx2(m, _mm256_permute4x64_epi64(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = min_epi64_avx2(m, _mm256_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+
+    for (int w = 0; w < ways; w += 8) {
+        __m256i lo = _mm256_load_si256((const __m256i*)(lru + w));
+        __m256i hi = _mm256_load_si256((const __m256i*)(lru + w + 4));
+        uint32_t eq = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lo, m))) |
+                      _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(hi, m))) << 4;
+        if (eq) return w + __builtin_ctz(eq);
+    }
+    return 0;
+}
+
+__attribute__((target("sse4.2")))
+static int find_way_sse4(const uint64_t* tags, const uint64_t* valid,
+                         int ways, uint64_t tag) {
+    __m128i key = _mm_set1_epi64x((long long)tag);
+    for (int w = 0; w < ways; w += 8) {
+        uint32_t m = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_load_si128((const __m128i*)(tags + w + 2 * k));
+            m |= (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, key))) << (2 * k);
+        }
+        m &= (uint32_t)(valid[w >> 6] >> (w & 63)) & 0xFF;
+        if (m) return w + __builtin_ctz(m);
+    }
+    return -1;
+}
+
+__attribute__((target("sse4.2")))
+static int find_lru_sse4(const uint64_t* lru, int ways) {
+    __m128i best = _mm_set1_epi64x(INT64_MAX);
+    __m128i best_idx = _mm_setzero_si128();
+    __m128i idx = _mm_set_epi64x(1, 0);
+    __m128i step = _mm_set1_epi64x(2);
+    for (int w = 0; w < ways; w += 2) {
+        __m128i v = _mm_load_si128((const __m128i*)(lru + w));
+        __m128i lt = _mm_cmpgt_epi64(best, v);
+        best = _mm_blendv_epi8(best, v, lt);
+        best_idx = _mm_blendv_epi8(best_idx, idx, lt);
+        idx = _mm_add_epi64(idx, step);
+    }
+
+    uint64_t v0 = (uint64_t)_mm_cvtsi128_si64(best);
+    uint64_t v1 = (uint64_t)_mm_extract_epi64(best, 1);
+    int i0 = (int)_mm_cvtsi128_si64(best_idx);
+    int i1 = (int)_mm_extract_epi64(best_idx, 1);
+    if (v1 < v0 || (v1 == v0 && i1 < i0)) return i1;
+    return i0;
+}
+#endif
+
+// NEON is architectural on AArch64, so no runtime probe is needed there
+#ifdef CACHE_SIMD_NEON
+static int find_way_neon(const uint64_t* tags, const uint64_t* valid,
+                         int ways, uint64_t tag) {
+    uint64x2_t key = vdupq_n_u64(tag);
+    for (int w = 0; w < ways; w += 8) {
+        uint32_t m = 0;
+        for (int k = 0; k < 4; k++) {
+            uint64x2_t eq = vceqq_u64(vld1q_u64(tags + w + 2 * k), key);
+            m |= (uint32_t)(vgetq_lane_u64(eq, 0) & 1) << (2 * k);
+            m |= (uint32_t)(vgetq_lane_u64(eq, 1) & 1) << (2 * k + 1);
+        }
+        m &= (uint32_t)(valid[w >> 6] >> (w & 63)) & 0xFF;
+        if (m) return w + __builtin_ctz(m);
+    }
+    return -1;
+}
+
+static int find_lru_neon(const uint64_t* lru, int ways) {
+    uint64x2_t best = vdupq_n_u64(UINT64_MAX);
+    uint64x2_t best_idx = vdupq_n_u64(0);
+    uint64x2_t idx = vcombine_u64(vcreate_u64(0), vcreate_u64(1));
+    uint64x2_t step = vdupq_n_u64(2);
+    for (int w = 0; w < ways; w += 2) {
+        uint64x2_t v = vld1q_u64(lru + w);
+        uint64x2_t lt = vcltq_u64(v, best);
+        best = vbslq_u64(lt, v, best);
+        best_idx = vbslq_u64(lt, idx, best_idx);
+        idx = vaddq_u64(idx, step);
+    }
+
+    uint64_t v0 = vgetq_lane_u64(best, 0), v1 = vgetq_lane_u64(best, 1);
+    int i0 = (int)vgetq_lane_u64(best_idx, 0), i1 = (int)vgetq_lane_u64(best_idx, 1);
+    if (v1 < v0 || (v1 == v0 && i1 < i0)) return i1;
+    return i0;
+}
+#endif
+
+static void cache_select_kernels(Cache* cache) {
+    cache->find_way = find_way_scalar;
+    cache->find_lru = find_lru_scalar;
+    cache->search_kernel = "scalar";
+
+    if (cache->way_stride % 8 != 0) return;
+
+#ifdef CACHE_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        cache->find_way = find_way_avx2;
+        cache->find_lru = find_lru_avx2;
+        cache->search_kernel = "avx2";
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        cache->find_way = find_way_sse4;
+        cache->find_lru = find_lru_sse4;
+        cache->search_kernel = "sse4.2";
+    }
+#elif defined(CACHE_SIMD_NEON)
+    cache->find_way = find_way_neon;
+    cache->find_lru = find_lru_neon;
+    cache->search_kernel = "neon";
+#endif
+}
+
 Cache* cache_create(CacheType type, int size, int line_size, int associativity) {
+    if (size <= 0 || line_size <= 0 || associativity <= 0) return NULL;
+
     Cache* cache = (Cache*)malloc(sizeof(Cache));
     if (!cache) return NULL;
-    
+
     cache->type = type;
     cache->size = size;
     cache->line_size = line_size;
     cache->associativity = associativity;
     cache->hit_time = 1;
     cache->miss_penalty = 10;
-    
+
     cache->hits = 0;
     cache->misses = 0;
     cache->accesses = 0;
-    
+
     // Calculate number of sets
     int lines = size / line_size;
     cache->num_sets = lines / associativity;
-    
-    // Allocate tag arrays
-    cache->tags = (uint64_t**)malloc(cache->num_sets * sizeof(uint64_t*));
-    cache->valid = (bool**)malloc(cache->num_sets * sizeof(bool*));
-    
-    for (int i = 0; i < cache->num_sets; i++) {
-        cache->tags[i] = (uint64_t*)malloc(associativity * sizeof(uint64_t));
-        cache->valid[i] = (bool*)malloc(associativity * sizeof(bool));
-        
-        for (int j = 0; j < associativity; j++) {
-            cache->tags[i][j] = 0;
-            cache->valid[i][j] = false;
-        }
+    if (cache->num_sets < 1) cache->num_sets = 1;
+
+    cache->pow2_index = is_pow2(line_size) && is_pow2(cache->num_sets);
+    if (cache->pow2_index) {
+        cache->line_shift = log2_u64(line_size);
+        cache->set_shift = log2_u64(cache->num_sets);
+        cache->set_mask = (uint64_t)cache->num_sets - 1;
+    } else {
+        cache->line_shift = 0;
+        cache->set_shift = 0;
+        cache->set_mask = 0;
     }
-    
-    // Allocate LRU counters for set-associative
-    if (type == CACHE_SET_ASSOC) {
-        cache->lru_counters = (uint64_t*)malloc(cache->num_sets * associativity * sizeof(uint64_t));
-        memset(cache->lru_counters, 0, cache->num_sets * associativity * sizeof(uint64_t));
+
+    // Size the per-set record. Wide sets pad their tag and LRU arrays to
+    // whole cache lines; narrow sets round the record up to a power of two
+    // so several of them share a line without straddling one.
+    int words_per_line = CACHE_LINE_SIZE / sizeof(uint64_t);
+    cache->way_stride = associativity < words_per_line ?
+                        associativity : ALIGN_UP(associativity, words_per_line);
+    cache->valid_words = (associativity + 63) / 64;
+
+    int record = 2 * cache->way_stride + cache->valid_words;
+    if (record < words_per_line) {
+        cache->set_stride = 1;
+        while (cache->set_stride < record) cache->set_stride <<= 1;
     } else {
-        cache->lru_counters = NULL;
+        cache->set_stride = ALIGN_UP(record, words_per_line);
     }
-    
+
+    size_t bytes = (size_t)cache->num_sets * cache->set_stride * sizeof(uint64_t);
+    bytes = ALIGN_UP(bytes, CACHE_LINE_SIZE);
+    cache->store = (uint64_t*)aligned_alloc(CACHE_LINE_SIZE, bytes);
+    if (!cache->store) {
+        free(cache);
+        return NULL;
+    }
+    memset(cache->store, 0, bytes);
+
+    // Padding ways never match (valid bit clear) and never win the LRU
+    // minimum, so way searches can run over the padded width.
+    for (int s = 0; s < cache->num_sets; s++) {
+        uint64_t* lru = set_lru(cache, cache_set(cache, s));
+        for (int w = associativity; w < cache->way_stride; w++) {
+            lru[w] = LRU_PAD;
+        }
+    }
+
+    cache_select_kernels(cache);
     return cache;
 }
 
 void cache_destroy(Cache* cache) {
     if (cache) {
-        for (int i = 0; i < cache->num_sets; i++) {
-            free(cache->tags[i]);
-            free(cache->valid[i]);
-        }
-        free(cache->tags);
-        free(cache->valid);
-        free(cache->lru_counters);
+        free(cache->store);
         free(cache);
     }
 }
 
+// Look up a line in one set, installing it on a miss. Returns true on hit.
+static inline bool cache_probe(Cache* cache, uint64_t set_index, uint64_t tag,
+                               uint64_t stamp) {
+    uint64_t* set = cache_set(cache, set_index);
+    uint64_t* lru = set_lru(cache, set);
+    uint64_t* valid = set_valid(cache, set);
+
+    // Search for tag in the set
+    int way = cache->find_way(set, valid, cache->way_stride, tag);
+    if (way >= 0) {
+        lru[way] = stamp;
+        return true;
+    }
+
+    // Find victim: first invalid way, otherwise least recently used
+    int victim = -1;
+    for (int w = 0; w < cache->valid_words; w++) {
+        uint64_t free_ways = ~valid[w];
+        if (free_ways) {
+            int i = w * 64 + __builtin_ctzll(free_ways);
+            if (i < cache->associativity) victim = i;
+            break;
+        }
+    }
+
+    if (victim < 0) {
+        victim = cache->find_lru(lru, cache->way_stride);
+    }
+
+    // Install new line
+    SET_BIT(valid[victim >> 6], victim & 63);
+    set[victim] = tag;
+    lru[victim] = stamp;
+
+    return false;
+}
+
 int cache_access(Cache* cache, uint64_t addr, bool is_write) {
+    (void)is_write;  // Write policy is not modelled; stores allocate like loads
     cache->accesses++;
-    
+
     // Calculate set index and tag
-    uint64_t line_addr = addr / cache->line_size;
-    int set_index = line_addr % cache->num_sets;
-    uint64_t tag = line_addr / cache->num_sets;
-    
-    // Search for tag in the set
-    for (int i = 0; i < cache->associativity; i++) {
-        if (cache->valid[set_index][i] && cache->tags[set_index][i] == tag) {
-            // Hit
-            cache->hits++;
-            
-            // Update LRU
-            if (cache->type == CACHE_SET_ASSOC) {
-                cache->lru_counters[set_index * cache->associativity + i] = cache->accesses;
-            }
-            
-            return cache->hit_time;
-        }
+    uint64_t set_index, tag;
+    cache_decode(cache, addr, &set_index, &tag);
+
+    if (cache_probe(cache, set_index, tag, cache->accesses)) {
+        cache->hits++;
+        return cache->hit_time;
     }
-    
-    // Miss
+
     cache->misses++;
-    
-    // Find victim for replacement
-    int victim = 0;
-    if (cache->type == CACHE_SET_ASSOC) {
-        // LRU replacement
-        uint64_t min_lru = UINT64_MAX;
-        for (int i = 0; i < cache->associativity; i++) {
-            if (!cache->valid[set_index][i]) {
-                victim = i;
+    return cache->miss_penalty;
+}
+
+// Line handles for coherence controllers: set_index * way_stride + way,
+// below cache_line_count(). They do not touch the statistics.
+int cache_line_count(Cache* cache) {
+    return cache->num_sets * cache->way_stride;
+}
+
+int cache_lookup_line(Cache* cache, uint64_t addr, bool touch) {
+    uint64_t set_index, tag;
+    cache_decode(cache, addr, &set_index, &tag);
+
+    uint64_t* set = cache_set(cache, set_index);
+    int way = cache->find_way(set, set_valid(cache, set), cache->way_stride, tag);
+    if (way < 0) return -1;
+    if (touch) set_lru(cache, set)[way] = cache->accesses;
+    return (int)set_index * cache->way_stride + way;
+}
+
+// Install addr (or touch it when present). *evicted is the address of the
+// valid line it replaced, UINT64_MAX when none was.
+int cache_fill_line(Cache* cache, uint64_t addr, uint64_t* evicted) {
+    uint64_t set_index, tag;
+    cache_decode(cache, addr, &set_index, &tag);
+    *evicted = UINT64_MAX;
+
+    uint64_t* set = cache_set(cache, set_index);
+    uint64_t* valid = set_valid(cache, set);
+    int way = cache->find_way(set, valid, cache->way_stride, tag);
+    if (way < 0) {
+        for (int w = 0; w < cache->valid_words && way < 0; w++) {
+            uint64_t free_ways = ~valid[w];
+            if (free_ways) {
+                int i = w * 64 + __builtin_ctzll(free_ways);
+                if (i < cache->associativity) way = i;
                 break;
             }
-            uint64_t lru = cache->lru_counters[set_index * cache->associativity + i];
-            if (lru < min_lru) {
-                min_lru = lru;
-                victim = i;
+        }
+        if (way < 0) {
+            way = cache->find_lru(set_lru(cache, set), cache->way_stride);
+            *evicted = (set[way] * cache->num_sets + set_index) * cache->line_size;
+        }
+        SET_BIT(valid[way >> 6], way & 63);
+        set[way] = tag;
+    }
+    set_lru(cache, set)[way] = cache->accesses;
+    return (int)set_index * cache->way_stride + way;
+}
+
+void cache_invalidate_line(Cache* cache, int line) {
+    uint64_t* set = cache_set(cache, line / cache->way_stride);
+    int way = line % cache->way_stride;
+    CLEAR_BIT(set_valid(cache, set)[way >> 6], way & 63);
+}
+
+// How many accesses ahead the batch loop prefetches set records
+#define CACHE_PREFETCH_DISTANCE 8
+#define CACHE_PREFETCH_LINES 8
+#define CACHE_PREFETCH_MIN_STORE (256 * KiB)
+
+// Batch loop body. `pow2` is a compile-time constant at both call sites, so
+// each gets its own copy with the index decode resolved outside the loop.
+// Indices of missing accesses are appended to miss_idx when it is non-NULL.
+static inline uint64_t cache_batch_run(Cache* cache, const uint64_t* addrs,
+                                       size_t n, uint32_t* latencies_out,
+                                       uint32_t* miss_idx, size_t* miss_count,
+                                       bool pow2) {
+    const int line_shift = cache->line_shift;
+    const int set_shift = cache->set_shift;
+    const uint64_t set_mask = cache->set_mask;
+    const uint64_t line_size = cache->line_size;
+    const uint64_t num_sets = cache->num_sets;
+    const uint32_t hit_time = cache->hit_time;
+    const uint32_t miss_penalty = cache->miss_penalty;
+    // Whole set records are prefetched, up to CACHE_PREFETCH_LINES lines,
+    // unless the tag store is small enough to stay resident on the host
+    const size_t store_bytes = (size_t)cache->num_sets * cache->set_stride * sizeof(uint64_t);
+    const int pf_bytes = store_bytes < CACHE_PREFETCH_MIN_STORE ? 0 :
+                         MIN(cache->set_stride * (int)sizeof(uint64_t),
+                             CACHE_PREFETCH_LINES * CACHE_LINE_SIZE);
+
+#define BATCH_DECODE(addr, set_index, tag) do { \
+        if (pow2) { \
+            uint64_t line_ = (addr) >> line_shift; \
+            (set_index) = line_ & set_mask; \
+            (tag) = line_ >> set_shift; \
+        } else { \
+            uint64_t line_ = (addr) / line_size; \
+            (set_index) = line_ % num_sets; \
+            (tag) = line_ / num_sets; \
+        } \
+    } while (0)
+
+    uint64_t stamp = cache->accesses;
+    uint64_t hits = 0;
+    uint64_t total = 0;
+    size_t misses = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (pf_bytes && i + CACHE_PREFETCH_DISTANCE < n) {
+            uint64_t pf_set, pf_tag;
+            BATCH_DECODE(addrs[i + CACHE_PREFETCH_DISTANCE], pf_set, pf_tag);
+            (void)pf_tag;
+            const char* rec = (const char*)cache_set(cache, pf_set);
+            for (int off = 0; off < pf_bytes; off += CACHE_LINE_SIZE) {
+                __builtin_prefetch(rec + off, 1, 3);
             }
         }
+
+        uint64_t set_index, tag;
+        BATCH_DECODE(addrs[i], set_index, tag);
+
+        uint32_t latency;
+        if (cache_probe(cache, set_index, tag, ++stamp)) {
+            hits++;
+            latency = hit_time;
+        } else {
+            if (miss_idx) miss_idx[misses] = (uint32_t)i;
+            misses++;
+            latency = miss_penalty;
+        }
+
+        total += latency;
+        if (latencies_out) latencies_out[i] = latency;
     }
-    
-    // Install new line
-    cache->valid[set_index][victim] = true;
-    cache->tags[set_index][victim] = tag;
-    
-    if (cache->type == CACHE_SET_ASSOC) {
-        cache->lru_counters[set_index * cache->associativity + victim] = cache->accesses;
+#undef BATCH_DECODE
+
+    cache->accesses = stamp;
+    cache->hits += hits;
+    cache->misses += n - hits;
+    if (miss_count) *miss_count = misses;
+    return total;
+}
+
+static uint64_t cache_batch(Cache* cache, const uint64_t* addrs, size_t n,
+                            uint32_t* latencies_out, uint32_t* miss_idx,
+                            size_t* miss_count) {
+    if (cache->pow2_index) {
+        return cache_batch_run(cache, addrs, n, latencies_out,
+                               miss_idx, miss_count, true);
     }
-    
-    return cache->miss_penalty;
+    return cache_batch_run(cache, addrs, n, latencies_out,
+                           miss_idx, miss_count, false);
+}
+
+uint64_t cache_access_batch(Cache* cache, const uint64_t* addrs,
+                            const uint8_t* is_write, size_t n,
+                            uint32_t* latencies_out) {
+    (void)is_write;  // See cache_access()
+    return cache_batch(cache, addrs, n, latencies_out, NULL, NULL);
+}
+
+// Accesses per L1 pass before the gathered misses are sent to L2. Bounds
+// the on-stack scratch buffers.
+#define CACHE_HIERARCHY_CHUNK 1024
+
+uint64_t cache_hierarchy_batch(Cache* l1, Cache* l2, const uint64_t* addrs,
+                               const uint8_t* is_write, size_t n,
+                               uint32_t* latencies_out) {
+    (void)is_write;  // See cache_access()
+
+    uint32_t lat[CACHE_HIERARCHY_CHUNK];
+    uint32_t miss_idx[CACHE_HIERARCHY_CHUNK];
+    uint64_t miss_addrs[CACHE_HIERARCHY_CHUNK];
+    uint32_t miss_lat[CACHE_HIERARCHY_CHUNK];
+    uint64_t total = 0;
+
+    for (size_t base = 0; base < n; base += CACHE_HIERARCHY_CHUNK) {
+        size_t count = MIN(n - base, (size_t)CACHE_HIERARCHY_CHUNK);
+        uint32_t* out = latencies_out ? latencies_out + base : lat;
+        size_t misses = 0;
+
+        total += cache_batch(l1, addrs + base, count, out, miss_idx, &misses);
+        if (misses == 0) continue;
+
+        // L1 state never depends on L2, so replaying the misses afterwards
+        // in order gives the same result as interleaving them.
+        for (size_t j = 0; j < misses; j++) {
+            miss_addrs[j] = addrs[base + miss_idx[j]];
+        }
+        total += cache_batch(l2, miss_addrs, misses, miss_lat, NULL, NULL);
+
+        if (latencies_out) {
+            for (size_t j = 0; j < misses; j++) {
+                out[miss_idx[j]] += miss_lat[j];
+            }
+        }
+    }
+
+    return total;
 }
 
 void cache_print_stats(Cache* cache) {
@@ -117,9 +550,10 @@ void cache_print_stats(Cache* cache) {
     printf("Size: %d KB\n", cache->size / KiB);
     printf("Line size: %d bytes\n", cache->line_size);
     printf("Associativity: %d\n", cache->associativity);
+    printf("Way search: %s\n", cache->search_kernel);
     printf("Accesses: %lu\n", cache->accesses);
     printf("Hits: %lu\n", cache->hits);
     printf("Misses: %lu\n", cache->misses);
-    printf("Hit rate: %.2f%%\n", 
+    printf("Hit rate: %.2f%%\n",
            cache->accesses > 0 ? (100.0 * cache->hits / cache->accesses) : 0.0);
-}
\ No newline at end of file
+}
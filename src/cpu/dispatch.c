@@ -0,0 +1,259 @@
+#include "cpu.h"
+
+#if defined(__GNUC__)
+#define HAVE_COMPUTED_GOTO 1
+#endif
+
+// How an opcode retires its result
+enum {
+    EXEC_NONE,
+    EXEC_ALU,       // written to rd
+    EXEC_FLAGS,     // written to flags
+    EXEC_LOAD,
+    EXEC_STORE,
+    EXEC_BRANCH,    // result is the next pc
+    EXEC_HALT
+};
+
+// Per-opcode semantics, X(opcode, class, result). a and b are the rs1 and
+// rs2 values, next_pc the fall-through pc. Every engine below and the
+// handler table are generated from this one list.
+#define EXEC_OPS(X) \
+    X(INST_NOP,  EXEC_NONE,   0) \
+    X(INST_ADD,  EXEC_ALU,    a + b) \
+    X(INST_SUB,  EXEC_ALU,    a - b) \
+    X(INST_MUL,  EXEC_ALU,    a * b) \
+    X(INST_DIV,  EXEC_ALU,    b ? a / b : 0) \
+    X(INST_AND,  EXEC_ALU,    a & b) \
+    X(INST_OR,   EXEC_ALU,    a | b) \
+    X(INST_XOR,  EXEC_ALU,    a ^ b) \
+    X(INST_NOT,  EXEC_ALU,    ~a) \
+    X(INST_SHL,  EXEC_ALU,    a << (b & 0x3F)) \
+    X(INST_SHR,  EXEC_ALU,    a >> (b & 0x3F)) \
+    X(INST_LD,   EXEC_LOAD,   0) \
+    X(INST_ST,   EXEC_STORE,  0) \
+    X(INST_JMP,  EXEC_BRANCH, imm) \
+    X(INST_JZ,   EXEC_BRANCH, a == 0 ? imm : next_pc) \
+    X(INST_JNZ,  EXEC_BRANCH, a != 0 ? imm : next_pc) \
+    X(INST_CALL, EXEC_NONE,   0) \
+    X(INST_RET,  EXEC_NONE,   0) \
+    X(INST_CMP,  EXEC_FLAGS,  a - b) \
+    X(INST_MOV,  EXEC_ALU,    a) \
+    X(INST_HLT,  EXEC_HALT,   0)
+
+// Handler table, used by the pipeline and Tomasulo execute stages
+#define EXEC_HANDLER(op, cls, expr) \
+    static uint64_t exec_##op(uint64_t a, uint64_t b, uint64_t imm, uint64_t next_pc) { \
+        (void)a; (void)b; (void)imm; (void)next_pc; \
+        return (expr); \
+    }
+EXEC_OPS(EXEC_HANDLER)
+
+#define EXEC_HANDLER_ENTRY(op, cls, expr) [op] = exec_##op,
+const ExecHandler exec_handlers[INST_COUNT] = {
+    EXEC_OPS(EXEC_HANDLER_ENTRY)
+};
+
+#define EXEC_CLASS_ENTRY(op, cls, expr) [op] = cls,
+static const uint8_t exec_class[INST_COUNT] = {
+    EXEC_OPS(EXEC_CLASS_ENTRY)
+};
+
+// Memory and predictor side effects, shared by every engine. Out of range
+// accesses are dropped, as in the pipeline's memory stage.
+static inline void exec_load(CPU* cpu, const DecodedInstruction* inst, uint32_t warm) {
+    uint64_t value = 0;
+    if (inst->address <= cpu->mem_size - sizeof(uint64_t)) {
+        if (warm & WARM_CACHES) cache_access(cpu->l1_cache, inst->address, false);
+        value = gmem_load64(cpu->memory, inst->address);
+    }
+    cpu->registers[inst->rd] = value;
+}
+
+static inline void exec_store(CPU* cpu, const DecodedInstruction* inst, uint32_t warm) {
+    if (inst->address <= cpu->mem_size - sizeof(uint64_t)) {
+        if (warm & WARM_CACHES) cache_access(cpu->l1_cache, inst->address, true);
+        gmem_store64(cpu->memory, inst->address, cpu->registers[inst->rd]);
+        predecode_invalidate(cpu->predecode, inst->address, sizeof(uint64_t));
+    }
+}
+
+static inline void exec_warm_branch(CPU* cpu, const DecodedInstruction* inst, bool taken) {
+    bool predicted = bp_predict(cpu->bp, inst->pc);
+    bp_update(cpu->bp, inst->pc, taken, predicted);
+}
+
+// Retire inst with a class and result known at compile time; sets pc
+#define EXEC_BODY(cls, expr) do { \
+    uint64_t a = cpu->registers[inst->rs1]; \
+    uint64_t b = cpu->registers[inst->rs2]; \
+    uint64_t imm = inst->imm; \
+    uint64_t next_pc = inst->pc + inst->size; \
+    (void)a; (void)b; (void)imm; \
+    pc = next_pc; \
+    if (cls == EXEC_ALU) { \
+        cpu->registers[inst->rd] = (expr); \
+    } else if (cls == EXEC_FLAGS) { \
+        cpu->flags = (expr); \
+    } else if (cls == EXEC_LOAD) { \
+        exec_load(cpu, inst, warm); \
+    } else if (cls == EXEC_STORE) { \
+        exec_store(cpu, inst, warm); \
+    } else if (cls == EXEC_BRANCH) { \
+        pc = (expr); \
+        if (warm & WARM_PREDICTOR) exec_warm_branch(cpu, inst, pc != next_pc); \
+    } \
+} while (0)
+
+// Block walk shared by the switch and table engines. An engine supplies
+// the body that retires inst and sets pc.
+#define EXEC_LOOP(body) do { \
+    while (executed < limit) { \
+        const DecodedBlock* block = predecode_lookup(cpu->predecode, pc); \
+        if (!block) break; \
+        for (int i = 0; i < block->count; i++) { \
+            const DecodedInstruction* inst = &block->insts[i]; \
+            if (inst->pc == stop_pc || inst->type == INST_HLT) goto done; \
+            if (warm & WARM_CACHES) cache_access(cpu->l1_cache, inst->pc, false); \
+            body; \
+            executed++; \
+            if (pc != inst->pc + inst->size || executed >= limit || !block->valid) { \
+                break; \
+            } \
+        } \
+    } \
+} while (0)
+
+// Baseline: one switch per instruction
+static uint64_t run_switch(CPU* cpu, uint64_t limit, uint64_t stop_pc, uint32_t warm) {
+    uint64_t executed = 0;
+    uint64_t pc = cpu->pc;
+
+#define EXEC_CASE(op, cls, expr) case op: EXEC_BODY(cls, expr); break;
+    EXEC_LOOP(
+        switch (inst->type) {
+            EXEC_OPS(EXEC_CASE)
+            default: pc = inst->pc + inst->size; break;
+        }
+    );
+#undef EXEC_CASE
+
+done:
+    cpu->pc = pc;
+    return executed;
+}
+
+// Portable: handler table call, then retire by class
+static uint64_t run_table(CPU* cpu, uint64_t limit, uint64_t stop_pc, uint32_t warm) {
+    uint64_t executed = 0;
+    uint64_t pc = cpu->pc;
+
+    EXEC_LOOP({
+        uint64_t next_pc = inst->pc + inst->size;
+        uint64_t result = exec_handlers[inst->type](cpu->registers[inst->rs1],
+                                                    cpu->registers[inst->rs2],
+                                                    inst->imm, next_pc);
+        pc = next_pc;
+        switch (exec_class[inst->type]) {
+            case EXEC_ALU: cpu->registers[inst->rd] = result; break;
+            case EXEC_FLAGS: cpu->flags = result; break;
+            case EXEC_LOAD: exec_load(cpu, inst, warm); break;
+            case EXEC_STORE: exec_store(cpu, inst, warm); break;
+            case EXEC_BRANCH:
+                pc = result;
+                if (warm & WARM_PREDICTOR) exec_warm_branch(cpu, inst, pc != next_pc);
+                break;
+            default: break;
+        }
+    });
+
+done:
+    cpu->pc = pc;
+    return executed;
+}
+
+#if HAVE_COMPUTED_GOTO
+// Threaded: every handler ends in its own indirect jump to the next one,
+// so the host predictor sees per-opcode successor patterns
+static uint64_t run_threaded(CPU* cpu, uint64_t limit, uint64_t stop_pc, uint32_t warm) {
+#define EXEC_LABEL_ENTRY(op, cls, expr) [op] = &&L_##op,
+    static void* const labels[INST_COUNT] = {
+        EXEC_OPS(EXEC_LABEL_ENTRY)
+    };
+#undef EXEC_LABEL_ENTRY
+
+    uint64_t executed = 0;
+    uint64_t pc = cpu->pc;
+    const DecodedBlock* block;
+    const DecodedInstruction* inst;
+    const DecodedInstruction* end;
+
+#define EXEC_DISPATCH() do { \
+    if (inst->pc == stop_pc) goto done; \
+    if (warm & WARM_CACHES) cache_access(cpu->l1_cache, inst->pc, false); \
+    goto *labels[inst->type]; \
+} while (0)
+
+next_block:
+    if (executed >= limit) goto done;
+    block = predecode_lookup(cpu->predecode, pc);
+    if (!block) goto done;
+    inst = block->insts;
+    end = inst + block->count;
+    EXEC_DISPATCH();
+
+    // Only branches leave a block early and only stores can invalidate it
+#define EXEC_LABEL(op, cls, expr) \
+L_##op: \
+    if (cls == EXEC_HALT) goto done; \
+    EXEC_BODY(cls, expr); \
+    executed++; \
+    if ((cls == EXEC_BRANCH && pc != inst->pc + inst->size) || \
+        (cls == EXEC_STORE && !block->valid) || \
+        executed >= limit || ++inst == end) { \
+        goto next_block; \
+    } \
+    EXEC_DISPATCH();
+    EXEC_OPS(EXEC_LABEL)
+#undef EXEC_LABEL
+#undef EXEC_DISPATCH
+
+done:
+    cpu->pc = pc;
+    return executed;
+}
+#endif
+
+uint64_t dispatch_run(CPU* cpu, DispatchMode mode, uint64_t max_instructions,
+                      uint64_t stop_pc, uint32_t warm) {
+    uint64_t limit = max_instructions ? max_instructions : UINT64_MAX;
+
+    switch (mode) {
+        case DISPATCH_SWITCH:
+            return run_switch(cpu, limit, stop_pc, warm);
+#if HAVE_COMPUTED_GOTO
+        case DISPATCH_THREADED:
+            return run_threaded(cpu, limit, stop_pc, warm);
+#endif
+        default:
+            return run_table(cpu, limit, stop_pc, warm);
+    }
+}
+
+DispatchMode dispatch_default_mode(void) {
+#if USE_THREADED_DISPATCH && HAVE_COMPUTED_GOTO
+    return DISPATCH_THREADED;
+#else
+    return DISPATCH_TABLE;
+#endif
+}
+
+const char* dispatch_mode_name(DispatchMode mode) {
+    switch (mode) {
+        case DISPATCH_SWITCH: return "switch";
+#if HAVE_COMPUTED_GOTO
+        case DISPATCH_THREADED: return "threaded";
+#endif
+        default: return "table";
+    }
+}
@@ -0,0 +1,74 @@
+#include "cpu.h"
+
+uint64_t cpu_fast_forward(CPU* cpu, uint64_t max_instructions, uint64_t stop_pc,
+                          uint32_t warm) {
+    cpu_drain_pipeline(cpu);
+
+    // Warming updates cache and predictor state but not their statistics
+    Cache* l1 = cpu->l1_cache;
+    uint64_t l1_hits = l1->hits, l1_misses = l1->misses, l1_accesses = l1->accesses;
+    uint64_t bp_correct = cpu->bp->correct, bp_total = cpu->bp->total;
+
+    uint64_t executed = dispatch_run(cpu, cpu->dispatch, max_instructions, stop_pc, warm);
+
+    l1->hits = l1_hits;
+    l1->misses = l1_misses;
+    l1->accesses = l1_accesses;
+    cpu->bp->correct = bp_correct;
+    cpu->bp->total = bp_total;
+
+    cpu->halted = false;
+    cpu->functional_instructions += executed;
+    return executed;
+}
+
+int cpu_run_sampled(CPU* cpu, const SamplingConfig* config, SamplingStats* stats) {
+    if (config->samples <= 0 || config->detail_cycles == 0) {
+        ERROR("Sampling needs at least one sample and detail cycles\n");
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(SamplingStats));
+    double sum = 0.0, sum_sq = 0.0;
+
+    for (int s = 0; s < config->samples; s++) {
+        uint64_t ff = cpu_fast_forward(cpu, config->fast_forward, NO_STOP_PC,
+                                       config->warm);
+        stats->functional_instructions += ff;
+
+        cpu_run(cpu, config->warmup_cycles);
+        uint64_t cycles = cpu->cycles;
+        uint64_t instructions = cpu->instructions;
+        cpu_run(cpu, config->detail_cycles);
+        cycles = cpu->cycles - cycles;
+        instructions = cpu->instructions - instructions;
+
+        if (instructions > 0) {
+            double cpi = (double)cycles / instructions;
+            stats->detailed_cycles += cycles;
+            stats->detailed_instructions += instructions;
+            sum += cpi;
+            sum_sq += cpi * cpi;
+            stats->samples++;
+        }
+
+        // Program ended during this sample
+        if (ff < config->fast_forward || cpu->halted) break;
+    }
+
+    if (stats->samples > 0) {
+        double mean = sum / stats->samples;
+        stats->cpi = (double)stats->detailed_cycles / stats->detailed_instructions;
+        stats->cpi_stddev = sqrt(MAX(sum_sq / stats->samples - mean * mean, 0.0));
+    }
+    return stats->samples;
+}
+
+void sampling_print_stats(const SamplingStats* stats) {
+    printf("\n=== Sampling Stats ===\n");
+    printf("Samples: %d\n", stats->samples);
+    printf("Functional instructions: %lu\n", stats->functional_instructions);
+    printf("Detailed cycles: %lu\n", stats->detailed_cycles);
+    printf("Detailed instructions: %lu\n", stats->detailed_instructions);
+    printf("CPI: %.3f (stddev %.3f)\n", stats->cpi, stats->cpi_stddev);
+}
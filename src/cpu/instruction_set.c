@@ -1,27 +1,6 @@
 #include "cpu.h"
 
-// Instruction formats
-typedef enum {
-    FORMAT_R,    // Register
-    FORMAT_I,    // Immediate
-    FORMAT_M,    // Memory
-    FORMAT_J,    // Jump
-    FORMAT_S     // System
-} InstructionFormat;
-
-// Instruction structure
-typedef struct {
-    InstructionType type;
-    InstructionFormat format;
-    uint8_t opcode;
-    uint8_t rd;      // Destination register
-    uint8_t rs1;     // Source register 1
-    uint8_t rs2;     // Source register 2
-    uint64_t imm;    // Immediate value
-    uint64_t address;
-} DecodedInstruction;
-
-// Instruction table
+// Instruction table, indexed by opcode
 static const struct {
     uint8_t opcode;
     InstructionType type;
@@ -51,6 +30,18 @@ static const struct {
     {0x14, INST_HLT,   FORMAT_S, "hlt"},
 };
 
+// Encoded length of each format
+static uint8_t format_size(InstructionFormat format) {
+    switch (format) {
+        case FORMAT_R: return 3;
+        case FORMAT_M: return 11;  // 3 + 8 for address
+        case FORMAT_I: return 10;  // 2 + 8 for immediate
+        case FORMAT_J: return 10;  // 2 + 8 for address
+        case FORMAT_S: return 1;
+        default: return 1;
+    }
+}
+
 // Decode instruction from memory
 DecodedInstruction decode_instruction(uint8_t* mem, uint64_t pc) {
     DecodedInstruction inst = {0};
@@ -59,14 +50,12 @@ DecodedInstruction decode_instruction(uint8_t* mem, uint64_t pc) {
     // Simple decoding (in real x86-64, this is much more complex)
     inst.opcode = ptr[0];
     inst.type = INST_NOP;
+    inst.pc = pc;
     
     // Look up in instruction table
-    for (size_t i = 0; i < ARRAY_SIZE(instruction_table); i++) {
-        if (instruction_table[i].opcode == inst.opcode) {
-            inst.type = instruction_table[i].type;
-            inst.format = instruction_table[i].format;
-            break;
-        }
+    if (inst.opcode < ARRAY_SIZE(instruction_table)) {
+        inst.type = instruction_table[inst.opcode].type;
+        inst.format = instruction_table[inst.opcode].format;
     }
     
     // Decode registers and immediate (simplified)
@@ -77,16 +66,53 @@ DecodedInstruction decode_instruction(uint8_t* mem, uint64_t pc) {
         
         if (inst.format == FORMAT_M) {
             // Memory instructions have address
-            inst.address = *(uint64_t*)(ptr + 3);
+            memcpy(&inst.address, ptr + 3, sizeof(uint64_t));
         }
     } else if (inst.format == FORMAT_I || inst.format == FORMAT_J) {
         inst.rd = (ptr[1] >> 4) & 0x0F;
-        inst.imm = *(uint64_t*)(ptr + 2);
+        memcpy(&inst.imm, ptr + 2, sizeof(uint64_t));
     }
     
+    inst.size = format_size(inst.format);
     return inst;
 }
 
+// Instructions that may redirect fetch end a basic block
+bool instruction_ends_block(InstructionType type) {
+    switch (type) {
+        case INST_JMP:
+        case INST_JZ:
+        case INST_JNZ:
+        case INST_CALL:
+        case INST_RET:
+        case INST_HLT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Instructions whose result is written to rd
+bool instruction_writes_register(InstructionType type) {
+    switch (type) {
+        case INST_ADD:
+        case INST_SUB:
+        case INST_MUL:
+        case INST_DIV:
+        case INST_AND:
+        case INST_OR:
+        case INST_XOR:
+        case INST_NOT:
+        case INST_SHL:
+        case INST_SHR:
+        case INST_LD:
+        case INST_MOV:
+            return true;
+        default:
+            return false;
+    }
+}
+
 // Encode instruction to memory
 uint32_t encode_instruction(DecodedInstruction inst, uint8_t* buffer) {
     uint32_t size = 1;  // Start with opcode
@@ -108,7 +134,7 @@ uint32_t encode_instruction(DecodedInstruction inst, uint8_t* buffer) {
             size = 3;
             
             if (inst.format == FORMAT_M) {
-                *(uint64_t*)(buffer + 3) = inst.address;
+                memcpy(buffer + 3, &inst.address, sizeof(uint64_t));
                 size += 8;
             }
             break;
@@ -116,7 +142,7 @@ uint32_t encode_instruction(DecodedInstruction inst, uint8_t* buffer) {
         case FORMAT_I:
         case FORMAT_J:
             buffer[1] = (inst.rd << 4);
-            *(uint64_t*)(buffer + 2) = inst.imm;
+            memcpy(buffer + 2, &inst.imm, sizeof(uint64_t));
             size = 10;
             break;
             
@@ -180,14 +206,9 @@ const char* disassemble_instruction(uint8_t* mem, uint64_t pc) {
 
 // Get instruction size in bytes
 uint32_t get_instruction_size(uint8_t* mem, uint64_t pc) {
-    DecodedInstruction inst = decode_instruction(mem, pc);
-    
-    switch (inst.format) {
-        case FORMAT_R: return 3;
-        case FORMAT_M: return 11;  // 3 + 8 for address
-        case FORMAT_I: return 10;  // 2 + 8 for immediate
-        case FORMAT_J: return 10;  // 2 + 8 for address
-        case FORMAT_S: return 1;
-        default: return 1;
+    InstructionFormat format = FORMAT_R;
+    if (mem[pc] < ARRAY_SIZE(instruction_table)) {
+        format = instruction_table[mem[pc]].format;
     }
-}
\ No newline at end of file
+    return format_size(format);
+}
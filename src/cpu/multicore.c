@@ -0,0 +1,433 @@
+#include "cpu.h"
+
+#define INBOX_INITIAL 64
+
+static inline L2Bank* line_bank(MulticoreSystem* sys, uint64_t line) {
+    return &sys->banks[line & (uint64_t)(sys->config.l2_banks - 1)];
+}
+
+// Banks split the line index, so each bank's cache sees the index with the
+// bank bits removed and uses all of its sets
+static inline uint64_t bank_address(MulticoreSystem* sys, uint64_t line) {
+    return (line >> __builtin_ctz(sys->config.l2_banks)) << sys->line_shift;
+}
+
+static void bank_lock(L2Bank* bank) {
+    if (pthread_mutex_trylock(&bank->lock) != 0) {
+        pthread_mutex_lock(&bank->lock);
+        bank->contended++;
+    }
+}
+
+MulticoreSystem* multicore_create(uint64_t mem_size, const MulticoreConfig* config) {
+    int banks = config->l2_banks;
+    int line_size = config->l2.line_size;
+    if (config->cores <= 0 || config->cores > MULTICORE_MAX_CORES ||
+        config->quantum == 0 || banks <= 0 || (banks & (banks - 1)) != 0 ||
+        line_size <= 0 || (line_size & (line_size - 1)) != 0 ||
+        config->l2.size < banks * line_size * config->l2.associativity) {
+        ERROR("Invalid multicore configuration\n");
+        return NULL;
+    }
+
+    MulticoreSystem* sys = (MulticoreSystem*)calloc(1, sizeof(MulticoreSystem));
+    if (!sys) return NULL;
+
+    sys->config = *config;
+    sys->mem_size = mem_size;
+    sys->line_shift = __builtin_ctz(line_size);
+    sys->lines = (mem_size + line_size - 1) >> sys->line_shift;
+
+    sys->memory = gmem_create(mem_size);
+    sys->directory = (DirectoryEntry*)calloc(sys->lines, sizeof(DirectoryEntry));
+    sys->banks = (L2Bank*)calloc(banks, sizeof(L2Bank));
+    sys->cores = (CPU**)calloc(config->cores, sizeof(CPU*));
+    sys->contexts = (CoreContext*)aligned_alloc(CACHE_LINE_SIZE,
+                                                config->cores * sizeof(CoreContext));
+    if (!sys->memory || !sys->directory || !sys->banks || !sys->cores || !sys->contexts) {
+        free(sys->contexts);
+        sys->contexts = NULL;
+        multicore_destroy(sys);
+        return NULL;
+    }
+    memset(sys->contexts, 0, config->cores * sizeof(CoreContext));
+
+    for (int b = 0; b < banks; b++) {
+        pthread_mutex_init(&sys->banks[b].lock, NULL);
+        sys->banks[b].cache = cache_create(config->l2.type, config->l2.size / banks,
+                                           line_size, config->l2.associativity);
+        if (!sys->banks[b].cache) {
+            multicore_destroy(sys);
+            return NULL;
+        }
+    }
+
+    for (int c = 0; c < config->cores; c++) {
+        CoreContext* ctx = &sys->contexts[c];
+        pthread_mutex_init(&ctx->inbox_lock, NULL);
+
+        CPU* cpu = cpu_create_shared(sys->memory);
+        sys->cores[c] = cpu;
+        if (!cpu) {
+            multicore_destroy(sys);
+            return NULL;
+        }
+        if (cpu->l1_cache->line_size != line_size) {
+            ERROR("L1 and L2 line sizes differ\n");
+            multicore_destroy(sys);
+            return NULL;
+        }
+        cpu->system = sys;
+        cpu->core_id = c;
+
+        ctx->l1_state = (uint8_t*)calloc(cache_line_count(cpu->l1_cache), sizeof(uint8_t));
+        ctx->inbox = (uint64_t*)malloc(INBOX_INITIAL * sizeof(uint64_t));
+        ctx->inbox_capacity = INBOX_INITIAL;
+        if (!ctx->l1_state || !ctx->inbox) {
+            multicore_destroy(sys);
+            return NULL;
+        }
+    }
+
+    return sys;
+}
+
+void multicore_destroy(MulticoreSystem* sys) {
+    if (!sys) return;
+
+    for (int c = 0; sys->cores && c < sys->config.cores; c++) {
+        cpu_destroy(sys->cores[c]);
+    }
+    for (int c = 0; sys->contexts && c < sys->config.cores; c++) {
+        free(sys->contexts[c].l1_state);
+        free(sys->contexts[c].inbox);
+        pthread_mutex_destroy(&sys->contexts[c].inbox_lock);
+    }
+    for (int b = 0; sys->banks && b < sys->config.l2_banks; b++) {
+        cache_destroy(sys->banks[b].cache);
+        pthread_mutex_destroy(&sys->banks[b].lock);
+    }
+
+    free(sys->cores);
+    free(sys->contexts);
+    free(sys->banks);
+    free(sys->directory);
+    gmem_destroy(sys->memory);
+    free(sys);
+}
+
+// Reset every core and forget all coherence state. Cached tags survive but
+// count as misses until the directory grants them again.
+void multicore_reset(MulticoreSystem* sys) {
+    for (int c = 0; c < sys->config.cores; c++) {
+        CoreContext* ctx = &sys->contexts[c];
+        cpu_reset(sys->cores[c]);
+        memset(ctx->l1_state, 0, cache_line_count(sys->cores[c]->l1_cache));
+        ctx->inbox_count = 0;
+        ctx->upgrades = 0;
+        ctx->invalidations = 0;
+        ctx->transfers = 0;
+        ctx->stall_cycles = 0;
+    }
+    for (int b = 0; b < sys->config.l2_banks; b++) {
+        sys->banks[b].accesses = 0;
+        sys->banks[b].contended = 0;
+    }
+    memset(sys->directory, 0, sys->lines * sizeof(DirectoryEntry));
+    sys->cycles = 0;
+    sys->quanta = 0;
+    sys->elapsed_us = 0;
+}
+
+// Load one image into shared memory and point every core at it
+int multicore_load_program(MulticoreSystem* sys, uint8_t* program, uint64_t size,
+                           uint64_t address) {
+    if (address + size > sys->mem_size) {
+        ERROR("Program too large for memory\n");
+        return -1;
+    }
+    gmem_write(sys->memory, address, program, size);
+    for (int c = 0; c < sys->config.cores; c++) {
+        predecode_invalidate(sys->cores[c]->predecode, address, size);
+        sys->cores[c]->pc = address;
+    }
+    return 0;
+}
+
+// Queue a message for another core; called with the line's bank held
+static void inbox_post(CoreContext* ctx, uint64_t line, bool downgrade) {
+    pthread_mutex_lock(&ctx->inbox_lock);
+    if (ctx->inbox_count == ctx->inbox_capacity) {
+        uint64_t* grown = (uint64_t*)realloc(ctx->inbox,
+                                             2 * ctx->inbox_capacity * sizeof(uint64_t));
+        if (!grown) {
+            pthread_mutex_unlock(&ctx->inbox_lock);
+            ERROR("Coherence inbox full, message dropped\n");
+            return;
+        }
+        ctx->inbox = grown;
+        ctx->inbox_capacity *= 2;
+    }
+    ctx->inbox[ctx->inbox_count] = line << 1 | downgrade;
+    __atomic_store_n(&ctx->inbox_count, ctx->inbox_count + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctx->inbox_lock);
+}
+
+// Apply pending invalidations and downgrades; only the owning core calls it
+static void inbox_apply(MulticoreSystem* sys, int core) {
+    CoreContext* ctx = &sys->contexts[core];
+    if (__atomic_load_n(&ctx->inbox_count, __ATOMIC_ACQUIRE) == 0) return;
+
+    Cache* l1 = sys->cores[core]->l1_cache;
+    pthread_mutex_lock(&ctx->inbox_lock);
+    for (size_t i = 0; i < ctx->inbox_count; i++) {
+        uint64_t msg = ctx->inbox[i];
+        int line = cache_lookup_line(l1, (msg >> 1) << sys->line_shift, false);
+        if (line < 0 || ctx->l1_state[line] == MESI_INVALID) continue;
+
+        if (msg & 1) {
+            ctx->l1_state[line] = MESI_SHARED;
+        } else {
+            ctx->l1_state[line] = MESI_INVALID;
+            cache_invalidate_line(l1, line);
+            ctx->invalidations++;
+        }
+    }
+    __atomic_store_n(&ctx->inbox_count, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ctx->inbox_lock);
+}
+
+// Drop core from the directory entry of a line its L1 evicted
+static void directory_evict(MulticoreSystem* sys, int core, uint64_t addr, uint8_t state) {
+    uint64_t line = addr >> sys->line_shift;
+    L2Bank* bank = line_bank(sys, line);
+    DirectoryEntry* dir = &sys->directory[line];
+
+    bank_lock(bank);
+    if (state == MESI_MODIFIED) {
+        cache_access(bank->cache, bank_address(sys, line), true);
+    }
+    if (dir->sharers & BIT(core)) {
+        dir->sharers &= ~BIT(core);
+        if (!dir->sharers) dir->state = MESI_INVALID;
+    }
+    pthread_mutex_unlock(&bank->lock);
+}
+
+// Coherent L1 access for one core. Hits stay private to the core; misses
+// and upgrades take the home bank's lock, update the directory, queue
+// messages for other holders, and install the line. Returns the latency.
+int multicore_access(MulticoreSystem* sys, int core, uint64_t addr, bool is_write) {
+    CoreContext* ctx = &sys->contexts[core];
+    Cache* l1 = sys->cores[core]->l1_cache;
+    inbox_apply(sys, core);
+
+    l1->accesses++;
+    int handle = cache_lookup_line(l1, addr, true);
+    uint8_t state = handle >= 0 ? ctx->l1_state[handle] : MESI_INVALID;
+    if (state == MESI_MODIFIED || state == MESI_EXCLUSIVE ||
+        (state == MESI_SHARED && !is_write)) {
+        if (is_write) ctx->l1_state[handle] = MESI_MODIFIED;
+        l1->hits++;
+        return l1->hit_time;
+    }
+    l1->misses++;
+
+    uint64_t line = addr >> sys->line_shift;
+    if (line >= sys->lines) return l1->miss_penalty;
+
+    L2Bank* bank = line_bank(sys, line);
+    DirectoryEntry* dir = &sys->directory[line];
+    int latency = l1->hit_time + sys->config.l2_latency;
+
+    bank_lock(bank);
+    bank->accesses++;
+
+    // An EXCLUSIVE owner may have written the line since: hits move E to M
+    // without telling the directory
+    uint64_t others = dir->sharers & ~BIT(core);
+    bool remote_dirty = others && (dir->state == MESI_MODIFIED || dir->state == MESI_EXCLUSIVE);
+    uint8_t granted;
+    if (is_write) {
+        for (uint64_t bits = others; bits; bits &= bits - 1) {
+            inbox_post(&sys->contexts[__builtin_ctzll(bits)], line, false);
+        }
+        dir->sharers = BIT(core);
+        dir->state = granted = MESI_MODIFIED;
+        dir->owner = core;
+    } else if (others) {
+        if (dir->state != MESI_SHARED) inbox_post(&sys->contexts[dir->owner], line, true);
+        dir->sharers |= BIT(core);
+        dir->state = granted = MESI_SHARED;
+    } else {
+        dir->sharers = BIT(core);
+        dir->state = granted = MESI_EXCLUSIVE;
+        dir->owner = core;
+    }
+
+    if (state == MESI_SHARED) {
+        // Upgrade: the data is already here, only ownership moves
+        ctx->upgrades++;
+    } else if (remote_dirty) {
+        ctx->transfers++;
+        latency += sys->config.l2_latency;
+    } else if (cache_access(bank->cache, bank_address(sys, line), is_write) !=
+               bank->cache->hit_time) {
+        latency += sys->config.memory_latency;
+    }
+
+    // Install under the bank lock: messages for this line sent before the
+    // grant are applied first, any sent after it arrive later
+    inbox_apply(sys, core);
+    uint64_t evicted;
+    handle = cache_fill_line(l1, addr, &evicted);
+    uint8_t evicted_state = ctx->l1_state[handle];
+    ctx->l1_state[handle] = granted;
+    pthread_mutex_unlock(&bank->lock);
+
+    if (evicted != UINT64_MAX && evicted_state != MESI_INVALID) {
+        directory_evict(sys, core, evicted, evicted_state);
+    }
+
+    ctx->stall_cycles += latency - l1->hit_time;
+    return latency;
+}
+
+typedef struct {
+    MulticoreSystem* sys;
+    pthread_mutex_t gate;
+    pthread_barrier_t barrier;
+    int threads;
+    uint64_t end;               // stop once sys->cycles reaches it
+    uint64_t step;              // cycles in the current quantum
+    bool done;
+} RunControl;
+
+typedef struct {
+    RunControl* ctl;
+    int id;
+} RunWorker;
+
+// Each worker owns cores id, id + threads, ... for the whole run
+static void* run_worker(void* arg) {
+    RunWorker* w = (RunWorker*)arg;
+    RunControl* ctl = w->ctl;
+    MulticoreSystem* sys = ctl->sys;
+
+    // Held by the caller until the worker count is final
+    pthread_mutex_lock(&ctl->gate);
+    pthread_mutex_unlock(&ctl->gate);
+
+    for (;;) {
+        for (int c = w->id; c < sys->config.cores; c += ctl->threads) {
+            CPU* cpu = sys->cores[c];
+            if (cpu->halted) continue;
+            cpu_run(cpu, ctl->step);
+            // Retire what follows the HLT; a mispredict may clear halted
+            if (cpu->halted) cpu_drain_pipeline(cpu);
+        }
+
+        if (pthread_barrier_wait(&ctl->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+            sys->cycles += ctl->step;
+            sys->quanta++;
+
+            bool running = false;
+            for (int c = 0; c < sys->config.cores; c++) {
+                if (!sys->cores[c]->halted) running = true;
+            }
+            ctl->done = !running || sys->cycles >= ctl->end;
+            ctl->step = MIN(sys->config.quantum, ctl->end - sys->cycles);
+        }
+        pthread_barrier_wait(&ctl->barrier);
+        if (ctl->done) break;
+    }
+    return NULL;
+}
+
+// Run every core in lock-step quanta until all have halted or max_cycles
+// (0 = no limit) have passed. Returns the cycles simulated.
+uint64_t multicore_run(MulticoreSystem* sys, uint64_t max_cycles) {
+    int threads = sys->config.threads > 0 ? sys->config.threads : parallel_default_threads();
+    threads = MIN(threads, sys->config.cores);
+
+    RunControl ctl = { .sys = sys };
+    uint64_t start_cycles = sys->cycles;
+    ctl.end = max_cycles ? sys->cycles + max_cycles : UINT64_MAX;
+    ctl.step = MIN(sys->config.quantum, ctl.end - sys->cycles);
+    pthread_mutex_init(&ctl.gate, NULL);
+
+    pthread_t* tids = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    RunWorker* workers = (RunWorker*)calloc(threads, sizeof(RunWorker));
+    if (!tids || !workers) {
+        free(tids);
+        free(workers);
+        pthread_mutex_destroy(&ctl.gate);
+        return 0;
+    }
+
+    uint64_t start = get_time_us();
+
+    // Worker 0 runs on the calling thread; cores of workers that failed to
+    // start go to the ones that did
+    pthread_mutex_lock(&ctl.gate);
+    int started = 1;
+    for (int i = 0; i < threads; i++) {
+        workers[i].ctl = &ctl;
+        workers[i].id = i;
+    }
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&tids[i], NULL, run_worker, &workers[i]) != 0) break;
+        started++;
+    }
+    ctl.threads = started;
+    pthread_barrier_init(&ctl.barrier, NULL, started);
+    pthread_mutex_unlock(&ctl.gate);
+
+    run_worker(&workers[0]);
+
+    for (int i = 1; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    sys->elapsed_us += get_time_us() - start;
+    sys->threads_used = started;
+
+    pthread_barrier_destroy(&ctl.barrier);
+    pthread_mutex_destroy(&ctl.gate);
+    free(tids);
+    free(workers);
+    return sys->cycles - start_cycles;
+}
+
+void multicore_print_stats(MulticoreSystem* sys) {
+    uint64_t instructions = 0;
+
+    printf("\n=== Multicore Stats ===\n");
+    printf("Cores: %d on %d host threads, quantum %lu cycles\n",
+           sys->config.cores, sys->threads_used, sys->config.quantum);
+    printf("%-5s %-12s %-12s %-6s %-9s %-9s %-9s %-9s\n", "Core", "Cycles",
+           "Insts", "IPC", "L1 hit%", "Upgrades", "Invals", "Xfers");
+    for (int c = 0; c < sys->config.cores; c++) {
+        CPU* cpu = sys->cores[c];
+        CoreContext* ctx = &sys->contexts[c];
+        Cache* l1 = cpu->l1_cache;
+        instructions += cpu->instructions;
+        printf("%-5d %-12lu %-12lu %-6.2f %-9.2f %-9lu %-9lu %-9lu\n", c,
+               cpu->cycles, cpu->instructions,
+               cpu->cycles > 0 ? (double)cpu->instructions / cpu->cycles : 0.0,
+               l1->accesses > 0 ? 100.0 * l1->hits / l1->accesses : 0.0,
+               ctx->upgrades, ctx->invalidations, ctx->transfers);
+    }
+
+    printf("%-5s %-12s %-12s %-9s\n", "Bank", "Accesses", "Contended", "L2 hit%");
+    for (int b = 0; b < sys->config.l2_banks; b++) {
+        L2Bank* bank = &sys->banks[b];
+        printf("%-5d %-12lu %-12lu %-9.2f\n", b, bank->accesses, bank->contended,
+               bank->cache->accesses > 0 ?
+               100.0 * bank->cache->hits / bank->cache->accesses : 0.0);
+    }
+
+    printf("Quanta: %lu, simulated cycles: %lu\n", sys->quanta, sys->cycles);
+    printf("Host time: %lu us (%.2f M instructions/s)\n", sys->elapsed_us,
+           sys->elapsed_us > 0 ? (double)instructions / sys->elapsed_us : 0.0);
+}
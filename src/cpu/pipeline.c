@@ -8,26 +8,32 @@ static uint64_t sign_extend(uint64_t value, int bits) {
     return (value ^ mask) - mask;
 }
 
+static inline bool is_branch(InstructionType type) {
+    return type == INST_JMP || type == INST_JZ || type == INST_JNZ;
+}
+
 static bool check_hazard(CPU* cpu, PipelineStage stage, uint64_t reg) {
     for (int i = stage + 1; i <= STAGE_COMMIT; i++) {
-        if (cpu->pipeline[i].dest == reg && cpu->pipeline[i].type != INST_NOP) {
+        if (cpu->pipeline[i].dest == reg &&
+            instruction_writes_register(cpu->pipeline[i].type)) {
             return true;
         }
     }
     return false;
 }
 
-// Create CPU
-CPU* cpu_create(uint64_t mem_size) {
+// Create CPU around guest memory it does not own
+CPU* cpu_create_shared(GuestMemory* memory) {
     CPU* cpu = (CPU*)malloc(sizeof(CPU));
     if (!cpu) return NULL;
+    cpu->ooo = NULL;
+    cpu->trace = NULL;
+    cpu->system = NULL;
+    cpu->core_id = 0;
+    cpu->owns_memory = false;
     
-    cpu->mem_size = mem_size;
-    cpu->memory = (uint8_t*)malloc(mem_size);
-    if (!cpu->memory) {
-        free(cpu);
-        return NULL;
-    }
+    cpu->mem_size = memory->size;
+    cpu->memory = memory;
     
     // Initialize caches
     cpu->l1_cache = cache_create(CACHE_SET_ASSOC, 32 * KiB, 64, 8);
@@ -36,16 +42,55 @@ CPU* cpu_create(uint64_t mem_size) {
     // Initialize branch predictor
     cpu->bp = bp_create(PREDICTOR_BIMODAL, 12, 4096);
     
+    cpu->dispatch = dispatch_default_mode();
+    
+    // Initialize predecode cache
+    cpu->predecode = predecode_create(cpu->memory, DEFAULT_PREDECODE_BLOCKS);
+    
+#if ENABLE_PROFILER
+    cpu->prof = profiler_create();
+#endif
+    
+#if FEATURE_OUT_OF_ORDER
+    OoOConfig ooo_config = {
+        .rob_size = DEFAULT_OOO_ROB_SIZE,
+        .rs_count = DEFAULT_OOO_RS_COUNT,
+        .dispatch_width = DEFAULT_OOO_WIDTH,
+        .issue_width = DEFAULT_OOO_WIDTH,
+        .commit_width = DEFAULT_OOO_WIDTH,
+    };
+    cpu->ooo = tomasulo_create(cpu, &ooo_config);
+#endif
+    
     cpu_reset(cpu);
     return cpu;
 }
 
+// Create CPU
+CPU* cpu_create(uint64_t mem_size) {
+    GuestMemory* memory = gmem_create(mem_size);
+    if (!memory) return NULL;
+    
+    CPU* cpu = cpu_create_shared(memory);
+    if (!cpu) {
+        gmem_destroy(memory);
+        return NULL;
+    }
+    cpu->owns_memory = true;
+    return cpu;
+}
+
 void cpu_destroy(CPU* cpu) {
     if (cpu) {
-        free(cpu->memory);
+        if (cpu->owns_memory) gmem_destroy(cpu->memory);
         cache_destroy(cpu->l1_cache);
         cache_destroy(cpu->l2_cache);
         bp_destroy(cpu->bp);
+        predecode_destroy(cpu->predecode);
+        tomasulo_destroy(cpu->ooo);
+#if ENABLE_PROFILER
+        profiler_destroy(cpu->prof);
+#endif
         free(cpu);
     }
 }
@@ -61,12 +106,20 @@ void cpu_reset(CPU* cpu) {
         cpu->pipeline[i].type = INST_NOP;
     }
     cpu->current_stage = STAGE_FETCH;
+    cpu->fetch_block = NULL;
+    cpu->fetch_slot = 0;
+    cpu->halted = false;
+    cpu->draining = false;
     
     cpu->cycles = 0;
     cpu->instructions = 0;
+    cpu->functional_instructions = 0;
     cpu->stalls = 0;
     cpu->bubbles = 0;
+    cpu->mem_stall = 0;
     cpu->start_time = get_time_ms();
+    
+    if (cpu->ooo) tomasulo_reset(cpu->ooo);
 }
 
 int cpu_load_program(CPU* cpu, uint8_t* program, uint64_t size, uint64_t address) {
@@ -74,7 +127,8 @@ int cpu_load_program(CPU* cpu, uint8_t* program, uint64_t size, uint64_t address
         ERROR("Program too large for memory\n");
         return -1;
     }
-    memcpy(cpu->memory + address, program, size);
+    gmem_write(cpu->memory, address, program, size);
+    predecode_invalidate(cpu->predecode, address, size);
     cpu->pc = address;
     return 0;
 }
@@ -83,47 +137,82 @@ int cpu_load_program(CPU* cpu, uint8_t* program, uint64_t size, uint64_t address
 static void stage_fetch(CPU* cpu) {
     PipelineRegister* pr = &cpu->pipeline[STAGE_FETCH];
     
+    // Check for branch misprediction: the branch resolved in execute this
+    // cycle, so only the younger decode and fetch slots are on the wrong path
+    PipelineRegister* ex = &cpu->pipeline[STAGE_EXECUTE];
+    if (!ex->bubble && is_branch(ex->type) && ex->result != ex->predicted_pc) {
+        cpu->pipeline[STAGE_DECODE].type = INST_NOP;
+        cpu->pipeline[STAGE_DECODE].bubble = true;
+        pr->stall = false;
+        cpu->pc = ex->result;
+        cpu->halted = false;
+        cpu->bubbles += BRANCH_MISPREDICT_PENALTY;
+        PROF_PC(cpu, ex->pc, flushes, 1);
+    }
+    
     if (pr->stall) {
         cpu->stalls++;
         return;
     }
     
-    // Check for branch misprediction
-    if (cpu->pipeline[STAGE_EXECUTE].type == INST_JMP ||
-        cpu->pipeline[STAGE_EXECUTE].type == INST_JZ ||
-        cpu->pipeline[STAGE_EXECUTE].type == INST_JNZ) {
-        
-        bool taken = cpu->pipeline[STAGE_EXECUTE].result != 0;
-        bool predicted = bp_predict(cpu->bp, cpu->pipeline[STAGE_EXECUTE].pc);
-        
-        if (taken != predicted) {
-            // Misprediction - flush pipeline
-            for (int i = STAGE_DECODE; i <= STAGE_COMMIT; i++) {
-                cpu->pipeline[i].type = INST_NOP;
-                cpu->pipeline[i].bubble = true;
-            }
-            cpu->pc = cpu->pipeline[STAGE_EXECUTE].result;
-            cpu->bubbles += 3;  // 3 cycle penalty
-        }
+    // Past a HLT, or draining for a handoff: insert bubbles
+    if (cpu->halted || cpu->draining) {
+        pr->type = INST_NOP;
+        pr->bubble = true;
+        return;
     }
     
     // Access instruction cache
-    cache_access(cpu->l1_cache, cpu->pc, false);
+    cpu_mem_access(cpu, cpu->pc, false);
+    if (cpu->trace) trace_write_fetch(cpu->trace, cpu->pc);
+    
+    // Continue through the current predecoded block, or look up the block
+    // starting at pc after a redirect or at the end of the last one
+    const DecodedBlock* block = cpu->fetch_block;
+    int slot = cpu->fetch_slot;
+    if (!block || !block->valid || slot >= block->count ||
+        block->insts[slot].pc != cpu->pc) {
+        block = predecode_lookup(cpu->predecode, cpu->pc);
+        slot = 0;
+    }
     
-    // Simple instruction fetch (in real implementation, decode opcode)
-    uint8_t opcode = cpu->memory[cpu->pc];
     pr->pc = cpu->pc;
-    pr->opcode = opcode;
     pr->cycle_entered = cpu->cycles;
     
-    // Map to instruction type (simplified)
-    if (opcode < 20) {
-        pr->type = opcode;
-    } else {
+    if (!block) {
+        // Fetch outside memory
         pr->type = INST_NOP;
+        pr->bubble = true;
+        cpu->fetch_block = NULL;
+        return;
     }
     
-    cpu->pc++;
+    const DecodedInstruction* inst = &block->insts[slot];
+    pr->bubble = false;
+    pr->type = inst->type;
+    pr->opcode = inst->opcode;
+    pr->src1 = inst->rs1;       // register numbers until decode reads them
+    pr->src2 = inst->rs2;
+    pr->dest = inst->rd;
+    pr->immediate = inst->imm;
+    pr->mem_addr = inst->address;
+    pr->next_pc = cpu->pc + inst->size;
+    pr->predicted_pc = pr->next_pc;
+    
+    // Direct branches: follow the predictor to the encoded target
+    if (is_branch(inst->type) && bp_predict(cpu->bp, inst->pc)) {
+        pr->predicted_pc = inst->imm;
+    }
+    
+    cpu->fetch_block = block;
+    cpu->fetch_slot = slot + 1;
+    cpu->pc = pr->predicted_pc;
+    
+    // Hold pc on HLT so a handoff resumes at it
+    if (inst->type == INST_HLT) {
+        cpu->halted = true;
+        cpu->pc = inst->pc;
+    }
 }
 
 // Decode stage
@@ -139,20 +228,27 @@ static void stage_decode(CPU* cpu) {
     
     // Check for data hazards
     if (check_hazard(cpu, STAGE_DECODE, prev->src1) ||
-        check_hazard(cpu, STAGE_DECODE, prev->src2)) {
+        check_hazard(cpu, STAGE_DECODE, prev->src2) ||
+        (prev->type == INST_ST && check_hazard(cpu, STAGE_DECODE, prev->dest))) {
         // Stall pipeline
         cpu->pipeline[STAGE_FETCH].stall = true;
         pr->type = INST_NOP;
+        pr->bubble = true;
         cpu->stalls++;
+        PROF_PC(cpu, prev->pc, stalls, 1);
         return;
     }
     
+    PROF_RESIDENCY(cpu, STAGE_FETCH, cpu->cycles - prev->cycle_entered);
     *pr = *prev;
     pr->cycle_entered = cpu->cycles;
     
-    // Simple register read (in real implementation, read from register file)
-    pr->src1 = cpu->registers[pr->opcode & 0x0F];
-    pr->src2 = cpu->registers[(pr->opcode >> 4) & 0x0F];
+    // Register read
+    pr->src1 = cpu->registers[pr->src1 & 0x0F];
+    pr->src2 = cpu->registers[pr->src2 & 0x0F];
+    if (pr->type == INST_ST) {
+        pr->mem_data = cpu->registers[pr->dest & 0x0F];
+    }
 }
 
 // Execute stage
@@ -166,60 +262,29 @@ static void stage_execute(CPU* cpu) {
         return;
     }
     
+    PROF_RESIDENCY(cpu, STAGE_DECODE, cpu->cycles - prev->cycle_entered);
     *pr = *prev;
     pr->cycle_entered = cpu->cycles;
     
-    // Execute based on instruction type
-    switch (pr->type) {
-        case INST_ADD:
-            pr->result = pr->src1 + pr->src2;
-            break;
-        case INST_SUB:
-            pr->result = pr->src1 - pr->src2;
-            break;
-        case INST_MUL:
-            pr->result = pr->src1 * pr->src2;
-            break;
-        case INST_AND:
-            pr->result = pr->src1 & pr->src2;
-            break;
-        case INST_OR:
-            pr->result = pr->src1 | pr->src2;
-            break;
-        case INST_XOR:
-            pr->result = pr->src1 ^ pr->src2;
-            break;
-        case INST_SHL:
-            pr->result = pr->src1 << (pr->src2 & 0x3F);
-            break;
-        case INST_SHR:
-            pr->result = pr->src1 >> (pr->src2 & 0x3F);
-            break;
-        case INST_JMP:
-            pr->result = pr->immediate;
-            break;
-        case INST_JZ:
-            pr->result = (pr->src1 == 0) ? pr->immediate : (pr->pc + 1);
-            break;
-        case INST_JNZ:
-            pr->result = (pr->src1 != 0) ? pr->immediate : (pr->pc + 1);
-            break;
-        case INST_CMP:
-            cpu->flags = pr->src1 - pr->src2;
-            pr->result = cpu->flags;
-            break;
-        case INST_MOV:
-            pr->result = pr->src1;
-            break;
-        default:
-            pr->result = 0;
-    }
-    
-    // Update branch predictor
-    if (pr->type == INST_JMP || pr->type == INST_JZ || pr->type == INST_JNZ) {
-        bool taken = pr->result != (pr->pc + 1);
-        bool predicted = bp_predict(cpu->bp, pr->pc);
+    // Execute through the shared handler table
+    pr->result = exec_handlers[pr->type](pr->src1, pr->src2, pr->immediate, pr->next_pc);
+    if (pr->type == INST_CMP) {
+        cpu->flags = pr->result;
+    }
+    
+    // Update branch predictor with the prediction made at fetch
+    if (is_branch(pr->type)) {
+        bool taken = pr->result != pr->next_pc;
+        bool predicted = pr->predicted_pc != pr->next_pc;
         bp_update(cpu->bp, pr->pc, taken, predicted);
+        if (cpu->trace) {
+            BranchRecord record = {
+                .pc = pr->pc, .target = pr->immediate, .taken = taken,
+                .kind = pr->type == INST_JMP ? BRANCH_JUMP : BRANCH_CONDITIONAL,
+                .size = (uint8_t)(pr->next_pc - pr->pc),
+            };
+            trace_write_branch(cpu->trace, &record);
+        }
     }
 }
 
@@ -234,20 +299,32 @@ static void stage_memory(CPU* cpu) {
         return;
     }
     
+    PROF_RESIDENCY(cpu, STAGE_EXECUTE, cpu->cycles - prev->cycle_entered);
     *pr = *prev;
     pr->cycle_entered = cpu->cycles;
     
     // Handle memory operations
+    if ((pr->type == INST_LD || pr->type == INST_ST) &&
+        pr->mem_addr > cpu->mem_size - sizeof(uint64_t)) {
+        // Out of range access
+        pr->result = 0;
+        return;
+    }
+    
+    // The pipeline blocks for whatever the access takes beyond an L1 hit
     if (pr->type == INST_LD) {
         // Load from memory
-        cache_access(cpu->l1_cache, pr->mem_addr, false);
-        uint64_t* data = (uint64_t*)(cpu->memory + pr->mem_addr);
-        pr->result = *data;
+        int latency = cpu_mem_access(cpu, pr->mem_addr, false);
+        cpu->mem_stall = latency - cpu->l1_cache->hit_time;
+        if (cpu->trace) trace_write_mem(cpu->trace, pr->mem_addr, false);
+        pr->result = gmem_load64(cpu->memory, pr->mem_addr);
     } else if (pr->type == INST_ST) {
-        // Store to memory
-        cache_access(cpu->l1_cache, pr->mem_addr, true);
-        uint64_t* data = (uint64_t*)(cpu->memory + pr->mem_addr);
-        *data = pr->mem_data;
+        // Store to memory; drops predecoded blocks if it lands on code
+        int latency = cpu_mem_access(cpu, pr->mem_addr, true);
+        cpu->mem_stall = latency - cpu->l1_cache->hit_time;
+        if (cpu->trace) trace_write_mem(cpu->trace, pr->mem_addr, true);
+        gmem_store64(cpu->memory, pr->mem_addr, pr->mem_data);
+        predecode_invalidate(cpu->predecode, pr->mem_addr, sizeof(uint64_t));
     }
 }
 
@@ -262,11 +339,12 @@ static void stage_writeback(CPU* cpu) {
         return;
     }
     
+    PROF_RESIDENCY(cpu, STAGE_MEMORY, cpu->cycles - prev->cycle_entered);
     *pr = *prev;
     pr->cycle_entered = cpu->cycles;
     
     // Write back to register file
-    if (pr->dest < 16) {
+    if (instruction_writes_register(pr->type) && pr->dest < 16) {
         cpu->registers[pr->dest] = pr->result;
     }
     
@@ -282,6 +360,7 @@ static void stage_commit(CPU* cpu) {
         pr->type = INST_NOP;
         pr->bubble = false;  // Clear bubble
     } else {
+        PROF_RESIDENCY(cpu, STAGE_WRITEBACK, cpu->cycles - prev->cycle_entered);
         *pr = *prev;
     }
     
@@ -291,30 +370,92 @@ static void stage_commit(CPU* cpu) {
 
 // Single CPU step
 void cpu_step(CPU* cpu) {
+    if (cpu->mem_stall > 0) {
+        cpu->mem_stall--;
+        cpu->stalls++;
+        cpu->cycles++;
+        PROF_PC(cpu, cpu->pipeline[STAGE_MEMORY].pc, mem_cycles, 1);
+        return;
+    }
+    
     // Advance pipeline in reverse order
-    stage_commit(cpu);
-    stage_writeback(cpu);
-    stage_memory(cpu);
-    stage_execute(cpu);
-    stage_decode(cpu);
-    stage_fetch(cpu);
+    PROF_REGION(cpu, STAGE_COMMIT, stage_commit(cpu));
+    PROF_REGION(cpu, STAGE_WRITEBACK, stage_writeback(cpu));
+    PROF_REGION(cpu, STAGE_MEMORY, stage_memory(cpu));
+    PROF_REGION(cpu, STAGE_EXECUTE, stage_execute(cpu));
+    PROF_REGION(cpu, STAGE_DECODE, stage_decode(cpu));
+    PROF_REGION(cpu, STAGE_FETCH, stage_fetch(cpu));
     
     cpu->cycles++;
 }
 
 // Run for specified cycles
 void cpu_run(CPU* cpu, uint64_t cycles) {
+#if FEATURE_OUT_OF_ORDER
+    if (cpu->ooo) {
+        tomasulo_run(cpu->ooo, cycles);
+        return;
+    }
+#endif
     for (uint64_t i = 0; i < cycles; i++) {
         cpu_step(cpu);
     }
 }
 
+// Route a memory access through the coherent hierarchy when the core
+// belongs to a multicore system. Returns the access latency.
+int cpu_mem_access(CPU* cpu, uint64_t addr, bool is_write) {
+    int latency;
+    if (cpu->system) {
+        PROF_REGION(cpu, PROF_CACHE,
+                    latency = multicore_access(cpu->system, cpu->core_id, addr, is_write));
+    } else {
+        PROF_REGION(cpu, PROF_CACHE, latency = cache_access(cpu->l1_cache, addr, is_write));
+    }
+    return latency;
+}
+
+// Let everything in flight retire without fetching more, leaving pc at the
+// next architectural instruction. Used before handing off to functional mode.
+void cpu_drain_pipeline(CPU* cpu) {
+    cpu->draining = true;
+    if (cpu->ooo) {
+        // Bounded by the slowest op retiring behind a full ROB
+        for (int i = 0; i < cpu->ooo->config.rob_size * 64 && cpu->ooo->rob_count > 0; i++) {
+            tomasulo_step(cpu->ooo);
+        }
+        tomasulo_flush(cpu->ooo);
+    }
+    for (int i = 0; i < 64; i++) {
+        bool busy = false;
+        for (int s = STAGE_FETCH; s <= STAGE_MEMORY; s++) {
+            if (!cpu->pipeline[s].bubble && cpu->pipeline[s].type != INST_NOP) {
+                busy = true;
+                break;
+            }
+        }
+        if (!busy) break;
+        do {
+            cpu_step(cpu);
+        } while (cpu->mem_stall > 0);
+    }
+    cpu->draining = false;
+    
+    for (int i = 0; i < 6; i++) {
+        cpu->pipeline[i].type = INST_NOP;
+        cpu->pipeline[i].bubble = false;
+        cpu->pipeline[i].stall = false;
+    }
+    cpu->fetch_block = NULL;
+}
+
 void cpu_print_stats(CPU* cpu) {
     uint64_t elapsed = get_time_ms() - cpu->start_time;
     
     printf("\n=== CPU Statistics ===\n");
     printf("Cycles: %lu\n", cpu->cycles);
     printf("Instructions: %lu\n", cpu->instructions);
+    printf("Functional instructions: %lu\n", cpu->functional_instructions);
     printf("CPI: %.2f\n", (float)cpu->cycles / cpu->instructions);
     printf("Stalls: %lu\n", cpu->stalls);
     printf("Pipeline bubbles: %lu\n", cpu->bubbles);
@@ -323,6 +464,11 @@ void cpu_print_stats(CPU* cpu) {
     cache_print_stats(cpu->l1_cache);
     cache_print_stats(cpu->l2_cache);
     bp_print_stats(cpu->bp);
+    predecode_print_stats(cpu->predecode);
+    if (cpu->ooo) tomasulo_print_stats(cpu->ooo);
+#if ENABLE_PROFILER
+    if (cpu->prof) profiler_print(cpu->prof);
+#endif
 }
 
 void cpu_print_registers(CPU* cpu) {
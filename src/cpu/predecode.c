@@ -0,0 +1,140 @@
+#include "cpu.h"
+
+// Longest encoding; decode works on a copy of this many bytes, zero past
+// the end of guest memory
+#define MAX_INSTRUCTION_SIZE 11
+
+static inline uint64_t predecode_slot(PredecodeCache* pc, uint64_t addr) {
+    return (addr ^ (addr >> 9)) & (uint64_t)(pc->block_count - 1);
+}
+
+static inline void mark_page(PredecodeCache* pc, uint64_t page) {
+    pc->code_pages[page / 64] |= BIT(page % 64);
+}
+
+static inline bool page_has_code(PredecodeCache* pc, uint64_t page) {
+    return TEST_BIT(pc->code_pages[page / 64], page % 64);
+}
+
+PredecodeCache* predecode_create(const GuestMemory* memory, int block_count) {
+    if (block_count <= 0 || (block_count & (block_count - 1)) != 0) {
+        ERROR("Predecode block count must be a power of two\n");
+        return NULL;
+    }
+
+    PredecodeCache* pc = (PredecodeCache*)calloc(1, sizeof(PredecodeCache));
+    if (!pc) return NULL;
+
+    uint64_t mem_size = memory->size;
+    uint64_t pages = (mem_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    pc->blocks = (DecodedBlock*)calloc(block_count, sizeof(DecodedBlock));
+    pc->code_pages = (uint64_t*)calloc((pages + 63) / 64, sizeof(uint64_t));
+    if (!pc->blocks || !pc->code_pages) {
+        free(pc->blocks);
+        free(pc->code_pages);
+        free(pc);
+        return NULL;
+    }
+
+    pc->block_count = block_count;
+    pc->memory = memory;
+    pc->mem_size = mem_size;
+    return pc;
+}
+
+void predecode_destroy(PredecodeCache* pc) {
+    if (pc) {
+        free(pc->blocks);
+        free(pc->code_pages);
+        free(pc);
+    }
+}
+
+static void predecode_fill(PredecodeCache* pc, DecodedBlock* block, uint64_t addr) {
+    block->start_pc = addr;
+    block->count = 0;
+
+    while (block->count < PREDECODE_BLOCK_MAX && addr < pc->mem_size) {
+        DecodedInstruction* inst = &block->insts[block->count++];
+        uint8_t bytes[MAX_INSTRUCTION_SIZE];
+        gmem_read(pc->memory, addr, bytes, sizeof(bytes));
+        *inst = decode_instruction(bytes, 0);
+        inst->pc = addr;
+
+        addr += inst->size;
+        if (instruction_ends_block(inst->type)) break;
+    }
+
+    block->end_pc = MIN(addr, pc->mem_size);
+    block->valid = true;
+
+    for (uint64_t page = block->start_pc >> PAGE_SHIFT;
+         page <= (block->end_pc - 1) >> PAGE_SHIFT; page++) {
+        mark_page(pc, page);
+    }
+}
+
+// Return the block starting at addr, decoding it on a miss. NULL when addr
+// is outside guest memory.
+const DecodedBlock* predecode_lookup(PredecodeCache* pc, uint64_t addr) {
+    if (addr >= pc->mem_size) return NULL;
+
+    DecodedBlock* block = &pc->blocks[predecode_slot(pc, addr)];
+    if (block->valid && block->start_pc == addr) {
+        pc->hits++;
+        return block;
+    }
+
+    pc->misses++;
+    predecode_fill(pc, block, addr);
+    return block;
+}
+
+// Drop every block overlapping a page touched by [addr, addr + size)
+void predecode_invalidate(PredecodeCache* pc, uint64_t addr, uint64_t size) {
+    if (size == 0 || addr >= pc->mem_size) return;
+
+    uint64_t first = addr >> PAGE_SHIFT;
+    uint64_t last = (MIN(addr + size, pc->mem_size) - 1) >> PAGE_SHIFT;
+
+    bool dirty = false;
+    for (uint64_t page = first; page <= last; page++) {
+        if (page_has_code(pc, page)) {
+            dirty = true;
+            break;
+        }
+    }
+    if (!dirty) return;
+
+    uint64_t lo = first << PAGE_SHIFT;
+    uint64_t hi = (last + 1) << PAGE_SHIFT;
+    for (int i = 0; i < pc->block_count; i++) {
+        DecodedBlock* block = &pc->blocks[i];
+        if (block->valid && block->start_pc < hi && block->end_pc > lo) {
+            block->valid = false;
+            pc->invalidations++;
+        }
+    }
+
+    // Surviving blocks never overlap these pages, refills mark them again
+    for (uint64_t page = first; page <= last; page++) {
+        pc->code_pages[page / 64] &= ~BIT(page % 64);
+    }
+}
+
+void predecode_flush(PredecodeCache* pc) {
+    uint64_t pages = (pc->mem_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    for (int i = 0; i < pc->block_count; i++) {
+        pc->blocks[i].valid = false;
+    }
+    memset(pc->code_pages, 0, ((pages + 63) / 64) * sizeof(uint64_t));
+}
+
+void predecode_print_stats(PredecodeCache* pc) {
+    uint64_t lookups = pc->hits + pc->misses;
+    printf("\n=== Predecode Cache Stats ===\n");
+    printf("Blocks: %d x %d instructions\n", pc->block_count, PREDECODE_BLOCK_MAX);
+    printf("Lookups: %lu\n", lookups);
+    printf("Hit rate: %.2f%%\n", lookups > 0 ? (100.0 * pc->hits / lookups) : 0.0);
+    printf("Invalidations: %lu\n", pc->invalidations);
+}
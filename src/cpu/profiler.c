@@ -0,0 +1,141 @@
+#include "cpu.h"
+
+// How far a PC probes the table before it is counted under `other`
+#define PROF_PC_PROBES 16
+
+static const char* region_names[PROF_REGIONS] = {
+    "fetch", "decode", "execute", "memory", "writeback", "commit", "cache"
+};
+
+Profiler* profiler_create(void) {
+    Profiler* prof = (Profiler*)malloc(sizeof(Profiler));
+    if (!prof) return NULL;
+    profiler_reset(prof);
+    return prof;
+}
+
+void profiler_destroy(Profiler* prof) {
+    free(prof);
+}
+
+void profiler_reset(Profiler* prof) {
+    memset(prof, 0, sizeof(Profiler));
+    prof->start_ticks = profiler_ticks();
+    prof->start_us = get_time_us();
+}
+
+// Attribution record for pc, added on first use
+ProfilePC* profiler_pc(Profiler* prof, uint64_t pc) {
+    uint64_t slot = (pc ^ (pc >> 12)) & (PROF_PC_SLOTS - 1);
+    for (int i = 0; i < PROF_PC_PROBES; i++) {
+        ProfilePC* entry = &prof->pcs[(slot + i) & (PROF_PC_SLOTS - 1)];
+        if (entry->pc == pc && (entry->stalls | entry->flushes | entry->mem_cycles)) {
+            return entry;
+        }
+        if (!(entry->stalls | entry->flushes | entry->mem_cycles)) {
+            entry->pc = pc;
+            prof->pc_count++;
+            return entry;
+        }
+    }
+    return &prof->other;
+}
+
+static double ticks_per_us(Profiler* prof) {
+    uint64_t us = get_time_us() - prof->start_us;
+    return us > 0 ? (double)(profiler_ticks() - prof->start_ticks) / us : 0.0;
+}
+
+static uint64_t pc_weight(const ProfilePC* entry) {
+    return entry->stalls + entry->flushes * BRANCH_MISPREDICT_PENALTY + entry->mem_cycles;
+}
+
+static int compare_pc_weight(const void* a, const void* b) {
+    uint64_t wa = pc_weight((const ProfilePC*)a);
+    uint64_t wb = pc_weight((const ProfilePC*)b);
+    return wa < wb ? 1 : wa > wb ? -1 : 0;
+}
+
+// Used PC records, heaviest first; the caller frees the array
+static ProfilePC* sorted_pcs(Profiler* prof, int* count) {
+    ProfilePC* out = (ProfilePC*)malloc((prof->pc_count + 1) * sizeof(ProfilePC));
+    if (!out) return NULL;
+
+    int n = 0;
+    for (int i = 0; i < PROF_PC_SLOTS; i++) {
+        if (pc_weight(&prof->pcs[i]) > 0) out[n++] = prof->pcs[i];
+    }
+    qsort(out, n, sizeof(ProfilePC), compare_pc_weight);
+    *count = n;
+    return out;
+}
+
+void profiler_print(Profiler* prof) {
+    double rate = ticks_per_us(prof);
+
+    printf("\n=== Profiler ===\n");
+    printf("%-10s %-12s %-14s %-10s\n", "Region", "Calls", "Ticks", "ns/call");
+    for (int r = 0; r < PROF_REGIONS; r++) {
+        double ns = prof->calls[r] > 0 && rate > 0 ?
+                    1000.0 * prof->ticks[r] / rate / prof->calls[r] : 0.0;
+        printf("%-10s %-12lu %-14lu %-10.1f\n", region_names[r],
+               prof->calls[r], prof->ticks[r], ns);
+    }
+
+    int count = 0;
+    ProfilePC* pcs = sorted_pcs(prof, &count);
+    if (!pcs) return;
+    printf("%-10s %-10s %-10s %-10s\n", "PC", "Stalls", "Flushes", "Mem cycles");
+    for (int i = 0; i < MIN(count, 10); i++) {
+        printf("0x%-8lx %-10lu %-10lu %-10lu\n", pcs[i].pc, pcs[i].stalls,
+               pcs[i].flushes, pcs[i].mem_cycles);
+    }
+    free(pcs);
+}
+
+// Write everything as JSON for scripts/profile.py and scripts/visualize.py
+int profiler_export(Profiler* prof, const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        ERROR("Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int count = 0;
+    ProfilePC* pcs = sorted_pcs(prof, &count);
+    if (!pcs) {
+        fclose(f);
+        return -1;
+    }
+
+    fprintf(f, "{\n  \"ticks_per_us\": %.3f,\n  \"regions\": [\n", ticks_per_us(prof));
+    for (int r = 0; r < PROF_REGIONS; r++) {
+        fprintf(f, "    {\"name\": \"%s\", \"calls\": %lu, \"ticks\": %lu}%s\n",
+                region_names[r], prof->calls[r], prof->ticks[r],
+                r + 1 < PROF_REGIONS ? "," : "");
+    }
+
+    fprintf(f, "  ],\n  \"residency\": {\n");
+    for (int s = 0; s < STAGE_COMMIT; s++) {
+        fprintf(f, "    \"%s\": [", region_names[s]);
+        for (int b = 0; b < PROF_RESIDENCY_BUCKETS; b++) {
+            fprintf(f, "%lu%s", prof->residency[s][b],
+                    b + 1 < PROF_RESIDENCY_BUCKETS ? ", " : "");
+        }
+        fprintf(f, "]%s\n", s + 1 < STAGE_COMMIT ? "," : "");
+    }
+
+    fprintf(f, "  },\n  \"other\": {\"stalls\": %lu, \"flushes\": %lu, \"mem_cycles\": %lu},\n"
+               "  \"pcs\": [\n",
+            prof->other.stalls, prof->other.flushes, prof->other.mem_cycles);
+    for (int i = 0; i < count; i++) {
+        fprintf(f, "    {\"pc\": %lu, \"stalls\": %lu, \"flushes\": %lu, \"mem_cycles\": %lu}%s\n",
+                pcs[i].pc, pcs[i].stalls, pcs[i].flushes, pcs[i].mem_cycles,
+                i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+
+    free(pcs);
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include "cpu.h"
+#include "snapshot.h"
+
+static size_t store_bytes(const Cache* cache) {
+    return ALIGN_UP((size_t)cache->num_sets * cache->set_stride * sizeof(uint64_t), CACHE_LINE_SIZE);
+}
+
+static void write_cache(SnapshotWriter* writer, const Cache* cache) {
+    Cache image = *cache;
+    image.store = NULL;
+    image.find_way = NULL;
+    image.find_lru = NULL;
+    image.search_kernel = NULL;
+    snapshot_write(writer, &image, sizeof(image));
+    snapshot_write(writer, cache->store, store_bytes(cache));
+}
+
+// Rebuilt through cache_create, so the search kernels are this host's
+static Cache* read_cache(SnapshotCursor* cursor) {
+    Cache image;
+    if (!snapshot_read(cursor, &image, sizeof(image))) return NULL;
+
+    Cache* cache = cache_create(image.type, image.size, image.line_size, image.associativity);
+    if (!cache) return NULL;
+    if (cache->num_sets != image.num_sets || cache->set_stride != image.set_stride ||
+        !snapshot_read(cursor, cache->store, store_bytes(cache))) {
+        cache_destroy(cache);
+        return NULL;
+    }
+
+    image.store = cache->store;
+    image.find_way = cache->find_way;
+    image.find_lru = cache->find_lru;
+    image.search_kernel = cache->search_kernel;
+    *cache = image;
+    return cache;
+}
+
+static void write_predictor(SnapshotWriter* writer, const BranchPredictor* bp) {
+    BranchPredictor image = *bp;
+    image.pht = NULL;
+    image.tage = NULL;
+    image.perceptron = NULL;
+    image.btb = NULL;
+    snapshot_write(writer, &image, sizeof(image));
+    snapshot_write(writer, bp->pht, bp->pht_size);
+    snapshot_write(writer, bp->btb, (bp->btb_mask + 1) * sizeof(BTBEntry));
+
+    if (bp->tage) {
+        TageState tage = *bp->tage;
+        tage.entries = NULL;
+        snapshot_write(writer, &tage, sizeof(tage));
+        snapshot_write(writer, bp->tage->entries,
+                       ((size_t)TAGE_TABLES << tage.table_bits) * sizeof(TageEntry));
+    }
+    if (bp->perceptron) {
+        PerceptronState perceptron = *bp->perceptron;
+        perceptron.weights = NULL;
+        snapshot_write(writer, &perceptron, sizeof(perceptron));
+        snapshot_write(writer, bp->perceptron->weights,
+                       (size_t)PERCEPTRON_TABLES << perceptron.row_bits);
+    }
+}
+
+static BranchPredictor* read_predictor(SnapshotCursor* cursor) {
+    BranchPredictor image;
+    if (!snapshot_read(cursor, &image, sizeof(image))) return NULL;
+
+    BranchPredictor* bp = bp_create(image.type, image.bhr_size, image.pht_size);
+    if (!bp) return NULL;
+    if (bp->pht_size != image.pht_size || bp->btb_mask != image.btb_mask) {
+        bp_destroy(bp);
+        return NULL;
+    }
+    image.pht = bp->pht;
+    image.tage = bp->tage;
+    image.perceptron = bp->perceptron;
+    image.btb = bp->btb;
+    *bp = image;
+
+    bool ok = snapshot_read(cursor, bp->pht, bp->pht_size) &&
+              snapshot_read(cursor, bp->btb, (bp->btb_mask + 1) * sizeof(BTBEntry));
+    if (ok && bp->tage) {
+        TageState tage;
+        ok = snapshot_read(cursor, &tage, sizeof(tage)) && tage.table_bits == bp->tage->table_bits;
+        if (ok) {
+            tage.entries = bp->tage->entries;
+            *bp->tage = tage;
+            ok = snapshot_read(cursor, tage.entries,
+                               ((size_t)TAGE_TABLES << tage.table_bits) * sizeof(TageEntry));
+        }
+    }
+    if (ok && bp->perceptron) {
+        PerceptronState perceptron;
+        ok = snapshot_read(cursor, &perceptron, sizeof(perceptron)) &&
+             perceptron.row_bits == bp->perceptron->row_bits;
+        if (ok) {
+            perceptron.weights = bp->perceptron->weights;
+            *bp->perceptron = perceptron;
+            ok = snapshot_read(cursor, perceptron.weights, (size_t)PERCEPTRON_TABLES << perceptron.row_bits);
+        }
+    }
+    if (!ok) {
+        bp_destroy(bp);
+        return NULL;
+    }
+    return bp;
+}
+
+// Registers, pipeline registers, counters, cache tag stores and predictor
+// tables, then guest memory
+int cpu_snapshot(SnapshotWriter* writer, const CPU* cpu) {
+    if (cpu->system) {
+        ERROR("Core %d belongs to a multicore system; only standalone CPUs are snapshotted\n",
+              cpu->core_id);
+        return -1;
+    }
+    if (cpu->ooo && cpu->ooo->rob_count > 0) {
+        ERROR("Cannot snapshot a CPU with %d instructions in flight\n", cpu->ooo->rob_count);
+        return -1;
+    }
+
+    CPU image = *cpu;
+    image.memory = NULL;
+    image.l1_cache = NULL;
+    image.l2_cache = NULL;
+    image.bp = NULL;
+    image.ooo = NULL;
+    image.trace = NULL;
+    image.predecode = NULL;
+    image.fetch_block = NULL;
+    image.fetch_slot = 0;
+#if ENABLE_PROFILER
+    image.prof = NULL;
+#endif
+
+    snapshot_begin(writer, SNAP_CPU);
+    snapshot_write(writer, &image, sizeof(image));
+    write_cache(writer, cpu->l1_cache);
+    write_cache(writer, cpu->l2_cache);
+    write_predictor(writer, cpu->bp);
+    snapshot_write_memory(writer, cpu->memory);
+    return writer->failed ? -1 : 0;
+}
+
+// The index-th CPU in the snapshot, owning its memory. Fetch looks its
+// block up again, and the predecode cache and profiler start empty.
+CPU* cpu_restore(Snapshot* snapshot, uint32_t index) {
+    SnapshotCursor cursor;
+    CPU image;
+    if (snapshot_find(snapshot, SNAP_CPU, index, &cursor) != 0) {
+        ERROR("No CPU %u in the snapshot\n", index);
+        return NULL;
+    }
+
+    Cache* l1 = snapshot_read(&cursor, &image, sizeof(image)) ? read_cache(&cursor) : NULL;
+    Cache* l2 = l1 ? read_cache(&cursor) : NULL;
+    BranchPredictor* bp = l2 ? read_predictor(&cursor) : NULL;
+    GuestMemory* memory = bp ? snapshot_read_memory(&cursor) : NULL;
+    CPU* cpu = memory ? cpu_create_shared(memory) : NULL;
+    if (!cpu) {
+        ERROR("Cannot restore CPU %u from the snapshot\n", index);
+        cache_destroy(l1);
+        cache_destroy(l2);
+        bp_destroy(bp);
+        gmem_destroy(memory);
+        return NULL;
+    }
+
+    cache_destroy(cpu->l1_cache);
+    cache_destroy(cpu->l2_cache);
+    bp_destroy(cpu->bp);
+    image.memory = memory;
+    image.owns_memory = true;
+    image.l1_cache = l1;
+    image.l2_cache = l2;
+    image.bp = bp;
+    image.ooo = cpu->ooo;
+    image.predecode = cpu->predecode;
+    image.start_time = cpu->start_time;
+#if ENABLE_PROFILER
+    image.prof = cpu->prof;
+#endif
+    *cpu = image;
+    return cpu;
+}
@@ -0,0 +1,319 @@
+#include "cpu.h"
+
+// Synthetic addresses are generated and replayed in chunks of this size
+#define SWEEP_CHUNK 4096
+
+static const char* cache_type_names[] = {
+    "direct", "set_assoc", "full_assoc"
+};
+
+static const char* pattern_names[] = {
+    "trace", "sequential", "random", "strided"
+};
+
+static const char* predictor_names[] = {
+    "always_taken", "always_not_taken", "bimodal", "gshare", "tage", "perceptron"
+};
+
+Sweep* sweep_create(const SweepTrace* trace, uint64_t seed) {
+    Sweep* sweep = (Sweep*)calloc(1, sizeof(Sweep));
+    if (!sweep) return NULL;
+
+    sweep->trace = trace;
+    sweep->seed = seed;
+    return sweep;
+}
+
+void sweep_destroy(Sweep* sweep) {
+    if (sweep) {
+        free(sweep->jobs);
+        free(sweep);
+    }
+}
+
+static SweepJob* sweep_new_job(Sweep* sweep) {
+    if (sweep->job_count == sweep->capacity) {
+        size_t capacity = sweep->capacity ? sweep->capacity * 2 : 64;
+        SweepJob* jobs = (SweepJob*)realloc(sweep->jobs, capacity * sizeof(SweepJob));
+        if (!jobs) return NULL;
+        sweep->jobs = jobs;
+        sweep->capacity = capacity;
+    }
+
+    // Seeds depend only on the sweep seed and job position, never on which
+    // worker runs the job or when
+    SweepJob* job = &sweep->jobs[sweep->job_count];
+    memset(job, 0, sizeof(SweepJob));
+    job->seed = rng_stream_seed(sweep->seed, sweep->job_count);
+    sweep->job_count++;
+    return job;
+}
+
+int sweep_add_cache(Sweep* sweep, CacheConfig config, AccessPattern pattern,
+                    uint64_t length) {
+    if (pattern == PATTERN_TRACE &&
+        (!sweep->trace || (!sweep->trace->addrs && !sweep->trace->file))) {
+        ERROR("Sweep has no address trace\n");
+        return -1;
+    }
+
+    SweepJob* job = sweep_new_job(sweep);
+    if (!job) return -1;
+
+    job->kind = SWEEP_CACHE;
+    job->cache = config;
+    job->pattern = pattern;
+    job->length = length;
+    return (int)(sweep->job_count - 1);
+}
+
+int sweep_add_cache_matrix(Sweep* sweep, const CacheConfig* configs, size_t config_count,
+                           const AccessPattern* patterns, size_t pattern_count,
+                           uint64_t length) {
+    int added = 0;
+    for (size_t c = 0; c < config_count; c++) {
+        for (size_t p = 0; p < pattern_count; p++) {
+            if (sweep_add_cache(sweep, configs[c], patterns[p], length) < 0) {
+                return -1;
+            }
+            added++;
+        }
+    }
+    return added;
+}
+
+int sweep_add_predictor(Sweep* sweep, PredictorType type, int bhr_size, int pht_size) {
+    if (!sweep->trace || (!sweep->trace->branches && !sweep->trace->file)) {
+        ERROR("Sweep has no branch trace\n");
+        return -1;
+    }
+
+    SweepJob* job = sweep_new_job(sweep);
+    if (!job) return -1;
+
+    job->kind = SWEEP_PREDICTOR;
+    job->predictor = type;
+    job->bhr_size = bhr_size;
+    job->pht_size = pht_size;
+    return (int)(sweep->job_count - 1);
+}
+
+// Fill buf with the next addresses of a synthetic pattern. The footprints
+// match the patterns in performance_test_cpu.
+static void sweep_fill_pattern(SweepJob* job, Cache* cache, uint64_t* state,
+                               uint64_t* addr, uint64_t* buf, size_t n) {
+    uint64_t size = (uint64_t)cache->size;
+
+    switch (job->pattern) {
+        case PATTERN_SEQUENTIAL:
+            for (size_t i = 0; i < n; i++) {
+                buf[i] = *addr;
+                *addr = (*addr + cache->line_size) % (size * 4);
+            }
+            break;
+
+        case PATTERN_RANDOM:
+            for (size_t i = 0; i < n; i++) {
+                buf[i] = splitmix64(state) % (size * 16);
+            }
+            break;
+
+        case PATTERN_STRIDED:
+            for (size_t i = 0; i < n; i++) {
+                buf[i] = *addr;
+                *addr = (*addr + size * 2) % (size * 8);
+            }
+            break;
+
+        default:
+            memset(buf, 0, n * sizeof(uint64_t));
+            break;
+    }
+}
+
+static void sweep_run_cache(const Sweep* sweep, SweepJob* job) {
+    Cache* cache = cache_create(job->cache.type, job->cache.size,
+                                job->cache.line_size, job->cache.associativity);
+    if (!cache) {
+        job->failed = true;
+        return;
+    }
+
+    if (job->pattern == PATTERN_TRACE && sweep->trace->file) {
+        // Each job streams the file through its own cursor
+        TraceCursor cursor;
+        if (trace_cursor_init(&cursor, sweep->trace->file, TRACE_MEM) < 0) {
+            job->failed = true;
+        } else {
+            size_t n;
+            while ((n = trace_next_block(&cursor)) > 0) {
+                job->cycles += cache_access_batch(cache, cursor.addrs, cursor.is_write, n, NULL);
+            }
+            trace_cursor_destroy(&cursor);
+        }
+    } else if (job->pattern == PATTERN_TRACE) {
+        const SweepTrace* trace = sweep->trace;
+        job->cycles = cache_access_batch(cache, trace->addrs, trace->is_write,
+                                         trace->addr_count, NULL);
+    } else {
+        uint64_t buf[SWEEP_CHUNK];
+        uint64_t state = job->seed;
+        uint64_t addr = 0;
+        for (uint64_t done = 0; done < job->length; done += SWEEP_CHUNK) {
+            size_t n = (size_t)MIN(job->length - done, (uint64_t)SWEEP_CHUNK);
+            sweep_fill_pattern(job, cache, &state, &addr, buf, n);
+            job->cycles += cache_access_batch(cache, buf, NULL, n, NULL);
+        }
+    }
+
+    job->events = cache->accesses;
+    job->hits = cache->hits;
+    cache_destroy(cache);
+}
+
+static void sweep_run_predictor(const Sweep* sweep, SweepJob* job) {
+    BranchPredictor* bp = bp_create(job->predictor, job->bhr_size, job->pht_size);
+    if (!bp) {
+        job->failed = true;
+        return;
+    }
+
+    if (sweep->trace->file) {
+        TraceCursor cursor;
+        if (trace_cursor_init(&cursor, sweep->trace->file, TRACE_BRANCH) < 0) {
+            job->failed = true;
+        } else {
+            size_t n;
+            while ((n = trace_next_block(&cursor)) > 0) {
+                bp_replay_batch(bp, cursor.branches, n);
+            }
+            trace_cursor_destroy(&cursor);
+        }
+    } else {
+        bp_replay_batch(bp, sweep->trace->branches, sweep->trace->branch_count);
+    }
+    job->events = bp->total;
+    job->hits = bp->correct;
+    bp_destroy(bp);
+}
+
+static void sweep_job_worker(void* ctx, size_t index, int worker) {
+    (void)worker;
+    Sweep* sweep = (Sweep*)ctx;
+    SweepJob* job = &sweep->jobs[index];
+
+    uint64_t start = get_time_us();
+    if (job->kind == SWEEP_CACHE) {
+        sweep_run_cache(sweep, job);
+    } else {
+        sweep_run_predictor(sweep, job);
+    }
+    job->elapsed_us = get_time_us() - start;
+}
+
+int sweep_run(Sweep* sweep, int threads) {
+    if (threads <= 0) threads = parallel_default_threads();
+    sweep->threads_used = (size_t)threads > sweep->job_count ?
+                          (int)sweep->job_count : threads;
+
+    uint64_t start = get_time_us();
+    int result = parallel_for(sweep->job_count, threads, sweep_job_worker, sweep);
+    sweep->elapsed_us = get_time_us() - start;
+    return result;
+}
+
+static double job_rate(const SweepJob* job) {
+    return job->events > 0 ? (100.0 * job->hits / job->events) : 0.0;
+}
+
+int sweep_write_csv(Sweep* sweep, const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        ERROR("Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(f, "job,kind,cache_type,size,line_size,associativity,pattern,"
+               "predictor,bhr_size,pht_size,seed,events,hits,hit_rate,"
+               "cycles,elapsed_us\n");
+    for (size_t i = 0; i < sweep->job_count; i++) {
+        SweepJob* job = &sweep->jobs[i];
+        if (job->kind == SWEEP_CACHE) {
+            fprintf(f, "%zu,cache,%s,%d,%d,%d,%s,,,,",
+                    i, cache_type_names[job->cache.type], job->cache.size,
+                    job->cache.line_size, job->cache.associativity,
+                    pattern_names[job->pattern]);
+        } else {
+            fprintf(f, "%zu,predictor,,,,,,%s,%d,%d,",
+                    i, predictor_names[job->predictor],
+                    job->bhr_size, job->pht_size);
+        }
+        fprintf(f, "%lu,%lu,%lu,%.4f,%lu,%lu\n",
+                job->seed, job->events, job->hits, job_rate(job),
+                job->cycles, job->elapsed_us);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int sweep_write_json(Sweep* sweep, const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        ERROR("Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(f, "{\n  \"seed\": %lu,\n  \"threads\": %d,\n  \"elapsed_us\": %lu,\n"
+               "  \"jobs\": [\n",
+            sweep->seed, sweep->threads_used, sweep->elapsed_us);
+    for (size_t i = 0; i < sweep->job_count; i++) {
+        SweepJob* job = &sweep->jobs[i];
+        fprintf(f, "    {\"job\": %zu, ", i);
+        if (job->kind == SWEEP_CACHE) {
+            fprintf(f, "\"kind\": \"cache\", \"cache_type\": \"%s\", \"size\": %d, "
+                       "\"line_size\": %d, \"associativity\": %d, \"pattern\": \"%s\", ",
+                    cache_type_names[job->cache.type], job->cache.size,
+                    job->cache.line_size, job->cache.associativity,
+                    pattern_names[job->pattern]);
+        } else {
+            fprintf(f, "\"kind\": \"predictor\", \"predictor\": \"%s\", "
+                       "\"bhr_size\": %d, \"pht_size\": %d, ",
+                    predictor_names[job->predictor], job->bhr_size, job->pht_size);
+        }
+        fprintf(f, "\"seed\": %lu, \"events\": %lu, \"hits\": %lu, "
+                   "\"hit_rate\": %.4f, \"cycles\": %lu, \"elapsed_us\": %lu}%s\n",
+                job->seed, job->events, job->hits, job_rate(job),
+                job->cycles, job->elapsed_us,
+                i + 1 < sweep->job_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+
+    fclose(f);
+    return 0;
+}
+
+void sweep_print(Sweep* sweep) {
+    printf("\n=== Sweep Results ===\n");
+    printf("Jobs: %zu, Threads: %d, Wall time: %.2f ms\n",
+           sweep->job_count, sweep->threads_used, sweep->elapsed_us / 1000.0);
+    printf("%-5s %-10s %-28s %-12s %-10s %-10s\n",
+           "Job", "Kind", "Config", "Events", "Rate(%)", "Time(ms)");
+
+    for (size_t i = 0; i < sweep->job_count; i++) {
+        SweepJob* job = &sweep->jobs[i];
+        char desc[64];
+        if (job->kind == SWEEP_CACHE) {
+            snprintf(desc, sizeof(desc), "%dKB/%d-way/%s",
+                     job->cache.size / KiB, job->cache.associativity,
+                     pattern_names[job->pattern]);
+        } else {
+            snprintf(desc, sizeof(desc), "%s/%d",
+                     predictor_names[job->predictor], job->pht_size);
+        }
+        printf("%-5zu %-10s %-28s %-12lu %-10.2f %-10.2f%s\n",
+               i, job->kind == SWEEP_CACHE ? "cache" : "predictor", desc,
+               job->events, job_rate(job), job->elapsed_us / 1000.0,
+               job->failed ? " [FAILED]" : "");
+    }
+}
@@ -1,222 +1,488 @@
 #include "cpu.h"
 
-// Reservation station
-typedef struct {
-    bool busy;
-    InstructionType op;
-    uint64_t vj, vk;
-    uint64_t qj, qk;  // Source reservation stations
-    uint64_t dest;
-    uint64_t address;
-    uint64_t result;
-    bool result_ready;
-} ReservationStation;
-
-// Reorder buffer entry
-typedef struct {
-    bool busy;
-    InstructionType op;
-    uint64_t result;
-    uint64_t dest;
-    bool ready;
-    bool exception;
-} ROBEntry;
-
-// Tomasulo CPU implementation
-typedef struct {
-    ReservationStation* rs;  // Reservation stations
-    ROBEntry* rob;           // Reorder buffer
-    uint64_t* registers;     // Register file
-    uint64_t* reg_status;    // Which RS produces register value
-    
-    int rs_count;
-    int rob_size;
-    
-    int rs_head;
-    int rs_tail;
-    int rob_head;
-    int rob_tail;
-    
-    uint64_t clock;
-    uint64_t instructions_issued;
-    uint64_t instructions_completed;
-    uint64_t instructions_committed;
-} TomasuloCPU;
-
-TomasuloCPU* tomasulo_create(int rs_count, int rob_size) {
-    TomasuloCPU* cpu = (TomasuloCPU*)malloc(sizeof(TomasuloCPU));
-    if (!cpu) return NULL;
-    
-    cpu->rs_count = rs_count;
-    cpu->rob_size = rob_size;
-    
-    cpu->rs = (ReservationStation*)calloc(rs_count, sizeof(ReservationStation));
-    cpu->rob = (ROBEntry*)calloc(rob_size, sizeof(ROBEntry));
-    cpu->registers = (uint64_t*)calloc(32, sizeof(uint64_t));
-    cpu->reg_status = (uint64_t*)calloc(32, sizeof(uint64_t));
-    
-    if (!cpu->rs || !cpu->rob || !cpu->registers || !cpu->reg_status) {
-        free(cpu->rs);
-        free(cpu->rob);
-        free(cpu->registers);
-        free(cpu->reg_status);
-        free(cpu);
+// Completion wheel slots. Longer latencies go round the wheel more than
+// once; each lap costs the entry one look.
+#define TOMASULO_WHEEL 256
+
+// Execute latency in cycles; loads add the L1 latency
+static const uint8_t op_latency[INST_COUNT] = {
+    [INST_ADD] = 1, [INST_SUB] = 1, [INST_MUL] = 3, [INST_DIV] = 12,
+    [INST_AND] = 1, [INST_OR] = 1, [INST_XOR] = 1, [INST_NOT] = 1,
+    [INST_SHL] = 1, [INST_SHR] = 1, [INST_LD] = 1, [INST_ST] = 1,
+    [INST_JMP] = 1, [INST_JZ] = 1, [INST_JNZ] = 1, [INST_CMP] = 1,
+    [INST_MOV] = 1,
+};
+
+static inline int rob_next(TomasuloCPU* ooo, int index) {
+    return index + 1 == ooo->config.rob_size ? 0 : index + 1;
+}
+
+static inline uint64_t* rob_consumers(TomasuloCPU* ooo, int index) {
+    return &ooo->consumers[(size_t)index * ooo->rs_words];
+}
+
+static inline bool is_branch(InstructionType type) {
+    return type == INST_JMP || type == INST_JZ || type == INST_JNZ;
+}
+
+static inline bool uses_rs1(InstructionType type) {
+    return (type >= INST_ADD && type <= INST_SHR) || type == INST_CMP ||
+           type == INST_MOV || type == INST_JZ || type == INST_JNZ;
+}
+
+static inline bool uses_rs2(InstructionType type) {
+    return (type >= INST_ADD && type <= INST_SHR && type != INST_NOT) ||
+           type == INST_CMP;
+}
+
+TomasuloCPU* tomasulo_create(CPU* cpu, const OoOConfig* config) {
+    if (config->rob_size <= 0 || config->rob_size > 65535 || config->rs_count <= 0 ||
+        config->dispatch_width <= 0 || config->issue_width <= 0 ||
+        config->commit_width <= 0) {
+        ERROR("Invalid out-of-order configuration\n");
         return NULL;
     }
-    
-    cpu->rs_head = 0;
-    cpu->rs_tail = 0;
-    cpu->rob_head = 0;
-    cpu->rob_tail = 0;
-    cpu->clock = 0;
-    
-    cpu->instructions_issued = 0;
-    cpu->instructions_completed = 0;
-    cpu->instructions_committed = 0;
-    
-    return cpu;
-}
-
-void tomasulo_destroy(TomasuloCPU* cpu) {
-    if (cpu) {
-        free(cpu->rs);
-        free(cpu->rob);
-        free(cpu->registers);
-        free(cpu->reg_status);
-        free(cpu);
-    }
-}
-
-// Issue instruction to reservation station
-bool tomasulo_issue(TomasuloCPU* cpu, DecodedInstruction inst) {
-    // Find free reservation station
-    for (int i = 0; i < cpu->rs_count; i++) {
-        if (!cpu->rs[i].busy) {
-            cpu->rs[i].busy = true;
-            cpu->rs[i].op = inst.type;
-            cpu->rs[i].dest = inst.rd;
-            
-            // Check if source operands are ready
-            if (cpu->reg_status[inst.rs1] == 0) {
-                cpu->rs[i].vj = cpu->registers[inst.rs1];
-                cpu->rs[i].qj = 0;
-            } else {
-                cpu->rs[i].qj = cpu->reg_status[inst.rs1];
-            }
-            
-            if (cpu->reg_status[inst.rs2] == 0) {
-                cpu->rs[i].vk = cpu->registers[inst.rs2];
-                cpu->rs[i].qk = 0;
+
+    TomasuloCPU* ooo = (TomasuloCPU*)calloc(1, sizeof(TomasuloCPU));
+    if (!ooo) return NULL;
+
+    ooo->cpu = cpu;
+    ooo->config = *config;
+    ooo->rs_words = (config->rs_count + 63) / 64;
+
+    ooo->rs = (ReservationStation*)calloc(config->rs_count, sizeof(ReservationStation));
+    ooo->rob = (ROBEntry*)calloc(config->rob_size, sizeof(ROBEntry));
+    ooo->consumers = (uint64_t*)calloc((size_t)config->rob_size * ooo->rs_words,
+                                       sizeof(uint64_t));
+    ooo->rs_free = (uint64_t*)calloc(ooo->rs_words, sizeof(uint64_t));
+    ooo->rs_ready = (uint64_t*)calloc(ooo->rs_words, sizeof(uint64_t));
+    ooo->wheel = (int32_t*)calloc(TOMASULO_WHEEL, sizeof(int32_t));
+
+    if (!ooo->rs || !ooo->rob || !ooo->consumers || !ooo->rs_free ||
+        !ooo->rs_ready || !ooo->wheel) {
+        tomasulo_destroy(ooo);
+        return NULL;
+    }
+
+    tomasulo_reset(ooo);
+    return ooo;
+}
+
+void tomasulo_destroy(TomasuloCPU* ooo) {
+    if (ooo) {
+        free(ooo->rs);
+        free(ooo->rob);
+        free(ooo->consumers);
+        free(ooo->rs_free);
+        free(ooo->rs_ready);
+        free(ooo->wheel);
+        free(ooo);
+    }
+}
+
+void tomasulo_reset(TomasuloCPU* ooo) {
+    for (int i = 0; i < ooo->config.rob_size; i++) {
+        ooo->rob[i].busy = false;
+        ooo->rob[i].rs = -1;
+        ooo->rob[i].next_event = -1;
+    }
+    for (int w = 0; w < ooo->rs_words; w++) {
+        int left = ooo->config.rs_count - w * 64;
+        ooo->rs_free[w] = left >= 64 ? ~0ULL : BIT(left) - 1;
+        ooo->rs_ready[w] = 0;
+    }
+    for (int i = 0; i < TOMASULO_WHEEL; i++) {
+        ooo->wheel[i] = -1;
+    }
+    memset(ooo->reg_status, 0, sizeof(ooo->reg_status));
+
+    ooo->rob_head = 0;
+    ooo->rob_tail = 0;
+    ooo->rob_count = 0;
+    ooo->fetch_stall_until = 0;
+    ooo->stores_dispatched = 0;
+    ooo->stores_committed = 0;
+
+    ooo->dispatched = 0;
+    ooo->issued = 0;
+    ooo->committed = 0;
+    ooo->squashed = 0;
+    ooo->mispredicts = 0;
+    ooo->rob_full_cycles = 0;
+    ooo->rs_full_cycles = 0;
+}
+
+// Drop every ROB entry after the oldest `keep`, then rebuild the rename
+// table and completion lists from the survivors. Stale consumer bits are
+// harmless: wakeup checks the waiting tag.
+static void tomasulo_squash(TomasuloCPU* ooo, int keep) {
+    int index = ooo->rob_tail;
+    while (ooo->rob_count > keep) {
+        index = index == 0 ? ooo->config.rob_size - 1 : index - 1;
+        ROBEntry* entry = &ooo->rob[index];
+        if (entry->rs >= 0) {
+            CLEAR_BIT(ooo->rs_ready[entry->rs / 64], entry->rs % 64);
+            SET_BIT(ooo->rs_free[entry->rs / 64], entry->rs % 64);
+            entry->rs = -1;
+        }
+        if (entry->op == INST_ST) ooo->stores_dispatched--;
+        entry->busy = false;
+        ooo->rob_count--;
+        ooo->squashed++;
+    }
+    ooo->rob_tail = index;
+
+    memset(ooo->reg_status, 0, sizeof(ooo->reg_status));
+    for (int i = 0, j = ooo->rob_head; i < ooo->rob_count; i++, j = rob_next(ooo, j)) {
+        if (ooo->rob[j].writes_reg) ooo->reg_status[ooo->rob[j].dest] = j + 1;
+    }
+
+    for (int slot = 0; slot < TOMASULO_WHEEL; slot++) {
+        int32_t* link = &ooo->wheel[slot];
+        while (*link >= 0) {
+            ROBEntry* entry = &ooo->rob[*link];
+            if (entry->busy) {
+                link = &entry->next_event;
             } else {
-                cpu->rs[i].qk = cpu->reg_status[inst.rs2];
+                *link = entry->next_event;
+                entry->next_event = -1;
             }
-            
-            // Allocate ROB entry
-            int rob_idx = cpu->rob_tail;
-            cpu->rob[rob_idx].busy = true;
-            cpu->rob[rob_idx].op = inst.type;
-            cpu->rob[rob_idx].dest = inst.rd;
-            cpu->rob[rob_idx].ready = false;
-            cpu->rob[rob_idx].exception = false;
-            
-            // Update register status
-            cpu->reg_status[inst.rd] = rob_idx + 1;  // +1 because 0 means no producer
-            
-            cpu->rob_tail = (cpu->rob_tail + 1) % cpu->rob_size;
-            cpu->instructions_issued++;
-            
-            return true;
         }
     }
-    return false;  // No free reservation station
-}
-
-// Execute instructions (simplified)
-void tomasulo_execute(TomasuloCPU* cpu) {
-    for (int i = 0; i < cpu->rs_count; i++) {
-        if (cpu->rs[i].busy && cpu->rs[i].qj == 0 && cpu->rs[i].qk == 0) {
-            // Operands ready, execute
-            switch (cpu->rs[i].op) {
-                case INST_ADD:
-                    cpu->rs[i].result = cpu->rs[i].vj + cpu->rs[i].vk;
-                    break;
-                case INST_SUB:
-                    cpu->rs[i].result = cpu->rs[i].vj - cpu->rs[i].vk;
-                    break;
-                case INST_MUL:
-                    cpu->rs[i].result = cpu->rs[i].vj * cpu->rs[i].vk;
-                    break;
-                // ... other operations
-                default:
-                    cpu->rs[i].result = 0;
+
+    ooo->cpu->fetch_block = NULL;
+}
+
+// Discard everything in flight and leave pc at the oldest uncommitted
+// instruction, for a handoff to another execution mode
+void tomasulo_flush(TomasuloCPU* ooo) {
+    CPU* cpu = ooo->cpu;
+    if (ooo->rob_count > 0) {
+        cpu->pc = ooo->rob[ooo->rob_head].pc;
+        cpu->halted = false;
+    }
+    tomasulo_squash(ooo, 0);
+}
+
+// Memory and branch records go out in commit order, so squashed work
+// never reaches the trace
+static void tomasulo_trace(CPU* cpu, const ROBEntry* entry) {
+    if (entry->op == INST_LD || entry->op == INST_ST) {
+        if (entry->address <= cpu->mem_size - sizeof(uint64_t)) {
+            trace_write_mem(cpu->trace, entry->address, entry->op == INST_ST);
+        }
+    } else if (is_branch(entry->op)) {
+        BranchRecord record = {
+            .pc = entry->pc, .target = entry->imm, .taken = entry->result != entry->next_pc,
+            .kind = entry->op == INST_JMP ? BRANCH_JUMP : BRANCH_CONDITIONAL,
+            .size = (uint8_t)(entry->next_pc - entry->pc),
+        };
+        trace_write_branch(cpu->trace, &record);
+    }
+}
+
+static void tomasulo_commit(TomasuloCPU* ooo) {
+    CPU* cpu = ooo->cpu;
+
+    for (int n = 0; n < ooo->config.commit_width && ooo->rob_count > 0; n++) {
+        int index = ooo->rob_head;
+        ROBEntry* entry = &ooo->rob[index];
+        if (!entry->done) break;
+
+        if (entry->writes_reg) {
+            cpu->registers[entry->dest] = entry->result;
+            if (ooo->reg_status[entry->dest] == index + 1) {
+                ooo->reg_status[entry->dest] = 0;
+            }
+        } else if (entry->op == INST_CMP) {
+            cpu->flags = entry->result;
+        } else if (entry->op == INST_ST) {
+            // Stores reach memory in order, at commit
+            if (entry->address <= cpu->mem_size - sizeof(uint64_t)) {
+                cpu_mem_access(cpu, entry->address, true);
+                gmem_store64(cpu->memory, entry->address, entry->result);
+                predecode_invalidate(cpu->predecode, entry->address, sizeof(uint64_t));
             }
-            cpu->rs[i].result_ready = true;
-            cpu->instructions_completed++;
+            ooo->stores_committed++;
         }
+        if (cpu->trace) tomasulo_trace(cpu, entry);
+
+        entry->busy = false;
+        ooo->rob_head = rob_next(ooo, index);
+        ooo->rob_count--;
+        ooo->committed++;
+        cpu->instructions++;
     }
 }
 
-// Write results back
-void tomasulo_writeback(TomasuloCPU* cpu) {
-    for (int i = 0; i < cpu->rs_count; i++) {
-        if (cpu->rs[i].busy && cpu->rs[i].result_ready) {
-            // Find ROB entry for this instruction
-            for (int j = 0; j < cpu->rob_size; j++) {
-                if (cpu->rob[j].busy && !cpu->rob[j].ready) {
-                    cpu->rob[j].result = cpu->rs[i].result;
-                    cpu->rob[j].ready = true;
-                    break;
-                }
+static void tomasulo_wake(TomasuloCPU* ooo, int index) {
+    ROBEntry* entry = &ooo->rob[index];
+    uint64_t* consumers = rob_consumers(ooo, index);
+    uint16_t tag = index + 1;
+
+    for (int w = 0; w < ooo->rs_words; w++) {
+        uint64_t bits = consumers[w];
+        consumers[w] = 0;
+        while (bits) {
+            int slot = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (TEST_BIT(ooo->rs_free[w], slot % 64)) continue;
+
+            ReservationStation* rs = &ooo->rs[slot];
+            if (rs->qj == tag) {
+                rs->vj = entry->result;
+                rs->qj = 0;
+            }
+            if (rs->qk == tag) {
+                rs->vk = entry->result;
+                rs->qk = 0;
             }
-            
-            // Free reservation station
-            cpu->rs[i].busy = false;
-            cpu->rs[i].result_ready = false;
+            if (rs->qj == 0 && rs->qk == 0) SET_BIT(ooo->rs_ready[w], slot % 64);
         }
     }
 }
 
-// Commit instructions in order
-void tomasulo_commit(TomasuloCPU* cpu) {
-    while (cpu->rob[cpu->rob_head].busy && cpu->rob[cpu->rob_head].ready) {
-        ROBEntry* entry = &cpu->rob[cpu->rob_head];
-        
-        if (!entry->exception) {
-            // Write result to register file
-            cpu->registers[entry->dest] = entry->result;
-            cpu->reg_status[entry->dest] = 0;  // Register now has value
+// Retire this cycle's completions: broadcast results and resolve branches
+static void tomasulo_writeback(TomasuloCPU* ooo) {
+    CPU* cpu = ooo->cpu;
+    int slot = cpu->cycles & (TOMASULO_WHEEL - 1);
+    int32_t index = ooo->wheel[slot];
+    ooo->wheel[slot] = -1;
+
+    while (index >= 0) {
+        ROBEntry* entry = &ooo->rob[index];
+        int32_t next = entry->next_event;
+        entry->next_event = -1;
+
+        // Squashed by an older branch completing earlier in this list
+        if (!entry->busy) {
+            index = next;
+            continue;
         }
-        
-        // Free ROB entry
-        entry->busy = false;
-        cpu->rob_head = (cpu->rob_head + 1) % cpu->rob_size;
-        cpu->instructions_committed++;
+
+        // Due on a later lap
+        if (entry->complete_at > cpu->cycles) {
+            entry->next_event = ooo->wheel[slot];
+            ooo->wheel[slot] = index;
+            index = next;
+            continue;
+        }
+
+        entry->done = true;
+        tomasulo_wake(ooo, index);
+
+        if (is_branch(entry->op)) {
+            bool taken = entry->result != entry->next_pc;
+            bool predicted = entry->predicted_pc != entry->next_pc;
+            bp_update(cpu->bp, entry->pc, taken, predicted);
+
+            if (entry->result != entry->predicted_pc) {
+                int keep = index - ooo->rob_head;
+                if (keep < 0) keep += ooo->config.rob_size;
+                tomasulo_squash(ooo, keep + 1);
+                cpu->pc = entry->result;
+                cpu->halted = false;
+                ooo->fetch_stall_until = cpu->cycles + BRANCH_MISPREDICT_PENALTY;
+                ooo->mispredicts++;
+            }
+        }
+        index = next;
     }
 }
 
-void tomasulo_print_stats(TomasuloCPU* cpu) {
-    printf("\n=== Tomasulo Out-of-Order Statistics ===\n");
-    printf("Clock cycles: %lu\n", cpu->clock);
-    printf("Instructions issued: %lu\n", cpu->instructions_issued);
-    printf("Instructions completed: %lu\n", cpu->instructions_completed);
-    printf("Instructions committed: %lu\n", cpu->instructions_committed);
-    printf("IPC: %.2f\n", (float)cpu->instructions_committed / cpu->clock);
-    
-    printf("\nReservation stations:\n");
-    for (int i = 0; i < cpu->rs_count; i++) {
-        if (cpu->rs[i].busy) {
-            printf("  RS%d: busy, dest=r%lu\n", i, cpu->rs[i].dest);
+static void tomasulo_issue(TomasuloCPU* ooo) {
+    CPU* cpu = ooo->cpu;
+    int issued = 0;
+
+    for (int w = 0; w < ooo->rs_words && issued < ooo->config.issue_width; w++) {
+        uint64_t bits = ooo->rs_ready[w];
+        while (bits && issued < ooo->config.issue_width) {
+            int slot = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            ReservationStation* rs = &ooo->rs[slot];
+            ROBEntry* entry = &ooo->rob[rs->rob];
+
+            // Loads wait for every older store to reach memory
+            if (rs->op == INST_LD && ooo->stores_committed < entry->store_seq) continue;
+
+            int latency = op_latency[rs->op];
+            if (rs->op == INST_LD) {
+                entry->result = 0;
+                if (entry->address <= cpu->mem_size - sizeof(uint64_t)) {
+                    latency += cpu_mem_access(cpu, entry->address, false);
+                    entry->result = gmem_load64(cpu->memory, entry->address);
+                }
+            } else if (rs->op == INST_ST) {
+                entry->result = rs->vj;
+            } else {
+                entry->result = exec_handlers[rs->op](rs->vj, rs->vk, entry->imm,
+                                                      entry->next_pc);
+            }
+
+            CLEAR_BIT(ooo->rs_ready[w], slot % 64);
+            SET_BIT(ooo->rs_free[w], slot % 64);
+            entry->rs = -1;
+
+            entry->complete_at = cpu->cycles + latency;
+            int when = entry->complete_at & (TOMASULO_WHEEL - 1);
+            entry->next_event = ooo->wheel[when];
+            ooo->wheel[when] = rs->rob;
+            issued++;
         }
     }
-    
-    printf("\nReorder buffer:\n");
-    for (int i = 0; i < cpu->rob_size; i++) {
-        if (cpu->rob[i].busy) {
-            printf("  ROB%d: %s, dest=r%lu, ready=%s\n",
-                   i,
-                   cpu->rob[i].exception ? "EXCEPTION" : "normal",
-                   cpu->rob[i].dest,
-                   cpu->rob[i].ready ? "yes" : "no");
+    ooo->issued += issued;
+}
+
+static int tomasulo_alloc_rs(TomasuloCPU* ooo) {
+    for (int w = 0; w < ooo->rs_words; w++) {
+        if (ooo->rs_free[w]) return w * 64 + __builtin_ctzll(ooo->rs_free[w]);
+    }
+    return -1;
+}
+
+static void tomasulo_rename(TomasuloCPU* ooo, int reg, int slot,
+                            uint16_t* tag, uint64_t* value) {
+    uint16_t producer = ooo->reg_status[reg];
+    *tag = 0;
+    if (producer == 0) {
+        *value = ooo->cpu->registers[reg];
+    } else if (ooo->rob[producer - 1].done) {
+        *value = ooo->rob[producer - 1].result;
+    } else {
+        *tag = producer;
+        SET_BIT(rob_consumers(ooo, producer - 1)[slot / 64], slot % 64);
+    }
+}
+
+// Front end: rename up to dispatch_width predecoded instructions into the
+// ROB and reservation stations, following predicted branch targets
+static void tomasulo_dispatch(TomasuloCPU* ooo) {
+    CPU* cpu = ooo->cpu;
+    if (cpu->halted || cpu->draining || cpu->cycles < ooo->fetch_stall_until) return;
+
+    for (int n = 0; n < ooo->config.dispatch_width; n++) {
+        if (ooo->rob_count == ooo->config.rob_size) {
+            ooo->rob_full_cycles++;
+            return;
+        }
+
+        const DecodedBlock* block = cpu->fetch_block;
+        int fetch_slot = cpu->fetch_slot;
+        if (!block || !block->valid || fetch_slot >= block->count ||
+            block->insts[fetch_slot].pc != cpu->pc) {
+            block = predecode_lookup(cpu->predecode, cpu->pc);
+            fetch_slot = 0;
+        }
+        if (!block) return;
+        const DecodedInstruction* inst = &block->insts[fetch_slot];
+
+        bool needs_rs = inst->type != INST_NOP && inst->type != INST_HLT &&
+                        inst->type != INST_CALL && inst->type != INST_RET;
+        int slot = -1;
+        if (needs_rs) {
+            slot = tomasulo_alloc_rs(ooo);
+            if (slot < 0) {
+                ooo->rs_full_cycles++;
+                return;
+            }
+        }
+
+        cpu_mem_access(cpu, inst->pc, false);
+        if (cpu->trace) trace_write_fetch(cpu->trace, inst->pc);
+        cpu->fetch_block = block;
+        cpu->fetch_slot = fetch_slot + 1;
+
+        int index = ooo->rob_tail;
+        ROBEntry* entry = &ooo->rob[index];
+        entry->busy = true;
+        entry->done = !needs_rs;
+        entry->op = inst->type;
+        entry->dest = inst->rd;
+        entry->writes_reg = instruction_writes_register(inst->type);
+        entry->rs = slot;
+        entry->next_event = -1;
+        entry->pc = inst->pc;
+        entry->next_pc = inst->pc + inst->size;
+        entry->predicted_pc = entry->next_pc;
+        entry->imm = inst->imm;
+        entry->address = inst->address;
+        entry->result = 0;
+        entry->store_seq = ooo->stores_dispatched;
+        memset(rob_consumers(ooo, index), 0, ooo->rs_words * sizeof(uint64_t));
+
+        if (is_branch(inst->type) && bp_predict(cpu->bp, inst->pc)) {
+            entry->predicted_pc = inst->imm;
+        }
+        cpu->pc = entry->predicted_pc;
+
+        if (needs_rs) {
+            ReservationStation* rs = &ooo->rs[slot];
+            rs->op = inst->type;
+            rs->rob = index;
+            rs->qj = rs->qk = 0;
+            rs->vj = rs->vk = 0;
+
+            if (inst->type == INST_ST) {
+                tomasulo_rename(ooo, inst->rd, slot, &rs->qj, &rs->vj);
+                ooo->stores_dispatched++;
+            } else {
+                if (uses_rs1(inst->type)) tomasulo_rename(ooo, inst->rs1, slot, &rs->qj, &rs->vj);
+                if (uses_rs2(inst->type)) tomasulo_rename(ooo, inst->rs2, slot, &rs->qk, &rs->vk);
+            }
+
+            CLEAR_BIT(ooo->rs_free[slot / 64], slot % 64);
+            if (rs->qj == 0 && rs->qk == 0) SET_BIT(ooo->rs_ready[slot / 64], slot % 64);
+        }
+
+        // Sources are renamed before the destination
+        if (entry->writes_reg) ooo->reg_status[inst->rd] = index + 1;
+
+        ooo->rob_tail = rob_next(ooo, index);
+        ooo->rob_count++;
+        ooo->dispatched++;
+
+        if (inst->type == INST_HLT) {
+            cpu->halted = true;
+            cpu->pc = inst->pc;
+            return;
         }
+
+        // A predicted-taken branch ends the fetch group
+        if (entry->predicted_pc != entry->next_pc) return;
     }
-}
\ No newline at end of file
+}
+
+void tomasulo_step(TomasuloCPU* ooo) {
+    // Advance in reverse order, as the in-order pipeline does
+    tomasulo_commit(ooo);
+    tomasulo_writeback(ooo);
+    tomasulo_issue(ooo);
+    tomasulo_dispatch(ooo);
+
+    ooo->cpu->cycles++;
+}
+
+void tomasulo_run(TomasuloCPU* ooo, uint64_t cycles) {
+    for (uint64_t i = 0; i < cycles; i++) {
+        tomasulo_step(ooo);
+    }
+}
+
+void tomasulo_print_stats(TomasuloCPU* ooo) {
+    uint64_t cycles = ooo->cpu->cycles;
+
+    printf("\n=== Tomasulo Out-of-Order Statistics ===\n");
+    printf("ROB: %d, RS: %d, Width: %d/%d/%d (dispatch/issue/commit)\n",
+           ooo->config.rob_size, ooo->config.rs_count, ooo->config.dispatch_width,
+           ooo->config.issue_width, ooo->config.commit_width);
+    printf("Clock cycles: %lu\n", cycles);
+    printf("Instructions dispatched: %lu\n", ooo->dispatched);
+    printf("Instructions issued: %lu\n", ooo->issued);
+    printf("Instructions committed: %lu\n", ooo->committed);
+    printf("Instructions squashed: %lu\n", ooo->squashed);
+    printf("Branch mispredicts: %lu\n", ooo->mispredicts);
+    printf("ROB full cycles: %lu\n", ooo->rob_full_cycles);
+    printf("RS full cycles: %lu\n", ooo->rs_full_cycles);
+    printf("IPC: %.2f\n", cycles > 0 ? (float)ooo->committed / cycles : 0.0f);
+}
@@ -0,0 +1,432 @@
+#include "cpu.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if HAVE_LZ4
+#include <lz4.h>
+#endif
+
+// Largest encoding of one record: a 10-byte varint delta per value, plus
+// the write bitmap for memory and the flags varint for branches
+#define TRACE_MAX_RECORD 24
+
+static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline uint8_t* put_varint(uint8_t* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// NULL when the varint runs past end or over 64 bits
+static inline const uint8_t* get_varint(const uint8_t* p, const uint8_t* end, uint64_t* v) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *v = value;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static size_t max_block_size(uint32_t block_records) {
+    return (size_t)block_records * TRACE_MAX_RECORD + 16;
+}
+
+// ---- Writer ----
+
+TraceWriter* trace_writer_create(const char* path, uint32_t block_records, TraceCodec codec) {
+    if (block_records == 0) block_records = TRACE_BLOCK_RECORDS;
+#if !HAVE_LZ4
+    if (codec == TRACE_CODEC_LZ4) {
+        WARN("Built without LZ4; writing varint trace blocks\n");
+        codec = TRACE_CODEC_VARINT;
+    }
+#endif
+
+    TraceWriter* writer = (TraceWriter*)calloc(1, sizeof(TraceWriter));
+    if (!writer) return NULL;
+
+    writer->codec = codec;
+    writer->header.magic = TRACE_MAGIC;
+    writer->header.version = TRACE_VERSION;
+    writer->header.block_records = block_records;
+    writer->scratch_size = max_block_size(block_records);
+    writer->values[TRACE_FETCH] = (uint64_t*)malloc(block_records * sizeof(uint64_t));
+    writer->values[TRACE_MEM] = (uint64_t*)malloc(block_records * sizeof(uint64_t));
+    writer->branches = (BranchRecord*)malloc(block_records * sizeof(BranchRecord));
+    writer->scratch = (uint8_t*)malloc(writer->scratch_size);
+#if HAVE_LZ4
+    writer->packed = (uint8_t*)malloc(LZ4_compressBound((int)writer->scratch_size));
+#endif
+    if (!writer->values[TRACE_FETCH] || !writer->values[TRACE_MEM] || !writer->branches ||
+        !writer->scratch || (HAVE_LZ4 && !writer->packed)) {
+        writer->failed = true;
+        trace_writer_close(writer);
+        return NULL;
+    }
+
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        ERROR("Cannot open %s: %s\n", path, strerror(errno));
+        writer->failed = true;
+        trace_writer_close(writer);
+        return NULL;
+    }
+
+    // Placeholder; the real header goes in once the index is written
+    if (fwrite(&writer->header, sizeof(TraceHeader), 1, writer->file) != 1) {
+        writer->failed = true;
+    }
+    writer->bytes = sizeof(TraceHeader);
+    return writer;
+}
+
+// Varint bytes for the pending records of stream into scratch
+static size_t encode_block(TraceWriter* writer, TraceStream stream, uint32_t count) {
+    uint8_t* p = writer->scratch;
+    uint64_t prev = 0;
+
+    if (stream == TRACE_BRANCH) {
+        for (uint32_t i = 0; i < count; i++) {
+            const BranchRecord* r = &writer->branches[i];
+            p = put_varint(p, zigzag((int64_t)(r->pc - prev)));
+            p = put_varint(p, (uint64_t)r->taken | (uint64_t)(r->kind & 3) << 1 |
+                              (uint64_t)r->size << 3);
+            p = put_varint(p, zigzag((int64_t)(r->target - r->pc)));
+            prev = r->pc;
+        }
+        return p - writer->scratch;
+    }
+
+    const uint64_t* values = writer->values[stream];
+    if (stream == TRACE_MEM) {
+        for (uint32_t i = 0; i < count; i++) {
+            uint64_t addr = values[i] >> 1;
+            p = put_varint(p, zigzag((int64_t)(addr - prev)));
+            prev = addr;
+        }
+        // Write bits after the addresses, one per record
+        memset(p, 0, (count + 7) / 8);
+        for (uint32_t i = 0; i < count; i++) {
+            p[i / 8] |= (uint8_t)((values[i] & 1) << (i % 8));
+        }
+        p += (count + 7) / 8;
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            p = put_varint(p, zigzag((int64_t)(values[i] - prev)));
+            prev = values[i];
+        }
+    }
+    return p - writer->scratch;
+}
+
+static void writer_flush(TraceWriter* writer, TraceStream stream) {
+    // After a failure the records are dropped, so the buffers never overrun
+    uint32_t count = writer->pending[stream];
+    writer->pending[stream] = 0;
+    if (count == 0 || writer->failed) return;
+
+    size_t raw = encode_block(writer, stream, count);
+    const uint8_t* out = writer->scratch;
+    size_t size = raw;
+    uint8_t codec = TRACE_CODEC_VARINT;
+#if HAVE_LZ4
+    if (writer->codec == TRACE_CODEC_LZ4) {
+        int packed = LZ4_compress_default((const char*)writer->scratch, (char*)writer->packed,
+                                          (int)raw, LZ4_compressBound((int)writer->scratch_size));
+        if (packed > 0 && (size_t)packed < raw) {
+            out = writer->packed;
+            size = packed;
+            codec = TRACE_CODEC_LZ4;
+        }
+    }
+#endif
+
+    if (writer->header.block_count == writer->index_capacity) {
+        size_t capacity = writer->index_capacity ? writer->index_capacity * 2 : 64;
+        TraceBlock* index = (TraceBlock*)realloc(writer->index, capacity * sizeof(TraceBlock));
+        if (!index) {
+            writer->failed = true;
+            return;
+        }
+        writer->index = index;
+        writer->index_capacity = capacity;
+    }
+
+    TraceBlock* block = &writer->index[writer->header.block_count++];
+    memset(block, 0, sizeof(TraceBlock));
+    block->offset = writer->bytes;
+    block->size = (uint32_t)size;
+    block->raw_size = (uint32_t)raw;
+    block->count = count;
+    block->stream = stream;
+    block->codec = codec;
+
+    if (fwrite(out, 1, size, writer->file) != size) {
+        ERROR("Trace write failed: %s\n", strerror(errno));
+        writer->failed = true;
+        return;
+    }
+    writer->bytes += size;
+    writer->header.counts[stream] += count;
+}
+
+void trace_write_fetch(TraceWriter* writer, uint64_t pc) {
+    writer->values[TRACE_FETCH][writer->pending[TRACE_FETCH]++] = pc;
+    if (writer->pending[TRACE_FETCH] == writer->header.block_records) {
+        writer_flush(writer, TRACE_FETCH);
+    }
+}
+
+void trace_write_mem(TraceWriter* writer, uint64_t addr, bool is_write) {
+    writer->values[TRACE_MEM][writer->pending[TRACE_MEM]++] = addr << 1 | is_write;
+    if (writer->pending[TRACE_MEM] == writer->header.block_records) {
+        writer_flush(writer, TRACE_MEM);
+    }
+}
+
+void trace_write_branch(TraceWriter* writer, const BranchRecord* record) {
+    writer->branches[writer->pending[TRACE_BRANCH]++] = *record;
+    if (writer->pending[TRACE_BRANCH] == writer->header.block_records) {
+        writer_flush(writer, TRACE_BRANCH);
+    }
+}
+
+// Flushes, writes the index and header, and frees the writer
+int trace_writer_close(TraceWriter* writer) {
+    if (!writer) return -1;
+
+    if (writer->file) {
+        for (int s = 0; s < TRACE_STREAMS; s++) {
+            writer_flush(writer, (TraceStream)s);
+        }
+        writer->header.index_offset = writer->bytes;
+        size_t blocks = writer->header.block_count;
+        if (!writer->failed &&
+            (fwrite(writer->index, sizeof(TraceBlock), blocks, writer->file) != blocks ||
+             fseek(writer->file, 0, SEEK_SET) != 0 ||
+             fwrite(&writer->header, sizeof(TraceHeader), 1, writer->file) != 1)) {
+            ERROR("Trace write failed: %s\n", strerror(errno));
+            writer->failed = true;
+        }
+        if (fclose(writer->file) != 0) writer->failed = true;
+    }
+
+    int result = writer->failed ? -1 : 0;
+    free(writer->values[TRACE_FETCH]);
+    free(writer->values[TRACE_MEM]);
+    free(writer->branches);
+    free(writer->scratch);
+    free(writer->packed);
+    free(writer->index);
+    free(writer);
+    return result;
+}
+
+// ---- Reader ----
+
+TraceReader* trace_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        ERROR("Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TraceHeader)) {
+        ERROR("%s is not a trace\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    // Blocks are paged in as cursors reach them, so traces may exceed RAM
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ERROR("Cannot map %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    TraceReader* reader = (TraceReader*)calloc(1, sizeof(TraceReader));
+    if (!reader) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    reader->map = (const uint8_t*)map;
+    reader->map_size = st.st_size;
+    memcpy(&reader->header, map, sizeof(TraceHeader));
+
+    const TraceHeader* h = &reader->header;
+    if (h->magic != TRACE_MAGIC || h->version != TRACE_VERSION || h->block_records == 0 ||
+        h->index_offset > reader->map_size ||
+        h->block_count > (reader->map_size - h->index_offset) / sizeof(TraceBlock)) {
+        ERROR("%s: bad trace header\n", path);
+        trace_close(reader);
+        return NULL;
+    }
+
+    // The index may sit at any offset; copy it out for aligned access
+    reader->index = (TraceBlock*)malloc((h->block_count + 1) * sizeof(TraceBlock));
+    if (!reader->index) {
+        trace_close(reader);
+        return NULL;
+    }
+    memcpy(reader->index, reader->map + h->index_offset, h->block_count * sizeof(TraceBlock));
+
+    for (uint64_t i = 0; i < h->block_count; i++) {
+        const TraceBlock* b = &reader->index[i];
+        if (b->stream >= TRACE_STREAMS || b->count > h->block_records ||
+            b->offset > h->index_offset || b->size > h->index_offset - b->offset ||
+            b->raw_size > max_block_size(h->block_records)) {
+            ERROR("%s: bad trace block %lu\n", path, i);
+            trace_close(reader);
+            return NULL;
+        }
+        reader->block_count[b->stream]++;
+    }
+
+    for (int s = 0; s < TRACE_STREAMS; s++) {
+        reader->blocks[s] = (uint32_t*)malloc((reader->block_count[s] + 1) * sizeof(uint32_t));
+        if (!reader->blocks[s]) {
+            trace_close(reader);
+            return NULL;
+        }
+        reader->block_count[s] = 0;
+    }
+    for (uint64_t i = 0; i < h->block_count; i++) {
+        uint8_t s = reader->index[i].stream;
+        reader->blocks[s][reader->block_count[s]++] = (uint32_t)i;
+    }
+
+    return reader;
+}
+
+void trace_close(TraceReader* reader) {
+    if (reader) {
+        for (int s = 0; s < TRACE_STREAMS; s++) {
+            free(reader->blocks[s]);
+        }
+        free(reader->index);
+        munmap((void*)reader->map, reader->map_size);
+        free(reader);
+    }
+}
+
+int trace_cursor_init(TraceCursor* cursor, const TraceReader* reader, TraceStream stream) {
+    memset(cursor, 0, sizeof(TraceCursor));
+    cursor->reader = reader;
+    cursor->stream = stream;
+
+    uint32_t n = reader->header.block_records;
+    if (stream == TRACE_BRANCH) {
+        cursor->branches = (BranchRecord*)calloc(n, sizeof(BranchRecord));
+        if (!cursor->branches) return -1;
+    } else {
+        cursor->addrs = (uint64_t*)malloc(n * sizeof(uint64_t));
+        cursor->is_write = (uint8_t*)calloc(n, sizeof(uint8_t));
+        if (!cursor->addrs || !cursor->is_write) {
+            trace_cursor_destroy(cursor);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void trace_cursor_destroy(TraceCursor* cursor) {
+    free(cursor->addrs);
+    free(cursor->is_write);
+    free(cursor->branches);
+    free(cursor->unpacked);
+    memset(cursor, 0, sizeof(TraceCursor));
+}
+
+static bool decode_block(TraceCursor* cursor, const uint8_t* p, size_t size, uint32_t count) {
+    const uint8_t* end = p + size;
+    uint64_t prev = 0;
+    uint64_t v;
+
+    if (cursor->stream == TRACE_BRANCH) {
+        for (uint32_t i = 0; i < count; i++) {
+            BranchRecord* r = &cursor->branches[i];
+            uint64_t flags, target;
+            if (!(p = get_varint(p, end, &v)) || !(p = get_varint(p, end, &flags)) ||
+                !(p = get_varint(p, end, &target))) {
+                return false;
+            }
+            r->pc = prev + unzigzag(v);
+            r->taken = flags & 1;
+            r->kind = (flags >> 1) & 3;
+            r->size = (uint8_t)(flags >> 3);
+            r->target = r->pc + unzigzag(target);
+            prev = r->pc;
+        }
+        return true;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!(p = get_varint(p, end, &v))) return false;
+        prev += unzigzag(v);
+        cursor->addrs[i] = prev;
+    }
+    if (cursor->stream == TRACE_MEM) {
+        if ((size_t)(end - p) < (count + 7) / 8) return false;
+        for (uint32_t i = 0; i < count; i++) {
+            cursor->is_write[i] = (p[i / 8] >> (i % 8)) & 1;
+        }
+    }
+    return true;
+}
+
+// Decode the cursor's next block; returns its record count, 0 at the end
+// of the stream or on a corrupt block
+size_t trace_next_block(TraceCursor* cursor) {
+    const TraceReader* reader = cursor->reader;
+    if (cursor->next >= reader->block_count[cursor->stream]) return 0;
+
+    const TraceBlock* b = &reader->index[reader->blocks[cursor->stream][cursor->next++]];
+    const uint8_t* data = reader->map + b->offset;
+    size_t size = b->size;
+
+    if (b->codec == TRACE_CODEC_LZ4) {
+#if HAVE_LZ4
+        size_t capacity = max_block_size(reader->header.block_records);
+        if (!cursor->unpacked) {
+            cursor->unpacked = (uint8_t*)malloc(capacity);
+            if (!cursor->unpacked) return 0;
+        }
+        int n = LZ4_decompress_safe((const char*)data, (char*)cursor->unpacked,
+                                    (int)size, (int)capacity);
+        if (n < 0 || (uint32_t)n != b->raw_size) {
+            ERROR("Corrupt LZ4 trace block\n");
+            return 0;
+        }
+        data = cursor->unpacked;
+        size = n;
+#else
+        ERROR("Trace block is LZ4-compressed; rebuild with make LZ4=1\n");
+        return 0;
+#endif
+    } else if (b->codec != TRACE_CODEC_VARINT) {
+        ERROR("Unknown trace codec %u\n", b->codec);
+        return 0;
+    }
+
+    if (!decode_block(cursor, data, size, b->count)) {
+        ERROR("Corrupt trace block\n");
+        return 0;
+    }
+    return b->count;
+}
@@ -0,0 +1,154 @@
+#include "embedded.h"
+
+// Sample every sensor of the node
+static void sample_task(void* arg) {
+    RTOS* node = (RTOS*)arg;
+    for (int i = 0; i < MAX_SENSORS; i++) {
+        sensor_update(&node->sensors[i]);
+    }
+}
+
+// Drive the alarm pin from the temperature thresholds
+static void alarm_task(void* arg) {
+    RTOS* node = (RTOS*)arg;
+    bool alarm = false;
+    for (int i = 0; i < MAX_SENSORS; i++) {
+        alarm |= node->sensors[i].temperature > 30.0 || node->sensors[i].temperature < 10.0;
+    }
+    gpio_write(&node->gpio, 0, alarm);
+}
+
+static void report_task(void* arg) {
+    RTOS* node = (RTOS*)arg;
+    uint8_t frame[4 * MAX_SENSORS];
+    for (int i = 0; i < MAX_SENSORS; i++) {
+        memcpy(&frame[4 * i], &node->sensors[i].temperature, 4);
+    }
+    uart_write(&node->uart, frame, sizeof(frame));
+}
+
+// Default node, after demo_sensor_monitor: fast sampling, an alarm check
+// and a slower uplink report whose length differs from node to node, so
+// in some nodes it blocks the sampler past its deadline
+void fleet_sensor_node(RTOS* node, uint32_t index, void* arg) {
+    (void)index;
+    (void)arg;
+    uint64_t state = node->seed;
+
+    gpio_set_direction(&node->gpio, 0, true);
+    rtos_create_task(node, sample_task, node, PRIO_HIGH, 50 + splitmix64(&state) % 4 * 25, 2);
+    rtos_create_task(node, alarm_task, node, PRIO_NORMAL, 250, 1);
+    rtos_create_task(node, report_task, node, PRIO_LOW, 1000, 10 + splitmix64(&state) % 80);
+}
+
+// Nodes without a setup get fleet_sensor_node
+RTOSFleet* fleet_create(uint32_t count, uint64_t seed, FleetSetup setup, void* arg) {
+    if (count == 0) return NULL;
+
+    RTOSFleet* fleet = (RTOSFleet*)calloc(1, sizeof(RTOSFleet));
+    if (!fleet) return NULL;
+
+    fleet->nodes = (RTOS*)malloc((size_t)count * sizeof(RTOS));
+    fleet->power = (PowerManager*)malloc((size_t)count * sizeof(PowerManager));
+    if (!fleet->nodes || !fleet->power) {
+        ERROR("Out of memory for a fleet of %u nodes\n", count);
+        fleet_destroy(fleet);
+        return NULL;
+    }
+    fleet->count = count;
+    fleet->seed = seed;
+    if (!setup) setup = fleet_sensor_node;
+
+    for (uint32_t i = 0; i < count; i++) {
+        RTOS* node = &fleet->nodes[i];
+        rtos_init(node);
+        rtos_set_virtual_clock(node, 0);
+        rtos_seed(node, rng_stream_seed(seed, i));
+        pm_init(&fleet->power[i]);
+        rtos_set_tickless(node, true, &fleet->power[i]);
+        setup(node, i, arg);
+    }
+    return fleet;
+}
+
+void fleet_destroy(RTOSFleet* fleet) {
+    if (!fleet) return;
+    for (uint32_t i = 0; i < fleet->count; i++) {
+        rtos_release(&fleet->nodes[i]);
+    }
+    free(fleet->nodes);
+    free(fleet->power);
+    free(fleet);
+}
+
+typedef struct {
+    RTOSFleet* fleet;
+    uint64_t ms;
+} FleetStep;
+
+static void step_node(void* ctx, size_t index, int worker) {
+    (void)worker;
+    FleetStep* step = (FleetStep*)ctx;
+    rtos_advance(&step->fleet->nodes[index], step->ms);
+}
+
+static void collect(RTOSFleet* fleet) {
+    fleet->executions = 0;
+    fleet->misses = 0;
+    fleet->energy = 0;
+    fleet->sleeps = 0;
+    fleet->max_wake_latency = 0;
+    fleet->nodes_missing = 0;
+
+    for (uint32_t i = 0; i < fleet->count; i++) {
+        RTOS* node = &fleet->nodes[i];
+        uint64_t misses = 0;
+        for (uint32_t t = 0; t < node->task_count; t++) {
+            RTTask* task = &node->tasks[t];
+            fleet->executions += task->executions;
+            misses += task->misses;
+            fleet->max_wake_latency = MAX(fleet->max_wake_latency, task->max_wake_latency);
+        }
+
+        pm_update(&fleet->power[i]);
+        fleet->misses += misses;
+        fleet->energy += fleet->power[i].total_energy;
+        fleet->sleeps += node->sleeps;
+        if (misses > 0) fleet->nodes_missing++;
+    }
+}
+
+// Advance every node by ms of virtual time on threads workers (<= 0: every
+// CPU). Nodes share nothing, so each runs the whole stretch in one go on
+// whichever worker picks it up.
+int fleet_run(RTOSFleet* fleet, uint64_t ms, int threads) {
+    FleetStep step = { .fleet = fleet, .ms = ms };
+    if (threads <= 0) threads = parallel_default_threads();
+
+    uint64_t start = get_time_us();
+    if (parallel_for(fleet->count, threads, step_node, &step) != 0) return -1;
+    fleet->elapsed_us += get_time_us() - start;
+    fleet->threads_used = (int)MIN((uint32_t)threads, fleet->count);
+    fleet->time_ms += ms;
+
+    collect(fleet);
+    return 0;
+}
+
+void fleet_print_stats(RTOSFleet* fleet) {
+    printf("\n=== Fleet Statistics ===\n");
+    printf("Nodes: %u, virtual time: %lu ms\n", fleet->count, fleet->time_ms);
+    printf("Jobs: %lu, deadline misses: %lu (%.3f%%), nodes missing: %u\n",
+           fleet->executions, fleet->misses,
+           fleet->executions > 0 ? 100.0 * fleet->misses / fleet->executions : 0.0,
+           fleet->nodes_missing);
+    printf("Energy: %.3f J total, %.1f uJ/job, %.2f mJ per node\n",
+           fleet->energy / 1000000.0,
+           fleet->executions > 0 ? (double)fleet->energy / fleet->executions : 0.0,
+           fleet->energy / 1000.0 / fleet->count);
+    printf("Sleeps: %lu, worst wake latency: %lu us\n",
+           fleet->sleeps, fleet->max_wake_latency);
+    printf("Host: %.2f ms on %d threads, %.0f node-seconds/s\n",
+           fleet->elapsed_us / 1000.0, fleet->threads_used,
+           fleet->elapsed_us > 0 ? (double)fleet->count * fleet->time_ms * 1000.0 / fleet->elapsed_us : 0.0);
+}
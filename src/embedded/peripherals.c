@@ -0,0 +1,249 @@
+#include "embedded.h"
+
+int spsc_ring_init(SPSCRing* ring, uint32_t capacity, uint32_t elem) {
+    memset(ring, 0, sizeof(SPSCRing));
+    if (capacity < 1 || capacity > (1u << 31) || elem < 1) return -1;
+
+    uint32_t slots = 1;
+    while (slots < capacity) slots <<= 1;
+    ring->data = (uint8_t*)malloc((size_t)slots * elem);
+    if (!ring->data) return -1;
+    ring->mask = slots - 1;
+    ring->elem = elem;
+    return 0;
+}
+
+void spsc_ring_destroy(SPSCRing* ring) {
+    free(ring->data);
+    memset(ring, 0, sizeof(SPSCRing));
+}
+
+// Up to count elements in at most two copies; the rest is left to the caller
+static uint32_t ring_write(SPSCRing* ring, const void* src, uint32_t count) {
+    if (!ring->data) return 0;
+
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint64_t space = ring->mask + 1 - (tail - ring->cached_head);
+    if (space < count) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        space = ring->mask + 1 - (tail - ring->cached_head);
+    }
+
+    uint32_t n = (uint32_t)MIN((uint64_t)count, space);
+    uint32_t at = (uint32_t)(tail & ring->mask);
+    uint32_t first = MIN(n, ring->mask + 1 - at);
+    memcpy(ring->data + (size_t)at * ring->elem, src, (size_t)first * ring->elem);
+    memcpy(ring->data, (const uint8_t*)src + (size_t)first * ring->elem,
+           (size_t)(n - first) * ring->elem);
+    if (n > 0) __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+// Producer side: what does not fit is dropped and counted
+uint32_t spsc_ring_push(SPSCRing* ring, const void* src, uint32_t count) {
+    uint32_t n = ring_write(ring, src, count);
+    ring->dropped += count - n;
+    return n;
+}
+
+uint32_t spsc_ring_pop(SPSCRing* ring, void* dst, uint32_t count) {
+    if (!ring->data) return 0;
+
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint64_t ready = ring->cached_tail - head;
+    if (ready < count) {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        ready = ring->cached_tail - head;
+    }
+
+    uint32_t n = (uint32_t)MIN((uint64_t)count, ready);
+    uint32_t at = (uint32_t)(head & ring->mask);
+    uint32_t first = MIN(n, ring->mask + 1 - at);
+    memcpy(dst, ring->data + (size_t)at * ring->elem, (size_t)first * ring->elem);
+    memcpy((uint8_t*)dst + (size_t)first * ring->elem, ring->data,
+           (size_t)(n - first) * ring->elem);
+    if (n > 0) __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+// Exact on either side when the other is idle, a lower bound otherwise
+uint32_t spsc_ring_count(SPSCRing* ring) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    return (uint32_t)(__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - head);
+}
+
+void gpio_init(VirtualGPIO* gpio) {
+    memset(gpio, 0, sizeof(VirtualGPIO));
+    if (spsc_ring_init(&gpio->events, GPIO_EVENT_RING, sizeof(GPIOEvent)) != 0 ||
+        spsc_ring_init(&gpio->loopback, GPIO_EVENT_RING, sizeof(GPIOEvent)) != 0) {
+        ERROR("Out of memory for GPIO event rings\n");
+    }
+}
+
+void gpio_destroy(VirtualGPIO* gpio) {
+    spsc_ring_destroy(&gpio->events);
+    spsc_ring_destroy(&gpio->loopback);
+}
+
+void gpio_set_direction(VirtualGPIO* gpio, uint32_t pin, bool output) {
+    if (pin < GPIO_PINS) {
+        if (output) {
+            __atomic_fetch_or(&gpio->direction, 1u << pin, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_and(&gpio->direction, ~(1u << pin), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Set the pin and queue an interrupt if that was an edge on a masked pin
+static void gpio_set(VirtualGPIO* gpio, SPSCRing* ring, uint32_t pin, bool value) {
+    uint32_t old = value ? __atomic_fetch_or(&gpio->value, 1u << pin, __ATOMIC_RELAXED)
+                         : __atomic_fetch_and(&gpio->value, ~(1u << pin), __ATOMIC_RELAXED);
+
+    uint32_t mask = __atomic_load_n(&gpio->interrupt_mask, __ATOMIC_RELAXED);
+    if (((old >> pin) & 1) != value && (mask & (1u << pin))) {
+        GPIOEvent event = { .pin = pin, .value = value };
+        spsc_ring_push(ring, &event, 1);
+    }
+}
+
+void gpio_write(VirtualGPIO* gpio, uint32_t pin, bool value) {
+    if (pin < GPIO_PINS && (gpio->direction & (1u << pin))) {
+        gpio_set(gpio, &gpio->loopback, pin, value);
+    }
+}
+
+bool gpio_read(VirtualGPIO* gpio, uint32_t pin) {
+    if (pin < GPIO_PINS) {
+        return (__atomic_load_n(&gpio->value, __ATOMIC_RELAXED) >> pin) & 1;
+    }
+    return false;
+}
+
+// The outside world driving an input pin, from at most one thread besides
+// the firmware's
+void gpio_drive(VirtualGPIO* gpio, uint32_t pin, bool value) {
+    if (pin < GPIO_PINS && !(__atomic_load_n(&gpio->direction, __ATOMIC_RELAXED) & (1u << pin))) {
+        gpio_set(gpio, &gpio->events, pin, value);
+    }
+}
+
+// Only what is queued on entry: interrupts raised by the callbacks wait for
+// the next boundary
+static uint32_t deliver(VirtualGPIO* gpio, SPSCRing* ring) {
+    GPIOEvent batch[GPIO_EVENT_BATCH];
+    uint32_t pending = spsc_ring_count(ring);
+    uint32_t total = 0;
+
+    while (total < pending) {
+        uint32_t n = spsc_ring_pop(ring, batch, MIN(pending - total, GPIO_EVENT_BATCH));
+        for (uint32_t i = 0; i < n && gpio->callback; i++) {
+            gpio->callback(batch[i].pin, batch[i].value);
+        }
+        total += n;
+    }
+    return total;
+}
+
+// Hand queued interrupts to callback, the firmware's own edges first;
+// rtos_schedule calls this on every pass
+uint32_t gpio_dispatch(VirtualGPIO* gpio) {
+    uint32_t n = deliver(gpio, &gpio->loopback) + deliver(gpio, &gpio->events);
+    gpio->delivered += n;
+    return n;
+}
+
+void uart_init(VirtualUART* uart, uint32_t baud_rate) {
+    memset(uart, 0, sizeof(VirtualUART));
+    if (uart_configure(uart, baud_rate, UART_RING_SIZE, UART_RING_SIZE) != 0) {
+        ERROR("Out of memory for UART rings\n");
+    }
+}
+
+// New rings of (at least) rx_size and tx_size bytes; anything queued is
+// dropped, so not while the line side is running
+int uart_configure(VirtualUART* uart, uint32_t baud_rate, uint32_t rx_size, uint32_t tx_size) {
+    SPSCRing rx, tx;
+    if (spsc_ring_init(&rx, rx_size, 1) != 0) return -1;
+    if (spsc_ring_init(&tx, tx_size, 1) != 0) {
+        spsc_ring_destroy(&rx);
+        return -1;
+    }
+
+    spsc_ring_destroy(&uart->rx);
+    spsc_ring_destroy(&uart->tx);
+    uart->rx = rx;
+    uart->tx = tx;
+    uart->baud_rate = baud_rate;
+    return 0;
+}
+
+void uart_destroy(VirtualUART* uart) {
+    spsc_ring_destroy(&uart->rx);
+    spsc_ring_destroy(&uart->tx);
+}
+
+// Bytes accepted; the rest found the tx ring full (tx.dropped)
+uint32_t uart_write(VirtualUART* uart, const uint8_t* data, uint32_t len) {
+    return spsc_ring_push(&uart->tx, data, len);
+}
+
+uint32_t uart_read(VirtualUART* uart, uint8_t* buffer, uint32_t len) {
+    return spsc_ring_pop(&uart->rx, buffer, len);
+}
+
+// Line side: bytes arriving on RX, overruns counted in rx.dropped
+uint32_t uart_line_send(VirtualUART* uart, const uint8_t* data, uint32_t len) {
+    return spsc_ring_push(&uart->rx, data, len);
+}
+
+// Line side: bytes the firmware has transmitted
+uint32_t uart_line_receive(VirtualUART* uart, uint8_t* buffer, uint32_t len) {
+    return spsc_ring_pop(&uart->tx, buffer, len);
+}
+
+static int dma_submit(UARTDMAQueue* queue, UARTDMA* desc) {
+    if (!desc || queue->count == UART_DMA_QUEUE) return -1;
+
+    desc->transferred = 0;
+    desc->done = false;
+    queue->queue[(queue->first + queue->count) % UART_DMA_QUEUE] = desc;
+    queue->count++;
+    return 0;
+}
+
+// Descriptors start at the next uart_dma_service; -1 if the queue is full
+int uart_dma_rx(VirtualUART* uart, UARTDMA* desc) {
+    return dma_submit(&uart->rx_dma, desc);
+}
+
+int uart_dma_tx(VirtualUART* uart, UARTDMA* desc) {
+    return dma_submit(&uart->tx_dma, desc);
+}
+
+// Move as much of the queued descriptors as the ring allows, in order
+static uint32_t dma_run(UARTDMAQueue* queue, SPSCRing* ring, bool transmit) {
+    uint32_t completed = 0;
+    while (queue->count > 0) {
+        UARTDMA* desc = queue->queue[queue->first];
+        uint8_t* at = desc->buffer + desc->transferred;
+        uint32_t left = desc->length - desc->transferred;
+        desc->transferred += transmit ? ring_write(ring, at, left) : spsc_ring_pop(ring, at, left);
+        if (desc->transferred < desc->length) break;
+
+        queue->first = (queue->first + 1) % UART_DMA_QUEUE;
+        queue->count--;
+        desc->done = true;
+        completed++;
+        if (desc->complete) desc->complete(desc, desc->arg);
+    }
+    return completed;
+}
+
+// Descriptors completed; rtos_schedule calls this on every pass
+uint32_t uart_dma_service(VirtualUART* uart) {
+    uint32_t completed = dma_run(&uart->tx_dma, &uart->tx, true) +
+                         dma_run(&uart->rx_dma, &uart->rx, false);
+    uart->dma_completed += completed;
+    return completed;
+}
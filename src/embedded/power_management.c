@@ -1,46 +1,18 @@
 #include "embedded.h"
 
-// Power states
-typedef enum {
-    POWER_RUN,      // Full power
-    POWER_IDLE,     // CPU idle, peripherals active
-    POWER_SLEEP,    // CPU stopped, some peripherals active
-    POWER_DEEP_SLEEP, // CPU stopped, minimal peripherals
-    POWER_OFF       // Complete power off
-} PowerState;
-
-// Power management unit
-typedef struct {
-    PowerState state;
-    uint64_t transition_time;
-    uint64_t wakeup_source;
-    float voltage;
-    float current;
-    float temperature;
-    
-    // Power domains
-    bool cpu_powered;
-    bool memory_powered;
-    bool peripherals_powered;
-    
-    // Wakeup sources
-    uint32_t wakeup_pins;
-    uint32_t wakeup_timers;
-    bool wakeup_on_uart;
-    
-    // Statistics
-    uint64_t time_in_state[5];
-    uint64_t state_entries[5];
-    uint64_t total_energy;  // in microjoules
-} PowerManager;
-
 // Create power manager
 PowerManager* pm_create(void) {
     PowerManager* pm = (PowerManager*)malloc(sizeof(PowerManager));
     if (!pm) return NULL;
     
+    pm_init(pm);
+    return pm;
+}
+
+void pm_init(PowerManager* pm) {
+    pm->clock = NULL;
     pm->state = POWER_RUN;
-    pm->transition_time = 0;
+    pm->transition_time = get_time_ms();
     pm->wakeup_source = 0;
     pm->voltage = 3.3;  // Typical 3.3V
     pm->current = 50.0; // 50mA in run mode
@@ -57,25 +29,38 @@ PowerManager* pm_create(void) {
     memset(pm->time_in_state, 0, sizeof(pm->time_in_state));
     memset(pm->state_entries, 0, sizeof(pm->state_entries));
     pm->total_energy = 0;
-    
-    return pm;
 }
 
 void pm_destroy(PowerManager* pm) {
     free(pm);
 }
 
+// Charge the time and energy (simplified: E = V * I * t) since the last
+// transition to the current state
+static void account(PowerManager* pm, uint64_t now) {
+    uint64_t elapsed = now - pm->transition_time;
+    pm->time_in_state[pm->state] += elapsed;
+    pm->total_energy += (uint64_t)(pm->voltage * pm->current * elapsed);  // mW * ms = μJ
+    pm->transition_time = now;
+}
+
+// Settle the account on the old clock, then keep time by the new one
+void pm_set_clock(PowerManager* pm, const uint64_t* clock) {
+    account(pm, device_time_ms(pm->clock));
+    pm->clock = clock;
+    pm->transition_time = device_time_ms(clock);
+}
+
 // Enter power state
 void pm_enter_state(PowerManager* pm, PowerState new_state) {
     PowerState old_state = pm->state;
-    uint64_t now = get_time_ms();
+    uint64_t now = device_time_ms(pm->clock);
     
     // Update statistics for old state
-    pm->time_in_state[old_state] += now - pm->transition_time;
+    account(pm, now);
     pm->state_entries[new_state]++;
     
     pm->state = new_state;
-    pm->transition_time = now;
     
     // Configure power domains based on state
     switch (new_state) {
@@ -115,30 +100,41 @@ void pm_enter_state(PowerManager* pm, PowerState new_state) {
             break;
     }
     
-    INFO("Power state: %d -> %d, current: %.1fmA\n", 
-         old_state, new_state, pm->current);
+    if (DEBUG_POWER) {
+        INFO("Power state: %d -> %d, current: %.1fmA\n", 
+             old_state, new_state, pm->current);
+    }
 }
 
 // Update power calculations
 void pm_update(PowerManager* pm) {
-    uint64_t now = get_time_ms();
-    uint64_t elapsed = now - pm->transition_time;
-    
-    // Update time in current state
-    pm->time_in_state[pm->state] += elapsed;
-    
-    // Calculate energy used (simplified: E = V * I * t)
-    float power_mw = pm->voltage * pm->current;  // mW
-    uint64_t energy_uj = (uint64_t)(power_mw * elapsed);  // μJ
-    
-    pm->total_energy += energy_uj;
-    pm->transition_time = now;
+    account(pm, device_time_ms(pm->clock));
     
     // Update temperature based on power
+    float power_mw = pm->voltage * pm->current;  // mW
     float temp_increase = power_mw * 0.01;  // Simplified thermal model
     pm->temperature = 25.0 + temp_increase;
 }
 
+// Time to get back to POWER_RUN from state, in us
+uint32_t pm_wakeup_latency(PowerState state) {
+    switch (state) {
+        case POWER_RUN: return 0;
+        case POWER_IDLE: return PM_IDLE_WAKEUP_US;
+        case POWER_SLEEP: return PM_SLEEP_WAKEUP_US;
+        case POWER_DEEP_SLEEP: return PM_DEEP_SLEEP_WAKEUP_US;
+        default: return UINT32_MAX;  // POWER_OFF needs a reset
+    }
+}
+
+// Deepest state that can be back in POWER_RUN within slack_us
+PowerState pm_deepest_state(uint64_t slack_us) {
+    for (int state = POWER_DEEP_SLEEP; state > POWER_RUN; state--) {
+        if (pm_wakeup_latency((PowerState)state) <= slack_us) return (PowerState)state;
+    }
+    return POWER_RUN;
+}
+
 // Set wakeup source
 void pm_set_wakeup_source(PowerManager* pm, uint32_t source_type, uint32_t source_id) {
     switch (source_type) {
@@ -195,13 +191,18 @@ void pm_print_stats(PowerManager* pm) {
     printf("Temperature: %.1f°C\n", pm->temperature);
     printf("Total energy: %.3fJ\n", pm->total_energy / 1000000.0);
     
+    uint64_t total = 0;
+    for (int i = 0; i < 5; i++) {
+        total += pm->time_in_state[i];
+    }
+    
     printf("\nTime in each state:\n");
     for (int i = 0; i < 5; i++) {
         if (pm->time_in_state[i] > 0) {
             printf("  %-12s: %8lu ms (%5.1f%%), entries: %lu\n",
                    state_names[i],
                    pm->time_in_state[i],
-                   100.0 * pm->time_in_state[i] / get_time_ms(),
+                   100.0 * pm->time_in_state[i] / total,
                    pm->state_entries[i]);
         }
     }
@@ -4,29 +4,130 @@ RTOS* rtos_create() {
     RTOS* rtos = (RTOS*)malloc(sizeof(RTOS));
     if (!rtos) return NULL;
     
+    rtos_init(rtos);
+    return rtos;
+}
+
+void rtos_init(RTOS* rtos) {
     memset(rtos, 0, sizeof(RTOS));
     rtos->system_time = get_time_ms();
+    rtos->wheel_origin = rtos->system_time;
     rtos->running = false;
     
     // Initialize virtual hardware
     gpio_init(&rtos->gpio);
     uart_init(&rtos->uart, 115200);
     
+    timer_wheel_init(&rtos->wheel);
     for (int i = 0; i < MAX_TIMERS; i++) {
         timer_init(&rtos->timers[i], 1, true);
+        timer_wheel_attach(&rtos->wheel, &rtos->timers[i]);
     }
     
+    rtos_seed(rtos, 0);
+}
+
+// Run on clock_us from start_ms on, sensors and power manager included.
+// Call before creating tasks: their first release is the current time.
+void rtos_set_virtual_clock(RTOS* rtos, uint64_t start_ms) {
+    rtos->virtual_clock = true;
+    rtos->clock_us = start_ms * 1000;
+    rtos->system_time = start_ms;
+    rtos->wheel_origin = start_ms - rtos->wheel.now;
+    
     for (int i = 0; i < MAX_SENSORS; i++) {
+        rtos->sensors[i].clock = &rtos->clock_us;
+        rtos->sensors[i].last_movement = start_ms;
+    }
+    if (rtos->pm) pm_set_clock(rtos->pm, &rtos->clock_us);
+}
+
+// Give each sensor its own stream of seed and take fresh readings
+void rtos_seed(RTOS* rtos, uint64_t seed) {
+    rtos->seed = seed;
+    for (int i = 0; i < MAX_SENSORS; i++) {
+        rtos->sensors[i].rng = rng_stream_seed(seed, i);
         sensor_update(&rtos->sensors[i]);
     }
-    
-    return rtos;
 }
 
 void rtos_destroy(RTOS* rtos) {
+    if (!rtos) return;
+    rtos_release(rtos);
     free(rtos);
 }
 
+void rtos_release(RTOS* rtos) {
+    gpio_destroy(&rtos->gpio);
+    uart_destroy(&rtos->uart);
+}
+
+// Absolute deadline of the task's current job
+static uint64_t job_deadline(RTTask* task) {
+    return (uint64_t)task->next_run + task->deadline;
+}
+
+// Policy order for released tasks; ties go to the lower index, as the
+// old linear scan did
+static bool runs_before(RTOS* rtos, uint8_t a, uint8_t b) {
+    RTTask* ta = &rtos->tasks[a];
+    RTTask* tb = &rtos->tasks[b];
+    
+    if (rtos->policy == RTOS_EDF) {
+        if (job_deadline(ta) != job_deadline(tb)) return job_deadline(ta) < job_deadline(tb);
+    } else if (ta->priority != tb->priority) {
+        return ta->priority > tb->priority;
+    }
+    return a < b;
+}
+
+static bool releases_before(RTOS* rtos, uint8_t a, uint8_t b) {
+    if (rtos->tasks[a].next_run != rtos->tasks[b].next_run) {
+        return rtos->tasks[a].next_run < rtos->tasks[b].next_run;
+    }
+    return a < b;
+}
+
+typedef bool (*TaskOrder)(RTOS* rtos, uint8_t a, uint8_t b);
+
+static void heap_push(RTOS* rtos, uint8_t* heap, uint32_t* count, TaskOrder before, uint8_t idx) {
+    uint32_t i = (*count)++;
+    while (i > 0 && before(rtos, idx, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = idx;
+}
+
+static void heap_sift_down(RTOS* rtos, uint8_t* heap, uint32_t count, TaskOrder before, uint32_t i) {
+    uint8_t idx = heap[i];
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= count) break;
+        if (child + 1 < count && before(rtos, heap[child + 1], heap[child])) {
+            child++;
+        }
+        if (!before(rtos, heap[child], idx)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = idx;
+}
+
+static uint8_t heap_pop(RTOS* rtos, uint8_t* heap, uint32_t* count, TaskOrder before) {
+    uint8_t top = heap[0];
+    heap[0] = heap[--(*count)];
+    if (*count > 0) heap_sift_down(rtos, heap, *count, before, 0);
+    return top;
+}
+
+void rtos_set_policy(RTOS* rtos, RTOSPolicy policy) {
+    rtos->policy = policy;
+    for (uint32_t i = rtos->ready_count / 2; i-- > 0;) {
+        heap_sift_down(rtos, rtos->ready, rtos->ready_count, runs_before, i);
+    }
+}
+
 uint32_t rtos_create_task(RTOS* rtos, void (*func)(void*), void* arg,
                          TaskPriority prio, uint32_t period, uint32_t wcet) {
     if (rtos->task_count >= MAX_TASKS) {
@@ -49,12 +150,122 @@ uint32_t rtos_create_task(RTOS* rtos, void (*func)(void*), void* arg,
     task->misses = 0;
     task->total_time = 0;
     
+    heap_push(rtos, rtos->pending, &rtos->pending_count, releases_before, rtos->task_count);
     rtos->task_count++;
     return task->id;
 }
 
+static uint64_t div_ceil(uint64_t a, uint64_t b) {
+    return (a + b - 1) / b;
+}
+
+// Fixed-priority response time of tasks[i]. Tasks run to completion, so on
+// top of interference from tasks ordered before it, a job can be held up by
+// one lower-ordered job that has just started. Every job in the level-i busy
+// period is checked (Davis, Burns, Bril & Lukkien 2007), since with
+// blocking the first one is not necessarily the worst. Returns UINT32_MAX
+// when it exceeds the deadline.
+static uint32_t response_time(RTOS* rtos, uint32_t i) {
+    RTTask* task = &rtos->tasks[i];
+    uint64_t blocking = 0;
+    
+    for (uint32_t j = 0; j < rtos->task_count; j++) {
+        if (j != i && rtos->tasks[j].period > 0 && !runs_before(rtos, j, i)) {
+            blocking = MAX(blocking, rtos->tasks[j].wcet);
+        }
+    }
+    
+    // Level-i busy period; unbounded once the levels up to i are saturated
+    double load = 0.0;
+    for (uint32_t j = 0; j < rtos->task_count; j++) {
+        RTTask* other = &rtos->tasks[j];
+        if (other->period > 0 && (j == i || runs_before(rtos, j, i))) {
+            load += (double)other->wcet / other->period;
+        }
+    }
+    if (load > 1.0 || (load == 1.0 && blocking > 0)) return UINT32_MAX;
+    
+    uint64_t busy = blocking + task->wcet;
+    for (;;) {
+        uint64_t next = blocking;
+        for (uint32_t j = 0; j < rtos->task_count; j++) {
+            RTTask* other = &rtos->tasks[j];
+            if (other->period > 0 && (j == i || runs_before(rtos, j, i))) {
+                next += div_ceil(MAX(busy, 1), other->period) * other->wcet;
+            }
+        }
+        if (next == busy) break;
+        busy = next;
+    }
+    
+    uint64_t worst = 0;
+    uint64_t jobs = div_ceil(MAX(busy, 1), task->period);
+    for (uint64_t q = 0; q < jobs; q++) {
+        // Start time of job q: fixed point of the demand released before it
+        uint64_t start = blocking + q * task->wcet;
+        for (;;) {
+            uint64_t next = blocking + q * task->wcet;
+            for (uint32_t j = 0; j < rtos->task_count; j++) {
+                RTTask* other = &rtos->tasks[j];
+                if (other->period > 0 && runs_before(rtos, j, i)) {
+                    next += (start / other->period + 1) * other->wcet;
+                }
+            }
+            if (next == start) break;
+            start = next;
+            if (start + task->wcet > q * task->period + task->deadline) return UINT32_MAX;
+        }
+        
+        uint64_t response = start + task->wcet - q * task->period;
+        if (response > task->deadline) return UINT32_MAX;
+        worst = MAX(worst, response);
+    }
+    return (uint32_t)worst;
+}
+
+uint32_t rtos_response_time(RTOS* rtos, uint32_t task_id) {
+    if (task_id == 0 || task_id > rtos->task_count) return UINT32_MAX;
+    if (rtos->tasks[task_id - 1].period == 0) return UINT32_MAX;
+    return response_time(rtos, task_id - 1);
+}
+
+// Non-preemptive EDF with implicit deadlines is schedulable iff utilization
+// is at most 1 and, for every task i and every L strictly between the
+// shortest period and T_i, L >= C_i + sum over shorter-period j of
+// floor((L - 1) / T_j) * C_j (Jeffay, Stanat & Martel 1991). The right-hand
+// side only steps up just after multiples of T_j, so those are the only
+// points checked.
+static bool edf_schedulable(RTOS* rtos) {
+    uint32_t min_period = UINT32_MAX;
+    for (uint32_t i = 0; i < rtos->task_count; i++) {
+        if (rtos->tasks[i].period > 0) min_period = MIN(min_period, rtos->tasks[i].period);
+    }
+    
+    for (uint32_t i = 0; i < rtos->task_count; i++) {
+        RTTask* task = &rtos->tasks[i];
+        if (task->period == 0) continue;
+        
+        for (uint32_t k = 0; k < rtos->task_count; k++) {
+            RTTask* step = &rtos->tasks[k];
+            if (step->period == 0 || step->period >= task->period) continue;
+            
+            for (uint64_t L = div_ceil(min_period, step->period) * step->period + 1;
+                 L < task->period; L += step->period) {
+                uint64_t demand = task->wcet;
+                for (uint32_t j = 0; j < rtos->task_count; j++) {
+                    RTTask* other = &rtos->tasks[j];
+                    if (other->period > 0 && other->period < task->period) {
+                        demand += (L - 1) / other->period * other->wcet;
+                    }
+                }
+                if (demand > L) return false;
+            }
+        }
+    }
+    return true;
+}
+
 bool rtos_schedulable(RTOS* rtos) {
-    // Rate Monotonic Analysis
     double utilization = 0.0;
     
     for (uint32_t i = 0; i < rtos->task_count; i++) {
@@ -64,52 +275,69 @@ bool rtos_schedulable(RTOS* rtos) {
         }
     }
     
-    // Liu & Layland bound
-    double bound = rtos->task_count * (pow(2.0, 1.0/rtos->task_count) - 1.0);
-    
     printf("Total utilization: %.2f%%\n", utilization * 100);
+    
+    if (rtos->policy == RTOS_EDF) {
+        bool ok = utilization <= 1.0 && edf_schedulable(rtos);
+        printf("EDF demand test: %s\n", ok ? "pass" : "fail");
+        return ok;
+    }
+    
+    // Liu & Layland is only sufficient; the response times decide
+    double bound = rtos->task_count * (pow(2.0, 1.0/rtos->task_count) - 1.0);
     printf("RMA bound for %d tasks: %.2f%%\n", 
            rtos->task_count, bound * 100);
     
-    return utilization <= bound;
+    bool ok = true;
+    for (uint32_t i = 0; i < rtos->task_count; i++) {
+        RTTask* task = &rtos->tasks[i];
+        if (task->period == 0) continue;
+        
+        uint32_t response = response_time(rtos, i);
+        if (response == UINT32_MAX) {
+            printf("  Task %u: misses its %u ms deadline\n", task->id, task->deadline);
+            ok = false;
+        } else {
+            printf("  Task %u: response time %u ms (deadline %u ms)\n",
+                   task->id, response, task->deadline);
+        }
+    }
+    return ok;
 }
 
 void rtos_schedule(RTOS* rtos) {
-    uint64_t now = get_time_ms();
+    uint64_t call_start = get_time_ns();
+    uint64_t task_ns = 0;
+    uint64_t now = rtos_time_us(rtos) / 1000;
     rtos->system_time = now;
     
-    // Check for timer events
-    for (int i = 0; i < MAX_TIMERS; i++) {
-        if (rtos->timers[i].enabled) {
-            rtos->timers[i].counter++;
-            if (rtos->timers[i].counter >= rtos->timers[i].compare) {
-                if (rtos->timers[i].callback) {
-                    rtos->timers[i].callback();
-                }
-                if (rtos->timers[i].auto_reload) {
-                    rtos->timers[i].counter = 0;
-                } else {
-                    rtos->timers[i].enabled = false;
-                }
-            }
-        }
+    // Catch the wheel up to now; only timers due on the way are touched
+    timer_wheel_advance(&rtos->wheel, now - rtos->wheel_origin - rtos->wheel.now);
+    
+    // Interrupts and DMA progress queued since the last pass, from host
+    // threads included
+    gpio_dispatch(&rtos->gpio);
+    uart_dma_service(&rtos->uart);
+    
+    // Release every task whose next_run has come
+    while (rtos->pending_count > 0 && now >= rtos->tasks[rtos->pending[0]].next_run) {
+        uint8_t idx = heap_pop(rtos, rtos->pending, &rtos->pending_count, releases_before);
+        heap_push(rtos, rtos->ready, &rtos->ready_count, runs_before, idx);
     }
     
-    // Find highest priority ready task
+    // First released task in policy order; one blocked or suspended since
+    // its release skips the job and looks again a period later
     RTTask* next_task = NULL;
-    int highest_prio = -1;
-    
-    for (uint32_t i = 0; i < rtos->task_count; i++) {
-        RTTask* task = &rtos->tasks[i];
+    uint8_t idx = 0;
+    while (!next_task && rtos->ready_count > 0) {
+        idx = heap_pop(rtos, rtos->ready, &rtos->ready_count, runs_before);
+        RTTask* task = &rtos->tasks[idx];
         
         if (task->state == TASK_READY || task->state == TASK_RUNNING) {
-            // Check if task needs to run
-            if (now >= task->next_run) {
-                if ((int)task->priority > highest_prio) {
-                    highest_prio = task->priority;
-                    next_task = task;
-                }
-            }
+            next_task = task;
+        } else {
+            task->next_run = now + MAX(task->period, 1);
+            heap_push(rtos, rtos->pending, &rtos->pending_count, releases_before, idx);
         }
     }
     
@@ -119,23 +347,38 @@ void rtos_schedule(RTOS* rtos) {
         next_task->state = TASK_RUNNING;
         next_task->last_run = now;
         
-        uint64_t start = get_time_ms();
+        uint64_t start_us = rtos_time_us(rtos);
+        uint64_t start_ns = get_time_ns();
+        uint64_t release_us = (uint64_t)next_task->next_run * 1000;
+        uint64_t latency = start_us > release_us ? start_us - release_us : 0;
+        next_task->wake_latency += latency;
+        next_task->max_wake_latency = MAX(next_task->max_wake_latency, latency);
         
         // Execute task function
         if (next_task->function) {
             next_task->function(next_task->arg);
         }
         
-        uint64_t end = get_time_ms();
-        uint64_t exec_time = end - start;
+        task_ns = get_time_ns() - start_ns;
+        
+        // On a virtual clock a job takes exactly its wcet
+        if (rtos->virtual_clock) rtos->clock_us += (uint64_t)next_task->wcet * 1000;
+        uint64_t end = rtos_time_us(rtos) / 1000;
+        uint64_t exec_time = end - start_us / 1000;
         
         next_task->executions++;
         next_task->total_time += exec_time;
         
+        if (rtos->pm) {
+            pm_update(rtos->pm);
+            next_task->energy += rtos->pm->total_energy - rtos->energy_mark;
+            rtos->energy_mark = rtos->pm->total_energy;
+        }
+        
         // Check for deadline miss
         if (end > next_task->next_run + next_task->deadline) {
             next_task->misses++;
-            ERROR("Task %d missed deadline!\n", next_task->id);
+            if (!rtos->virtual_clock) ERROR("Task %d missed deadline!\n", next_task->id);
         }
         
         // Schedule next execution
@@ -145,10 +388,16 @@ void rtos_schedule(RTOS* rtos) {
         
         next_task->state = TASK_READY;
         rtos->current_task = NULL;
+        heap_push(rtos, rtos->pending, &rtos->pending_count, releases_before, idx);
     } else {
         // Idle
         rtos->idle_time++;
     }
+    
+    uint64_t overhead = get_time_ns() - call_start - task_ns;
+    rtos->schedule_calls++;
+    rtos->overhead_ns += overhead;
+    rtos->max_overhead_ns = MAX(rtos->max_overhead_ns, overhead);
 }
 
 void rtos_start(RTOS* rtos) {
@@ -162,9 +411,13 @@ void rtos_start(RTOS* rtos) {
     while (rtos->running) {
         rtos_schedule(rtos);
         
-        // Small delay to prevent CPU hogging
-        struct timespec ts = {0, 1000000};  // 1ms
-        nanosleep(&ts, NULL);
+        if (rtos->tickless) {
+            rtos_idle(rtos);
+        } else {
+            // Small delay to prevent CPU hogging
+            struct timespec ts = {0, 1000000};  // 1ms
+            nanosleep(&ts, NULL);
+        }
     }
 }
 
@@ -172,11 +425,122 @@ void rtos_stop(RTOS* rtos) {
     rtos->running = false;
 }
 
+// With tickless on, idle stretches are slept through in the deepest power
+// state pm can wake from in time; pm may be NULL to sleep without modelling
+// power
+void rtos_set_tickless(RTOS* rtos, bool tickless, PowerManager* pm) {
+    rtos->tickless = tickless;
+    rtos->pm = pm;
+    if (pm) {
+        pm_set_clock(pm, rtos->virtual_clock ? &rtos->clock_us : NULL);
+        rtos->energy_mark = pm->total_energy;
+    }
+}
+
+// Time in ms of the next task release or timer expiry, UINT64_MAX if none
+uint64_t rtos_next_wakeup(RTOS* rtos) {
+    uint64_t next = UINT64_MAX;
+    if (rtos->ready_count > 0) return rtos->system_time;
+    if (rtos->pending_count > 0) {
+        next = rtos->tasks[rtos->pending[0]].next_run;
+    }
+    
+    uint64_t expiry = timer_wheel_next_expiry(&rtos->wheel);
+    if (expiry != UINT64_MAX) {
+        next = MIN(next, rtos->wheel_origin + expiry);
+    }
+    return next;
+}
+
+static void sleep_until_us(RTOS* rtos, uint64_t deadline) {
+    uint64_t now = rtos_time_us(rtos);
+    if (deadline <= now) return;
+    
+    if (rtos->virtual_clock) {
+        rtos->clock_us = deadline;
+        return;
+    }
+    
+    struct timespec ts = {(time_t)((deadline - now) / 1000000),
+                          (long)((deadline - now) % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+// Sleep until the next event, or limit (ms), instead of ticking through the
+// gap
+static void idle_until(RTOS* rtos, uint64_t limit) {
+    uint64_t now_us = rtos_time_us(rtos);
+    uint64_t wake = MIN(rtos_next_wakeup(rtos), limit);
+    if (wake * 1000 <= now_us) return;
+    
+    rtos->wakeup_time = wake;
+    rtos_enter_sleep(rtos, pm_deepest_state(wake * 1000 - now_us));
+}
+
+void rtos_idle(RTOS* rtos) {
+    idle_until(rtos, rtos_time_us(rtos) / 1000 + RTOS_MAX_SLEEP_MS);
+}
+
+// Run for ms of the RTOS's own time: released jobs back to back, idle gaps
+// slept through as in tickless mode (skipped outright on a virtual clock).
+// Stops early once rtos_stop clears running.
+void rtos_advance(RTOS* rtos, uint64_t ms) {
+    uint64_t end = rtos_time_us(rtos) / 1000 + ms;
+    
+    rtos->running = true;
+    while (rtos->running && rtos_time_us(rtos) / 1000 < end) {
+        rtos_schedule(rtos);
+        idle_until(rtos, end);
+    }
+    rtos->running = false;
+}
+
+// Stay in mode until wakeup_time, leaving early enough to be running again
+// by then
+void rtos_enter_sleep(RTOS* rtos, uint32_t mode) {
+    uint64_t start = rtos_time_us(rtos);
+    uint64_t wake = rtos->wakeup_time * 1000;
+    uint32_t latency = pm_wakeup_latency((PowerState)mode);
+    
+    rtos->sleep_mode = mode;
+    if (rtos->pm && mode != POWER_RUN) {
+        pm_enter_state(rtos->pm, (PowerState)mode);
+    }
+    if (wake > start + latency) {
+        sleep_until_us(rtos, wake - latency);
+    }
+    rtos_wakeup(rtos);
+    
+    // The way back up to POWER_RUN
+    sleep_until_us(rtos, wake);
+    rtos->sleeps++;
+    rtos->sleep_us += rtos_time_us(rtos) - start;
+}
+
+void rtos_wakeup(RTOS* rtos) {
+    if (rtos->pm && rtos->pm->state != POWER_RUN) {
+        pm_enter_state(rtos->pm, POWER_RUN);
+    }
+    rtos->sleep_mode = POWER_RUN;
+}
+
 void rtos_print_stats(RTOS* rtos) {
     printf("\n=== RTOS Statistics ===\n");
     printf("System time: %lu ms\n", rtos->system_time);
     printf("Idle time: %lu cycles\n", rtos->idle_time);
     printf("Running: %s\n", rtos->running ? "Yes" : "No");
+    printf("Policy: %s\n", rtos->policy == RTOS_EDF ? "EDF" : "Fixed priority");
+    if (rtos->schedule_calls > 0) {
+        printf("Scheduling overhead: %.0f ns avg, %lu ns max over %lu calls\n",
+               (double)rtos->overhead_ns / rtos->schedule_calls,
+               rtos->max_overhead_ns, rtos->schedule_calls);
+    }
+    printf("Timer wheel: %u armed, %lu fired, %lu cascaded\n",
+           rtos->wheel.armed, rtos->wheel.fired, rtos->wheel.cascaded);
+    if (rtos->tickless) {
+        printf("Tickless idle: %lu sleeps, %.1f ms asleep\n",
+               rtos->sleeps, rtos->sleep_us / 1000.0);
+    }
     
     printf("\nTasks:\n");
     for (uint32_t i = 0; i < rtos->task_count; i++) {
@@ -197,63 +561,14 @@ void rtos_print_stats(RTOS* rtos) {
                task->executions, task->misses,
                task->executions > 0 ? 
                (float)task->total_time / task->executions : 0.0);
-    }
-}
-
-// Virtual hardware implementations
-void gpio_init(VirtualGPIO* gpio) {
-    memset(gpio, 0, sizeof(VirtualGPIO));
-}
-
-void gpio_set_direction(VirtualGPIO* gpio, uint32_t pin, bool output) {
-    if (pin < GPIO_PINS) {
-        if (output) {
-            gpio->direction |= (1 << pin);
-        } else {
-            gpio->direction &= ~(1 << pin);
-        }
-    }
-}
-
-void gpio_write(VirtualGPIO* gpio, uint32_t pin, bool value) {
-    if (pin < GPIO_PINS && (gpio->direction & (1 << pin))) {
-        if (value) {
-            gpio->value |= (1 << pin);
-        } else {
-            gpio->value &= ~(1 << pin);
-        }
-        
-        if (gpio->callback) {
-            gpio->callback(pin, value);
+        if (task->executions > 0) {
+            printf("    Wake latency: %.1f us avg, %lu us max",
+                   (double)task->wake_latency / task->executions,
+                   task->max_wake_latency);
+            if (rtos->pm) {
+                printf(", Energy: %.1f uJ/job", (double)task->energy / task->executions);
+            }
+            printf("\n");
         }
     }
 }
-
-bool gpio_read(VirtualGPIO* gpio, uint32_t pin) {
-    if (pin < GPIO_PINS) {
-        return (gpio->value >> pin) & 1;
-    }
-    return false;
-}
-
-void uart_init(VirtualUART* uart, uint32_t baud_rate) {
-    memset(uart, 0, sizeof(VirtualUART));
-    uart->baud_rate = baud_rate;
-}
-
-void uart_write(VirtualUART* uart, uint8_t* data, uint32_t len) {
-    for (uint32_t i = 0; i < len; i++) {
-        uart->tx_buffer[uart->tx_tail] = data[i];
-        uart->tx_tail = (uart->tx_tail + 1) % 256;
-    }
-    uart->tx_busy = true;
-}
-
-uint32_t uart_read(VirtualUART* uart, uint8_t* buffer, uint32_t len) {
-    uint32_t count = 0;
-    while (count < len && uart->rx_head != uart->rx_tail) {
-        buffer[count++] = uart->rx_buffer[uart->rx_head];
-        uart->rx_head = (uart->rx_head + 1) % 256;
-    }
-    return count;
-}
\ No newline at end of file
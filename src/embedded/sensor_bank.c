@@ -0,0 +1,404 @@
+#include "embedded.h"
+#include <math.h>
+
+#if USE_SIMD && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SENSOR_SIMD_X86 1
+#endif
+
+// Noise channels, one hash key each per sample
+enum {
+    NOISE_TEMPERATURE,
+    NOISE_HUMIDITY,
+    NOISE_PRESSURE,
+    NOISE_ACCEL_X,
+    NOISE_ACCEL_Y,
+    NOISE_ACCEL_Z,
+    NOISE_LIGHT,
+    NOISE_MOVEMENT,
+    NOISE_CHANNELS
+};
+
+#define SENSOR_GOLDEN 0x9E3779B9u
+
+// sin(2 * pi * x) for x in turns, odd Taylor series to x^11 after folding
+// into a quarter turn; within 1e-6 of libm. The vector kernels do the same
+// operations in the same order.
+#define SIN_C3  -1.6666667e-1f
+#define SIN_C5   8.3333333e-3f
+#define SIN_C7  -1.9841270e-4f
+#define SIN_C9   2.7557319e-6f
+#define SIN_C11 -2.5052108e-8f
+#define TWO_PI   6.2831853f
+
+static inline float sin_turns(float x) {
+    float r = x - rintf(x);
+    if (fabsf(r) > 0.25f) r = copysignf(0.5f, r) - r;
+    float t = r * TWO_PI;
+    float t2 = t * t;
+    return t * (1.0f + t2 * (SIN_C3 + t2 * (SIN_C5 + t2 * (SIN_C7 + t2 * (SIN_C9 + t2 * SIN_C11)))));
+}
+
+// Counter-based RNG: a 32-bit integer hash (lowbias32), cheap in any lane width
+static inline uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline float unit_float(uint32_t h) {
+    return (float)(h >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline float noise(const uint32_t* keys, int channel, uint32_t index) {
+    return unit_float(hash32(keys[channel] + index * SENSOR_GOLDEN));
+}
+
+// Same model as sensor_update: a daily cycle per sensor (offset by its
+// phase), uniform noise, and an occasional movement on the accelerometer
+static void generate_scalar(SensorBank* bank, float day, float move, const uint32_t* keys) {
+    for (uint32_t i = 0; i < bank->stride; i++) {
+        float cycle = sin_turns(day + bank->phase[i]);
+        float slow = sin_turns(day * (1.0f / 24.0f) + bank->phase[i]);
+
+        bank->temperature[i] = 20.0f + 10.0f * cycle + (noise(keys, NOISE_TEMPERATURE, i) - 0.5f);
+
+        float humidity = 50.0f - 30.0f * cycle + (noise(keys, NOISE_HUMIDITY, i) * 4.0f - 2.0f);
+        bank->humidity[i] = fminf(fmaxf(humidity, 0.0f), 100.0f);
+
+        bank->pressure[i] = 1013.25f + 10.0f * slow + (noise(keys, NOISE_PRESSURE, i) - 0.5f);
+
+        bool moving = noise(keys, NOISE_MOVEMENT, i) < move;
+        float scale = moving ? 2.0f : 0.02f;
+        float z_scale = moving ? 0.2f : 0.02f;
+        bank->acceleration[0][i] = (noise(keys, NOISE_ACCEL_X, i) - 0.5f) * scale;
+        bank->acceleration[1][i] = (noise(keys, NOISE_ACCEL_Y, i) - 0.5f) * scale;
+        bank->acceleration[2][i] = 9.8f + (noise(keys, NOISE_ACCEL_Z, i) - 0.5f) * z_scale;
+
+        float light = 1000.0f * (0.5f + 0.5f * cycle) + (noise(keys, NOISE_LIGHT, i) * 100.0f - 50.0f);
+        bank->light_level[i] = (uint32_t)fmaxf(light, 0.0f);
+    }
+}
+
+#ifdef SENSOR_SIMD_X86
+__attribute__((target("avx2")))
+static inline __m256 sin_turns_avx2(__m256 x) {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 r = _mm256_sub_ps(x, _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    __m256 folded = _mm256_sub_ps(_mm256_or_ps(_mm256_and_ps(r, sign), _mm256_set1_ps(0.5f)), r);
+    __m256 wide = _mm256_cmp_ps(_mm256_andnot_ps(sign, r), _mm256_set1_ps(0.25f), _CMP_GT_OQ);
+    r = _mm256_blendv_ps(r, folded, wide);
+
+    __m256 t = _mm256_mul_ps(r, _mm256_set1_ps(TWO_PI));
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 p = _mm256_add_ps(_mm256_set1_ps(SIN_C9), _mm256_mul_ps(t2, _mm256_set1_ps(SIN_C11)));
+    p = _mm256_add_ps(_mm256_set1_ps(SIN_C7), _mm256_mul_ps(t2, p));
+    p = _mm256_add_ps(_mm256_set1_ps(SIN_C5), _mm256_mul_ps(t2, p));
+    p = _mm256_add_ps(_mm256_set1_ps(SIN_C3), _mm256_mul_ps(t2, p));
+    p = _mm256_add_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(t2, p));
+    return _mm256_mul_ps(t, p);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 noise_avx2(const uint32_t* keys, int channel, __m256i index) {
+    __m256i x = _mm256_add_epi32(_mm256_set1_epi32((int)keys[channel]),
+                                 _mm256_mullo_epi32(index, _mm256_set1_epi32((int)SENSOR_GOLDEN)));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7feb352d));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x846ca68bu));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(x, 8)),
+                         _mm256_set1_ps(1.0f / 16777216.0f));
+}
+
+__attribute__((target("avx2")))
+static void generate_avx2(SensorBank* bank, float day, float move, const uint32_t* keys) {
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 vday = _mm256_set1_ps(day);
+    const __m256 vslow = _mm256_set1_ps(day * (1.0f / 24.0f));
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (uint32_t i = 0; i < bank->stride; i += 8) {
+        __m256 phase = _mm256_load_ps(bank->phase + i);
+        __m256 cycle = sin_turns_avx2(_mm256_add_ps(vday, phase));
+        __m256 slow = sin_turns_avx2(_mm256_add_ps(vslow, phase));
+
+        __m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(20.0f), _mm256_mul_ps(_mm256_set1_ps(10.0f), cycle)),
+                                 _mm256_sub_ps(noise_avx2(keys, NOISE_TEMPERATURE, index), half));
+        _mm256_store_ps(bank->temperature + i, v);
+
+        v = _mm256_add_ps(_mm256_sub_ps(_mm256_set1_ps(50.0f), _mm256_mul_ps(_mm256_set1_ps(30.0f), cycle)),
+                          _mm256_sub_ps(_mm256_mul_ps(noise_avx2(keys, NOISE_HUMIDITY, index), _mm256_set1_ps(4.0f)),
+                                        _mm256_set1_ps(2.0f)));
+        v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(100.0f));
+        _mm256_store_ps(bank->humidity + i, v);
+
+        v = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(1013.25f), _mm256_mul_ps(_mm256_set1_ps(10.0f), slow)),
+                          _mm256_sub_ps(noise_avx2(keys, NOISE_PRESSURE, index), half));
+        _mm256_store_ps(bank->pressure + i, v);
+
+        __m256 moving = _mm256_cmp_ps(noise_avx2(keys, NOISE_MOVEMENT, index), _mm256_set1_ps(move), _CMP_LT_OQ);
+        __m256 scale = _mm256_blendv_ps(_mm256_set1_ps(0.02f), _mm256_set1_ps(2.0f), moving);
+        __m256 z_scale = _mm256_blendv_ps(_mm256_set1_ps(0.02f), _mm256_set1_ps(0.2f), moving);
+        _mm256_store_ps(bank->acceleration[0] + i,
+                        _mm256_mul_ps(_mm256_sub_ps(noise_avx2(keys, NOISE_ACCEL_X, index), half), scale));
+        _mm256_store_ps(bank->acceleration[1] + i,
+                        _mm256_mul_ps(_mm256_sub_ps(noise_avx2(keys, NOISE_ACCEL_Y, index), half), scale));
+        _mm256_store_ps(bank->acceleration[2] + i,
+                        _mm256_add_ps(_mm256_set1_ps(9.8f),
+                                      _mm256_mul_ps(_mm256_sub_ps(noise_avx2(keys, NOISE_ACCEL_Z, index), half), z_scale)));
+
+        v = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(1000.0f), _mm256_add_ps(half, _mm256_mul_ps(half, cycle))),
+                          _mm256_sub_ps(_mm256_mul_ps(noise_avx2(keys, NOISE_LIGHT, index), _mm256_set1_ps(100.0f)),
+                                        _mm256_set1_ps(50.0f)));
+        v = _mm256_max_ps(v, _mm256_setzero_ps());
+        _mm256_store_si256((__m256i*)(bank->light_level + i), _mm256_cvttps_epi32(v));
+
+        index = _mm256_add_epi32(index, _mm256_set1_epi32(8));
+    }
+}
+#endif
+
+static void* bank_array(uint32_t stride, size_t elem) {
+    void* p = aligned_alloc(64, ALIGN_UP(stride * elem, 64));
+    if (p) memset(p, 0, ALIGN_UP(stride * elem, 64));
+    return p;
+}
+
+SensorBank* sensor_bank_create(uint32_t count, uint64_t seed) {
+    if (count == 0) return NULL;
+
+    SensorBank* bank = (SensorBank*)calloc(1, sizeof(SensorBank));
+    if (!bank) return NULL;
+
+    bank->count = count;
+    bank->stride = ALIGN_UP(count, SENSOR_BANK_LANES);
+    bank->seed = (uint32_t)rng_stream_seed(seed, 0);
+
+    bank->phase = (float*)bank_array(bank->stride, sizeof(float));
+    bank->temperature = (float*)bank_array(bank->stride, sizeof(float));
+    bank->humidity = (float*)bank_array(bank->stride, sizeof(float));
+    bank->pressure = (float*)bank_array(bank->stride, sizeof(float));
+    for (int a = 0; a < 3; a++) {
+        bank->acceleration[a] = (float*)bank_array(bank->stride, sizeof(float));
+    }
+    bank->light_level = (uint32_t*)bank_array(bank->stride, sizeof(uint32_t));
+
+    if (!bank->phase || !bank->temperature || !bank->humidity || !bank->pressure ||
+        !bank->acceleration[0] || !bank->acceleration[1] || !bank->acceleration[2] ||
+        !bank->light_level) {
+        ERROR("Out of memory for a bank of %u sensors\n", count);
+        sensor_bank_destroy(bank);
+        return NULL;
+    }
+
+    // Sensors spread over up to a quarter day of longitude
+    for (uint32_t i = 0; i < bank->count; i++) {
+        bank->phase[i] = unit_float(hash32(bank->seed ^ (i * SENSOR_GOLDEN))) * 0.25f;
+    }
+
+    sensor_bank_set_kernel(bank, NULL);
+    return bank;
+}
+
+void sensor_bank_destroy(SensorBank* bank) {
+    if (!bank) return;
+    free(bank->phase);
+    free(bank->temperature);
+    free(bank->humidity);
+    free(bank->pressure);
+    for (int a = 0; a < 3; a++) {
+        free(bank->acceleration[a]);
+    }
+    free(bank->light_level);
+    free(bank);
+}
+
+// kernel is "scalar", "avx2", or NULL for the fastest the host has.
+// Returns -1 if the host cannot run it.
+int sensor_bank_set_kernel(SensorBank* bank, const char* kernel) {
+#ifdef SENSOR_SIMD_X86
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2");
+    if ((!kernel && avx2) || (kernel && strcmp(kernel, "avx2") == 0)) {
+        if (!avx2) return -1;
+        bank->generate = generate_avx2;
+        bank->kernel = "avx2";
+        return 0;
+    }
+#endif
+    if (kernel && strcmp(kernel, "scalar") != 0) return -1;
+    bank->generate = generate_scalar;
+    bank->kernel = "scalar";
+    return 0;
+}
+
+// One sample of every sensor at time_ms
+void sensor_bank_generate(SensorBank* bank, uint64_t time_ms) {
+    uint32_t keys[NOISE_CHANNELS];
+    uint32_t base = hash32(bank->seed ^ (uint32_t)bank->sample) ^ (uint32_t)(bank->sample >> 32);
+    for (int c = 0; c < NOISE_CHANNELS; c++) {
+        keys[c] = hash32(base + c * SENSOR_GOLDEN);
+    }
+
+    // A movement every 5 s on average, as in sensor_update
+    float move = bank->sample == 0 ? 1.0f : MIN((time_ms - bank->last_time) / 5000.0f, 1.0f);
+    float day = (float)(fmod(time_ms / 1000.0, 86400.0) / 86400.0);
+
+    bank->generate(bank, day, move, keys);
+    bank->sample++;
+    bank->last_time = time_ms;
+}
+
+// Copy one sensor's latest sample out for code written against VirtualSensor
+void sensor_bank_read(const SensorBank* bank, uint32_t index, VirtualSensor* sensor) {
+    if (index >= bank->count) return;
+
+    sensor->temperature = bank->temperature[index];
+    sensor->humidity = bank->humidity[index];
+    sensor->pressure = bank->pressure[index];
+    for (int a = 0; a < 3; a++) {
+        sensor->acceleration[a] = bank->acceleration[a][index];
+    }
+    sensor->light_level = bank->light_level[index];
+    sensor->last_update = bank->last_time;
+}
+
+static uint32_t fold_range(SensorStream* stream, const float* values, bool first,
+                           uint32_t from, uint32_t to) {
+    uint32_t crossed = 0;
+    for (uint32_t i = from; i < to; i++) {
+        float v = values[i];
+        stream->min[i] = first || v < stream->min[i] ? v : stream->min[i];
+        stream->max[i] = first || v > stream->max[i] ? v : stream->max[i];
+        stream->sum[i] = first ? v : stream->sum[i] + v;
+
+        // Count only leaving [low, high]; wandering back in is not an alert
+        int32_t zone = (v > stream->high) - (v < stream->low);
+        if (zone != 0 && zone != stream->zone[i]) {
+            stream->crossings[i]++;
+            crossed++;
+        }
+        stream->zone[i] = zone;
+    }
+    return crossed;
+}
+
+static uint32_t fold_scalar(SensorStream* stream, const float* values, bool first) {
+    return fold_range(stream, values, first, 0, stream->count);
+}
+
+#ifdef SENSOR_SIMD_X86
+// values need not be padded: whole vectors first, the rest in scalar
+__attribute__((target("avx2")))
+static uint32_t fold_avx2(SensorStream* stream, const float* values, bool first) {
+    const __m256 low = _mm256_set1_ps(stream->low);
+    const __m256 high = _mm256_set1_ps(stream->high);
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t vectors = stream->count & ~(uint32_t)7;
+    uint32_t crossed = 0;
+
+    for (uint32_t i = 0; i < vectors; i += 8) {
+        __m256 v = _mm256_loadu_ps(values + i);
+        if (first) {
+            _mm256_store_ps(stream->min + i, v);
+            _mm256_store_ps(stream->max + i, v);
+            _mm256_store_ps(stream->sum + i, v);
+        } else {
+            _mm256_store_ps(stream->min + i, _mm256_min_ps(v, _mm256_load_ps(stream->min + i)));
+            _mm256_store_ps(stream->max + i, _mm256_max_ps(v, _mm256_load_ps(stream->max + i)));
+            _mm256_store_ps(stream->sum + i, _mm256_add_ps(_mm256_load_ps(stream->sum + i), v));
+        }
+
+        // Compare masks are -1 when true: below - above gives -1, 0 or 1
+        __m256i above = _mm256_castps_si256(_mm256_cmp_ps(v, high, _CMP_GT_OQ));
+        __m256i below = _mm256_castps_si256(_mm256_cmp_ps(v, low, _CMP_LT_OQ));
+        __m256i zone = _mm256_sub_epi32(below, above);
+        __m256i old = _mm256_load_si256((const __m256i*)(stream->zone + i));
+        __m256i out = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi32(zone, zero),
+                                                          _mm256_cmpeq_epi32(zone, old)),
+                                          _mm256_set1_epi32(-1));
+        _mm256_store_si256((__m256i*)(stream->zone + i), zone);
+
+        __m256i* crossings = (__m256i*)(stream->crossings + i);
+        _mm256_store_si256(crossings, _mm256_sub_epi32(_mm256_load_si256(crossings), out));
+        crossed += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(out)));
+    }
+    return crossed + fold_range(stream, values, first, vectors, stream->count);
+}
+#endif
+
+SensorStream* sensor_stream_create(uint32_t count, uint32_t window, float low, float high) {
+    if (count == 0 || window == 0) return NULL;
+
+    SensorStream* stream = (SensorStream*)calloc(1, sizeof(SensorStream));
+    if (!stream) return NULL;
+
+    stream->count = count;
+    stream->stride = ALIGN_UP(count, SENSOR_BANK_LANES);
+    stream->window = window;
+    stream->low = low;
+    stream->high = high;
+
+    stream->min = (float*)bank_array(stream->stride, sizeof(float));
+    stream->max = (float*)bank_array(stream->stride, sizeof(float));
+    stream->sum = (float*)bank_array(stream->stride, sizeof(float));
+    stream->zone = (int32_t*)bank_array(stream->stride, sizeof(int32_t));
+    stream->crossings = (uint32_t*)bank_array(stream->stride, sizeof(uint32_t));
+    stream->window_min = (float*)bank_array(stream->stride, sizeof(float));
+    stream->window_max = (float*)bank_array(stream->stride, sizeof(float));
+    stream->window_mean = (float*)bank_array(stream->stride, sizeof(float));
+
+    if (!stream->min || !stream->max || !stream->sum || !stream->zone || !stream->crossings ||
+        !stream->window_min || !stream->window_max || !stream->window_mean) {
+        ERROR("Out of memory for a stream of %u sensors\n", count);
+        sensor_stream_destroy(stream);
+        return NULL;
+    }
+
+    stream->fold = fold_scalar;
+    stream->kernel = "scalar";
+#ifdef SENSOR_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        stream->fold = fold_avx2;
+        stream->kernel = "avx2";
+    }
+#endif
+    return stream;
+}
+
+void sensor_stream_destroy(SensorStream* stream) {
+    if (!stream) return;
+    free(stream->min);
+    free(stream->max);
+    free(stream->sum);
+    free(stream->zone);
+    free(stream->crossings);
+    free(stream->window_min);
+    free(stream->window_max);
+    free(stream->window_mean);
+    free(stream);
+}
+
+// Fold one sample per sensor (values[0..count), e.g. bank->temperature)
+// into the open window
+void sensor_stream_push(SensorStream* stream, const float* values) {
+    stream->total_crossings += stream->fold(stream, values, stream->filled == 0);
+    stream->samples++;
+
+    if (++stream->filled == stream->window) {
+        float scale = 1.0f / stream->window;
+        for (uint32_t i = 0; i < stream->count; i++) {
+            stream->window_min[i] = stream->min[i];
+            stream->window_max[i] = stream->max[i];
+            stream->window_mean[i] = stream->sum[i] * scale;
+        }
+        stream->filled = 0;
+        stream->windows++;
+    }
+}
@@ -0,0 +1,141 @@
+#include "embedded.h"
+#include "snapshot.h"
+
+#define RTOS_RINGS 4
+
+typedef struct {
+    const RTOS* base;
+    bool save;
+} Relocation;
+
+static void relocate_data(const Relocation* r, void* field) {
+    if (r->save) {
+        snapshot_save_pointer(field, r->base, sizeof(RTOS));
+    } else {
+        snapshot_load_pointer(field, r->base);
+    }
+}
+
+static void relocate_code(const Relocation* r, void* field) {
+    if (r->save) {
+        snapshot_save_code(field);
+    } else {
+        snapshot_load_code(field);
+    }
+}
+
+// Every pointer field but the rings' buffers and pm. Pointers into the
+// RTOS itself (timer links, the virtual clock, a task's arg when it is the
+// RTOS) move with it; DMA descriptors and other task args are kept as is.
+static void relocate(RTOS* rtos, const Relocation* r) {
+    for (int i = 0; i < MAX_TASKS; i++) {
+        relocate_code(r, &rtos->tasks[i].function);
+        relocate_data(r, &rtos->tasks[i].arg);
+    }
+    relocate_data(r, &rtos->current_task);
+    relocate_code(r, &rtos->gpio.callback);
+    for (int i = 0; i < UART_DMA_QUEUE; i++) {
+        relocate_data(r, &rtos->uart.rx_dma.queue[i]);
+        relocate_data(r, &rtos->uart.tx_dma.queue[i]);
+    }
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        VirtualTimer* timer = &rtos->timers[i];
+        relocate_code(r, &timer->callback);
+        relocate_data(r, &timer->wheel);
+        relocate_data(r, &timer->next);
+        relocate_data(r, &timer->pprev);
+    }
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            relocate_data(r, &rtos->wheel.slots[level][slot]);
+        }
+    }
+    for (int i = 0; i < MAX_SENSORS; i++) {
+        relocate_data(r, &rtos->sensors[i].clock);
+    }
+}
+
+static SPSCRing* ring_at(RTOS* rtos, int i) {
+    SPSCRing* rings[RTOS_RINGS] = { &rtos->gpio.events, &rtos->gpio.loopback,
+                                    &rtos->uart.rx, &rtos->uart.tx };
+    return rings[i];
+}
+
+static size_t ring_bytes(const SPSCRing* ring) {
+    return (size_t)(ring->mask + 1) * ring->elem;
+}
+
+// The RTOS image, its ring buffers, then its power manager if it has one.
+// Nothing else may touch the peripherals meanwhile.
+int rtos_snapshot(SnapshotWriter* writer, const RTOS* rtos) {
+    RTOS image = *rtos;
+    Relocation r = { .base = rtos, .save = true };
+    relocate(&image, &r);
+    snapshot_save_pointer(&image.pm, rtos, sizeof(RTOS));
+    for (int i = 0; i < RTOS_RINGS; i++) {
+        ring_at(&image, i)->data = NULL;
+    }
+
+    snapshot_begin(writer, SNAP_RTOS);
+    snapshot_write(writer, &image, sizeof(image));
+    for (int i = 0; i < RTOS_RINGS; i++) {
+        SPSCRing* ring = ring_at((RTOS*)rtos, i);
+        if (ring->data) snapshot_write(writer, ring->data, ring_bytes(ring));
+    }
+    if (rtos->pm) {
+        PowerManager pm = *rtos->pm;
+        snapshot_save_pointer(&pm.clock, rtos, sizeof(RTOS));
+        snapshot_write(writer, &pm, sizeof(pm));
+    }
+    return writer->failed ? -1 : 0;
+}
+
+// The index-th RTOS in the snapshot, as it was. A power manager it had is
+// a new one from pm_create, which the caller frees after rtos_destroy.
+RTOS* rtos_restore(Snapshot* snapshot, uint32_t index) {
+    SnapshotCursor cursor;
+    if (snapshot_find(snapshot, SNAP_RTOS, index, &cursor) != 0) {
+        ERROR("No RTOS %u in the snapshot\n", index);
+        return NULL;
+    }
+
+    RTOS* rtos = (RTOS*)malloc(sizeof(RTOS));
+    if (!rtos) return NULL;
+    if (!snapshot_read(&cursor, rtos, sizeof(RTOS))) {
+        ERROR("Cannot restore RTOS %u from the snapshot\n", index);
+        free(rtos);
+        return NULL;
+    }
+    Relocation r = { .base = rtos, .save = false };
+    relocate(rtos, &r);
+    bool has_pm = rtos->pm != NULL;
+    rtos->pm = NULL;
+
+    // Indices come from the image; an empty ring was never allocated
+    bool ok = true;
+    for (int i = 0; i < RTOS_RINGS; i++) {
+        SPSCRing* ring = ring_at(rtos, i);
+        SPSCRing saved = *ring;
+        if (!ok || saved.elem == 0 || spsc_ring_init(ring, saved.mask + 1, saved.elem) != 0) {
+            ok = ok && saved.elem == 0;
+            continue;
+        }
+        saved.data = ring->data;
+        *ring = saved;
+        ok = snapshot_read(&cursor, ring->data, ring_bytes(ring));
+    }
+
+    if (ok && has_pm) {
+        rtos->pm = pm_create();
+        ok = rtos->pm && snapshot_read(&cursor, rtos->pm, sizeof(PowerManager));
+        if (ok) snapshot_load_pointer(&rtos->pm->clock, rtos);
+    }
+
+    if (!ok) {
+        ERROR("Cannot restore RTOS %u from the snapshot\n", index);
+        pm_destroy(rtos->pm);
+        rtos_destroy(rtos);
+        return NULL;
+    }
+    return rtos;
+}
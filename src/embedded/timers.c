@@ -9,20 +9,73 @@ void timer_init(VirtualTimer* timer, uint64_t prescaler, bool auto_reload) {
     timer->enabled = false;
     timer->auto_reload = auto_reload;
     timer->callback = NULL;
+    timer->wheel = NULL;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->start = 0;
+    timer->expires = 0;
+}
+
+static VirtualTimer** wheel_slot(TimerWheel* wheel, uint64_t expires) {
+    uint64_t delta = expires - wheel->now;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        if (delta < (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+            return &wheel->slots[level][(expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+        }
+    }
+    
+    // Past the top level's span: park it one span out, it is re-filed on cascade
+    int top = TIMER_WHEEL_LEVELS - 1;
+    uint64_t span = 1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+    if (delta >= span) expires = wheel->now + span - 1;
+    return &wheel->slots[top][(expires >> (TIMER_WHEEL_BITS * top)) & (TIMER_WHEEL_SLOTS - 1)];
+}
+
+static void wheel_insert(TimerWheel* wheel, VirtualTimer* timer) {
+    VirtualTimer** slot = wheel_slot(wheel, timer->expires);
+    timer->next = *slot;
+    if (*slot) (*slot)->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+static void wheel_remove(VirtualTimer* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
 }
 
 void timer_start(VirtualTimer* timer, uint64_t compare_value) {
     if (!timer) return;
     
+    if (timer->wheel && timer->enabled) {
+        wheel_remove(timer);
+        timer->wheel->armed--;
+    }
+    
     timer->counter = 0;
     timer->compare = compare_value;
     timer->enabled = true;
+    
+    // Fires on the compare-th tick (the first, for 0), as timer_tick does
+    if (timer->wheel) {
+        timer->start = timer->wheel->now;
+        timer->expires = timer->start + MAX(compare_value, 1);
+        wheel_insert(timer->wheel, timer);
+        timer->wheel->armed++;
+    }
 }
 
 void timer_stop(VirtualTimer* timer) {
-    if (timer) {
-        timer->enabled = false;
+    if (!timer) return;
+    
+    if (timer->wheel && timer->enabled) {
+        timer->counter = timer->wheel->now - timer->start;
+        wheel_remove(timer);
+        timer->wheel->armed--;
     }
+    timer->enabled = false;
 }
 
 void timer_set_callback(VirtualTimer* timer, void (*callback)(void)) {
@@ -32,15 +85,18 @@ void timer_set_callback(VirtualTimer* timer, void (*callback)(void)) {
 }
 
 uint64_t timer_get_value(VirtualTimer* timer) {
-    return timer ? timer->counter : 0;
+    if (!timer) return 0;
+    if (timer->wheel && timer->enabled) return timer->wheel->now - timer->start;
+    return timer->counter;
 }
 
 bool timer_is_running(VirtualTimer* timer) {
     return timer ? timer->enabled : false;
 }
 
+// Manual tick for a timer not attached to a wheel
 void timer_tick(VirtualTimer* timer) {
-    if (!timer || !timer->enabled) return;
+    if (!timer || !timer->enabled || timer->wheel) return;
     
     timer->counter++;
     
@@ -55,4 +111,97 @@ void timer_tick(VirtualTimer* timer) {
             timer->enabled = false;
         }
     }
-}
\ No newline at end of file
+}
+
+void timer_wheel_init(TimerWheel* wheel) {
+    memset(wheel, 0, sizeof(TimerWheel));
+}
+
+// From now on the timer counts wheel ticks; a running one keeps its count
+void timer_wheel_attach(TimerWheel* wheel, VirtualTimer* timer) {
+    if (!wheel || !timer || timer->wheel) return;
+    
+    timer->wheel = wheel;
+    if (timer->enabled) {
+        timer->start = wheel->now - MIN(timer->counter, wheel->now);
+        timer->expires = timer->start + MAX(timer->compare, 1);
+        if (timer->expires <= wheel->now) timer->expires = wheel->now + 1;
+        wheel_insert(wheel, timer);
+        wheel->armed++;
+    }
+}
+
+static void wheel_cascade(TimerWheel* wheel, int level) {
+    VirtualTimer** slot = &wheel->slots[level][(wheel->now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+    VirtualTimer* timer = *slot;
+    *slot = NULL;
+    
+    while (timer) {
+        VirtualTimer* next = timer->next;
+        wheel_insert(wheel, timer);
+        wheel->cascaded++;
+        timer = next;
+    }
+}
+
+static void wheel_fire(TimerWheel* wheel, VirtualTimer* timer) {
+    wheel_remove(timer);
+    wheel->fired++;
+    timer->counter = timer->compare;
+    
+    if (timer->auto_reload) {
+        timer->start = wheel->now;
+        timer->expires = wheel->now + MAX(timer->compare, 1);
+        wheel_insert(wheel, timer);
+    } else {
+        timer->enabled = false;
+        wheel->armed--;
+    }
+    
+    // Last, so the callback may restart or stop the timer
+    if (timer->callback) {
+        timer->callback();
+    }
+}
+
+void timer_wheel_advance(TimerWheel* wheel, uint64_t ticks) {
+    // Nothing armed: no slot can hold anything
+    if (wheel->armed == 0) {
+        wheel->now += ticks;
+        return;
+    }
+    
+    while (ticks-- > 0) {
+        wheel->now++;
+        
+        // Entering a new span of each level below pulls its next slot down
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if (wheel->now & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1)) break;
+            wheel_cascade(wheel, level);
+        }
+        
+        // The slot for now holds only timers due now; parked far-future
+        // timers never reach level 0 early
+        VirtualTimer** slot = &wheel->slots[0][wheel->now & (TIMER_WHEEL_SLOTS - 1)];
+        while (*slot) {
+            wheel_fire(wheel, *slot);
+        }
+    }
+}
+
+// Tick of the earliest armed timer, UINT64_MAX if none. Slots only bound
+// their timers per level, so every occupied slot is looked at; this is for
+// going idle, not the tick path.
+uint64_t timer_wheel_next_expiry(TimerWheel* wheel) {
+    uint64_t next = UINT64_MAX;
+    if (wheel->armed == 0) return next;
+    
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+            for (VirtualTimer* timer = wheel->slots[level][i]; timer; timer = timer->next) {
+                next = MIN(next, timer->expires);
+            }
+        }
+    }
+    return next;
+}
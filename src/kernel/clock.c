@@ -0,0 +1,240 @@
+#include "kernel.h"
+
+static bool event_before(const KernelEvent* a, const KernelEvent* b) {
+    return a->time != b->time ? a->time < b->time : a->seq < b->seq;
+}
+
+int event_queue_init(EventQueue* eq, uint32_t capacity) {
+    eq->heap = (KernelEvent*)malloc(MAX(capacity, 1) * sizeof(KernelEvent));
+    if (!eq->heap) return -1;
+    eq->count = 0;
+    eq->capacity = MAX(capacity, 1);
+    eq->next_seq = 0;
+    return 0;
+}
+
+void event_queue_destroy(EventQueue* eq) {
+    free(eq->heap);
+    eq->heap = NULL;
+    eq->count = 0;
+    eq->capacity = 0;
+}
+
+// Stamps ev->seq, so events due on the same tick fire in the order queued
+int event_queue_push(EventQueue* eq, KernelEvent* ev) {
+    if (eq->count == eq->capacity) {
+        KernelEvent* heap = (KernelEvent*)realloc(eq->heap, 2 * eq->capacity * sizeof(KernelEvent));
+        if (!heap) {
+            ERROR("Out of memory for kernel events\n");
+            return -1;
+        }
+        eq->heap = heap;
+        eq->capacity *= 2;
+    }
+
+    ev->seq = eq->next_seq++;
+    uint32_t i = eq->count++;
+    while (i > 0 && event_before(ev, &eq->heap[(i - 1) / 2])) {
+        eq->heap[i] = eq->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    eq->heap[i] = *ev;
+    return 0;
+}
+
+bool event_queue_pop(EventQueue* eq, KernelEvent* ev) {
+    if (eq->count == 0) return false;
+
+    *ev = eq->heap[0];
+    KernelEvent last = eq->heap[--eq->count];
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= eq->count) break;
+        if (child + 1 < eq->count && event_before(&eq->heap[child + 1], &eq->heap[child])) {
+            child++;
+        }
+        if (!event_before(&eq->heap[child], &last)) break;
+        eq->heap[i] = eq->heap[child];
+        i = child;
+    }
+    eq->heap[i] = last;
+    return true;
+}
+
+static int queue_wakeup(Microkernel* kernel, PCB* pcb, uint64_t delay) {
+    KernelEvent ev = {0};
+    ev.time = kernel->scheduler->system_time + delay;
+    ev.type = EVENT_WAKEUP;
+    ev.pcb = pcb;
+    ev.token = pcb->wait_token;
+    return event_queue_push(&kernel->events, &ev);
+}
+
+static void unlink_waiter(Microkernel* kernel, PCB* pcb) {
+    if (pcb->wait_queue < 0) return;
+
+    PCB** link = &kernel->queue_waiters[pcb->wait_queue];
+    while (*link && *link != pcb) {
+        link = &(*link)->next;
+    }
+    if (*link) *link = pcb->next;
+    pcb->next = NULL;
+    pcb->wait_queue = -1;
+}
+
+static void wake(Microkernel* kernel, PCB* pcb) {
+    unlink_waiter(kernel, pcb);
+    scheduler_wake_process(kernel->scheduler, pcb);
+}
+
+// Take pid off the CPUs until kernel_resume_process or a wakeup event
+void kernel_suspend_process(Microkernel* kernel, uint32_t pid) {
+    PCB* pcb = kernel_find_process(kernel, pid);
+    if (!pcb || pcb->state == PROC_TERMINATED || pcb->state == PROC_BLOCKED) return;
+
+    scheduler_remove_process(kernel->scheduler, pcb);
+    pcb->state = PROC_BLOCKED;
+    pcb->wait_token++;
+}
+
+void kernel_resume_process(Microkernel* kernel, uint32_t pid) {
+    PCB* pcb = kernel_find_process(kernel, pid);
+    if (pcb && pcb->state == PROC_BLOCKED) {
+        wake(kernel, pcb);
+    }
+}
+
+int kernel_sleep_process(Microkernel* kernel, uint32_t pid, uint64_t ticks) {
+    PCB* pcb = kernel_find_process(kernel, pid);
+    if (!pcb || pcb->state == PROC_TERMINATED) return -1;
+
+    kernel_suspend_process(kernel, pid);
+    return queue_wakeup(kernel, pcb, ticks);
+}
+
+// Block pid until a message is sent to qid or timeout ticks pass
+// (MQ_WAIT_FOREVER: no limit). Returns 1 if it blocked, 0 if a message was
+// already waiting.
+int kernel_wait_message(Microkernel* kernel, int qid, uint32_t pid, int timeout) {
+    PCB* pcb = kernel_find_process(kernel, pid);
+    if (qid < 0 || qid >= kernel->queue_count || !kernel->queues[qid] ||
+        !pcb || pcb->state == PROC_TERMINATED) {
+        return -1;
+    }
+
+    MessageQueue* mq = kernel->queues[qid];
+    if (__atomic_load_n(&mq->tail, __ATOMIC_ACQUIRE) != __atomic_load_n(&mq->head, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    kernel_suspend_process(kernel, pid);
+
+    // FIFO: the longest waiter gets the next message
+    PCB** link = &kernel->queue_waiters[qid];
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = pcb;
+    pcb->next = NULL;
+    pcb->wait_queue = qid;
+
+    if (timeout >= 0 && queue_wakeup(kernel, pcb, timeout) != 0) return -1;
+    return 1;
+}
+
+// messages were sent to qid: wake as many waiters on the next dispatch
+void kernel_notify_queue(Microkernel* kernel, int qid, int messages) {
+    PCB** link = &kernel->queue_waiters[qid];
+    while (*link && messages > 0) {
+        PCB* pcb = *link;
+        *link = pcb->next;
+        pcb->next = NULL;
+        pcb->wait_queue = -1;
+
+        // Exited while waiting
+        if (pcb->state != PROC_BLOCKED) continue;
+
+        queue_wakeup(kernel, pcb, 0);
+        messages--;
+    }
+}
+
+int kernel_add_timer(Microkernel* kernel, uint64_t delay, uint64_t period,
+                     TimerHandler handler, void* arg) {
+    if (!handler) return -1;
+
+    KernelEvent ev = {0};
+    ev.time = kernel->scheduler->system_time + delay;
+    ev.type = EVENT_TIMER;
+    ev.period = period;
+    ev.handler = handler;
+    ev.arg = arg;
+    return event_queue_push(&kernel->events, &ev);
+}
+
+void kernel_set_realtime(Microkernel* kernel, bool realtime) {
+    kernel->realtime = realtime;
+}
+
+static void dispatch(Microkernel* kernel, KernelEvent* ev) {
+    kernel->events_dispatched++;
+
+    switch (ev->type) {
+        case EVENT_WAKEUP:
+            // Resumed, woken by another event or blocked again since
+            if (ev->pcb->state == PROC_BLOCKED && ev->pcb->wait_token == ev->token) {
+                wake(kernel, ev->pcb);
+            }
+            break;
+
+        case EVENT_TIMER:
+            ev->handler(kernel, ev->arg);
+            if (ev->period > 0) {
+                ev->time += ev->period;
+                event_queue_push(&kernel->events, ev);
+            }
+            break;
+    }
+}
+
+// Run ticks of virtual time, dispatching events up to and including the
+// last tick. Between events the scheduler skips straight to its own next
+// decision, so idle stretches cost nothing; in realtime mode the loop
+// sleeps to keep the clock in step with the wall. A timer handler can end
+// the run early by clearing kernel->running.
+void kernel_advance(Microkernel* kernel, uint64_t ticks) {
+    Scheduler* sched = kernel->scheduler;
+    if (!sched) return;
+
+    uint64_t end = sched->system_time + ticks;
+    uint64_t sim_start = sched->system_time;
+    uint64_t wall_start = get_time_us();
+
+    kernel->running = true;
+    for (;;) {
+        KernelEvent ev;
+        while (kernel->events.count > 0 && kernel->events.heap[0].time <= sched->system_time &&
+               event_queue_pop(&kernel->events, &ev)) {
+            dispatch(kernel, &ev);
+        }
+        if (!kernel->running || sched->system_time >= end) break;
+
+        uint64_t target = end;
+        if (kernel->events.count > 0) {
+            target = MIN(target, kernel->events.heap[0].time);
+        }
+        scheduler_advance(sched, target - sched->system_time);
+
+        if (kernel->realtime) {
+            uint64_t due = wall_start + (sched->system_time - sim_start) * KERNEL_REALTIME_TICK_US;
+            uint64_t now = get_time_us();
+            if (due > now) {
+                struct timespec ts = {(time_t)((due - now) / 1000000),
+                                      (long)((due - now) % 1000000) * 1000};
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+    kernel->running = false;
+}
@@ -1,63 +1,243 @@
 #include "kernel.h"
+#include <sched.h>
 
-MessageQueue* mq_create(int capacity) {
-    MessageQueue* mq = (MessageQueue*)malloc(sizeof(MessageQueue));
+// Waiting on a full or empty queue: spin first, then yield, then nap for
+// growing intervals, so a partner that is about to act costs no syscall
+typedef struct {
+    uint64_t deadline;      // get_time_us(), or UINT64_MAX
+    int timeout;
+    int round;
+} Backoff;
+
+static void backoff_init(Backoff* b, int timeout) {
+    b->timeout = timeout;
+    b->deadline = timeout < 0 ? UINT64_MAX : get_time_us() + (uint64_t)timeout * 1000;
+    b->round = 0;
+}
+
+// False once the timeout has run out
+static bool backoff_wait(Backoff* b) {
+    if (b->timeout == 0) return false;
+
+    b->round++;
+    if (b->round <= 64) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        return true;
+    }
+
+    uint64_t now = get_time_us();
+    if (now >= b->deadline) return false;
+    if (b->round <= 80) {
+        sched_yield();
+        return true;
+    }
+
+    uint64_t nap = MIN(50ULL << MIN(b->round - 80, 5), 1000);    // 50us up to 1ms
+    nap = MIN(nap, b->deadline - now);
+    struct timespec ts = {0, (long)(nap * 1000)};
+    nanosleep(&ts, NULL);
+    return true;
+}
+
+MessageQueue* mq_create(int capacity, MQMode mode) {
+    if (capacity < 1) return NULL;
+
+    MessageQueue* mq = (MessageQueue*)aligned_alloc(CACHE_LINE_SIZE,
+                                                    ALIGN_UP(sizeof(MessageQueue), CACHE_LINE_SIZE));
     if (!mq) return NULL;
-    
-    mq->capacity = capacity;
-    mq->messages = (Message*)malloc(capacity * sizeof(Message));
-    if (!mq->messages) {
+    memset(mq, 0, sizeof(MessageQueue));
+
+    uint64_t slots = 1;
+    while (slots < (uint64_t)capacity) slots <<= 1;
+    mq->mask = slots - 1;
+    mq->mode = mode;
+    mq->messages = (Message*)malloc(slots * sizeof(Message));
+    if (mode == MQ_MPMC) {
+        mq->seqs = (uint64_t*)malloc(slots * sizeof(uint64_t));
+    }
+    if (!mq->messages || (mode == MQ_MPMC && !mq->seqs)) {
+        free(mq->messages);
+        free(mq->seqs);
         free(mq);
         return NULL;
     }
-    
-    mq->head = 0;
-    mq->tail = 0;
-    mq->count = 0;
-    
-    sem_init(&mq->mutex, 0, 1);
-    sem_init(&mq->slots, 0, capacity);
-    sem_init(&mq->items, 0, 0);
-    
+
+    // Slot i is free for the producer at position i
+    for (uint64_t i = 0; mq->seqs && i < slots; i++) {
+        mq->seqs[i] = i;
+    }
+
     return mq;
 }
 
+// Not safe against concurrent senders or receivers. Granted buffers still
+// queued belong to the queue and are freed with it.
 void mq_destroy(MessageQueue* mq) {
     if (mq) {
-        sem_destroy(&mq->mutex);
-        sem_destroy(&mq->slots);
-        sem_destroy(&mq->items);
+        Message msg;
+        while (mq_receive(mq, &msg, 0) == 0) {
+            if (msg.flags & MSG_GRANT) free(msg.data);
+        }
         free(mq->messages);
+        free(mq->seqs);
         free(mq);
     }
 }
 
-int mq_send(MessageQueue* mq, Message* msg, int timeout) {
-    if (sem_wait(&mq->slots) != 0) return -1;
-    if (sem_wait(&mq->mutex) != 0) return -1;
-    
-    // Copy message to queue
-    mq->messages[mq->tail] = *msg;
-    mq->tail = (mq->tail + 1) % mq->capacity;
-    mq->count++;
-    
-    sem_post(&mq->mutex);
-    sem_post(&mq->items);
-    
+static int spsc_push(MessageQueue* mq, const Message* msgs, int count) {
+    uint64_t tail = __atomic_load_n(&mq->tail, __ATOMIC_RELAXED);
+    uint64_t space = mq->mask + 1 - (tail - mq->cached_head);
+    if (space < (uint64_t)count) {
+        mq->cached_head = __atomic_load_n(&mq->head, __ATOMIC_ACQUIRE);
+        space = mq->mask + 1 - (tail - mq->cached_head);
+    }
+
+    int n = (int)MIN((uint64_t)count, space);
+    for (int i = 0; i < n; i++) {
+        mq->messages[(tail + i) & mq->mask] = msgs[i];
+    }
+    if (n > 0) __atomic_store_n(&mq->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+static int spsc_pop(MessageQueue* mq, Message* msgs, int count) {
+    uint64_t head = __atomic_load_n(&mq->head, __ATOMIC_RELAXED);
+    uint64_t ready = mq->cached_tail - head;
+    if (ready < (uint64_t)count) {
+        mq->cached_tail = __atomic_load_n(&mq->tail, __ATOMIC_ACQUIRE);
+        ready = mq->cached_tail - head;
+    }
+
+    int n = (int)MIN((uint64_t)count, ready);
+    for (int i = 0; i < n; i++) {
+        msgs[i] = mq->messages[(head + i) & mq->mask];
+    }
+    if (n > 0) __atomic_store_n(&mq->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+// Claim every free slot from tail on, up to count, with one CAS. A slot is
+// free for position p while its sequence number is p.
+static int mpmc_push(MessageQueue* mq, const Message* msgs, int count) {
+    uint64_t pos = __atomic_load_n(&mq->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        int n = 0;
+        while (n < count &&
+               __atomic_load_n(&mq->seqs[(pos + n) & mq->mask], __ATOMIC_ACQUIRE) == pos + n) {
+            n++;
+        }
+
+        if (n == 0) {
+            uint64_t seq = __atomic_load_n(&mq->seqs[pos & mq->mask], __ATOMIC_ACQUIRE);
+            if ((int64_t)(seq - pos) < 0) return 0;    // Full
+            pos = __atomic_load_n(&mq->tail, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(&mq->tail, &pos, pos + n, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            for (int i = 0; i < n; i++) {
+                uint64_t slot = (pos + i) & mq->mask;
+                mq->messages[slot] = msgs[i];
+                __atomic_store_n(&mq->seqs[slot], pos + i + 1, __ATOMIC_RELEASE);
+            }
+            return n;
+        }
+    }
+}
+
+// A slot holds the message for position p once its sequence number is
+// p + 1; releasing it sets the number a full lap ahead for the producers
+static int mpmc_pop(MessageQueue* mq, Message* msgs, int count) {
+    uint64_t pos = __atomic_load_n(&mq->head, __ATOMIC_RELAXED);
+    for (;;) {
+        int n = 0;
+        while (n < count &&
+               __atomic_load_n(&mq->seqs[(pos + n) & mq->mask], __ATOMIC_ACQUIRE) == pos + n + 1) {
+            n++;
+        }
+
+        if (n == 0) {
+            uint64_t seq = __atomic_load_n(&mq->seqs[pos & mq->mask], __ATOMIC_ACQUIRE);
+            if ((int64_t)(seq - (pos + 1)) < 0) return 0;  // Empty
+            pos = __atomic_load_n(&mq->head, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(&mq->head, &pos, pos + n, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            for (int i = 0; i < n; i++) {
+                uint64_t slot = (pos + i) & mq->mask;
+                msgs[i] = mq->messages[slot];
+                __atomic_store_n(&mq->seqs[slot], pos + i + mq->mask + 1, __ATOMIC_RELEASE);
+            }
+            return n;
+        }
+    }
+}
+
+// Send as many of msgs as fit before the timeout; returns how many went
+int mq_send_batch(MessageQueue* mq, const Message* msgs, int count, int timeout) {
+    Backoff backoff;
+    backoff_init(&backoff, timeout);
+
+    int sent = 0;
+    bool waited = false;
+    while (sent < count) {
+        int n = mq->mode == MQ_SPSC ? spsc_push(mq, msgs + sent, count - sent)
+                                    : mpmc_push(mq, msgs + sent, count - sent);
+        sent += n;
+        if (n > 0 || sent == count) continue;
+
+        if (!waited) {
+            __atomic_fetch_add(&mq->send_waits, 1, __ATOMIC_RELAXED);
+            waited = true;
+        }
+        if (!backoff_wait(&backoff)) break;
+    }
+    return sent;
+}
+
+// Wait up to the timeout for at least one message, then take up to count
+// of those queued; returns how many were taken
+int mq_receive_batch(MessageQueue* mq, Message* msgs, int count, int timeout) {
+    Backoff backoff;
+    backoff_init(&backoff, timeout);
+
+    bool waited = false;
+    while (count > 0) {
+        int n = mq->mode == MQ_SPSC ? spsc_pop(mq, msgs, count) : mpmc_pop(mq, msgs, count);
+        if (n > 0) return n;
+
+        if (!waited) {
+            __atomic_fetch_add(&mq->receive_waits, 1, __ATOMIC_RELAXED);
+            waited = true;
+        }
+        if (!backoff_wait(&backoff)) break;
+    }
     return 0;
 }
 
+int mq_send(MessageQueue* mq, const Message* msg, int timeout) {
+    return mq_send_batch(mq, msg, 1, timeout) == 1 ? 0 : -1;
+}
+
 int mq_receive(MessageQueue* mq, Message* msg, int timeout) {
-    if (sem_wait(&mq->items) != 0) return -1;
-    if (sem_wait(&mq->mutex) != 0) return -1;
-    
-    // Get message from queue
-    *msg = mq->messages[mq->head];
-    mq->head = (mq->head + 1) % mq->capacity;
-    mq->count--;
-    
-    sem_post(&mq->mutex);
-    sem_post(&mq->slots);
-    
-    return 0;
-}
\ No newline at end of file
+    return mq_receive_batch(mq, msg, 1, timeout) == 1 ? 0 : -1;
+}
+
+// Small payloads are copied into the message; larger ones are granted, so
+// data must be a malloc'd buffer the sender no longer touches
+void msg_set_payload(Message* msg, void* data, size_t size) {
+    msg->size = size;
+    if (size <= MSG_INLINE_SIZE) {
+        if (size > 0) memcpy(msg->inline_data, data, size);
+        msg->data = NULL;
+        msg->flags &= ~MSG_GRANT;
+    } else {
+        msg->data = data;
+        msg->flags |= MSG_GRANT;
+    }
+}
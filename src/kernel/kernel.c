@@ -10,6 +10,7 @@ Microkernel* kernel_create(uint64_t mem_size) {
         return NULL;
     }
     scheduler_init(kernel->scheduler);
+    scheduler_set_cpus(kernel->scheduler, DEFAULT_NUM_CORES);
     
     kernel->mm = mm_create(mem_size);
     if (!kernel->mm) {
@@ -26,12 +27,24 @@ Microkernel* kernel_create(uint64_t mem_size) {
         return NULL;
     }
     
+    if (event_queue_init(&kernel->events, 64) != 0) {
+        vfs_destroy(kernel->filesystem);
+        mm_destroy(kernel->mm);
+        free(kernel->scheduler);
+        free(kernel);
+        return NULL;
+    }
+    kernel->events_dispatched = 0;
+    kernel->realtime = false;
+    memset(kernel->syscall_stats, 0, sizeof(kernel->syscall_stats));
+    
     kernel->queue_count = 0;
     kernel->running = false;
     
     // Initialize message queues
     for (int i = 0; i < MAX_QUEUES; i++) {
         kernel->queues[i] = NULL;
+        kernel->queue_waiters[i] = NULL;
     }
     
     INFO("Microkernel created with %lu MB memory\n", mem_size / MiB);
@@ -47,6 +60,7 @@ void kernel_destroy(Microkernel* kernel) {
                 mm_free_pages(kernel->mm, pcb->pid);
                 pcb_destroy(pcb);
             }
+            scheduler_destroy(kernel->scheduler);
             free(kernel->scheduler);
         }
         
@@ -59,6 +73,7 @@ void kernel_destroy(Microkernel* kernel) {
         
         mm_destroy(kernel->mm);
         vfs_destroy(kernel->filesystem);
+        event_queue_destroy(&kernel->events);
         free(kernel);
     }
 }
@@ -77,7 +92,8 @@ uint32_t kernel_create_process(Microkernel* kernel, void* entry_point) {
         return 0;
     }
     
-    pcb->page_table = (uint64_t*)phys_addr;
+    // The mapping lives in the memory manager's page tables; page_table is
+    // a host allocation pcb_destroy frees, so it stays NULL
     pcb->page_count = 4;
     
     scheduler_add_process(kernel->scheduler, pcb);
@@ -86,74 +102,151 @@ uint32_t kernel_create_process(Microkernel* kernel, void* entry_point) {
     return pid;
 }
 
+// The child shares the parent's memory copy-on-write and gets descriptors
+// of its own for the parent's open files. Returns the child's PID, or 0.
+uint32_t kernel_fork_process(Microkernel* kernel, uint32_t pid) {
+    PCB* parent = kernel_find_process(kernel, pid);
+    if (!parent || parent->state == PROC_TERMINATED) return 0;
+    
+    uint32_t child_pid = kernel->scheduler->next_pid++;
+    PCB* child = pcb_create(child_pid, (void*)parent->pc);
+    if (!child) return 0;
+    if (mm_fork(kernel->mm, pid, child_pid) != 0) {
+        pcb_destroy(child);
+        return 0;
+    }
+    
+    memcpy(child->registers, parent->registers, sizeof(child->registers));
+    child->registers[0] = 0;    // fork returns 0 in the child
+    child->sp = parent->sp;
+    child->flags = parent->flags;
+    child->priority = parent->priority;
+    child->quantum = parent->quantum;
+    child->quantum_remaining = parent->quantum;
+    child->affinity = parent->affinity;
+    child->page_count = parent->page_count;
+    child->heap_start = parent->heap_start;
+    child->heap_end = parent->heap_end;
+    memcpy(child->message_queues, parent->message_queues, sizeof(child->message_queues));
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (parent->open_files[i] != -1) {
+            child->open_files[i] = vfs_dup_file(kernel->filesystem, parent->open_files[i]);
+        }
+    }
+    
+    scheduler_add_process(kernel->scheduler, child);
+    INFO("Forked process PID %u from PID %u\n", child_pid, pid);
+    
+    return child_pid;
+}
+
+// PIDs from kernel_create_process are handed out in order, so the PCB is
+// usually at index pid - 1; anything else falls back to a scan
+PCB* kernel_find_process(Microkernel* kernel, uint32_t pid) {
+    Scheduler* sched = kernel->scheduler;
+    if (!sched) return NULL;
+    
+    if (pid >= 1 && pid <= (uint32_t)sched->process_count && sched->processes[pid - 1]->pid == pid) {
+        return sched->processes[pid - 1];
+    }
+    for (int i = 0; i < sched->process_count; i++) {
+        if (sched->processes[i]->pid == pid) {
+            return sched->processes[i];
+        }
+    }
+    return NULL;
+}
+
 void kernel_terminate_process(Microkernel* kernel, uint32_t pid) {
-    if (!kernel->scheduler) return;
+    PCB* pcb = kernel_find_process(kernel, pid);
+    if (!pcb) return;
     
-    for (int i = 0; i < kernel->scheduler->process_count; i++) {
-        PCB* pcb = kernel->scheduler->processes[i];
-        if (pcb->pid == pid) {
-            pcb->state = PROC_TERMINATED;
-            
-            // Free process resources
-            mm_free_pages(kernel->mm, pid);
-            
-            // Close all open files
-            for (int j = 0; j < MAX_FILES; j++) {
-                if (pcb->open_files[j] != -1) {
-                    // File closing logic would go here
-                    pcb->open_files[j] = -1;
-                }
-            }
-            
-            INFO("Terminated process PID %u\n", pid);
-            break;
+    pcb->state = PROC_TERMINATED;
+    scheduler_remove_process(kernel->scheduler, pcb);
+    
+    // Free process resources
+    mm_free_pages(kernel->mm, pid);
+    
+    // Close all open files
+    for (int j = 0; j < MAX_FILES; j++) {
+        if (pcb->open_files[j] != -1) {
+            vfs_close_file(kernel->filesystem, pcb->open_files[j]);
+            pcb->open_files[j] = -1;
         }
     }
+    
+    INFO("Terminated process PID %u\n", pid);
 }
 
-int kernel_create_queue(Microkernel* kernel) {
+int kernel_create_queue(Microkernel* kernel, MQMode mode) {
     if (kernel->queue_count >= MAX_QUEUES) {
         ERROR("Too many message queues\n");
         return -1;
     }
     
-    MessageQueue* mq = mq_create(32);  // 32 message capacity
+    MessageQueue* mq = mq_create(32, mode);  // 32 message capacity
     if (!mq) return -1;
     
     int qid = kernel->queue_count++;
     kernel->queues[qid] = mq;
     
-    INFO("Created message queue %d\n", qid);
+    INFO("Created %s message queue %d\n", mode == MQ_SPSC ? "SPSC" : "MPMC", qid);
     return qid;
 }
 
-int kernel_send_message(Microkernel* kernel, int qid, Message* msg) {
+static MessageQueue* queue_for(Microkernel* kernel, int qid) {
     if (qid < 0 || qid >= kernel->queue_count) {
         ERROR("Invalid queue ID\n");
-        return -1;
+        return NULL;
     }
     
     if (!kernel->queues[qid]) {
         ERROR("Queue not initialized\n");
-        return -1;
+        return NULL;
     }
     
+    return kernel->queues[qid];
+}
+
+// Sends never block: -1 means the queue was full
+int kernel_send_message(Microkernel* kernel, int qid, Message* msg) {
+    MessageQueue* mq = queue_for(kernel, qid);
+    if (!mq) return -1;
+    
     msg->timestamp = get_time_ms();
-    return mq_send(kernel->queues[qid], msg, 0);
+    if (mq_send(mq, msg, 0) != 0) return -1;
+    
+    kernel_notify_queue(kernel, qid, 1);
+    return 0;
 }
 
 int kernel_receive_message(Microkernel* kernel, int qid, Message* msg, int timeout) {
-    if (qid < 0 || qid >= kernel->queue_count) {
-        ERROR("Invalid queue ID\n");
-        return -1;
-    }
+    MessageQueue* mq = queue_for(kernel, qid);
+    if (!mq) return -1;
     
-    if (!kernel->queues[qid]) {
-        ERROR("Queue not initialized\n");
-        return -1;
+    return mq_receive(mq, msg, timeout);
+}
+
+// Returns how many of msgs were queued, all under one claim of the ring
+int kernel_send_batch(Microkernel* kernel, int qid, Message* msgs, int count) {
+    MessageQueue* mq = queue_for(kernel, qid);
+    if (!mq) return -1;
+    
+    uint64_t now = get_time_ms();
+    for (int i = 0; i < count; i++) {
+        msgs[i].timestamp = now;
     }
+    int sent = mq_send_batch(mq, msgs, count, 0);
+    kernel_notify_queue(kernel, qid, sent);
+    return sent;
+}
+
+// Returns how many messages were received, 0 if none came within timeout
+int kernel_receive_batch(Microkernel* kernel, int qid, Message* msgs, int count, int timeout) {
+    MessageQueue* mq = queue_for(kernel, qid);
+    if (!mq) return -1;
     
-    return mq_receive(kernel->queues[qid], msg, timeout);
+    return mq_receive_batch(mq, msgs, count, timeout);
 }
 
 void kernel_destroy_queue(Microkernel* kernel, int qid) {
@@ -164,28 +257,33 @@ void kernel_destroy_queue(Microkernel* kernel, int qid) {
     }
 }
 
+// Runs on the virtual clock; see kernel_set_realtime for wall-clock pacing
 void kernel_run(Microkernel* kernel, uint64_t cycles) {
     if (!kernel->scheduler) return;
     
-    kernel->running = true;
     INFO("Microkernel starting with %u processes\n", 
          kernel->scheduler->process_count);
     
-    for (uint64_t i = 0; i < cycles && kernel->running; i++) {
-        scheduler_tick(kernel->scheduler);
-        
-        // Simulate some work
-        struct timespec ts = {0, 100000};  // 0.1ms
-        nanosleep(&ts, NULL);
-    }
-    
-    kernel->running = false;
+    uint64_t start = get_time_us();
+    kernel_advance(kernel, cycles);
+    uint64_t elapsed = get_time_us() - start;
     
     // Print statistics
     printf("\n=== Microkernel Statistics ===\n");
     printf("Total cycles: %lu\n", cycles);
+    printf("Wall time: %.3f ms%s\n", elapsed / 1000.0, kernel->realtime ? " (realtime)" : "");
+    printf("Events dispatched: %lu (%u pending)\n", kernel->events_dispatched, kernel->events.count);
     printf("Active processes: %d\n", kernel->scheduler->process_count);
     
+    scheduler_print_stats(kernel->scheduler);
+    syscall_print_stats(kernel);
     mm_print_stats(kernel->mm);
     vfs_list_files(kernel->filesystem);
+}
+
+// Match the scheduler to a multicore model's core count; only before any
+// process exists
+int kernel_set_cpus(Microkernel* kernel, int cpus) {
+    if (!kernel->scheduler) return -1;
+    return scheduler_set_cpus(kernel->scheduler, cpus);
 }
\ No newline at end of file
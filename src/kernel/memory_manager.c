@@ -1,54 +1,691 @@
 #include "kernel.h"
 
+static int tlb_init(Tlb* tlb, uint32_t entries, uint32_t ways) {
+    tlb->sets = entries / ways;     // power of two
+    tlb->ways = ways;
+    tlb->clock = 0;
+    tlb->hits = 0;
+    tlb->misses = 0;
+    tlb->entries = (TlbEntry*)calloc(entries, sizeof(TlbEntry));
+    return tlb->entries ? 0 : -1;
+}
+
+static TlbEntry* tlb_probe(Tlb* tlb, uint16_t asid, uint64_t vpn, bool huge) {
+    TlbEntry* set = &tlb->entries[(vpn & (tlb->sets - 1)) * tlb->ways];
+    for (uint32_t w = 0; w < tlb->ways; w++) {
+        TlbEntry* e = &set[w];
+        if (e->valid && e->vpn == vpn && e->asid == asid && e->huge == huge) {
+            e->last_used = ++tlb->clock;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// A virtual address is mapped by at most one page size, so probing both is
+// safe; the 2MB probe is skipped while no huge pages exist
+static TlbEntry* tlb_lookup(Tlb* tlb, uint16_t asid, uint64_t vaddr, bool any_huge) {
+    TlbEntry* e = tlb_probe(tlb, asid, vaddr >> PAGE_SHIFT, false);
+    if (!e && any_huge) {
+        e = tlb_probe(tlb, asid, vaddr >> HUGE_PAGE_SHIFT, true);
+    }
+    if (e) {
+        tlb->hits++;
+    } else {
+        tlb->misses++;
+    }
+    return e;
+}
+
+// An entry already held for the page is replaced, e.g. once a write has
+// made it dirty or given it a frame of its own
+static void tlb_insert(Tlb* tlb, uint16_t asid, uint64_t vpn, uint64_t frame, bool huge, bool writable) {
+    TlbEntry* set = &tlb->entries[(vpn & (tlb->sets - 1)) * tlb->ways];
+    TlbEntry* victim = NULL;
+    for (uint32_t w = 0; w < tlb->ways; w++) {
+        if (set[w].valid && set[w].vpn == vpn && set[w].asid == asid && set[w].huge == huge) {
+            victim = &set[w];
+            break;
+        }
+    }
+    if (!victim) {
+        victim = &set[0];
+        for (uint32_t w = 0; w < tlb->ways; w++) {
+            if (!set[w].valid) {
+                victim = &set[w];
+                break;
+            }
+            if (set[w].last_used < victim->last_used) victim = &set[w];
+        }
+    }
+    victim->vpn = vpn;
+    victim->frame = frame;
+    victim->asid = asid;
+    victim->huge = huge;
+    victim->writable = writable;
+    victim->valid = true;
+    victim->last_used = ++tlb->clock;
+}
+
+static void tlb_invalidate(Tlb* tlb, uint16_t asid, uint64_t vpn, bool huge) {
+    TlbEntry* e = tlb_probe(tlb, asid, vpn, huge);
+    if (e) e->valid = false;
+}
+
+static void tlb_flush_asid(Tlb* tlb, uint16_t asid) {
+    for (uint32_t i = 0; i < tlb->sets * tlb->ways; i++) {
+        if (tlb->entries[i].asid == asid) tlb->entries[i].valid = false;
+    }
+}
+
+static inline uint64_t* pt_slot(PageTable* table, uint64_t vaddr, int level) {
+    return &table->entries[(vaddr >> (PAGE_SHIFT + level * PT_INDEX_BITS)) & (PT_ENTRIES - 1)];
+}
+
+static inline PageTable* pt_child(uint64_t pte) {
+    return (PageTable*)(uintptr_t)(pte & PTE_ADDR_MASK);
+}
+
+// Walk from the root to the entry that decides vaddr: a 4KB leaf, a 2MB
+// leaf, or the first non-present entry on the way down
+static uint64_t* pt_walk(PageTable* table, uint64_t vaddr, uint64_t* levels) {
+    for (int level = PT_LEVELS - 1; ; level--) {
+        uint64_t* pte = pt_slot(table, vaddr, level);
+        (*levels)++;
+        if (level == 0 || !(*pte & PTE_PRESENT) || (*pte & PTE_HUGE)) return pte;
+        table = pt_child(*pte);
+    }
+}
+
+// Virtual time for page ages: translations so far
+static inline uint64_t mm_now(const MemoryManager* mm) {
+    return mm->tlb_hits + mm->tlb_misses;
+}
+
+static void note_owner(MemoryManager* mm, uint32_t pid, uint64_t vaddr, uint64_t frame) {
+    FrameInfo* info = &mm->frame_info[frame];
+    info->owner = pid + 1;
+    info->vpage = vaddr >> PAGE_SHIFT;
+    info->last_use = mm_now(mm);
+}
+
+static PageTable* pt_alloc(MemoryManager* mm) {
+    PageTable* table = (PageTable*)aligned_alloc(PAGE_SIZE, sizeof(PageTable));
+    if (!table) return NULL;
+    memset(table, 0, sizeof(PageTable));
+    mm->table_count++;
+    return table;
+}
+
+// The PID's address space, or NULL if it has none and create is false or
+// the host is out of memory. spaces[] only grows as far as the largest PID
+// that has asked for one.
+AddressSpace* mm_space(MemoryManager* mm, uint32_t pid, bool create) {
+    if (pid < mm->space_capacity && mm->spaces[pid]) return mm->spaces[pid];
+    if (!create || pid >= MAX_PROCESSES) return NULL;
+
+    if (pid >= mm->space_capacity) {
+        uint32_t capacity = mm->space_capacity ? mm->space_capacity : 16;
+        while (capacity <= pid) capacity *= 2;
+        capacity = MIN(capacity, MAX_PROCESSES);
+        AddressSpace** spaces = (AddressSpace**)realloc(mm->spaces, capacity * sizeof(AddressSpace*));
+        if (!spaces) return NULL;
+        memset(spaces + mm->space_capacity, 0, (capacity - mm->space_capacity) * sizeof(AddressSpace*));
+        mm->spaces = spaces;
+        AddressSpace** live = (AddressSpace**)realloc(mm->live, capacity * sizeof(AddressSpace*));
+        if (!live) return NULL;
+        mm->live = live;
+        mm->space_capacity = capacity;
+    }
+
+    AddressSpace* space = (AddressSpace*)calloc(1, sizeof(AddressSpace));
+    if (!space) return NULL;
+    space->pid = pid;
+    space->live_index = mm->live_count;
+    mm->live[mm->live_count++] = space;
+    mm->spaces[pid] = space;
+    return space;
+}
+
+static void space_free(MemoryManager* mm, AddressSpace* space) {
+    AddressSpace* last = mm->live[--mm->live_count];
+    mm->live[space->live_index] = last;
+    last->live_index = space->live_index;
+    mm->spaces[space->pid] = NULL;
+    free(space);
+}
+
+// Install a leaf for vaddr, creating tables on the way. Returns the leaf, or
+// NULL if vaddr is already mapped or the host is out of memory.
+static uint64_t* pt_map(MemoryManager* mm, uint32_t pid, uint64_t vaddr, uint64_t paddr, bool huge) {
+    AddressSpace* space = mm_space(mm, pid, true);
+    if (!space) return NULL;
+    if (!space->root) {
+        space->root = pt_alloc(mm);
+        if (!space->root) return NULL;
+    }
+
+    PageTable* table = space->root;
+    int leaf_level = huge ? 1 : 0;
+    for (int level = PT_LEVELS - 1; level > leaf_level; level--) {
+        uint64_t* pte = pt_slot(table, vaddr, level);
+        if (!(*pte & PTE_PRESENT)) {
+            PageTable* child = pt_alloc(mm);
+            if (!child) return NULL;
+            *pte = (uint64_t)(uintptr_t)child | PTE_PRESENT | PTE_WRITABLE;
+        } else if (*pte & PTE_HUGE) {
+            return NULL;
+        }
+        table = pt_child(*pte);
+    }
+
+    uint64_t* leaf = pt_slot(table, vaddr, leaf_level);
+    if (*leaf & PTE_PRESENT) return NULL;
+    *leaf = paddr | PTE_PRESENT | PTE_WRITABLE | (huge ? PTE_HUGE : 0);
+    if (huge) {
+        mm->huge_pages++;
+    } else {
+        note_owner(mm, pid, vaddr, paddr / PAGE_SIZE);
+    }
+    return leaf;
+}
+
+static void buddy_push(BuddyAllocator* b, uint32_t frame, int order) {
+    uint32_t head = b->heads[order];
+    b->next[frame] = head;
+    b->prev[frame] = FRAME_NONE;
+    if (head != FRAME_NONE) b->prev[head] = frame;
+    b->heads[order] = frame;
+    b->free_order[frame] = order + 1;
+    b->blocks[order]++;
+    b->nonempty |= 1u << order;
+}
+
+static void buddy_unlink(BuddyAllocator* b, uint32_t frame, int order) {
+    uint32_t next = b->next[frame];
+    uint32_t prev = b->prev[frame];
+    if (prev != FRAME_NONE) {
+        b->next[prev] = next;
+    } else {
+        b->heads[order] = next;
+    }
+    if (next != FRAME_NONE) b->prev[next] = prev;
+    b->free_order[frame] = 0;
+    if (--b->blocks[order] == 0) b->nonempty &= ~(1u << order);
+}
+
+// Smallest free block of at least 2^order frames, split down to size.
+// Returns FRAME_NONE if none is left.
+static uint32_t buddy_alloc(BuddyAllocator* b, int order) {
+    uint32_t candidates = b->nonempty >> order;
+    if (!candidates) return FRAME_NONE;
+
+    int found = order + __builtin_ctz(candidates);
+    uint32_t frame = b->heads[found];
+    buddy_unlink(b, frame, found);
+    while (found > order) {
+        found--;
+        buddy_push(b, frame + (1u << found), found);
+    }
+    return frame;
+}
+
+static void buddy_free(BuddyAllocator* b, uint32_t frame, int order) {
+    while (order < BUDDY_MAX_ORDER) {
+        uint64_t buddy = frame ^ (1u << order);
+        if (buddy >= b->frame_count || b->free_order[buddy] != order + 1) break;
+        buddy_unlink(b, (uint32_t)buddy, order);
+        frame &= ~(1u << order);
+        order++;
+    }
+    buddy_push(b, frame, order);
+}
+
+// Free an arbitrary run as the largest aligned blocks that tile it
+static void buddy_free_range(BuddyAllocator* b, uint64_t first, uint64_t count) {
+    while (count > 0) {
+        int order = 63 - __builtin_clzll(count);
+        if (first) order = MIN(order, __builtin_ctzll(first));
+        order = MIN(order, BUDDY_MAX_ORDER);
+        buddy_free(b, (uint32_t)first, order);
+        first += 1ULL << order;
+        count -= 1ULL << order;
+    }
+}
+
+static int order_for(uint64_t pages) {
+    int order = 0;
+    while ((1ULL << order) < pages) order++;
+    return order;
+}
+
+static void drain_frame_cache(MemoryManager* mm, FrameCache* cache) {
+    mm->cached_frames -= cache->count;
+    while (cache->count > 0) {
+        buddy_free(&mm->buddy, cache->frames[--cache->count], 0);
+    }
+}
+
+// Hand every PID's cached frames back to the buddy lists, so they can
+// coalesce and serve other PIDs; a failed allocation does this before giving
+// up or reclaiming. Returns false when no frame was cached.
+static bool drain_frame_caches(MemoryManager* mm) {
+    if (mm->cached_frames == 0) return false;
+
+    for (uint32_t i = 0; i < mm->live_count && mm->cached_frames > 0; i++) {
+        drain_frame_cache(mm, &mm->live[i]->cache);
+    }
+    return true;
+}
+
+// Take a contiguous run of count frames starting phase frames into a block
+// of the rounded-up order; the head and tail of the block go back at once.
+// Returns FRAME_NONE when no block is large enough.
+static uint32_t alloc_frames(MemoryManager* mm, uint64_t count, uint64_t phase) {
+    int order = order_for(count + phase);
+    if (order > BUDDY_MAX_ORDER) return FRAME_NONE;
+
+    uint32_t block = buddy_alloc(&mm->buddy, order);
+    if (block == FRAME_NONE && drain_frame_caches(mm)) block = buddy_alloc(&mm->buddy, order);
+    if (block == FRAME_NONE) return FRAME_NONE;
+
+    buddy_free_range(&mm->buddy, block, phase);
+    buddy_free_range(&mm->buddy, block + phase + count, (1ULL << order) - phase - count);
+    mm->free_pages -= count;
+    return block + phase;
+}
+
+static inline uint32_t swap_slot(uint64_t pte) {
+    return (uint32_t)((pte & PTE_ADDR_MASK) >> PAGE_SHIFT);
+}
+
+// Up to count consecutive free slots, starting at the first free one from
+// where the last run ended; 0 when the area is full. Dirty pages written
+// together so take one run.
+static uint32_t slot_alloc(SwapArea* swap, uint32_t count, uint32_t* first) {
+    if (swap->slots_used == swap->slot_count) return 0;
+
+    uint32_t slot = swap->next_slot;
+    for (;;) {
+        uint64_t word = swap->slot_used[slot / 64];
+        if (word == ~0ULL) {
+            slot = (slot / 64 + 1) * 64;
+        } else if (word & (1ULL << (slot % 64))) {
+            slot++;
+        } else {
+            break;
+        }
+        if (slot >= swap->slot_count) slot = 0;
+    }
+
+    uint32_t n = 0;
+    *first = slot;
+    while (n < count && slot + n < swap->slot_count &&
+           !(swap->slot_used[(slot + n) / 64] & (1ULL << ((slot + n) % 64)))) {
+        swap->slot_used[(slot + n) / 64] |= 1ULL << ((slot + n) % 64);
+        n++;
+    }
+    swap->slots_used += n;
+    swap->next_slot = slot + n < swap->slot_count ? slot + n : 0;
+    return n;
+}
+
+static void slot_put(SwapArea* swap, uint32_t slot) {
+    if (swap->slot_shares[slot] > 0) {
+        swap->slot_shares[slot]--;
+        return;
+    }
+    swap->slot_used[slot / 64] &= ~(1ULL << (slot % 64));
+    swap->slots_used--;
+}
+
+// Freed frames lose their reverse map entry and any clean copy in swap
+static void forget_frames(MemoryManager* mm, uint64_t first, uint64_t count) {
+    if (!mm->swap) return;
+
+    for (uint64_t f = first; f < first + count; f++) {
+        if (mm->frame_info[f].slot) slot_put(mm->swap, mm->frame_info[f].slot - 1);
+        memset(&mm->frame_info[f], 0, sizeof(FrameInfo));
+    }
+}
+
+static void release_frames(MemoryManager* mm, uint64_t first, uint64_t count) {
+    forget_frames(mm, first, count);
+    buddy_free_range(&mm->buddy, first, count);
+    mm->free_pages += count;
+    gmem_discard(mm->physical_memory, first * PAGE_SIZE, count * PAGE_SIZE);
+}
+
+// The 4KB leaf frame's reverse map entry points at, if it still maps frame
+static uint64_t* frame_leaf(MemoryManager* mm, uint32_t frame) {
+    const FrameInfo* info = &mm->frame_info[frame];
+    AddressSpace* space = info->owner ? mm_space(mm, info->owner - 1, false) : NULL;
+    if (!space || !space->root) return NULL;
+
+    uint64_t levels = 0;
+    uint64_t* pte = pt_walk(space->root, info->vpage * PAGE_SIZE, &levels);
+    if ((*pte & (PTE_PRESENT | PTE_HUGE)) != PTE_PRESENT ||
+        (*pte & PTE_ADDR_MASK) != (uint64_t)frame * PAGE_SIZE) {
+        return NULL;
+    }
+    return pte;
+}
+
+// Leaf of a frame page replacement may take: private, not host-backed and
+// not already queued for write-back
+static uint64_t* evictable(MemoryManager* mm, uint32_t frame) {
+    if (mm->frame_shares[frame] > 0 || mm->frame_info[frame].writeback) return NULL;
+
+    uint64_t* pte = frame_leaf(mm, frame);
+    return pte && !(*pte & PTE_HOST) ? pte : NULL;
+}
+
+static void flush_translation(MemoryManager* mm, uint32_t frame) {
+    const FrameInfo* info = &mm->frame_info[frame];
+    tlb_invalidate(&mm->l1_tlb, info->owner - 1, info->vpage, false);
+    tlb_invalidate(&mm->l2_tlb, info->owner - 1, info->vpage, false);
+}
+
+// Whether evicting the page needs a write first: it is dirty, or it holds
+// data no slot has a copy of
+static bool needs_write(MemoryManager* mm, uint32_t frame, const uint64_t* pte) {
+    if (*pte & PTE_DIRTY) return true;
+    return !mm->frame_info[frame].slot &&
+           gmem_page(mm->physical_memory, (uint64_t)frame * PAGE_SIZE) != gmem_zero_page;
+}
+
+// Unmap a clean page and free its frame. The leaf takes over the page's
+// slot; a page that never held data is dropped and refaults as zeros.
+static void evict(MemoryManager* mm, uint32_t frame, uint64_t* pte) {
+    SwapArea* swap = mm->swap;
+    FrameInfo* info = &mm->frame_info[frame];
+    if (info->slot) {
+        *pte = (uint64_t)(info->slot - 1) << PAGE_SHIFT | (*pte & (PTE_WRITABLE | PTE_COW)) | PTE_SWAPPED;
+        info->slot = 0;
+    } else {
+        *pte = 0;
+        swap->dropped++;
+    }
+    flush_translation(mm, frame);
+    swap->evictions++;
+    release_frames(mm, frame, 1);
+}
+
+// Write every queued page still mapped, then evict the ones meant to go
+// that have not been written to since. Pages get fresh slots, as few runs
+// of consecutive ones as the area allows, and each run is gathered into one
+// swap file write. Returns how many pages were evicted.
+static int flush_writeback(MemoryManager* mm) {
+    SwapArea* swap = mm->swap;
+    uint32_t pages[SWAP_WRITEBACK_BATCH];    // queue entries still to write
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < swap->queued; i++) {
+        uint32_t frame = swap->queue[i].frame;
+        FrameInfo* info = &mm->frame_info[frame];
+        info->writeback = false;
+        if (!frame_leaf(mm, frame)) continue;   // Gone since
+
+        // An older copy is stale
+        if (info->slot) {
+            slot_put(swap, info->slot - 1);
+            info->slot = 0;
+        }
+        pages[count++] = i;
+    }
+
+    for (uint32_t done = 0; done < count;) {
+        uint32_t first;
+        uint32_t n = slot_alloc(swap, count - done, &first);
+        if (n == 0) {
+            ERROR("Swap area full\n");
+            break;
+        }
+        for (uint32_t j = 0; j < n; j++) {
+            memcpy(swap->staging + (size_t)j * PAGE_SIZE,
+                   gmem_page(mm->physical_memory, (uint64_t)swap->queue[pages[done + j]].frame * PAGE_SIZE),
+                   PAGE_SIZE);
+        }
+
+        size_t len = (size_t)n * PAGE_SIZE;
+        vfs_seek(swap->vfs, swap->fd, (int64_t)first * PAGE_SIZE, SEEK_SET);
+        bool written = vfs_write_file(swap->vfs, swap->fd, swap->staging, len) == (int)len;
+        if (written) {
+            swap->writes++;
+            swap->swap_outs += n;
+        } else {
+            ERROR("Cannot write swap slots %u-%u\n", first, first + n - 1);
+        }
+        for (uint32_t j = 0; j < n; j++) {
+            uint32_t frame = swap->queue[pages[done + j]].frame;
+            if (written) {
+                mm->frame_info[frame].slot = first + j + 1;
+            } else {
+                // Stays dirty, so it is not evicted and is written again later
+                *frame_leaf(mm, frame) |= PTE_DIRTY;
+                slot_put(swap, first + j);
+            }
+        }
+        done += n;
+    }
+
+    int evicted = 0;
+    for (uint32_t i = 0; i < swap->queued; i++) {
+        if (!swap->queue[i].evict) continue;
+        uint64_t* pte = evictable(mm, swap->queue[i].frame);
+        if (pte && mm->frame_info[swap->queue[i].frame].slot && !(*pte & PTE_DIRTY)) {
+            evict(mm, swap->queue[i].frame, pte);
+            evicted++;
+        }
+    }
+    swap->queued = 0;
+    return evicted;
+}
+
+// Clean the page's dirty bit and queue it; its cached translations go, so
+// a write from here on dirties it again. Returns pages evicted by a flush.
+static int queue_writeback(MemoryManager* mm, uint32_t frame, uint64_t* pte, bool evict_after) {
+    SwapArea* swap = mm->swap;
+    *pte &= ~PTE_DIRTY;
+    flush_translation(mm, frame);
+    mm->frame_info[frame].writeback = true;
+    swap->queue[swap->queued].frame = frame;
+    swap->queue[swap->queued].evict = evict_after;
+    swap->queued++;
+    return swap->queued == SWAP_WRITEBACK_BATCH ? flush_writeback(mm) : 0;
+}
+
+// Free up to SWAP_RECLAIM_BATCH frames with the clock hand sweeping
+// physical frames. A referenced page has its accessed bit cleared and its
+// translations flushed, so the next use sets the bit again, and counts as
+// used now. CLOCK evicts the first page found unreferenced. WSClock's first
+// lap takes only pages unused for the working-set window, and queues dirty
+// ones for write-back instead of waiting on them; after a lap with nothing
+// freed it falls back to CLOCK. Returns how many frames were freed.
+static int reclaim(MemoryManager* mm) {
+    SwapArea* swap = mm->swap;
+    uint64_t frames = mm->total_pages;
+    uint64_t now = mm_now(mm);
+    int freed = 0;
+
+    for (uint64_t scanned = 0; scanned < 3 * frames; scanned++) {
+        if (freed >= SWAP_RECLAIM_BATCH || (freed > 0 && scanned >= frames)) break;
+
+        uint32_t frame = (uint32_t)(swap->hand++ % frames);
+        swap->scanned++;
+        uint64_t* pte = evictable(mm, frame);
+        if (!pte) continue;
+
+        FrameInfo* info = &mm->frame_info[frame];
+        if (*pte & PTE_ACCESSED) {
+            *pte &= ~PTE_ACCESSED;
+            info->last_use = now;
+            flush_translation(mm, frame);
+            continue;
+        }
+
+        bool first_lap = scanned < frames;
+        if (swap->policy == SWAP_WSCLOCK && first_lap && now - info->last_use <= swap->window) continue;
+
+        if (!needs_write(mm, frame, pte)) {
+            evict(mm, frame, pte);
+            freed++;
+        } else {
+            freed += queue_writeback(mm, frame, pte, swap->policy == SWAP_CLOCK || !first_lap);
+        }
+    }
+
+    if (freed == 0 && swap->queued > 0) freed = flush_writeback(mm);
+    return freed;
+}
+
+// One frame for a demand fault, from the PID's cache when it has one
+static uint32_t alloc_frame(MemoryManager* mm, uint32_t pid) {
+    AddressSpace* space = mm_space(mm, pid, true);
+    if (!space) return FRAME_NONE;
+    FrameCache* cache = &space->cache;
+    if (cache->count == 0) {
+        // Refill in a batch so most faults skip the buddy lists
+        uint32_t block = buddy_alloc(&mm->buddy, FRAME_CACHE_BATCH_ORDER);
+        if (block != FRAME_NONE) {
+            for (uint32_t i = 1u << FRAME_CACHE_BATCH_ORDER; i > 0; i--) {
+                cache->frames[cache->count++] = block + i - 1;
+            }
+            mm->cached_frames += cache->count;
+        } else {
+            block = buddy_alloc(&mm->buddy, 0);
+            if (block == FRAME_NONE && drain_frame_caches(mm)) {
+                block = buddy_alloc(&mm->buddy, 0);
+            }
+            if (block == FRAME_NONE && mm->swap && reclaim(mm) > 0) {
+                block = buddy_alloc(&mm->buddy, 0);
+            }
+            if (block == FRAME_NONE) return FRAME_NONE;
+            mm->free_pages--;
+            return block;
+        }
+    }
+    mm->free_pages--;
+    mm->cached_frames--;
+    return cache->frames[--cache->count];
+}
+
+static void release_frame(MemoryManager* mm, uint32_t pid, uint32_t frame) {
+    AddressSpace* space = mm_space(mm, pid, false);
+    FrameCache* cache = space ? &space->cache : NULL;
+    forget_frames(mm, frame, 1);
+    gmem_discard(mm->physical_memory, (uint64_t)frame * PAGE_SIZE, PAGE_SIZE);
+    mm->free_pages++;
+    if (cache && cache->count < FRAME_CACHE_SIZE) {
+        cache->frames[cache->count++] = frame;
+        mm->cached_frames++;
+    } else {
+        buddy_free(&mm->buddy, frame, 0);
+    }
+}
+
+// Drop one mapping of count frames; those no other mapping shares are freed,
+// runs of them together
+static void put_frames(MemoryManager* mm, uint64_t first, uint64_t count) {
+    uint64_t run = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        if (mm->frame_shares[first + i] > 0) {
+            mm->frame_shares[first + i]--;
+            if (run < i) release_frames(mm, first + run, i - run);
+            run = i + 1;
+        }
+    }
+    if (run < count) release_frames(mm, first + run, count - run);
+}
+
 MemoryManager* mm_create(uint64_t mem_size) {
-    MemoryManager* mm = (MemoryManager*)malloc(sizeof(MemoryManager));
+    MemoryManager* mm = (MemoryManager*)calloc(1, sizeof(MemoryManager));
     if (!mm) return NULL;
-    
+
     mm->mem_size = mem_size;
-    mm->physical_memory = (uint8_t*)malloc(mem_size);
+    mm->physical_memory = gmem_create(mem_size);
     if (!mm->physical_memory) {
         free(mm);
         return NULL;
     }
-    
-    // Initialize page tables
-    memset(mm->page_tables, 0, sizeof(mm->page_tables));
-    memset(mm->page_table_sizes, 0, sizeof(mm->page_table_sizes));
-    
-    // Initialize page bitmap
+
     mm->total_pages = mem_size / PAGE_SIZE;
-    mm->free_pages = mm->total_pages;
-    mm->page_bitmap = (bool*)malloc(mm->total_pages * sizeof(bool));
-    if (!mm->page_bitmap) {
-        free(mm->physical_memory);
-        free(mm);
+    if (mm->total_pages >= FRAME_NONE) {
+        ERROR("Too many physical pages: %lu\n", mm->total_pages);
+        mm_destroy(mm);
+        return NULL;
+    }
+
+    BuddyAllocator* b = &mm->buddy;
+    uint64_t frames = mm->total_pages ? mm->total_pages : 1;
+    b->frame_count = mm->total_pages;
+    b->next = (uint32_t*)calloc(frames, sizeof(uint32_t));
+    b->prev = (uint32_t*)calloc(frames, sizeof(uint32_t));
+    b->free_order = (uint8_t*)calloc(frames, sizeof(uint8_t));
+    mm->frame_shares = (uint32_t*)calloc(frames, sizeof(uint32_t));
+    mm->frame_info = (FrameInfo*)calloc(frames, sizeof(FrameInfo));
+    for (int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        b->heads[order] = FRAME_NONE;
+    }
+    if (!b->next || !b->prev || !b->free_order || !mm->frame_shares || !mm->frame_info ||
+        tlb_init(&mm->l1_tlb, DEFAULT_TLB_L1_ENTRIES, DEFAULT_TLB_L1_WAYS) != 0 ||
+        tlb_init(&mm->l2_tlb, DEFAULT_TLB_L2_ENTRIES, DEFAULT_TLB_L2_WAYS) != 0) {
+        mm_destroy(mm);
         return NULL;
     }
-    
-    // Mark all pages as free initially
-    for (uint64_t i = 0; i < mm->total_pages; i++) {
-        mm->page_bitmap[i] = false;  // false = free
+
+    // Frame 0 stays reserved so that 0 can mean failure
+    if (mm->total_pages > 1) {
+        buddy_free_range(b, 1, mm->total_pages - 1);
+        mm->free_pages = mm->total_pages - 1;
     }
-    
-    mm->page_faults = 0;
-    mm->tlb_hits = 0;
-    mm->tlb_misses = 0;
-    
+
     return mm;
 }
 
+static void pt_free(MemoryManager* mm, PageTable* table, int level) {
+    for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+        uint64_t pte = table->entries[i];
+        if (!(pte & PTE_PRESENT)) {
+            if (pte & PTE_SWAPPED) slot_put(mm->swap, swap_slot(pte));
+            continue;
+        }
+
+        if (level == 0) {
+            put_frames(mm, (pte & PTE_ADDR_MASK) / PAGE_SIZE, 1);
+        } else if (pte & PTE_HUGE) {
+            put_frames(mm, (pte & PTE_ADDR_MASK) / PAGE_SIZE, PT_ENTRIES);
+            mm->huge_pages--;
+        } else {
+            pt_free(mm, pt_child(pte), level - 1);
+        }
+    }
+    free(table);
+    mm->table_count--;
+}
+
 void mm_destroy(MemoryManager* mm) {
     if (mm) {
-        free(mm->physical_memory);
-        free(mm->page_bitmap);
-        
-        // Free all page tables
-        for (int i = 0; i < MAX_PROCESSES; i++) {
-            if (mm->page_tables[i]) {
-                free(mm->page_tables[i]);
-            }
+        // Free all address spaces; each one leaves the live list
+        while (mm->live_count > 0) {
+            mm_free_pages(mm, mm->live[mm->live_count - 1]->pid);
         }
-        
+        free(mm->spaces);
+        free(mm->live);
+
+        gmem_destroy(mm->physical_memory);
+        free(mm->buddy.next);
+        free(mm->buddy.prev);
+        free(mm->buddy.free_order);
+        free(mm->frame_shares);
+        free(mm->frame_info);
+        if (mm->swap) {
+            free(mm->swap->slot_used);
+            free(mm->swap->slot_shares);
+            free(mm->swap->staging);
+            free(mm->swap);
+        }
+        free(mm->l1_tlb.entries);
+        free(mm->l2_tlb.entries);
         free(mm);
     }
 }
@@ -58,139 +695,499 @@ uint64_t mm_allocate_pages(MemoryManager* mm, uint32_t pid, uint32_t pages) {
         ERROR("Invalid PID\n");
         return 0;
     }
-    
+
     if (pages == 0) return 0;
-    
-    // Find contiguous free pages
-    uint64_t start_page = 0;
-    uint64_t consecutive = 0;
-    
-    for (uint64_t i = 0; i < mm->total_pages; i++) {
-        if (!mm->page_bitmap[i]) {
-            if (consecutive == 0) start_page = i;
-            consecutive++;
-            
-            if (consecutive == pages) {
-                // Found enough contiguous pages
-                for (uint64_t j = start_page; j < start_page + pages; j++) {
-                    mm->page_bitmap[j] = true;  // Mark as allocated
-                }
-                
-                mm->free_pages -= pages;
-                
-                // Create or extend page table
-                if (!mm->page_tables[pid]) {
-                    mm->page_tables[pid] = (PageTableEntry*)malloc(MAX_PAGES * sizeof(PageTableEntry));
-                    if (!mm->page_tables[pid]) {
-                        return 0;
-                    }
-                    memset(mm->page_tables[pid], 0, MAX_PAGES * sizeof(PageTableEntry));
-                    mm->page_table_sizes[pid] = 0;
-                }
-                
-                // Setup page table entries
-                for (uint32_t j = 0; j < pages; j++) {
-                    PageTableEntry* pte = &mm->page_tables[pid][mm->page_table_sizes[pid] + j];
-                    pte->virtual_addr = (mm->page_table_sizes[pid] + j) * PAGE_SIZE;
-                    pte->physical_addr = (start_page + j) * PAGE_SIZE;
-                    pte->present = true;
-                    pte->writable = true;
-                    pte->accessed = false;
-                    pte->dirty = false;
-                    pte->timestamp = 0;
-                }
-                
-                mm->page_table_sizes[pid] += pages;
-                
-                return start_page * PAGE_SIZE;
-            }
-        } else {
-            consecutive = 0;
+
+    AddressSpace* space = mm_space(mm, pid, true);
+    if (!space) return 0;
+    uint64_t vpage = space->heap_pages;
+    if (vpage + pages > (1ULL << (VA_BITS - PAGE_SHIFT))) {
+        ERROR("Virtual address space exhausted\n");
+        return 0;
+    }
+
+    // Find contiguous free pages. A run that can hold a huge page starts at
+    // the same offset within a 2MB block as its virtual address does.
+    uint64_t start = FRAME_NONE;
+    if (pages >= PT_ENTRIES) {
+        start = alloc_frames(mm, pages, vpage & (PT_ENTRIES - 1));
+    }
+    if (start == FRAME_NONE) {
+        start = alloc_frames(mm, pages, 0);
+    }
+    if (start == FRAME_NONE) {
+        ERROR("Not enough contiguous pages available\n");
+        return 0;
+    }
+
+    // Map the run after the process's previous allocations, 2MB at a time
+    // wherever both addresses are aligned
+    uint64_t mapped = 0;
+    while (mapped < pages) {
+        uint64_t vaddr = (vpage + mapped) * PAGE_SIZE;
+        uint64_t paddr = (start + mapped) * PAGE_SIZE;
+        bool huge = ((vaddr | paddr) & (HUGE_PAGE_SIZE - 1)) == 0 && pages - mapped >= PT_ENTRIES;
+        if (!pt_map(mm, pid, vaddr, paddr, huge)) {
+            ERROR("Cannot map virtual page 0x%lx for PID %u\n", vaddr, pid);
+            release_frames(mm, start + mapped, pages - mapped);
+            space->heap_pages += mapped;
+            return 0;
         }
+        mapped += huge ? PT_ENTRIES : 1;
     }
-    
-    ERROR("Not enough contiguous pages available\n");
-    return 0;
+
+    space->heap_pages += pages;
+    return start * PAGE_SIZE;
 }
 
 void mm_free_pages(MemoryManager* mm, uint32_t pid) {
-    if (pid >= MAX_PROCESSES || !mm->page_tables[pid]) {
-        return;
+    AddressSpace* space = mm_space(mm, pid, false);
+    if (!space) return;
+
+    // Free all pages allocated to this process, then its page tables
+    if (space->root) pt_free(mm, space->root, PT_LEVELS - 1);
+    drain_frame_cache(mm, &space->cache);
+    space_free(mm, space);
+    mm_flush_tlb(mm, pid);
+}
+
+// Unmap one 4KB page; its frame goes to the PID's frame cache unless a
+// fork still shares it. Pages inside a huge mapping cannot be unmapped on
+// their own.
+int mm_unmap_page(MemoryManager* mm, uint32_t pid, uint64_t vaddr) {
+    AddressSpace* space = mm_space(mm, pid, false);
+    if (!space || !space->root || (vaddr >> VA_BITS) != 0) {
+        return -1;
+    }
+
+    uint64_t levels = 0;
+    uint64_t* pte = pt_walk(space->root, vaddr, &levels);
+    if (*pte & PTE_SWAPPED) {
+        slot_put(mm->swap, swap_slot(*pte));
+        *pte = 0;
+        return 0;
+    }
+    if (!(*pte & PTE_PRESENT) || (*pte & PTE_HUGE)) return -1;
+
+    uint32_t frame = (uint32_t)((*pte & PTE_ADDR_MASK) / PAGE_SIZE);
+    *pte = 0;
+    tlb_invalidate(&mm->l1_tlb, pid, vaddr >> PAGE_SHIFT, false);
+    tlb_invalidate(&mm->l2_tlb, pid, vaddr >> PAGE_SHIFT, false);
+    if (mm->frame_shares[frame] > 0) {
+        mm->frame_shares[frame]--;
+    } else {
+        release_frame(mm, pid, frame);
+    }
+    return 0;
+}
+
+// Reserve pages of virtual space after the PID's other allocations without
+// claiming any frames: each page is backed by a zeroed frame on first touch
+int mm_reserve_pages(MemoryManager* mm, uint32_t pid, uint64_t pages, uint64_t* vaddr) {
+    AddressSpace* space = pages > 0 ? mm_space(mm, pid, true) : NULL;
+    if (!space) return -1;
+
+    uint64_t vpage = space->heap_pages;
+    if (vpage + pages > (1ULL << (VA_BITS - PAGE_SHIFT))) {
+        ERROR("Virtual address space exhausted\n");
+        return -1;
+    }
+
+    space->heap_pages += pages;
+    *vaddr = vpage * PAGE_SIZE;
+    return 0;
+}
+
+// Map count host pages, such as file chunks, after the PID's other
+// allocations. Each gets a frame of its own, but guest accesses to that
+// frame go straight to the host page; unmapping hands the page back.
+int mm_map_host_pages(MemoryManager* mm, uint32_t pid, uint8_t* const* pages, uint32_t count,
+                      uint64_t* vaddr) {
+    AddressSpace* space = count > 0 ? mm_space(mm, pid, true) : NULL;
+    if (!space) return -1;
+
+    uint64_t vpage = space->heap_pages;
+    if (vpage + count > (1ULL << (VA_BITS - PAGE_SHIFT))) {
+        ERROR("Virtual address space exhausted\n");
+        return -1;
     }
-    
-    // Free all pages allocated to this process
-    for (uint32_t i = 0; i < mm->page_table_sizes[pid]; i++) {
-        PageTableEntry* pte = &mm->page_tables[pid][i];
-        if (pte->present) {
-            uint64_t page_num = pte->physical_addr / PAGE_SIZE;
-            if (page_num < mm->total_pages) {
-                mm->page_bitmap[page_num] = false;  // Mark as free
-                mm->free_pages++;
+    if (count > mm->free_pages) {
+        ERROR("Not enough free pages to map %u pages\n", count);
+        return -1;
+    }
+
+    // Frames need not be contiguous: no huge page can cover host pages
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t va = (vpage + i) * PAGE_SIZE;
+        uint32_t frame = alloc_frame(mm, pid);
+        uint64_t* leaf = frame != FRAME_NONE ? pt_map(mm, pid, va, (uint64_t)frame * PAGE_SIZE, false) : NULL;
+        bool mapped = leaf != NULL;
+        if (mapped) {
+            *leaf |= PTE_HOST;
+        } else if (frame != FRAME_NONE) {
+            release_frame(mm, pid, frame);
+        }
+        if (!mapped || gmem_share(mm->physical_memory, (uint64_t)frame * PAGE_SIZE, pages[i]) != 0) {
+            ERROR("Cannot map host page at 0x%lx for PID %u\n", va, pid);
+            if (mapped) mm_unmap_page(mm, pid, va);
+            while (i-- > 0) {
+                mm_unmap_page(mm, pid, (vpage + i) * PAGE_SIZE);
             }
+            return -1;
         }
     }
-    
-    // Free page table
-    free(mm->page_tables[pid]);
-    mm->page_tables[pid] = NULL;
-    mm->page_table_sizes[pid] = 0;
+
+    space->heap_pages += count;
+    *vaddr = vpage * PAGE_SIZE;
+    return 0;
 }
 
-uint64_t mm_translate_address(MemoryManager* mm, uint32_t pid, uint64_t vaddr) {
-    if (pid >= MAX_PROCESSES || !mm->page_tables[pid]) {
+// Copy the tree under src for a fork. Leaves are shared: private pages turn
+// copy-on-write in both trees, host pages stay writable in both.
+static PageTable* pt_clone(MemoryManager* mm, PageTable* src, int level) {
+    PageTable* dst = pt_alloc(mm);
+    if (!dst) return NULL;
+
+    for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+        uint64_t pte = src->entries[i];
+        if (!(pte & PTE_PRESENT)) {
+            // Both sides read a swapped-out page back from the one slot
+            if (pte & PTE_SWAPPED) {
+                mm->swap->slot_shares[swap_slot(pte)]++;
+                dst->entries[i] = pte;
+            }
+            continue;
+        }
+
+        if (level > 0 && !(pte & PTE_HUGE)) {
+            PageTable* child = pt_clone(mm, pt_child(pte), level - 1);
+            if (!child) {
+                pt_free(mm, dst, level);
+                return NULL;
+            }
+            dst->entries[i] = (uint64_t)(uintptr_t)child | PTE_PRESENT | PTE_WRITABLE;
+            continue;
+        }
+
+        if ((pte & PTE_WRITABLE) && !(pte & PTE_HOST)) {
+            pte = (pte & ~PTE_WRITABLE) | PTE_COW;
+            src->entries[i] = pte;
+        }
+        uint64_t first = (pte & PTE_ADDR_MASK) / PAGE_SIZE;
+        uint64_t count = (pte & PTE_HUGE) ? PT_ENTRIES : 1;
+        for (uint64_t f = first; f < first + count; f++) {
+            mm->frame_shares[f]++;
+        }
+        if (pte & PTE_HUGE) mm->huge_pages++;
+        dst->entries[i] = pte;
+    }
+    return dst;
+}
+
+// Give child, replacing whatever it had, the parent's address space. No
+// frame is copied until one side writes to it.
+int mm_fork(MemoryManager* mm, uint32_t parent, uint32_t child) {
+    if (parent >= MAX_PROCESSES || child >= MAX_PROCESSES || parent == child) return -1;
+
+    mm_free_pages(mm, child);
+
+    // Queued pages had their dirty bits cleared; write them while the frames
+    // are still private, or a later eviction would take their old slot
+    mm_swap_flush(mm);
+    AddressSpace* from = mm_space(mm, parent, false);
+    if (!from) return 0;
+    AddressSpace* to = mm_space(mm, child, true);
+    if (!to) return -1;
+    if (from->root) {
+        to->root = pt_clone(mm, from->root, PT_LEVELS - 1);
+        if (!to->root) {
+            ERROR("Cannot copy page tables of PID %u\n", parent);
+            return -1;
+        }
+    }
+    to->heap_pages = from->heap_pages;
+
+    // The parent's cached translations may still allow writes
+    mm_flush_tlb(mm, parent);
+    mm_flush_tlb(mm, child);
+    return 0;
+}
+
+// Replace a 2MB leaf with a table of 4KB leaves over the same frames
+static uint64_t* pt_split(MemoryManager* mm, uint32_t pid, uint64_t vaddr, uint64_t* pte) {
+    PageTable* table = pt_alloc(mm);
+    if (!table) return NULL;
+
+    uint64_t base = *pte & PTE_ADDR_MASK;
+    uint64_t flags = *pte & ~PTE_ADDR_MASK & ~PTE_HUGE;
+    uint64_t start = vaddr & ~(HUGE_PAGE_SIZE - 1);
+    for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+        table->entries[i] = (base + (uint64_t)i * PAGE_SIZE) | flags;
+        note_owner(mm, pid, start + (uint64_t)i * PAGE_SIZE, base / PAGE_SIZE + i);
+    }
+    *pte = (uint64_t)(uintptr_t)table | PTE_PRESENT | PTE_WRITABLE;
+    mm->huge_pages--;
+    tlb_invalidate(&mm->l1_tlb, pid, vaddr >> HUGE_PAGE_SHIFT, true);
+    tlb_invalidate(&mm->l2_tlb, pid, vaddr >> HUGE_PAGE_SHIFT, true);
+    return pt_slot(table, vaddr, 0);
+}
+
+// First write through a read-only leaf. A copy-on-write page is copied
+// unless no other mapping is left; a huge one is split first, so only the
+// 4KB page written gets copied. Returns the now writable leaf, or NULL.
+static uint64_t* cow_fault(MemoryManager* mm, uint32_t pid, uint64_t vaddr, uint64_t* pte) {
+    if (!(*pte & PTE_COW)) {
+        ERROR("Write to read-only page 0x%lx of PID %u\n", vaddr, pid);
+        return NULL;
+    }
+
+    mm->cow_faults++;
+    if (*pte & PTE_HUGE) {
+        uint64_t first = (*pte & PTE_ADDR_MASK) / PAGE_SIZE;
+        uint32_t i = 0;
+        while (i < PT_ENTRIES && mm->frame_shares[first + i] == 0) i++;
+        if (i == PT_ENTRIES) {
+            *pte = (*pte & ~PTE_COW) | PTE_WRITABLE;
+            return pte;
+        }
+        pte = pt_split(mm, pid, vaddr, pte);
+        if (!pte) return NULL;
+    }
+
+    uint32_t frame = (uint32_t)((*pte & PTE_ADDR_MASK) / PAGE_SIZE);
+    uint64_t flags = (*pte & ~PTE_ADDR_MASK & ~PTE_COW) | PTE_WRITABLE;
+    if (mm->frame_shares[frame] == 0) {
+        *pte = (uint64_t)frame * PAGE_SIZE | flags;
+        note_owner(mm, pid, vaddr, frame);
+        return pte;
+    }
+
+    uint32_t copy = alloc_frame(mm, pid);
+    if (copy == FRAME_NONE) {
+        ERROR("No frame to copy page 0x%lx of PID %u\n", vaddr, pid);
+        return NULL;
+    }
+
+    // Untouched pages read as zero, which the fresh frame already is
+    const uint8_t* src = gmem_page(mm->physical_memory, (uint64_t)frame * PAGE_SIZE);
+    if (src != gmem_zero_page) {
+        uint8_t* dst = gmem_page_mut(mm->physical_memory, (uint64_t)copy * PAGE_SIZE);
+        if (!dst) {
+            release_frame(mm, pid, copy);
+            return NULL;
+        }
+        memcpy(dst, src, PAGE_SIZE);
+    }
+    mm->frame_shares[frame]--;
+    mm->cow_copies++;
+    *pte = (uint64_t)copy * PAGE_SIZE | flags;
+    note_owner(mm, pid, vaddr, copy);
+    return pte;
+}
+
+// Fault on a swapped-out page: read it back into a fresh frame. The slot
+// stays with the frame as a clean copy unless a fork shares it.
+static uint64_t* swap_in(MemoryManager* mm, uint32_t pid, uint64_t vaddr, uint64_t* pte) {
+    SwapArea* swap = mm->swap;
+    uint32_t slot = swap_slot(*pte);
+    uint32_t frame = alloc_frame(mm, pid);
+    if (frame == FRAME_NONE) {
+        ERROR("Page fault cannot be resolved\n");
+        return NULL;
+    }
+
+    uint8_t* page = gmem_page_mut(mm->physical_memory, (uint64_t)frame * PAGE_SIZE);
+    vfs_seek(swap->vfs, swap->fd, (int64_t)slot * PAGE_SIZE, SEEK_SET);
+    if (!page || vfs_read_file(swap->vfs, swap->fd, page, PAGE_SIZE) != PAGE_SIZE) {
+        ERROR("Cannot read swap slot %u\n", slot);
+        release_frame(mm, pid, frame);
+        return NULL;
+    }
+
+    note_owner(mm, pid, vaddr, frame);
+    if (swap->slot_shares[slot] > 0) {
+        swap->slot_shares[slot]--;
+    } else {
+        mm->frame_info[frame].slot = slot + 1;
+    }
+    *pte = (uint64_t)frame * PAGE_SIZE | (*pte & (PTE_WRITABLE | PTE_COW)) | PTE_PRESENT;
+    swap->swap_ins++;
+    return pte;
+}
+
+void mm_flush_tlb(MemoryManager* mm, uint32_t pid) {
+    tlb_flush_asid(&mm->l1_tlb, pid);
+    tlb_flush_asid(&mm->l2_tlb, pid);
+}
+
+// A write that hits a TLB entry not yet writable and dirty walks the table
+// like a miss, so copy-on-write faults and dirty bits are taken there
+static uint64_t translate(MemoryManager* mm, uint32_t pid, uint64_t vaddr, bool write) {
+    if (pid >= MAX_PROCESSES || (vaddr >> VA_BITS) != 0) {
         mm->page_faults++;
         return 0;
     }
-    
-    uint64_t vpage = vaddr / PAGE_SIZE;
-    uint64_t offset = vaddr % PAGE_SIZE;
-    
-    // Simple linear search (in real system, use page table walk)
-    for (uint32_t i = 0; i < mm->page_table_sizes[pid]; i++) {
-        PageTableEntry* pte = &mm->page_tables[pid][i];
-        if (pte->present && (pte->virtual_addr / PAGE_SIZE) == vpage) {
-            pte->accessed = true;
-            mm->tlb_hits++;
-            return pte->physical_addr + offset;
-        }
-    }
-    
-    // Page fault
-    mm->page_faults++;
+
+    bool any_huge = mm->huge_pages > 0;
+    TlbEntry* e = tlb_lookup(&mm->l1_tlb, pid, vaddr, any_huge);
+    if (!e) {
+        e = tlb_lookup(&mm->l2_tlb, pid, vaddr, any_huge);
+        if (e && (!write || e->writable)) {
+            tlb_insert(&mm->l1_tlb, pid, e->vpn, e->frame, e->huge, e->writable);
+        }
+    }
+    if (e && (!write || e->writable)) {
+        mm->tlb_hits++;
+        return e->frame + (vaddr & ((e->huge ? HUGE_PAGE_SIZE : PAGE_SIZE) - 1));
+    }
+
+    // Both TLBs missed: walk the page table
     mm->tlb_misses++;
-    
-    // Try to allocate a new page
-    uint64_t phys_addr = mm_allocate_pages(mm, pid, 1);
-    if (phys_addr == 0) {
-        ERROR("Page fault cannot be resolved\n");
-        return 0;
+    uint64_t* pte = NULL;
+    AddressSpace* space = mm_space(mm, pid, false);
+    if (space && space->root) {
+        pte = pt_walk(space->root, vaddr, &mm->walk_levels);
+    }
+
+    if (pte && (*pte & PTE_SWAPPED)) {
+        mm->page_faults++;
+        pte = swap_in(mm, pid, vaddr, pte);
+        if (!pte) return 0;
+    } else if (!pte || !(*pte & PTE_PRESENT)) {
+        // Page fault: back the page with a fresh frame
+        mm->page_faults++;
+        uint32_t frame = alloc_frame(mm, pid);
+        if (frame == FRAME_NONE) {
+            ERROR("Page fault cannot be resolved\n");
+            return 0;
+        }
+        pte = pt_map(mm, pid, vaddr & ~(uint64_t)(PAGE_SIZE - 1), (uint64_t)frame * PAGE_SIZE, false);
+        if (!pte) {
+            release_frame(mm, pid, frame);
+            ERROR("Page fault cannot be resolved\n");
+            return 0;
+        }
+    }
+    if (write && !(*pte & PTE_WRITABLE)) {
+        pte = cow_fault(mm, pid, vaddr, pte);
+        if (!pte) return 0;
+    }
+
+    *pte |= PTE_ACCESSED | (write ? PTE_DIRTY : 0);
+    bool huge = (*pte & PTE_HUGE) != 0;
+    bool writable = (*pte & (PTE_WRITABLE | PTE_DIRTY)) == (PTE_WRITABLE | PTE_DIRTY);
+    uint64_t frame = *pte & PTE_ADDR_MASK;
+    uint64_t vpn = vaddr >> (huge ? HUGE_PAGE_SHIFT : PAGE_SHIFT);
+    tlb_insert(&mm->l2_tlb, pid, vpn, frame, huge, writable);
+    tlb_insert(&mm->l1_tlb, pid, vpn, frame, huge, writable);
+
+    return frame + (vaddr & ((huge ? HUGE_PAGE_SIZE : PAGE_SIZE) - 1));
+}
+
+// Physical address of vaddr for a read; shared pages stay shared
+uint64_t mm_translate_address(MemoryManager* mm, uint32_t pid, uint64_t vaddr) {
+    return translate(mm, pid, vaddr, false);
+}
+
+// Physical address of vaddr for a write, copying a copy-on-write page first
+uint64_t mm_translate_write(MemoryManager* mm, uint32_t pid, uint64_t vaddr) {
+    return translate(mm, pid, vaddr, true);
+}
+
+// Back faults with page replacement: when no frame is left, the policy
+// picks victims to evict to slots of a new VFS file
+int mm_enable_swap(MemoryManager* mm, VFS* vfs, const char* name, uint32_t slots, SwapPolicy policy) {
+    if (mm->swap || slots == 0 || slots == UINT32_MAX) return -1;
+
+    SwapArea* swap = (SwapArea*)calloc(1, sizeof(SwapArea));
+    if (!swap) return -1;
+    swap->vfs = vfs;
+    swap->policy = policy;
+    swap->window = SWAP_WSCLOCK_WINDOW;
+    swap->slot_count = slots;
+    swap->slot_used = (uint64_t*)calloc((slots + 63) / 64, sizeof(uint64_t));
+    swap->slot_shares = (uint32_t*)calloc(slots, sizeof(uint32_t));
+    swap->staging = (uint8_t*)aligned_alloc(PAGE_SIZE, SWAP_WRITEBACK_BATCH * PAGE_SIZE);
+    if (!swap->slot_used || !swap->slot_shares || !swap->staging ||
+        (swap->fd = vfs_create_file(vfs, name, (size_t)slots * PAGE_SIZE)) < 0) {
+        free(swap->slot_used);
+        free(swap->slot_shares);
+        free(swap->staging);
+        free(swap);
+        return -1;
     }
-    
-    // Setup new page table entry
-    if (mm->page_table_sizes[pid] < MAX_PAGES) {
-        PageTableEntry* pte = &mm->page_tables[pid][mm->page_table_sizes[pid] - 1];
-        pte->virtual_addr = vpage * PAGE_SIZE;
-        pte->physical_addr = phys_addr;
-        pte->present = true;
-        pte->writable = true;
-        pte->accessed = true;
-        pte->dirty = false;
-        pte->timestamp = 0;
+
+    mm->swap = swap;
+    return 0;
+}
+
+// Write out pages still queued for write-back
+void mm_swap_flush(MemoryManager* mm) {
+    if (mm->swap && mm->swap->queued > 0) flush_writeback(mm);
+}
+
+// Resident 4KB pages of pid referenced in the last window translations, as
+// far as the clock has seen
+uint64_t mm_working_set(MemoryManager* mm, uint32_t pid, uint64_t window) {
+    uint64_t now = mm_now(mm);
+    uint64_t pages = 0;
+    for (uint64_t frame = 1; frame < mm->total_pages; frame++) {
+        if (mm->frame_info[frame].owner != pid + 1) continue;
+        const uint64_t* pte = frame_leaf(mm, (uint32_t)frame);
+        if (pte && ((*pte & PTE_ACCESSED) || now - mm->frame_info[frame].last_use <= window)) pages++;
+    }
+    return pages;
+}
+
+// Share of free frames in blocks too small to back a huge page, the
+// unusable free space index at order 9
+double mm_fragmentation(MemoryManager* mm) {
+    const BuddyAllocator* b = &mm->buddy;
+    uint64_t free_frames = 0;
+    uint64_t small_frames = 0;
+    for (int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        free_frames += b->blocks[order] << order;
+        if (order < PT_INDEX_BITS) small_frames += b->blocks[order] << order;
     }
-    
-    return phys_addr + offset;
+    return free_frames ? (double)small_frames / free_frames : 0.0;
 }
 
 void mm_print_stats(MemoryManager* mm) {
+    uint64_t lookups = mm->tlb_hits + mm->tlb_misses;
+
     printf("\n=== Memory Manager Stats ===\n");
     printf("Total memory: %lu MB\n", mm->mem_size / MiB);
+    printf("Resident memory: %lu KB\n", mm->physical_memory->resident_pages * PAGE_SIZE / KiB);
+    printf("Shared pages: %lu\n", mm->physical_memory->shared_pages);
     printf("Total pages: %lu\n", mm->total_pages);
     printf("Free pages: %lu\n", mm->free_pages);
     printf("Used pages: %lu\n", mm->total_pages - mm->free_pages);
+    printf("Fragmentation: %.1f%%\n", 100.0 * mm_fragmentation(mm));
+    printf("Free blocks by order:");
+    for (int order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        if (mm->buddy.blocks[order]) printf(" %d:%lu", order, mm->buddy.blocks[order]);
+    }
+    printf("\n");
+    printf("Huge pages: %lu\n", mm->huge_pages);
+    printf("Page tables: %lu\n", mm->table_count);
     printf("Page faults: %lu\n", mm->page_faults);
+    printf("Fault rate: %.3f per 1000 translations\n",
+           lookups > 0 ? 1000.0 * mm->page_faults / lookups : 0.0);
+    printf("COW faults: %lu (%lu copied)\n", mm->cow_faults, mm->cow_copies);
+    if (mm->swap) {
+        const SwapArea* swap = mm->swap;
+        printf("Swap policy: %s\n", swap->policy == SWAP_WSCLOCK ? "WSClock" : "CLOCK");
+        printf("Swap slots used: %u / %u\n", swap->slots_used, swap->slot_count);
+        printf("Swap ins: %lu\n", swap->swap_ins);
+        printf("Swap outs: %lu in %lu writes\n", swap->swap_outs, swap->writes);
+        printf("Evictions: %lu (%lu never written)\n", swap->evictions, swap->dropped);
+        printf("Clock scans: %lu\n", swap->scanned);
+    }
+    printf("L1 TLB hits: %lu / %lu\n", mm->l1_tlb.hits, mm->l1_tlb.hits + mm->l1_tlb.misses);
+    printf("L2 TLB hits: %lu / %lu\n", mm->l2_tlb.hits, mm->l2_tlb.hits + mm->l2_tlb.misses);
     printf("TLB hits: %lu\n", mm->tlb_hits);
     printf("TLB misses: %lu\n", mm->tlb_misses);
-    printf("Hit rate: %.2f%%\n", 
-           (mm->tlb_hits + mm->tlb_misses) > 0 ? 
-           (100.0 * mm->tlb_hits / (mm->tlb_hits + mm->tlb_misses)) : 0.0);
-}
\ No newline at end of file
+    printf("Hit rate: %.2f%%\n", lookups > 0 ? (100.0 * mm->tlb_hits / lookups) : 0.0);
+    printf("Levels per walk: %.2f\n",
+           mm->tlb_misses > 0 ? (double)mm->walk_levels / mm->tlb_misses : 0.0);
+}
@@ -23,10 +23,25 @@ PCB* pcb_create(uint32_t pid, void* entry_point) {
     
     memset(pcb->open_files, -1, sizeof(pcb->open_files));
     memset(pcb->message_queues, -1, sizeof(pcb->message_queues));
+    pcb->ring = NULL;
     
     pcb->start_time = 0;
     pcb->cpu_time = 0;
     pcb->wakeups = 0;
+    pcb->migrations = 0;
+    
+    pcb->affinity = ~0ULL;  // Any CPU
+    pcb->cpu = 0;
+    pcb->migration_penalty = 0;
+    
+    pcb->next = NULL;
+    pcb->prev = NULL;
+    pcb->ready_since = 0;
+    pcb->boost_epoch = 0;
+    pcb->queued = false;
+    
+    pcb->wait_token = 0;
+    pcb->wait_queue = -1;
     
     return pcb;
 }
@@ -36,24 +51,167 @@ void pcb_destroy(PCB* pcb) {
         if (pcb->page_table) {
             free(pcb->page_table);
         }
+        free(pcb->ring);
         free(pcb);
     }
 }
 
+// A boost bumps the epoch instead of rewriting every queued PCB, so a
+// priority set in an older epoch means the top level
+int scheduler_priority(const Scheduler* sched, const PCB* pcb) {
+    return pcb->boost_epoch == sched->boost_epoch ? (pcb->priority & (MLFQ_LEVELS - 1)) : 0;
+}
+
+static void set_priority(Scheduler* sched, PCB* pcb, int priority) {
+    pcb->priority = priority;
+    pcb->boost_epoch = sched->boost_epoch;
+}
+
+static uint64_t cpu_mask(const Scheduler* sched) {
+    return sched->cpu_count >= 64 ? ~0ULL : (1ULL << sched->cpu_count) - 1;
+}
+
+// CPUs pcb may use; a mask naming none of them falls back to all
+static uint64_t allowed_cpus(const Scheduler* sched, const PCB* pcb) {
+    uint64_t allowed = pcb->affinity & cpu_mask(sched);
+    return allowed ? allowed : cpu_mask(sched);
+}
+
+static void enqueue(Scheduler* sched, PCB* pcb, int cpu) {
+    int level = scheduler_priority(sched, pcb);
+    set_priority(sched, pcb, level);
+    
+    RunQueue* rq = &sched->cpus[cpu];
+    ReadyQueue* q = &rq->ready_queues[level];
+    pcb->next = NULL;
+    pcb->prev = q->tail;
+    if (q->tail) {
+        q->tail->next = pcb;
+    } else {
+        q->head = pcb;
+    }
+    q->tail = pcb;
+    q->count++;
+    rq->nr_ready++;
+    rq->ready_bitmap |= 1u << level;
+    
+    pcb->cpu = cpu;
+    pcb->queued = true;
+    pcb->ready_since = sched->system_time;
+}
+
+static void unlink_pcb(Scheduler* sched, PCB* pcb, int level) {
+    RunQueue* rq = &sched->cpus[pcb->cpu];
+    ReadyQueue* q = &rq->ready_queues[level];
+    if (pcb->prev) {
+        pcb->prev->next = pcb->next;
+    } else {
+        q->head = pcb->next;
+    }
+    if (pcb->next) {
+        pcb->next->prev = pcb->prev;
+    } else {
+        q->tail = pcb->prev;
+    }
+    pcb->next = NULL;
+    pcb->prev = NULL;
+    pcb->queued = false;
+    rq->nr_ready--;
+    if (--q->count == 0) {
+        rq->ready_bitmap &= ~(1u << level);
+    }
+}
+
+// Least loaded CPU pcb may run on
+static int place(const Scheduler* sched, const PCB* pcb) {
+    uint64_t allowed = allowed_cpus(sched, pcb);
+    int best = __builtin_ctzll(allowed);
+    int best_load = INT32_MAX;
+    for (uint64_t m = allowed; m; m &= m - 1) {
+        int cpu = __builtin_ctzll(m);
+        const RunQueue* rq = &sched->cpus[cpu];
+        int load = rq->nr_ready + (rq->current ? 1 : 0);
+        if (load < best_load) {
+            best = cpu;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+// Move every process to the top level. On each CPU the lower levels are
+// spliced onto level 0 in priority order and the epoch moves on, so the
+// boost costs O(MLFQ_LEVELS) per CPU however many processes are queued.
+static void boost(Scheduler* sched) {
+    for (int cpu = 0; cpu < sched->cpu_count; cpu++) {
+        RunQueue* rq = &sched->cpus[cpu];
+        ReadyQueue* top = &rq->ready_queues[0];
+        for (int level = 1; level < MLFQ_LEVELS; level++) {
+            ReadyQueue* q = &rq->ready_queues[level];
+            if (q->count == 0) continue;
+            
+            if (top->tail) {
+                top->tail->next = q->head;
+                q->head->prev = top->tail;
+            } else {
+                top->head = q->head;
+            }
+            top->tail = q->tail;
+            top->count += q->count;
+            q->head = NULL;
+            q->tail = NULL;
+            q->count = 0;
+        }
+        rq->ready_bitmap = top->count > 0 ? 1 : 0;
+    }
+    sched->boost_epoch++;
+    sched->next_boost = sched->system_time + SCHEDULER_BOOST_TICKS;
+}
+
 void scheduler_init(Scheduler* sched) {
     memset(sched, 0, sizeof(Scheduler));
-    sched->current_process = NULL;
     sched->process_count = 0;
+    sched->cpu_count = 1;
     sched->system_time = 0;
+    sched->next_boost = SCHEDULER_BOOST_TICKS;
     sched->next_pid = 1;
-    
-    for (int i = 0; i < 16; i++) {
-        sched->queue_counts[i] = 0;
+}
+
+// Frees the process list; the PCBs belong to the caller
+void scheduler_destroy(Scheduler* sched) {
+    free(sched->processes);
+    sched->processes = NULL;
+    sched->process_count = 0;
+    sched->process_capacity = 0;
+}
+
+// Room for count processes in the process list
+int scheduler_reserve(Scheduler* sched, int count) {
+    if (count <= sched->process_capacity) return 0;
+    if (count > MAX_PROCESSES) return -1;
+
+    int capacity = sched->process_capacity ? sched->process_capacity : 16;
+    while (capacity < count) capacity *= 2;
+    capacity = MIN(capacity, MAX_PROCESSES);
+    PCB** processes = (PCB**)realloc(sched->processes, capacity * sizeof(PCB*));
+    if (!processes) return -1;
+    sched->processes = processes;
+    sched->process_capacity = capacity;
+    return 0;
+}
+
+// Only before any process has been added
+int scheduler_set_cpus(Scheduler* sched, int cpus) {
+    if (cpus < 1 || cpus > SCHED_MAX_CPUS || sched->process_count > 0) {
+        ERROR("Cannot run the scheduler on %d CPUs\n", cpus);
+        return -1;
     }
+    sched->cpu_count = cpus;
+    return 0;
 }
 
 void scheduler_add_process(Scheduler* sched, PCB* pcb) {
-    if (sched->process_count >= MAX_PROCESSES) {
+    if (scheduler_reserve(sched, sched->process_count + 1) != 0) {
         ERROR("Too many processes\n");
         return;
     }
@@ -61,90 +219,266 @@ void scheduler_add_process(Scheduler* sched, PCB* pcb) {
     sched->processes[sched->process_count++] = pcb;
     
     // Add to appropriate ready queue
-    uint8_t priority = pcb->priority & 0x0F;  // 0-15
-    int idx = sched->queue_counts[priority];
-    if (idx < MAX_PROCESSES) {
-        sched->ready_queues[priority][idx] = pcb;
-        sched->queue_counts[priority]++;
-        pcb->state = PROC_READY;
+    set_priority(sched, pcb, pcb->priority & (MLFQ_LEVELS - 1));
+    enqueue(sched, pcb, place(sched, pcb));
+    pcb->state = PROC_READY;
+}
+
+// Take pcb off the ready queues and the CPU, e.g. when it terminates
+void scheduler_remove_process(Scheduler* sched, PCB* pcb) {
+    if (pcb->queued) {
+        unlink_pcb(sched, pcb, scheduler_priority(sched, pcb));
+    }
+    if (sched->cpus[pcb->cpu].current == pcb) {
+        sched->cpus[pcb->cpu].current = NULL;
     }
 }
 
-PCB* scheduler_next_process(Scheduler* sched) {
-    // MLFQ scheduling: check queues from highest to lowest priority
-    for (int priority = 0; priority < 16; priority++) {
-        if (sched->queue_counts[priority] > 0) {
-            // Get first process from this queue
-            PCB* next = sched->ready_queues[priority][0];
-            
-            // Shift queue
-            for (int i = 1; i < sched->queue_counts[priority]; i++) {
-                sched->ready_queues[priority][i-1] = sched->ready_queues[priority][i];
+// A blocked process becomes ready again, at the priority it blocked with
+void scheduler_wake_process(Scheduler* sched, PCB* pcb) {
+    if (pcb->queued || pcb->state == PROC_TERMINATED) return;
+    
+    pcb->state = PROC_READY;
+    pcb->wakeups++;
+    enqueue(sched, pcb, place(sched, pcb));
+}
+
+// A queued process on a CPU it may no longer use moves now; a running one
+// moves when its quantum ends
+void scheduler_set_affinity(Scheduler* sched, PCB* pcb, uint64_t affinity) {
+    pcb->affinity = affinity;
+    if (pcb->queued && !(allowed_cpus(sched, pcb) & (1ULL << pcb->cpu))) {
+        unlink_pcb(sched, pcb, scheduler_priority(sched, pcb));
+        enqueue(sched, pcb, place(sched, pcb));
+    }
+}
+
+// Work stealing for an idle CPU: take a process from the busiest queue.
+// Its highest level is searched from the tail, which is the process that
+// would otherwise wait longest there, for one whose affinity allows cpu.
+static PCB* steal(Scheduler* sched, int cpu) {
+    int victim = -1;
+    int most = 0;
+    for (int c = 0; c < sched->cpu_count; c++) {
+        if (c != cpu && sched->cpus[c].nr_ready > most) {
+            victim = c;
+            most = sched->cpus[c].nr_ready;
+        }
+    }
+    if (victim < 0) return NULL;
+    
+    RunQueue* rq = &sched->cpus[victim];
+    for (uint16_t levels = rq->ready_bitmap; levels; levels &= levels - 1) {
+        int level = __builtin_ctz(levels);
+        PCB* pcb = rq->ready_queues[level].tail;
+        for (int scanned = 0; pcb && scanned < SCHED_STEAL_SCAN; scanned++, pcb = pcb->prev) {
+            if (allowed_cpus(sched, pcb) & (1ULL << cpu)) {
+                uint64_t ready_since = pcb->ready_since;
+                unlink_pcb(sched, pcb, level);
+                enqueue(sched, pcb, cpu);
+                pcb->ready_since = ready_since;
+                pcb->migrations++;
+                pcb->migration_penalty = SCHEDULER_MIGRATION_TICKS;
+                sched->migrations++;
+                sched->cpus[cpu].steals++;
+                return pcb;
             }
-            sched->queue_counts[priority]--;
-            
-            next->state = PROC_RUNNING;
-            next->quantum_remaining = next->quantum;
-            
-            return next;
         }
     }
+    return NULL;
+}
+
+PCB* scheduler_next_process(Scheduler* sched, int cpu) {
+    RunQueue* rq = &sched->cpus[cpu];
+    if (!rq->ready_bitmap && !steal(sched, cpu)) {
+        return NULL;  // No process ready
+    }
+    
+    // MLFQ scheduling: the lowest set bit is the highest non-empty level
+    int level = __builtin_ctz(rq->ready_bitmap);
+    PCB* next = rq->ready_queues[level].head;
+    unlink_pcb(sched, next, level);
+    set_priority(sched, next, level);
     
-    return NULL;  // No process ready
+    uint64_t waited = sched->system_time - next->ready_since;
+    int bucket = waited ? MIN(64 - __builtin_clzll(waited), SCHED_LATENCY_BUCKETS - 1) : 0;
+    sched->latency_hist[bucket]++;
+    sched->max_latency = MAX(sched->max_latency, waited);
+    rq->dispatches++;
+    
+    next->state = PROC_RUNNING;
+    next->quantum_remaining = next->quantum;
+    
+    return next;
 }
 
-void scheduler_tick(Scheduler* sched) {
-    sched->system_time++;
+static void cpu_tick(Scheduler* sched, int cpu) {
+    RunQueue* rq = &sched->cpus[cpu];
     
-    if (sched->current_process) {
-        PCB* pcb = sched->current_process;
+    if (rq->current) {
+        PCB* pcb = rq->current;
         pcb->cpu_time++;
-        pcb->quantum_remaining--;
+        rq->busy_ticks++;
+        if (pcb->migration_penalty > 0) {
+            pcb->migration_penalty--;
+            rq->migration_ticks++;
+        }
+        if (pcb->quantum_remaining > 0) {
+            pcb->quantum_remaining--;
+        }
         
         if (pcb->quantum_remaining == 0) {
             // Time slice expired
             pcb->state = PROC_READY;
             
             // Lower priority if process used full quantum
-            if (pcb->priority < 15) {
-                pcb->priority++;
+            int priority = scheduler_priority(sched, pcb);
+            if (priority < MLFQ_LEVELS - 1) {
+                priority++;
             }
+            set_priority(sched, pcb, priority);
             
-            // Add back to ready queue
-            uint8_t priority = pcb->priority & 0x0F;
-            int idx = sched->queue_counts[priority];
-            if (idx < MAX_PROCESSES) {
-                sched->ready_queues[priority][idx] = pcb;
-                sched->queue_counts[priority]++;
+            // Add back to ready queue, on this CPU unless its affinity changed
+            int target = cpu;
+            if (!(allowed_cpus(sched, pcb) & (1ULL << cpu))) {
+                target = place(sched, pcb);
             }
+            enqueue(sched, pcb, target);
             
-            sched->current_process = NULL;
+            rq->current = NULL;
         }
+    } else {
+        rq->idle_ticks++;
     }
     
     // If no process running, schedule next one
-    if (!sched->current_process) {
-        sched->current_process = scheduler_next_process(sched);
+    if (!rq->current) {
+        rq->current = scheduler_next_process(sched, cpu);
     }
 }
 
+void scheduler_tick(Scheduler* sched) {
+    sched->system_time++;
+    
+    if (sched->system_time >= sched->next_boost) {
+        boost(sched);
+    }
+    
+    for (int cpu = 0; cpu < sched->cpu_count; cpu++) {
+        cpu_tick(sched, cpu);
+    }
+}
+
+// Ticks until some CPU has a decision to make: a quantum runs out, an idle
+// CPU can take ready work, or a boost is due. UINT64_MAX when every CPU is
+// idle and nothing is ready.
+uint64_t scheduler_next_event(const Scheduler* sched) {
+    uint64_t next = UINT64_MAX;
+    bool idle_cpu = false;
+    int ready = 0;
+    for (int cpu = 0; cpu < sched->cpu_count; cpu++) {
+        const RunQueue* rq = &sched->cpus[cpu];
+        ready += rq->nr_ready;
+        if (rq->current) {
+            next = MIN(next, MAX(rq->current->quantum_remaining, 1));
+        } else {
+            idle_cpu = true;
+        }
+    }
+    
+    if (next == UINT64_MAX && ready == 0) return UINT64_MAX;
+    if (idle_cpu && ready > 0) return 1;
+    uint64_t boost_in = sched->next_boost > sched->system_time ? sched->next_boost - sched->system_time : 1;
+    return MIN(next, boost_in);
+}
+
+// Account ticks on which scheduler_next_event says nothing happens, as
+// cpu_tick would one at a time
+static void run_quiet(Scheduler* sched, uint64_t ticks) {
+    if (ticks == 0) return;
+    
+    sched->system_time += ticks;
+    sched->skipped_ticks += ticks;
+    
+    // Only reached when idle: with nothing queued a boost just moves the
+    // epoch on
+    if (sched->system_time >= sched->next_boost) {
+        uint64_t boosts = (sched->system_time - sched->next_boost) / SCHEDULER_BOOST_TICKS + 1;
+        sched->boost_epoch += boosts;
+        sched->next_boost += boosts * SCHEDULER_BOOST_TICKS;
+    }
+    
+    for (int cpu = 0; cpu < sched->cpu_count; cpu++) {
+        RunQueue* rq = &sched->cpus[cpu];
+        PCB* pcb = rq->current;
+        if (!pcb) {
+            rq->idle_ticks += ticks;
+            continue;
+        }
+        
+        uint64_t cold = MIN(pcb->migration_penalty, ticks);
+        pcb->migration_penalty -= cold;
+        rq->migration_ticks += cold;
+        pcb->cpu_time += ticks;
+        rq->busy_ticks += ticks;
+        pcb->quantum_remaining -= ticks;
+    }
+}
+
+// Same as ticks calls to scheduler_tick, but stretches where no CPU has a
+// decision to make cost one step however long they are
+void scheduler_advance(Scheduler* sched, uint64_t ticks) {
+    while (ticks > 0) {
+        uint64_t step = MIN(ticks, scheduler_next_event(sched));
+        run_quiet(sched, step - 1);
+        scheduler_tick(sched);
+        ticks -= step;
+    }
+}
+
+// Bound, in ticks, on how long the given fraction of dispatches
+// waited in a ready queue
+uint64_t scheduler_latency_percentile(const Scheduler* sched, double fraction) {
+    uint64_t total = 0;
+    for (int i = 0; i < SCHED_LATENCY_BUCKETS; i++) {
+        total += sched->latency_hist[i];
+    }
+    
+    uint64_t target = (uint64_t)ceil(fraction * total);
+    uint64_t seen = 0;
+    for (int i = 0; i < SCHED_LATENCY_BUCKETS; i++) {
+        seen += sched->latency_hist[i];
+        if (seen >= target && seen > 0) {
+            return MIN((1ULL << i) - 1, sched->max_latency);
+        }
+    }
+    return sched->max_latency;
+}
+
 void scheduler_print(Scheduler* sched) {
     printf("\n=== Scheduler Status ===\n");
     printf("System time: %lu\n", sched->system_time);
     printf("Total processes: %d\n", sched->process_count);
-    printf("Current process: %s\n", 
-           sched->current_process ? "Yes" : "No");
+    printf("CPUs: %d\n", sched->cpu_count);
     
-    if (sched->current_process) {
-        printf("  PID: %u, State: RUNNING, Priority: %d\n",
-               sched->current_process->pid,
-               sched->current_process->priority);
+    for (int cpu = 0; cpu < sched->cpu_count; cpu++) {
+        RunQueue* rq = &sched->cpus[cpu];
+        if (rq->current) {
+            printf("  CPU %d: PID %u RUNNING, Priority %d, %d ready\n", cpu,
+                   rq->current->pid, scheduler_priority(sched, rq->current), rq->nr_ready);
+        } else {
+            printf("  CPU %d: idle, %d ready\n", cpu, rq->nr_ready);
+        }
     }
     
     printf("\nReady queues:\n");
-    for (int i = 0; i < 16; i++) {
-        if (sched->queue_counts[i] > 0) {
-            printf("  Priority %d: %d processes\n", i, sched->queue_counts[i]);
+    for (int i = 0; i < MLFQ_LEVELS; i++) {
+        int count = 0;
+        for (int cpu = 0; cpu < sched->cpu_count; cpu++) {
+            count += sched->cpus[cpu].ready_queues[i].count;
+        }
+        if (count > 0) {
+            printf("  Priority %d: %d processes\n", i, count);
         }
     }
     
@@ -159,7 +493,31 @@ void scheduler_print(Scheduler* sched) {
             case PROC_BLOCKED: state_str = "BLOCKED"; break;
             case PROC_TERMINATED: state_str = "TERMINATED"; break;
         }
-        printf("  PID %u: %s, Priority %d, CPU time %lu\n",
-               p->pid, state_str, p->priority, p->cpu_time);
+        printf("  PID %u: %s, Priority %d, CPU %d, CPU time %lu\n",
+               p->pid, state_str, scheduler_priority(sched, p), p->cpu, p->cpu_time);
+    }
+}
+
+void scheduler_print_stats(Scheduler* sched) {
+    uint64_t busy = 0, cold = 0, steals = 0, dispatches = 0;
+    for (int cpu = 0; cpu < sched->cpu_count; cpu++) {
+        busy += sched->cpus[cpu].busy_ticks;
+        cold += sched->cpus[cpu].migration_ticks;
+        steals += sched->cpus[cpu].steals;
+        dispatches += sched->cpus[cpu].dispatches;
     }
-}
\ No newline at end of file
+    uint64_t capacity = sched->system_time * sched->cpu_count;
+    
+    printf("\n=== Scheduler Stats ===\n");
+    printf("CPUs: %d\n", sched->cpu_count);
+    printf("Ticks: %lu (%lu skipped as quiet)\n", sched->system_time, sched->skipped_ticks);
+    printf("Utilization: %.1f%%\n", capacity ? 100.0 * busy / capacity : 0.0);
+    printf("Useful work: %lu ticks (%.2f per tick)\n", busy - cold,
+           sched->system_time ? (double)(busy - cold) / sched->system_time : 0.0);
+    printf("Dispatches: %lu\n", dispatches);
+    printf("Steals: %lu\n", steals);
+    printf("Migrations: %lu (%lu cold-cache ticks)\n", sched->migrations, cold);
+    printf("Ready latency p50/p99/max: %lu/%lu/%lu ticks\n",
+           scheduler_latency_percentile(sched, 0.50),
+           scheduler_latency_percentile(sched, 0.99), sched->max_latency);
+}
@@ -0,0 +1,768 @@
+#include "kernel.h"
+#include "snapshot.h"
+
+// Memory manager state outside its per-frame arrays and per-PID tables
+typedef struct {
+    uint64_t mem_size;
+    uint64_t table_count;
+    uint64_t free_pages;
+    uint64_t total_pages;
+    BuddyAllocator buddy;
+    Tlb l1_tlb;
+    Tlb l2_tlb;
+    uint64_t page_faults;
+    uint64_t cow_faults;
+    uint64_t cow_copies;
+    uint64_t tlb_hits;
+    uint64_t tlb_misses;
+    uint64_t walk_levels;
+    uint64_t huge_pages;
+    uint32_t spaces;            // SpaceRecords that follow
+    bool swap;
+} MMRecord;
+
+// A PID with a page table, a heap or cached frames
+typedef struct {
+    uint32_t pid;
+    bool has_table;
+    uint64_t heap_pages;
+    FrameCache cache;
+} SpaceRecord;
+
+// A physical frame backed by a file chunk, through vfs_mmap
+typedef struct {
+    uint64_t addr;
+    uint32_t file;
+    uint64_t chunk;
+} ChunkLink;
+
+typedef struct {
+    int process_count;
+    int cpu_count;
+    uint32_t boost_epoch;
+    uint64_t next_boost;
+    uint64_t system_time;
+    uint64_t skipped_ticks;
+    uint64_t next_pid;
+    uint64_t migrations;
+    uint64_t latency_hist[SCHED_LATENCY_BUCKETS];
+    uint64_t max_latency;
+} SchedulerRecord;
+
+// ---- PCB references: PID + 1, 0 for NULL ----
+
+static void save_pcb(void* field) {
+    PCB* pcb;
+    memcpy(&pcb, field, sizeof(pcb));
+    uint64_t ref = pcb ? (uint64_t)pcb->pid + 1 : 0;
+    memcpy(field, &ref, sizeof(ref));
+}
+
+static bool load_pcb(void* field, PCB* const* by_pid) {
+    uint64_t ref;
+    memcpy(&ref, field, sizeof(ref));
+    PCB* pcb = NULL;
+    if (ref > MAX_PROCESSES || (ref > 0 && !(pcb = by_pid[ref - 1]))) return false;
+    memcpy(field, &pcb, sizeof(pcb));
+    return true;
+}
+
+// ---- VFS ----
+
+static void write_vfs(SnapshotWriter* writer, const VFS* vfs) {
+    VFS image = *vfs;
+    image.files = NULL;
+    image.index = NULL;
+    image.fds = NULL;
+    snapshot_write(writer, &image, sizeof(image));
+    snapshot_write(writer, vfs->index, (vfs->index_mask + 1) * sizeof(int));
+    snapshot_write(writer, vfs->fds, vfs->fd_count * sizeof(VFileHandle));
+
+    // Per file: its image, the indices of its written chunks, the chunks
+    for (int f = 0; f < vfs->file_count; f++) {
+        const VFile* file = vfs->files[f];
+        VFile info = *file;
+        info.chunks = NULL;
+        info.extents = NULL;
+        info.extent_count = 0;
+        info.extent_slots = 0;
+        info.spare = NULL;
+        info.spare_chunks = 0;
+        snapshot_write(writer, &info, sizeof(info));
+        for (uint64_t c = 0; c < file->chunk_slots; c++) {
+            if (file->chunks[c]) snapshot_write(writer, &c, sizeof(c));
+        }
+        snapshot_align(writer);
+        for (uint64_t c = 0; c < file->chunk_slots; c++) {
+            if (file->chunks[c]) snapshot_write(writer, file->chunks[c], VFS_CHUNK_SIZE);
+        }
+    }
+}
+
+// Chunks are copied into one extent per file, since the VFS frees what
+// they live in
+static VFile* read_file(SnapshotCursor* cursor) {
+    VFile image;
+    if (!snapshot_read(cursor, &image, sizeof(image)) || image.chunk_count > image.chunk_slots ||
+        image.chunk_count > (cursor->end - cursor->offset) / sizeof(uint64_t)) {
+        return NULL;
+    }
+
+    VFile* file = (VFile*)calloc(1, sizeof(VFile));
+    uint64_t* at = (uint64_t*)malloc(MAX(image.chunk_count, 1) * sizeof(uint64_t));
+    if (!file || !at) {
+        free(file);
+        free(at);
+        return NULL;
+    }
+    *file = image;
+    file->chunk_count = 0;
+
+    bool ok = snapshot_read(cursor, at, image.chunk_count * sizeof(uint64_t));
+    const uint8_t* data = ok ? snapshot_pages(cursor, image.chunk_count * VFS_CHUNK_SIZE) : NULL;
+    if (data && image.chunk_slots > 0) {
+        file->chunks = (uint8_t**)calloc(image.chunk_slots, sizeof(uint8_t*));
+        ok = file->chunks != NULL;
+    }
+    if (data && ok && image.chunk_count > 0) {
+        file->extents = (uint8_t**)malloc(sizeof(uint8_t*));
+        uint8_t* extent = (uint8_t*)aligned_alloc(PAGE_SIZE, image.chunk_count * VFS_CHUNK_SIZE);
+        ok = file->extents && extent;
+        if (ok) {
+            file->extents[0] = extent;
+            file->extent_count = 1;
+            file->extent_slots = 1;
+            memcpy(extent, data, image.chunk_count * VFS_CHUNK_SIZE);
+        } else {
+            free(extent);
+        }
+        for (uint64_t i = 0; ok && i < image.chunk_count; i++) {
+            ok = at[i] < image.chunk_slots && !file->chunks[at[i]];
+            if (ok) file->chunks[at[i]] = extent + i * VFS_CHUNK_SIZE;
+        }
+    }
+    free(at);
+
+    if (!data || !ok) {
+        if (file->extent_count > 0) free(file->extents[0]);
+        free(file->extents);
+        free(file->chunks);
+        free(file);
+        return NULL;
+    }
+    file->chunk_count = image.chunk_count;
+    return file;
+}
+
+static VFS* read_vfs(SnapshotCursor* cursor) {
+    VFS image;
+    if (!snapshot_read(cursor, &image, sizeof(image)) || image.file_slots < 1 ||
+        image.file_count < 0 || image.file_count > image.file_slots || image.fd_slots < 1 ||
+        image.fd_count < 0 || image.fd_count > image.fd_slots) {
+        return NULL;
+    }
+
+    VFS* vfs = (VFS*)malloc(sizeof(VFS));
+    if (!vfs) return NULL;
+    *vfs = image;
+    vfs->file_count = 0;
+    vfs->index = (int*)malloc(((size_t)image.index_mask + 1) * sizeof(int));
+    vfs->files = (VFile**)malloc(image.file_slots * sizeof(VFile*));
+    vfs->fds = (VFileHandle*)malloc(image.fd_slots * sizeof(VFileHandle));
+    bool ok = vfs->index && vfs->files && vfs->fds &&
+              snapshot_read(cursor, vfs->index, ((size_t)image.index_mask + 1) * sizeof(int)) &&
+              snapshot_read(cursor, vfs->fds, image.fd_count * sizeof(VFileHandle));
+    while (ok && vfs->file_count < image.file_count) {
+        VFile* file = read_file(cursor);
+        ok = file != NULL;
+        if (ok) vfs->files[vfs->file_count++] = file;
+    }
+
+    if (!ok) {
+        vfs_destroy(vfs);
+        return NULL;
+    }
+    return vfs;
+}
+
+// ---- Memory manager ----
+
+// Preorder: the table with its child pointers cleared, then each child
+static void write_tables(SnapshotWriter* writer, const PageTable* table, int level) {
+    PageTable image = *table;
+    for (uint32_t i = 0; level > 0 && i < PT_ENTRIES; i++) {
+        if ((image.entries[i] & PTE_PRESENT) && !(image.entries[i] & PTE_HUGE)) {
+            image.entries[i] &= ~PTE_ADDR_MASK;
+        }
+    }
+    snapshot_write(writer, &image, sizeof(image));
+
+    for (uint32_t i = 0; level > 0 && i < PT_ENTRIES; i++) {
+        uint64_t pte = table->entries[i];
+        if ((pte & PTE_PRESENT) && !(pte & PTE_HUGE)) {
+            write_tables(writer, (const PageTable*)(uintptr_t)(pte & PTE_ADDR_MASK), level - 1);
+        }
+    }
+}
+
+// Frees what it built on failure
+static PageTable* read_tables(SnapshotCursor* cursor, int level) {
+    PageTable* table = (PageTable*)aligned_alloc(PAGE_SIZE, sizeof(PageTable));
+    if (!table) return NULL;
+    if (!snapshot_read(cursor, table, sizeof(PageTable))) {
+        free(table);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; level > 0 && i < PT_ENTRIES; i++) {
+        uint64_t* pte = &table->entries[i];
+        if (!(*pte & PTE_PRESENT) || (*pte & PTE_HUGE)) continue;
+
+        PageTable* child = read_tables(cursor, level - 1);
+        if (!child) {
+            // Children already linked go with the table
+            *pte = 0;
+            for (uint32_t j = 0; j < i; j++) {
+                uint64_t done = table->entries[j];
+                if ((done & PTE_PRESENT) && !(done & PTE_HUGE)) {
+                    table->entries[j] = 0;
+                    free((PageTable*)(uintptr_t)(done & PTE_ADDR_MASK));
+                }
+            }
+            free(table);
+            return NULL;
+        }
+        *pte |= (uint64_t)(uintptr_t)child;
+    }
+    return table;
+}
+
+static int cmp_link(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t)((const ChunkLink*)a)->addr;
+    uintptr_t y = (uintptr_t)((const ChunkLink*)b)->addr;
+    return (x > y) - (x < y);
+}
+
+// Physical frames lent to the memory manager by vfs_mmap, found by looking
+// each shared page up among the file chunks. Other host pages mapped with
+// mm_map_host_pages come back as private copies.
+static ChunkLink* chunk_links(const MemoryManager* mm, const VFS* vfs, uint64_t* count) {
+    *count = 0;
+    const GuestMemory* pm = mm->physical_memory;
+    if (pm->shared_pages == 0) return (ChunkLink*)malloc(sizeof(ChunkLink));
+
+    // Chunks sorted by address, with addr holding their host pointer
+    uint64_t chunks = 0;
+    for (int f = 0; f < vfs->file_count; f++) {
+        chunks += vfs->files[f]->chunk_count;
+    }
+    ChunkLink* by_ptr = (ChunkLink*)malloc(MAX(chunks, 1) * sizeof(ChunkLink));
+    ChunkLink* links = (ChunkLink*)malloc(pm->shared_pages * sizeof(ChunkLink));
+    if (!by_ptr || !links) {
+        free(by_ptr);
+        free(links);
+        return NULL;
+    }
+    uint64_t n = 0;
+    for (int f = 0; f < vfs->file_count; f++) {
+        const VFile* file = vfs->files[f];
+        for (uint64_t c = 0; c < file->chunk_slots; c++) {
+            if (!file->chunks[c]) continue;
+            by_ptr[n++] = (ChunkLink){ .addr = (uintptr_t)file->chunks[c], .file = (uint32_t)f, .chunk = c };
+        }
+    }
+    qsort(by_ptr, n, sizeof(ChunkLink), cmp_link);
+
+    for (uint64_t t = 0; t < pm->table_count; t++) {
+        if (!pm->shared[t]) continue;
+        for (uint32_t p = 0; p < GMEM_TABLE_PAGES; p++) {
+            if (!(pm->shared[t][p / 64] & (1ULL << (p % 64)))) continue;
+            ChunkLink key = { .addr = (uintptr_t)pm->tables[t][p] };
+            const ChunkLink* hit = (const ChunkLink*)bsearch(&key, by_ptr, n, sizeof(ChunkLink), cmp_link);
+            if (hit) {
+                links[*count] = *hit;
+                links[*count].addr = ((t << GMEM_TABLE_BITS) + p) * PAGE_SIZE;
+                (*count)++;
+            }
+        }
+    }
+    free(by_ptr);
+    return links;
+}
+
+static int write_mm(SnapshotWriter* writer, const MemoryManager* mm, const VFS* vfs) {
+    if (mm->swap && mm->swap->vfs != vfs) {
+        ERROR("Swap lives outside the kernel's filesystem; cannot snapshot it\n");
+        return -1;
+    }
+    uint64_t link_count;
+    ChunkLink* links = chunk_links(mm, vfs, &link_count);
+    if (!links) return -1;
+
+    MMRecord record = {
+        .mem_size = mm->mem_size,
+        .table_count = mm->table_count,
+        .free_pages = mm->free_pages,
+        .total_pages = mm->total_pages,
+        .buddy = mm->buddy,
+        .l1_tlb = mm->l1_tlb,
+        .l2_tlb = mm->l2_tlb,
+        .page_faults = mm->page_faults,
+        .cow_faults = mm->cow_faults,
+        .cow_copies = mm->cow_copies,
+        .tlb_hits = mm->tlb_hits,
+        .tlb_misses = mm->tlb_misses,
+        .walk_levels = mm->walk_levels,
+        .huge_pages = mm->huge_pages,
+        .swap = mm->swap != NULL,
+    };
+    record.buddy.next = NULL;
+    record.buddy.prev = NULL;
+    record.buddy.free_order = NULL;
+    record.l1_tlb.entries = NULL;
+    record.l2_tlb.entries = NULL;
+    record.spaces = mm->live_count;
+    snapshot_write(writer, &record, sizeof(record));
+
+    // Per-frame arrays are as long as mm_create made them
+    uint64_t frames = MAX(mm->total_pages, 1);
+    snapshot_write(writer, mm->buddy.next, frames * sizeof(uint32_t));
+    snapshot_write(writer, mm->buddy.prev, frames * sizeof(uint32_t));
+    snapshot_write(writer, mm->buddy.free_order, frames * sizeof(uint8_t));
+    snapshot_write(writer, mm->frame_shares, frames * sizeof(uint32_t));
+    snapshot_write(writer, mm->frame_info, frames * sizeof(FrameInfo));
+    snapshot_write(writer, mm->l1_tlb.entries, mm->l1_tlb.sets * mm->l1_tlb.ways * sizeof(TlbEntry));
+    snapshot_write(writer, mm->l2_tlb.entries, mm->l2_tlb.sets * mm->l2_tlb.ways * sizeof(TlbEntry));
+
+    for (uint32_t i = 0; i < mm->live_count; i++) {
+        const AddressSpace* live = mm->live[i];
+        SpaceRecord space = {
+            .pid = live->pid,
+            .has_table = live->root != NULL,
+            .heap_pages = live->heap_pages,
+            .cache = live->cache,
+        };
+        snapshot_write(writer, &space, sizeof(space));
+        if (space.has_table) write_tables(writer, live->root, PT_LEVELS - 1);
+    }
+
+    if (mm->swap) {
+        const SwapArea* swap = mm->swap;
+        SwapArea image = *swap;
+        image.vfs = NULL;
+        image.slot_used = NULL;
+        image.slot_shares = NULL;
+        image.staging = NULL;
+        snapshot_write(writer, &image, sizeof(image));
+        snapshot_write(writer, swap->slot_used, (swap->slot_count + 63) / 64 * sizeof(uint64_t));
+        snapshot_write(writer, swap->slot_shares, swap->slot_count * sizeof(uint32_t));
+    }
+
+    snapshot_write(writer, &link_count, sizeof(link_count));
+    snapshot_write(writer, links, link_count * sizeof(ChunkLink));
+    free(links);
+    snapshot_write_memory(writer, mm->physical_memory);
+    return 0;
+}
+
+static bool read_swap(SnapshotCursor* cursor, MemoryManager* mm, VFS* vfs) {
+    SwapArea image;
+    if (!snapshot_read(cursor, &image, sizeof(image)) || image.slot_count == 0) return false;
+
+    SwapArea* swap = (SwapArea*)calloc(1, sizeof(SwapArea));
+    if (!swap) return false;
+    *swap = image;
+    swap->vfs = vfs;
+    swap->slot_used = (uint64_t*)malloc((image.slot_count + 63) / 64 * sizeof(uint64_t));
+    swap->slot_shares = (uint32_t*)malloc(image.slot_count * sizeof(uint32_t));
+    swap->staging = (uint8_t*)aligned_alloc(PAGE_SIZE, SWAP_WRITEBACK_BATCH * PAGE_SIZE);
+    mm->swap = swap;    // mm_destroy frees it from here on
+    return swap->slot_used && swap->slot_shares && swap->staging &&
+           snapshot_read(cursor, swap->slot_used, (image.slot_count + 63) / 64 * sizeof(uint64_t)) &&
+           snapshot_read(cursor, swap->slot_shares, image.slot_count * sizeof(uint32_t));
+}
+
+// Into the memory manager kernel_create made for the same mem_size
+static bool read_mm(SnapshotCursor* cursor, MemoryManager* mm, VFS* vfs) {
+    MMRecord record;
+    if (!snapshot_read(cursor, &record, sizeof(record)) || record.mem_size != mm->mem_size ||
+        record.l1_tlb.sets != mm->l1_tlb.sets || record.l1_tlb.ways != mm->l1_tlb.ways ||
+        record.l2_tlb.sets != mm->l2_tlb.sets || record.l2_tlb.ways != mm->l2_tlb.ways) {
+        return false;
+    }
+
+    uint64_t frames = MAX(mm->total_pages, 1);
+    BuddyAllocator* b = &mm->buddy;
+    if (!snapshot_read(cursor, b->next, frames * sizeof(uint32_t)) ||
+        !snapshot_read(cursor, b->prev, frames * sizeof(uint32_t)) ||
+        !snapshot_read(cursor, b->free_order, frames * sizeof(uint8_t)) ||
+        !snapshot_read(cursor, mm->frame_shares, frames * sizeof(uint32_t)) ||
+        !snapshot_read(cursor, mm->frame_info, frames * sizeof(FrameInfo)) ||
+        !snapshot_read(cursor, mm->l1_tlb.entries, mm->l1_tlb.sets * mm->l1_tlb.ways * sizeof(TlbEntry)) ||
+        !snapshot_read(cursor, mm->l2_tlb.entries, mm->l2_tlb.sets * mm->l2_tlb.ways * sizeof(TlbEntry))) {
+        return false;
+    }
+    memcpy(b->heads, record.buddy.heads, sizeof(b->heads));
+    memcpy(b->blocks, record.buddy.blocks, sizeof(b->blocks));
+    b->nonempty = record.buddy.nonempty;
+    record.l1_tlb.entries = mm->l1_tlb.entries;
+    record.l2_tlb.entries = mm->l2_tlb.entries;
+    mm->l1_tlb = record.l1_tlb;
+    mm->l2_tlb = record.l2_tlb;
+    mm->free_pages = record.free_pages;
+    mm->page_faults = record.page_faults;
+    mm->cow_faults = record.cow_faults;
+    mm->cow_copies = record.cow_copies;
+    mm->tlb_hits = record.tlb_hits;
+    mm->tlb_misses = record.tlb_misses;
+    mm->walk_levels = record.walk_levels;
+    mm->huge_pages = record.huge_pages;
+
+    for (uint32_t i = 0; i < record.spaces; i++) {
+        SpaceRecord space;
+        if (!snapshot_read(cursor, &space, sizeof(space)) || mm_space(mm, space.pid, false)) {
+            return false;
+        }
+        AddressSpace* live = mm_space(mm, space.pid, true);
+        if (!live) return false;
+        if (space.has_table) {
+            live->root = read_tables(cursor, PT_LEVELS - 1);
+            if (!live->root) return false;
+        }
+        live->heap_pages = space.heap_pages;
+        live->cache = space.cache;
+        mm->cached_frames += space.cache.count;
+    }
+    mm->table_count = record.table_count;
+
+    if (record.swap && !read_swap(cursor, mm, vfs)) return false;
+
+    uint64_t link_count;
+    if (!snapshot_read(cursor, &link_count, sizeof(link_count)) ||
+        link_count > (cursor->end - cursor->offset) / sizeof(ChunkLink)) {
+        return false;
+    }
+    ChunkLink* links = (ChunkLink*)malloc(MAX(link_count, 1) * sizeof(ChunkLink));
+    if (!links || !snapshot_read(cursor, links, link_count * sizeof(ChunkLink))) {
+        free(links);
+        return false;
+    }
+
+    GuestMemory* pm = snapshot_read_memory(cursor);
+    bool ok = pm != NULL;
+    if (ok) {
+        gmem_destroy(mm->physical_memory);
+        mm->physical_memory = pm;
+    }
+    for (uint64_t i = 0; ok && i < link_count; i++) {
+        const ChunkLink* link = &links[i];
+        ok = link->file < (uint32_t)vfs->file_count && link->chunk < vfs->files[link->file]->chunk_slots &&
+             vfs->files[link->file]->chunks[link->chunk] &&
+             gmem_share(pm, link->addr, vfs->files[link->file]->chunks[link->chunk]) == 0;
+    }
+    free(links);
+    return ok;
+}
+
+// ---- Scheduler and processes ----
+
+static void write_pcb(SnapshotWriter* writer, const PCB* pcb) {
+    PCB image = *pcb;
+    image.page_table = NULL;
+    save_pcb(&image.next);
+    save_pcb(&image.prev);
+    snapshot_save_pointer(&image.ring, pcb, sizeof(PCB));
+    snapshot_write(writer, &image, sizeof(image));
+
+    if (pcb->ring) {
+        const SyscallRing* ring = pcb->ring;
+        SyscallRing header = *ring;
+        header.sq = NULL;
+        header.cq = NULL;
+        snapshot_write(writer, &header, sizeof(header));
+        snapshot_write(writer, ring->sq, (ring->mask + 1) * sizeof(SyscallEntry));
+        snapshot_write(writer, ring->cq, (ring->mask + 1) * sizeof(SyscallCompletion));
+    }
+}
+
+// Links stay encoded until every PCB exists
+static PCB* read_pcb(SnapshotCursor* cursor) {
+    PCB* pcb = (PCB*)malloc(sizeof(PCB));
+    if (!pcb) return NULL;
+    if (!snapshot_read(cursor, pcb, sizeof(PCB)) || pcb->pid >= MAX_PROCESSES) {
+        free(pcb);
+        return NULL;
+    }
+    bool has_ring = pcb->ring != NULL;
+    pcb->ring = NULL;
+    if (!has_ring) return pcb;
+
+    SyscallRing header;
+    bool ok = snapshot_read(cursor, &header, sizeof(header)) &&
+              syscall_ring_setup(pcb, header.mask + 1) == 0 && pcb->ring->mask == header.mask;
+    if (ok) {
+        header.sq = pcb->ring->sq;
+        header.cq = pcb->ring->cq;
+        *pcb->ring = header;
+        ok = snapshot_read(cursor, header.sq, (header.mask + 1) * sizeof(SyscallEntry)) &&
+             snapshot_read(cursor, header.cq, (header.mask + 1) * sizeof(SyscallCompletion));
+    }
+    if (!ok) {
+        pcb_destroy(pcb);
+        return NULL;
+    }
+    return pcb;
+}
+
+static void write_scheduler(SnapshotWriter* writer, const Scheduler* sched) {
+    SchedulerRecord record = {
+        .process_count = sched->process_count,
+        .cpu_count = sched->cpu_count,
+        .boost_epoch = sched->boost_epoch,
+        .next_boost = sched->next_boost,
+        .system_time = sched->system_time,
+        .skipped_ticks = sched->skipped_ticks,
+        .next_pid = sched->next_pid,
+        .migrations = sched->migrations,
+        .max_latency = sched->max_latency,
+    };
+    memcpy(record.latency_hist, sched->latency_hist, sizeof(record.latency_hist));
+    snapshot_write(writer, &record, sizeof(record));
+
+    for (int i = 0; i < sched->process_count; i++) {
+        write_pcb(writer, sched->processes[i]);
+    }
+    for (int c = 0; c < sched->cpu_count; c++) {
+        RunQueue rq = sched->cpus[c];
+        save_pcb(&rq.current);
+        for (int level = 0; level < MLFQ_LEVELS; level++) {
+            save_pcb(&rq.ready_queues[level].head);
+            save_pcb(&rq.ready_queues[level].tail);
+        }
+        snapshot_write(writer, &rq, sizeof(rq));
+    }
+}
+
+// PCBs land in processes[] as they are read, so kernel_destroy frees them
+// on failure; by_pid is filled for the references that follow
+static bool read_scheduler(SnapshotCursor* cursor, Scheduler* sched, PCB** by_pid) {
+    SchedulerRecord record;
+    if (!snapshot_read(cursor, &record, sizeof(record)) || record.process_count < 0 ||
+        record.process_count > MAX_PROCESSES || record.cpu_count < 1 ||
+        record.cpu_count > SCHED_MAX_CPUS) {
+        return false;
+    }
+    sched->cpu_count = record.cpu_count;
+    sched->boost_epoch = record.boost_epoch;
+    sched->next_boost = record.next_boost;
+    sched->system_time = record.system_time;
+    sched->skipped_ticks = record.skipped_ticks;
+    sched->next_pid = record.next_pid;
+    sched->migrations = record.migrations;
+    sched->max_latency = record.max_latency;
+    memcpy(sched->latency_hist, record.latency_hist, sizeof(sched->latency_hist));
+
+    if (scheduler_reserve(sched, record.process_count) != 0) return false;
+    while (sched->process_count < record.process_count) {
+        PCB* pcb = read_pcb(cursor);
+        if (!pcb) return false;
+        sched->processes[sched->process_count++] = pcb;
+        if (by_pid[pcb->pid]) return false;
+        by_pid[pcb->pid] = pcb;
+    }
+    for (int i = 0; i < sched->process_count; i++) {
+        PCB* pcb = sched->processes[i];
+        if (!load_pcb(&pcb->next, by_pid) || !load_pcb(&pcb->prev, by_pid)) return false;
+    }
+
+    for (int c = 0; c < sched->cpu_count; c++) {
+        RunQueue* rq = &sched->cpus[c];
+        if (!snapshot_read(cursor, rq, sizeof(RunQueue))) {
+            memset(rq, 0, sizeof(RunQueue));
+            return false;
+        }
+        bool ok = load_pcb(&rq->current, by_pid);
+        for (int level = 0; level < MLFQ_LEVELS; level++) {
+            ok = load_pcb(&rq->ready_queues[level].head, by_pid) &&
+                 load_pcb(&rq->ready_queues[level].tail, by_pid) && ok;
+        }
+        if (!ok) {
+            memset(rq, 0, sizeof(RunQueue));
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---- Message queues ----
+
+static void write_queue(SnapshotWriter* writer, const MessageQueue* mq) {
+    MessageQueue image = *mq;
+    image.messages = NULL;
+    image.seqs = NULL;
+    snapshot_write(writer, &image, sizeof(image));
+    snapshot_write(writer, mq->messages, (mq->mask + 1) * sizeof(Message));
+    if (mq->seqs) snapshot_write(writer, mq->seqs, (mq->mask + 1) * sizeof(uint64_t));
+
+    // Granted payloads of the queued messages
+    for (uint64_t i = mq->head; i != mq->tail; i++) {
+        const Message* msg = &mq->messages[i & mq->mask];
+        if (msg->flags & MSG_GRANT) snapshot_write(writer, msg->data, msg->size);
+    }
+}
+
+static MessageQueue* read_queue(SnapshotCursor* cursor) {
+    MessageQueue image;
+    if (!snapshot_read(cursor, &image, sizeof(image)) || image.mask >= INT32_MAX ||
+        image.tail - image.head > image.mask + 1) {
+        return NULL;
+    }
+
+    MessageQueue* mq = mq_create((int)(image.mask + 1), image.mode);
+    if (!mq) return NULL;
+    Message* messages = mq->messages;
+    uint64_t* seqs = mq->seqs;
+    bool ok = snapshot_read(cursor, messages, (image.mask + 1) * sizeof(Message)) &&
+              (!seqs || snapshot_read(cursor, seqs, (image.mask + 1) * sizeof(uint64_t)));
+
+    // Granted buffers are the receiver's to free, so each gets its own
+    for (uint64_t i = image.head; ok && i != image.tail; i++) {
+        Message* msg = &messages[i & image.mask];
+        if (!(msg->flags & MSG_GRANT)) continue;
+        void* data = malloc(MAX(msg->size, 1));
+        ok = data && snapshot_read(cursor, data, msg->size);
+        msg->data = data;
+        if (!ok) {
+            free(data);
+            image.tail = i;     // only the payloads read so far are owned
+        }
+    }
+
+    image.messages = messages;
+    image.seqs = seqs;
+    *mq = image;
+    if (!ok) {
+        mq_destroy(mq);
+        return NULL;
+    }
+    return mq;
+}
+
+// ---- Kernel ----
+
+// The whole kernel: scheduler and PCBs, page tables and frames, files,
+// message queues and pending events, with physical memory page-aligned.
+// Nothing may run in the kernel meanwhile. Timer handlers are saved as
+// code offsets and their args as they are, unless they point into the
+// Microkernel struct.
+int kernel_snapshot(SnapshotWriter* writer, const Microkernel* kernel) {
+    Microkernel image = *kernel;
+    image.scheduler = NULL;
+    image.mm = NULL;
+    image.filesystem = NULL;
+    image.events.heap = NULL;
+    for (int q = 0; q < MAX_QUEUES; q++) {
+        save_pcb(&image.queue_waiters[q]);
+        snapshot_save_pointer(&image.queues[q], kernel, sizeof(Microkernel));
+    }
+
+    snapshot_begin(writer, SNAP_KERNEL);
+    uint64_t mem_size = kernel->mm->mem_size;
+    snapshot_write(writer, &mem_size, sizeof(mem_size));
+    snapshot_write(writer, &image, sizeof(image));
+    write_vfs(writer, kernel->filesystem);
+    if (write_mm(writer, kernel->mm, kernel->filesystem) != 0) {
+        writer->failed = true;
+        return -1;
+    }
+    write_scheduler(writer, kernel->scheduler);
+
+    for (int q = 0; q < kernel->queue_count; q++) {
+        if (kernel->queues[q]) write_queue(writer, kernel->queues[q]);
+    }
+
+    for (uint32_t i = 0; i < kernel->events.count; i++) {
+        KernelEvent ev = kernel->events.heap[i];
+        save_pcb(&ev.pcb);
+        snapshot_save_code(&ev.handler);
+        snapshot_save_pointer(&ev.arg, kernel, sizeof(Microkernel));
+        snapshot_write(writer, &ev, sizeof(ev));
+    }
+    return writer->failed ? -1 : 0;
+}
+
+static bool read_kernel(SnapshotCursor* cursor, Microkernel* kernel, const Microkernel* image) {
+    VFS* vfs = read_vfs(cursor);
+    if (!vfs) return false;
+    vfs_destroy(kernel->filesystem);
+    kernel->filesystem = vfs;
+
+    if (!read_mm(cursor, kernel->mm, vfs)) return false;
+
+    PCB** by_pid = (PCB**)calloc(MAX_PROCESSES, sizeof(PCB*));
+    if (!by_pid) return false;
+    bool ok = read_scheduler(cursor, kernel->scheduler, by_pid);
+
+    for (int q = 0; ok && q < MAX_QUEUES; q++) {
+        kernel->queue_waiters[q] = image->queue_waiters[q];
+        ok = load_pcb(&kernel->queue_waiters[q], by_pid);
+        if (!ok) kernel->queue_waiters[q] = NULL;
+    }
+    for (int q = 0; ok && q < image->queue_count; q++) {
+        if (!image->queues[q]) continue;
+        kernel->queues[q] = read_queue(cursor);
+        ok = kernel->queues[q] != NULL;
+    }
+    kernel->queue_count = image->queue_count;
+
+    uint32_t events = image->events.count;
+    if (ok && events > kernel->events.capacity) {
+        event_queue_destroy(&kernel->events);
+        ok = event_queue_init(&kernel->events, events) == 0;
+    }
+    for (uint32_t i = 0; ok && i < events; i++) {
+        KernelEvent* ev = &kernel->events.heap[i];
+        ok = snapshot_read(cursor, ev, sizeof(KernelEvent)) && load_pcb(&ev->pcb, by_pid);
+        if (ok) {
+            snapshot_load_code(&ev->handler);
+            snapshot_load_pointer(&ev->arg, kernel);
+            kernel->events.count = i + 1;
+        }
+    }
+    kernel->events.next_seq = image->events.next_seq;
+    free(by_pid);
+    return ok;
+}
+
+// The index-th kernel in the snapshot. Physical memory is backed by the
+// mapping until written; files, page tables and the rest are copied.
+Microkernel* kernel_restore(Snapshot* snapshot, uint32_t index) {
+    SnapshotCursor cursor;
+    if (snapshot_find(snapshot, SNAP_KERNEL, index, &cursor) != 0) {
+        ERROR("No kernel %u in the snapshot\n", index);
+        return NULL;
+    }
+
+    uint64_t mem_size;
+    Microkernel image;
+    if (!snapshot_read(&cursor, &mem_size, sizeof(mem_size)) ||
+        !snapshot_read(&cursor, &image, sizeof(image)) ||
+        image.queue_count < 0 || image.queue_count > MAX_QUEUES) {
+        ERROR("Cannot restore kernel %u from the snapshot\n", index);
+        return NULL;
+    }
+
+    Microkernel* kernel = kernel_create(mem_size);
+    if (!kernel) return NULL;
+    kernel->events_dispatched = image.events_dispatched;
+    kernel->realtime = image.realtime;
+    kernel->running = image.running;
+    memcpy(kernel->syscall_stats, image.syscall_stats, sizeof(kernel->syscall_stats));
+
+    if (!read_kernel(&cursor, kernel, &image)) {
+        ERROR("Cannot restore kernel %u from the snapshot\n", index);
+        kernel_destroy(kernel);
+        return NULL;
+    }
+    return kernel;
+}
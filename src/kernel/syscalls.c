@@ -1,158 +1,337 @@
 #include "kernel.h"
 
-// System call numbers
-typedef enum {
-    SYS_EXIT = 0,
-    SYS_FORK,
-    SYS_READ,
-    SYS_WRITE,
-    SYS_OPEN,
-    SYS_CLOSE,
-    SYS_EXEC,
-    SYS_WAIT,
-    SYS_BRK,
-    SYS_MMAP,
-    SYS_MUNMAP,
-    SYS_GETPID,
-    SYS_GETTIME,
-    SYS_SLEEP,
-    SYS_YIELD,
-    SYS_SEND,
-    SYS_RECV,
-    SYS_IOCTL,
-    SYS_MAX
-} SyscallNumber;
-
-// System call handler
-uint64_t syscall_handler(Microkernel* kernel, PCB* pcb, 
-                        uint64_t syscall_num, uint64_t arg1, 
-                        uint64_t arg2, uint64_t arg3, uint64_t arg4) {
+// One handler per system call; args are arg1..arg4 of the call
+typedef uint64_t (*SyscallHandler)(Microkernel* kernel, PCB* pcb, const uint64_t* args);
+
+static const char* const syscall_names[SYS_MAX] = {
+    [SYS_EXIT] = "exit",
+    [SYS_FORK] = "fork",
+    [SYS_READ] = "read",
+    [SYS_WRITE] = "write",
+    [SYS_OPEN] = "open",
+    [SYS_CLOSE] = "close",
+    [SYS_EXEC] = "exec",
+    [SYS_WAIT] = "wait",
+    [SYS_BRK] = "brk",
+    [SYS_MMAP] = "mmap",
+    [SYS_MUNMAP] = "munmap",
+    [SYS_GETPID] = "getpid",
+    [SYS_GETTIME] = "gettime",
+    [SYS_SLEEP] = "sleep",
+    [SYS_YIELD] = "yield",
+    [SYS_SEND] = "send",
+    [SYS_RECV] = "recv",
+    [SYS_IOCTL] = "ioctl",
+    [SYS_RING_ENTER] = "ring_enter",
+};
+
+// Declared but not modelled yet
+static uint64_t sys_nosys(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    (void)kernel;
+    (void)pcb;
+    (void)args;
+    return -1;  // ENOSYS
+}
+
+static uint64_t sys_exit(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    (void)args;
+    kernel_terminate_process(kernel, pcb->pid);
+    return 0;
+}
+
+// The child's PID in the parent, or -1
+static uint64_t sys_fork(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    (void)args;
+    uint32_t child = kernel_fork_process(kernel, pcb->pid);
+    return child ? child : (uint64_t)-1;  // ENOMEM
+}
+
+static uint64_t sys_getpid(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    (void)kernel;
+    (void)args;
+    return pcb->pid;
+}
+
+// Virtual time, in ms
+static uint64_t sys_gettime(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    (void)pcb;
+    (void)args;
+    return kernel->scheduler->system_time * SCHEDULER_TICK_MS;
+}
+
+// Block until a wakeup event arg1 ms of virtual time from now
+static uint64_t sys_sleep(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    return kernel_sleep_process(kernel, pcb->pid,
+                                (args[0] + SCHEDULER_TICK_MS - 1) / SCHEDULER_TICK_MS);
+}
+
+static uint64_t sys_yield(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    (void)kernel;
+    (void)args;
+    pcb->state = PROC_READY;
+    pcb->quantum_remaining = 0;  // Force reschedule
+    return 0;
+}
+
+// Simple heap expansion
+static uint64_t sys_brk(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    uint64_t new_brk = args[0];
+    if (new_brk > pcb->heap_end) {
+        uint64_t pages_needed = ALIGN_UP(new_brk - pcb->heap_end, PAGE_SIZE) / PAGE_SIZE;
+        mm_allocate_pages(kernel->mm, pcb->pid, pages_needed);
+    }
+    pcb->heap_end = new_brk;
+    return new_brk;
+}
+
+// mmap(hint, length): anonymous memory, zeroed and backed page by page on
+// first touch. The hint is ignored.
+static uint64_t sys_mmap(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    if (args[1] == 0) return -1;  // EINVAL
+    
+    uint64_t vaddr;
+    if (mm_reserve_pages(kernel->mm, pcb->pid, ALIGN_UP(args[1], PAGE_SIZE) / PAGE_SIZE, &vaddr) != 0) {
+        return -1;  // ENOMEM
+    }
+    return vaddr;
+}
+
+// Unmap the 4KB pages in [arg1, arg1 + arg2); pages not mapped are skipped
+static uint64_t sys_munmap(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    uint64_t start = args[0];
+    uint64_t length = args[1];
+    if ((start & (PAGE_SIZE - 1)) || length == 0) return -1;  // EINVAL
+    
+    for (uint64_t vaddr = start; vaddr < start + length; vaddr += PAGE_SIZE) {
+        mm_unmap_page(kernel->mm, pcb->pid, vaddr);
+    }
+    return 0;
+}
+
+// Process descriptors index open_files, which holds VFS ones
+static uint64_t sys_open(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (pcb->open_files[i] == -1) {
+            int fd = vfs_open_file(kernel->filesystem, (const char*)args[0]);
+            if (fd < 0) return -1;  // ENOENT
+            pcb->open_files[i] = fd;
+            return i;
+        }
+    }
+    return -1;  // EMFILE
+}
+
+static uint64_t sys_close(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    if (args[0] < MAX_FILES && pcb->open_files[args[0]] != -1) {
+        vfs_close_file(kernel->filesystem, pcb->open_files[args[0]]);
+        pcb->open_files[args[0]] = -1;
+        return 0;
+    }
+    return -1;  // EBADF
+}
+
+// read(buffer, fd, size)
+static uint64_t sys_read(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    if (args[1] < MAX_FILES && pcb->open_files[args[1]] != -1) {
+        return vfs_read_file(kernel->filesystem, pcb->open_files[args[1]],
+                             (void*)args[0], args[2]);
+    }
+    return -1;  // EBADF
+}
+
+// write(buffer, fd, size)
+static uint64_t sys_write(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    if (args[1] < MAX_FILES && pcb->open_files[args[1]] != -1) {
+        return vfs_write_file(kernel->filesystem, pcb->open_files[args[1]],
+                              (void*)args[0], args[2]);
+    }
+    return -1;  // EBADF
+}
+
+// send(queue, msg_id, data, size). Payloads over MSG_INLINE_SIZE are
+// granted: the malloc'd buffer now belongs to the receiver.
+static uint64_t sys_send(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    Message msg;
+    msg.src_pid = pcb->pid;
+    msg.dst_pid = args[0];
+    msg.msg_id = args[1];
+    msg.flags = 0;
+    msg_set_payload(&msg, (void*)args[2], args[3]);
+    return kernel_send_message(kernel, args[0], &msg);
+}
+
+// recv(queue, timeout, buffer, size)
+static uint64_t sys_recv(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    (void)pcb;
+    Message msg;
+    int result = kernel_receive_message(kernel, args[0], &msg, args[1]);
+    if (result != 0) return result;
+    
+    // Zero-copy: with no buffer the receiver takes a granted buffer itself
+    // and gets its size through arg4
+    if (!args[2] && (msg.flags & MSG_GRANT)) {
+        if (args[3]) *(size_t*)args[3] = msg.size;
+        return (uint64_t)msg.data;
+    }
     
-    switch (syscall_num) {
-        case SYS_EXIT:
-            kernel_terminate_process(kernel, pcb->pid);
-            return 0;
-            
-        case SYS_GETPID:
-            return pcb->pid;
-            
-        case SYS_GETTIME:
-            return get_time_ms();
-            
-        case SYS_SLEEP:
-            // Simple sleep implementation
-            {
-                uint64_t end = get_time_ms() + arg1;
-                while (get_time_ms() < end) {
-                    // Yield CPU
-                    pcb->state = PROC_BLOCKED;
-                    scheduler_tick(kernel->scheduler);
-                }
-            }
-            return 0;
-            
-        case SYS_YIELD:
-            pcb->state = PROC_READY;
-            pcb->quantum_remaining = 0;  // Force reschedule
-            return 0;
-            
-        case SYS_BRK:
-            // Simple heap expansion
-            {
-                uint64_t new_brk = arg1;
-                if (new_brk > pcb->heap_end) {
-                    uint64_t pages_needed = ALIGN_UP(new_brk - pcb->heap_end, PAGE_SIZE) / PAGE_SIZE;
-                    mm_allocate_pages(kernel->mm, pcb->pid, pages_needed);
-                }
-                pcb->heap_end = new_brk;
-                return new_brk;
-            }
-            
-        case SYS_OPEN:
-            return vfs_open_file(kernel->filesystem, (const char*)arg1);
-            
-        case SYS_CLOSE:
-            // Find and close file
-            for (int i = 0; i < MAX_FILES; i++) {
-                if (pcb->open_files[i] == (int)arg1) {
-                    pcb->open_files[i] = -1;
-                    // In real implementation, would close file in VFS
-                    return 0;
-                }
-            }
-            return -1;  // EBADF
-            
-        case SYS_READ:
-            if (arg2 < MAX_FILES && pcb->open_files[arg2] != -1) {
-                return vfs_read_file(kernel->filesystem, pcb->open_files[arg2],
-                                   (void*)arg1, arg3);
-            }
-            return -1;  // EBADF
-            
-        case SYS_WRITE:
-            if (arg2 < MAX_FILES && pcb->open_files[arg2] != -1) {
-                return vfs_write_file(kernel->filesystem, pcb->open_files[arg2],
-                                    (void*)arg1, arg3);
-            }
-            return -1;  // EBADF
-            
-        case SYS_SEND:
-            {
-                Message msg;
-                msg.src_pid = pcb->pid;
-                msg.dst_pid = arg1;
-                msg.msg_id = arg2;
-                msg.data = (void*)arg3;
-                msg.size = arg4;
-                return kernel_send_message(kernel, arg1, &msg);
-            }
-            
-        case SYS_RECV:
-            {
-                Message msg;
-                int result = kernel_receive_message(kernel, arg1, &msg, arg2);
-                if (result == 0) {
-                    // Copy message to user buffer
-                    if (msg.size <= arg4) {
-                        memcpy((void*)arg3, msg.data, msg.size);
-                        return msg.size;
-                    } else {
-                        return -1;  // EMSGSIZE
-                    }
-                }
-                return result;
-            }
-            
-        default:
-            ERROR("Unknown syscall: %lu\n", syscall_num);
-            return -1;  // ENOSYS
+    // Copy message to user buffer
+    int64_t copied = -1;  // EMSGSIZE
+    if (args[2] && msg.size <= args[3]) {
+        memcpy((void*)args[2], msg_payload(&msg), msg.size);
+        copied = msg.size;
     }
+    if (msg.flags & MSG_GRANT) free(msg.data);
+    return copied;
+}
+
+// No devices answer ioctls
+static uint64_t sys_ioctl(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    (void)kernel;
+    (void)pcb;
+    (void)args;
+    return -1;  // ENOTTY
+}
+
+static uint64_t sys_ring_enter(Microkernel* kernel, PCB* pcb, const uint64_t* args) {
+    (void)args;
+    return syscall_ring_drain(kernel, pcb);
 }
 
 // System call table
-static uint64_t (*syscall_table[SYS_MAX])(Microkernel*, PCB*, uint64_t, uint64_t, uint64_t, uint64_t) = {
-    [SYS_EXIT] = syscall_handler,
-    [SYS_GETPID] = syscall_handler,
-    [SYS_GETTIME] = syscall_handler,
-    [SYS_SLEEP] = syscall_handler,
-    [SYS_YIELD] = syscall_handler,
-    [SYS_BRK] = syscall_handler,
-    [SYS_OPEN] = syscall_handler,
-    [SYS_CLOSE] = syscall_handler,
-    [SYS_READ] = syscall_handler,
-    [SYS_WRITE] = syscall_handler,
-    [SYS_SEND] = syscall_handler,
-    [SYS_RECV] = syscall_handler,
+static const SyscallHandler syscall_table[SYS_MAX] = {
+    [SYS_EXIT] = sys_exit,
+    [SYS_FORK] = sys_fork,
+    [SYS_READ] = sys_read,
+    [SYS_WRITE] = sys_write,
+    [SYS_OPEN] = sys_open,
+    [SYS_CLOSE] = sys_close,
+    [SYS_EXEC] = sys_nosys,
+    [SYS_WAIT] = sys_nosys,
+    [SYS_BRK] = sys_brk,
+    [SYS_MMAP] = sys_mmap,
+    [SYS_MUNMAP] = sys_munmap,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_GETTIME] = sys_gettime,
+    [SYS_SLEEP] = sys_sleep,
+    [SYS_YIELD] = sys_yield,
+    [SYS_SEND] = sys_send,
+    [SYS_RECV] = sys_recv,
+    [SYS_IOCTL] = sys_ioctl,
+    [SYS_RING_ENTER] = sys_ring_enter,
 };
 
+static void account(Microkernel* kernel, uint64_t num, uint64_t ns, bool batched) {
+    SyscallStats* stats = &kernel->syscall_stats[num];
+    stats->calls++;
+    stats->batched += batched;
+    stats->total_ns += ns;
+    stats->max_ns = MAX(stats->max_ns, ns);
+}
+
 // Invoke system call from user process
 uint64_t syscall_invoke(Microkernel* kernel, PCB* pcb, uint64_t num,
-                       uint64_t arg1, uint64_t arg2, 
-                       uint64_t arg3, uint64_t arg4) {
-    
-    if (num >= SYS_MAX || syscall_table[num] == NULL) {
+                        uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4) {
+    if (num >= SYS_MAX) {
+        ERROR("Unknown syscall: %lu\n", num);
         return -1;  // ENOSYS
     }
     
-    return syscall_table[num](kernel, pcb, num, arg1, arg2, arg3, arg4);
-}
\ No newline at end of file
+    uint64_t args[4] = {arg1, arg2, arg3, arg4};
+    uint64_t start = get_time_ns();
+    uint64_t result = syscall_table[num](kernel, pcb, args);
+    account(kernel, num, get_time_ns() - start, false);
+    return result;
+}
+
+// entries is rounded up to a power of two
+int syscall_ring_setup(PCB* pcb, uint32_t entries) {
+    if (entries == 0 || entries > (1u << 16) || pcb->ring) return -1;
+    
+    uint32_t slots = 1;
+    while (slots < entries) slots <<= 1;
+    SyscallRing* ring = (SyscallRing*)calloc(1, sizeof(SyscallRing) +
+                                             slots * (sizeof(SyscallEntry) + sizeof(SyscallCompletion)));
+    if (!ring) return -1;
+    
+    ring->mask = slots - 1;
+    ring->sq = (SyscallEntry*)(ring + 1);
+    ring->cq = (SyscallCompletion*)(ring->sq + slots);
+    pcb->ring = ring;
+    return 0;
+}
+
+// Queue a call for the next SYS_RING_ENTER; -1 when the ring is full
+int syscall_ring_submit(SyscallRing* ring, uint32_t num, uint64_t arg1, uint64_t arg2,
+                        uint64_t arg3, uint64_t arg4, uint64_t user_data) {
+    if (ring->sq_tail - ring->sq_head > ring->mask) return -1;
+    
+    SyscallEntry* entry = &ring->sq[ring->sq_tail & ring->mask];
+    entry->num = num;
+    entry->args[0] = arg1;
+    entry->args[1] = arg2;
+    entry->args[2] = arg3;
+    entry->args[3] = arg4;
+    entry->user_data = user_data;
+    ring->sq_tail++;
+    return 0;
+}
+
+// Take up to max completions, oldest first
+int syscall_ring_reap(SyscallRing* ring, SyscallCompletion* out, int max) {
+    int n = 0;
+    while (n < max && ring->cq_head != ring->cq_tail) {
+        out[n++] = ring->cq[ring->cq_head++ & ring->mask];
+    }
+    return n;
+}
+
+// Run the queued calls in order, in one pass. Stops early when the
+// completion queue fills or a call blocks or ends the process; the rest
+// stay queued. Returns how many ran.
+int syscall_ring_drain(Microkernel* kernel, PCB* pcb) {
+    SyscallRing* ring = pcb->ring;
+    if (!ring) return -1;
+    
+    int done = 0;
+    uint64_t start = get_time_ns();
+    while (ring->sq_head != ring->sq_tail) {
+        if (pcb->state == PROC_BLOCKED || pcb->state == PROC_TERMINATED) break;
+        if (ring->cq_tail - ring->cq_head > ring->mask) {
+            ring->overflows++;
+            break;
+        }
+    
+        const SyscallEntry* entry = &ring->sq[ring->sq_head & ring->mask];
+        uint32_t num = entry->num;
+        uint64_t result = -1;  // ENOSYS
+        if (num < SYS_MAX && num != SYS_RING_ENTER) {
+            result = syscall_table[num](kernel, pcb, entry->args);
+        }
+    
+        SyscallCompletion* completion = &ring->cq[ring->cq_tail & ring->mask];
+        completion->user_data = entry->user_data;
+        completion->result = result;
+        ring->cq_tail++;
+        ring->sq_head++;
+        done++;
+    
+        // One clock read per call: each call ends where the next starts
+        uint64_t end = get_time_ns();
+        if (num < SYS_MAX) {
+            account(kernel, num, end - start, true);
+        }
+        start = end;
+    }
+    return done;
+}
+
+void syscall_print_stats(Microkernel* kernel) {
+    printf("\n=== System Call Stats ===\n");
+    printf("%-12s %10s %10s %10s %10s\n", "Call", "Count", "Batched", "Avg ns", "Max ns");
+    for (int i = 0; i < SYS_MAX; i++) {
+        const SyscallStats* stats = &kernel->syscall_stats[i];
+        if (stats->calls == 0) continue;
+        printf("%-12s %10lu %10lu %10.0f %10lu\n", syscall_names[i], stats->calls,
+               stats->batched, (double)stats->total_ns / stats->calls, stats->max_ns);
+    }
+}
@@ -1,5 +1,45 @@
 #include "kernel.h"
 
+#define VFS_INITIAL_SLOTS 64
+
+// FNV-1a over the name as stored, i.e. cut at MAX_NAME_LEN - 1
+static uint32_t name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < MAX_NAME_LEN - 1 && name[i]; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Index slot holding name, or the empty slot where it would go
+static uint32_t index_slot(const VFS* vfs, const char* name) {
+    uint32_t slot = name_hash(name) & vfs->index_mask;
+    while (vfs->index[slot] >= 0 &&
+           strncmp(vfs->files[vfs->index[slot]]->name, name, MAX_NAME_LEN - 1) != 0) {
+        slot = (slot + 1) & vfs->index_mask;
+    }
+    return slot;
+}
+
+static int grow_index(VFS* vfs) {
+    uint32_t slots = 2 * (vfs->index_mask + 1);
+    int* index = (int*)malloc(slots * sizeof(int));
+    if (!index) return -1;
+    
+    free(vfs->index);
+    vfs->index = index;
+    vfs->index_mask = slots - 1;
+    memset(index, -1, slots * sizeof(int));
+    for (int i = 0; i < vfs->file_count; i++) {
+        vfs->index[index_slot(vfs, vfs->files[i]->name)] = i;
+    }
+    return 0;
+}
+
+static int find_file(const VFS* vfs, const char* name) {
+    return vfs->index[index_slot(vfs, name)];
+}
+
 VFS* vfs_create() {
     VFS* vfs = (VFS*)malloc(sizeof(VFS));
     if (!vfs) return NULL;
@@ -7,125 +47,321 @@ VFS* vfs_create() {
     memset(vfs, 0, sizeof(VFS));
     strcpy(vfs->current_dir, "/");
     vfs->file_count = 0;
+    vfs->free_fd = -1;
+    
+    vfs->index_mask = 2 * VFS_INITIAL_SLOTS - 1;
+    vfs->index = (int*)malloc(2 * VFS_INITIAL_SLOTS * sizeof(int));
+    vfs->files = (VFile**)malloc(VFS_INITIAL_SLOTS * sizeof(VFile*));
+    vfs->fds = (VFileHandle*)malloc(VFS_INITIAL_SLOTS * sizeof(VFileHandle));
+    if (!vfs->index || !vfs->files || !vfs->fds) {
+        vfs_destroy(vfs);
+        return NULL;
+    }
+    memset(vfs->index, -1, 2 * VFS_INITIAL_SLOTS * sizeof(int));
+    vfs->file_slots = VFS_INITIAL_SLOTS;
+    vfs->fd_slots = VFS_INITIAL_SLOTS;
     
     return vfs;
 }
 
+// Mapped chunks are freed too, so the VFS must outlive any address space
+// they are mapped into
 void vfs_destroy(VFS* vfs) {
     if (vfs) {
         for (int i = 0; i < vfs->file_count; i++) {
-            if (vfs->files[i].data) {
-                free(vfs->files[i].data);
+            VFile* file = vfs->files[i];
+            for (uint64_t e = 0; e < file->extent_count; e++) {
+                free(file->extents[e]);
             }
+            free(file->extents);
+            free(file->chunks);
+            free(file);
         }
+        free(vfs->files);
+        free(vfs->index);
+        free(vfs->fds);
         free(vfs);
     }
 }
 
-int vfs_create_file(VFS* vfs, const char* name, size_t size) {
-    if (vfs->file_count >= MAX_FILES) {
-        ERROR("Too many files\n");
+// Room for one more descriptor, so the next alloc_fd cannot fail
+static int reserve_fd(VFS* vfs) {
+    if (vfs->free_fd >= 0 || vfs->fd_count < vfs->fd_slots) return 0;
+
+    VFileHandle* fds = (VFileHandle*)realloc(vfs->fds, 2 * vfs->fd_slots * sizeof(VFileHandle));
+    if (!fds) {
+        ERROR("Too many open files\n");
         return -1;
     }
+    vfs->fds = fds;
+    vfs->fd_slots *= 2;
+    return 0;
+}
+
+static int alloc_fd(VFS* vfs, int file) {
+    if (reserve_fd(vfs) != 0) return -1;
+
+    int fd = vfs->free_fd;
+    if (fd >= 0) {
+        vfs->free_fd = vfs->fds[fd].next_free;
+    } else {
+        fd = vfs->fd_count++;
+    }
     
+    vfs->fds[fd].file = file;
+    vfs->fds[fd].offset = 0;
+    vfs->fds[fd].next_free = -1;
+    vfs->files[file]->open_count++;
+    vfs->files[file]->timestamp = get_time_ms();
+    return fd;
+}
+
+static VFile* file_for(VFS* vfs, int fd) {
+    if (fd < 0 || fd >= vfs->fd_count || vfs->fds[fd].file < 0) {
+        ERROR("Invalid file descriptor\n");
+        return NULL;
+    }
+    return vfs->files[vfs->fds[fd].file];
+}
+
+// Room in file->chunks for chunk index last; only the pointer array grows
+static int reserve_chunks(VFile* file, uint64_t last) {
+    if (last < file->chunk_slots) return 0;
+    
+    uint64_t slots = MAX(file->chunk_slots, 8);
+    while (slots <= last) slots *= 2;
+    uint8_t** chunks = (uint8_t**)realloc(file->chunks, slots * sizeof(uint8_t*));
+    if (!chunks) return -1;
+    
+    memset(chunks + file->chunk_slots, 0, (slots - file->chunk_slots) * sizeof(uint8_t*));
+    file->chunks = chunks;
+    file->chunk_slots = slots;
+    return 0;
+}
+
+// Next extent: as many chunks as the file has, within 1..VFS_EXTENT_CHUNKS
+static int add_extent(VFile* file) {
+    if (file->extent_count == file->extent_slots) {
+        uint64_t slots = MAX(2 * file->extent_slots, 8);
+        uint8_t** extents = (uint8_t**)realloc(file->extents, slots * sizeof(uint8_t*));
+        if (!extents) return -1;
+        file->extents = extents;
+        file->extent_slots = slots;
+    }
+    
+    uint32_t chunks = (uint32_t)MIN(MAX(file->chunk_count, 1), VFS_EXTENT_CHUNKS);
+    uint8_t* extent = (uint8_t*)aligned_alloc(PAGE_SIZE, (size_t)chunks * VFS_CHUNK_SIZE);
+    if (!extent) return -1;
+    file->extents[file->extent_count++] = extent;
+    file->spare = extent;
+    file->spare_chunks = chunks;
+    return 0;
+}
+
+// Page-aligned so vfs_mmap can hand it to guest memory as it is. A new
+// chunk is zeroed except for [from, to), which the caller is about to fill.
+static uint8_t* chunk_for_write(VFile* file, uint64_t c, size_t from, size_t to) {
+    if (!file->chunks[c]) {
+        if (file->spare_chunks == 0 && add_extent(file) != 0) return NULL;
+        uint8_t* chunk = file->spare;
+        file->spare += VFS_CHUNK_SIZE;
+        file->spare_chunks--;
+        memset(chunk, 0, from);
+        memset(chunk + to, 0, VFS_CHUNK_SIZE - to);
+        file->chunks[c] = chunk;
+        file->chunk_count++;
+    }
+    return file->chunks[c];
+}
+
+// Creates size bytes of zeros, which take no chunks until written, and
+// returns a descriptor open on the new file
+int vfs_create_file(VFS* vfs, const char* name, size_t size) {
     // Check if file already exists
-    for (int i = 0; i < vfs->file_count; i++) {
-        if (strcmp(vfs->files[i].name, name) == 0) {
-            ERROR("File already exists: %s\n", name);
+    if (find_file(vfs, name) >= 0) {
+        ERROR("File already exists: %s\n", name);
+        return -1;
+    }
+    
+    if (vfs->file_count == vfs->file_slots) {
+        VFile** files = (VFile**)realloc(vfs->files, 2 * vfs->file_slots * sizeof(VFile*));
+        if (!files) {
+            ERROR("Too many files\n");
             return -1;
         }
+        vfs->files = files;
+        vfs->file_slots *= 2;
     }
-    
-    VFile* file = &vfs->files[vfs->file_count];
-    strncpy(file->name, name, MAX_NAME_LEN - 1);
-    file->name[MAX_NAME_LEN - 1] = '\0';
-    
-    file->capacity = size + 1024;  // Extra capacity
-    file->data = (uint8_t*)malloc(file->capacity);
-    if (!file->data) {
-        ERROR("Failed to allocate file data\n");
+    if (2 * (uint32_t)(vfs->file_count + 1) > vfs->index_mask + 1 && grow_index(vfs) != 0) {
+        ERROR("Too many files\n");
         return -1;
     }
+    // The file is only published once its descriptor is certain
+    if (reserve_fd(vfs) != 0) return -1;
     
-    memset(file->data, 0, file->capacity);
+    VFile* file = (VFile*)calloc(1, sizeof(VFile));
+    if (!file) {
+        ERROR("Failed to allocate file\n");
+        return -1;
+    }
+    strncpy(file->name, name, MAX_NAME_LEN - 1);
+    file->name[MAX_NAME_LEN - 1] = '\0';
     file->size = size;
     file->timestamp = get_time_ms();
-    file->is_open = false;
     
+    int id = vfs->file_count;
+    vfs->files[id] = file;
+    vfs->index[index_slot(vfs, file->name)] = id;
     vfs->file_count++;
-    INFO("Created file: %s (size: %zu)\n", name, size);
-    return vfs->file_count - 1;
+    
+    int fd = alloc_fd(vfs, id);
+    if (fd >= 0) {
+        INFO("Created file: %s (size: %zu)\n", name, size);
+    }
+    return fd;
 }
 
+// Every open gets a descriptor of its own, starting at offset 0
 int vfs_open_file(VFS* vfs, const char* name) {
-    for (int i = 0; i < vfs->file_count; i++) {
-        if (strcmp(vfs->files[i].name, name) == 0) {
-            vfs->files[i].is_open = true;
-            vfs->files[i].timestamp = get_time_ms();
-            return i;
-        }
+    int file = find_file(vfs, name);
+    if (file < 0) {
+        ERROR("File not found: %s\n", name);
+        return -1;
     }
-    ERROR("File not found: %s\n", name);
-    return -1;
+    return alloc_fd(vfs, file);
 }
 
+int vfs_close_file(VFS* vfs, int fd) {
+    VFile* file = file_for(vfs, fd);
+    if (!file) return -1;
+    
+    file->open_count--;
+    vfs->fds[fd].file = -1;
+    vfs->fds[fd].next_free = vfs->free_fd;
+    vfs->free_fd = fd;
+    return 0;
+}
+
+// A second descriptor for fd's file, starting at fd's offset
+int vfs_dup_file(VFS* vfs, int fd) {
+    if (!file_for(vfs, fd)) return -1;
+    
+    int dup = alloc_fd(vfs, vfs->fds[fd].file);
+    if (dup >= 0) vfs->fds[dup].offset = vfs->fds[fd].offset;
+    return dup;
+}
+
+// Reads from the descriptor's offset and moves it past what was read
 int vfs_read_file(VFS* vfs, int fd, void* buffer, size_t size) {
-    if (fd < 0 || fd >= vfs->file_count) {
-        ERROR("Invalid file descriptor\n");
-        return -1;
-    }
+    VFile* file = file_for(vfs, fd);
+    if (!file) return -1;
     
-    VFile* file = &vfs->files[fd];
-    if (!file->is_open) {
-        ERROR("File not open\n");
-        return -1;
-    }
+    uint64_t offset = vfs->fds[fd].offset;
+    size_t to_read = offset < file->size ? MIN(size, file->size - offset) : 0;
     
-    size_t to_read = size;
-    if (to_read > file->size) {
-        to_read = file->size;
+    uint8_t* out = (uint8_t*)buffer;
+    for (size_t done = 0; done < to_read;) {
+        uint64_t pos = offset + done;
+        size_t chunk = MIN(to_read - done, VFS_CHUNK_SIZE - pos % VFS_CHUNK_SIZE);
+        uint64_t c = pos / VFS_CHUNK_SIZE;
+        const uint8_t* data = c < file->chunk_slots ? file->chunks[c] : NULL;
+        if (data) {
+            memcpy(out + done, data + pos % VFS_CHUNK_SIZE, chunk);
+        } else {
+            memset(out + done, 0, chunk);
+        }
+        done += chunk;
     }
     
-    memcpy(buffer, file->data, to_read);
+    vfs->fds[fd].offset += to_read;
     file->timestamp = get_time_ms();
     
     return to_read;
 }
 
+// Writes at the descriptor's offset, growing the file past its end
 int vfs_write_file(VFS* vfs, int fd, void* data, size_t size) {
-    if (fd < 0 || fd >= vfs->file_count) {
-        ERROR("Invalid file descriptor\n");
-        return -1;
-    }
+    VFile* file = file_for(vfs, fd);
+    if (!file) return -1;
+    if (size == 0) return 0;
     
-    VFile* file = &vfs->files[fd];
-    if (!file->is_open) {
-        ERROR("File not open\n");
+    uint64_t offset = vfs->fds[fd].offset;
+    if (reserve_chunks(file, (offset + size - 1) / VFS_CHUNK_SIZE) != 0) {
+        ERROR("Failed to resize file\n");
         return -1;
     }
     
-    // Resize if needed
-    if (file->size + size > file->capacity) {
-        size_t new_capacity = file->capacity * 2;
-        if (new_capacity < file->size + size) {
-            new_capacity = file->size + size + 1024;
-        }
-        
-        uint8_t* new_data = (uint8_t*)realloc(file->data, new_capacity);
-        if (!new_data) {
+    const uint8_t* in = (const uint8_t*)data;
+    size_t done = 0;
+    while (done < size) {
+        uint64_t pos = offset + done;
+        size_t chunk = MIN(size - done, VFS_CHUNK_SIZE - pos % VFS_CHUNK_SIZE);
+        uint8_t* dest = chunk_for_write(file, pos / VFS_CHUNK_SIZE, pos % VFS_CHUNK_SIZE,
+                                        pos % VFS_CHUNK_SIZE + chunk);
+        if (!dest) {
             ERROR("Failed to resize file\n");
-            return -1;
+            break;
         }
-        
-        file->data = new_data;
-        file->capacity = new_capacity;
+        memcpy(dest + pos % VFS_CHUNK_SIZE, in + done, chunk);
+        done += chunk;
     }
     
-    memcpy(file->data + file->size, data, size);
-    file->size += size;
+    vfs->fds[fd].offset += done;
+    file->size = MAX(file->size, offset + done);
     file->timestamp = get_time_ms();
     
-    return size;
+    return done > 0 ? (int)done : -1;
+}
+
+// whence is SEEK_SET, SEEK_CUR or SEEK_END; seeking past the end is fine
+// and a later write leaves a hole. Returns the new offset.
+int64_t vfs_seek(VFS* vfs, int fd, int64_t offset, int whence) {
+    VFile* file = file_for(vfs, fd);
+    if (!file) return -1;
+    
+    int64_t base;
+    switch (whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = (int64_t)vfs->fds[fd].offset; break;
+        case SEEK_END: base = (int64_t)file->size; break;
+        default: return -1;
+    }
+    if (base + offset < 0) return -1;
+    
+    vfs->fds[fd].offset = base + offset;
+    return base + offset;
+}
+
+// Map length bytes of the file from offset, a multiple of VFS_CHUNK_SIZE,
+// into pid's address space without copying: the pages are the file's own
+// chunks, so stores through the mapping change the file and writes to the
+// file show through it. Holes in the range get chunks first.
+int vfs_mmap(VFS* vfs, MemoryManager* mm, uint32_t pid, int fd, uint64_t offset, size_t length,
+             uint64_t* vaddr) {
+    VFile* file = file_for(vfs, fd);
+    if (!file) return -1;
+    
+    if (length == 0 || offset % VFS_CHUNK_SIZE != 0 ||
+        offset + length > ALIGN_UP(file->size, VFS_CHUNK_SIZE)) {
+        ERROR("Cannot map %zu bytes at %lu of %s\n", length, offset, file->name);
+        return -1;
+    }
+    
+    uint64_t first = offset / VFS_CHUNK_SIZE;
+    uint64_t count = ALIGN_UP(length, VFS_CHUNK_SIZE) / VFS_CHUNK_SIZE;
+    if (count > UINT32_MAX || reserve_chunks(file, first + count - 1) != 0) return -1;
+    for (uint64_t c = first; c < first + count; c++) {
+        if (!chunk_for_write(file, c, 0, 0)) {
+            ERROR("Failed to allocate file data\n");
+            return -1;
+        }
+    }
+    
+    if (mm_map_host_pages(mm, pid, file->chunks + first, (uint32_t)count, vaddr) != 0) {
+        return -1;
+    }
+    file->mapped_pages += count;
+    return 0;
 }
 
 void vfs_list_files(VFS* vfs) {
@@ -134,11 +370,13 @@ void vfs_list_files(VFS* vfs) {
     printf("Files (%d):\n", vfs->file_count);
     
     for (int i = 0; i < vfs->file_count; i++) {
-        VFile* file = &vfs->files[i];
-        printf("  %s [%s] Size: %zu, Modified: %lu\n",
+        VFile* file = vfs->files[i];
+        printf("  %s [%u open] Size: %zu, Chunks: %lu, Mapped: %lu, Modified: %lu\n",
                file->name,
-               file->is_open ? "open" : "closed",
+               file->open_count,
                file->size,
+               file->chunk_count,
+               file->mapped_pages,
                file->timestamp);
     }
-}
\ No newline at end of file
+}
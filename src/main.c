@@ -6,6 +6,13 @@
 #include "kernel.h"
 #include "embedded.h"
 
+// Entry points in src/apps
+void demo_traffic_light();
+void demo_sensor_monitor();
+void benchmark_cpu();
+void benchmark_cache();
+void benchmark_scheduler();
+
 volatile sig_atomic_t running = 1;
 
 void signal_handler(int sig) {
@@ -21,6 +28,7 @@ void print_menu() {
     printf("4. Run traffic light controller\n");
     printf("5. Run all benchmarks\n");
     printf("6. Interactive mode\n");
+    printf("7. Run sensor monitor\n");
     printf("0. Exit\n");
     printf("Choice: ");
 }
@@ -96,12 +104,30 @@ int main(int argc, char** argv) {
                 running = 0;
                 break;
             case 1: {
+#if FEATURE_MULTICORE
+                MulticoreConfig config = {
+                    .cores = DEFAULT_NUM_CORES,
+                    .threads = 0,
+                    .quantum = DEFAULT_QUANTUM_CYCLES,
+                    .l2 = { CACHE_SET_ASSOC, DEFAULT_CACHE_L2_SIZE, 64, 16 },
+                    .l2_banks = DEFAULT_L2_BANKS,
+                    .l2_latency = DEFAULT_L2_LATENCY,
+                    .memory_latency = DEFAULT_MEMORY_LATENCY,
+                };
+                MulticoreSystem* sys = multicore_create(64 * KiB, &config);
+                if (sys) {
+                    multicore_run(sys, 1000);
+                    multicore_print_stats(sys);
+                    multicore_destroy(sys);
+                }
+#else
                 CPU* cpu = cpu_create(64 * KiB);
                 if (cpu) {
                     cpu_run(cpu, 1000);
                     cpu_print_stats(cpu);
                     cpu_destroy(cpu);
                 }
+#endif
                 break;
             }
             case 2:
@@ -131,6 +157,9 @@ int main(int argc, char** argv) {
             case 6:
                 interactive_mode();
                 break;
+            case 7:
+                demo_sensor_monitor();
+                break;
             default:
                 printf("Invalid choice\n");
         }
@@ -1,7 +1,10 @@
 #include "cpu.h"
 #include "kernel.h"
 #include "embedded.h"
+#include "snapshot.h"
 #include <assert.h>
+#include <sched.h>
+#include <stddef.h>
 
 void test_cache(void) {
     printf("Testing cache...\n");
@@ -9,15 +12,13 @@ void test_cache(void) {
     Cache* cache = cache_create(CACHE_SET_ASSOC, 8 * KiB, 64, 4);
     assert(cache != NULL);
     
-    // Test sequential access
-    uint64_t addr = 0;
+    // Sequential access over a range that fits: only the first pass misses
     for (int i = 0; i < 1000; i++) {
-        cache_access(cache, addr, false);
-        addr += 64;
+        cache_access(cache, (uint64_t)i * 64 % (8 * KiB), false);
     }
     
     assert(cache->accesses == 1000);
-    assert(cache->hits > 0);  // Should have some hits after warmup
+    assert(cache->hits == 1000 - 128);
     
     cache_print_stats(cache);
     cache_destroy(cache);
@@ -25,6 +26,450 @@ void test_cache(void) {
     printf("Cache test PASSED\n");
 }
 
+void test_cache_geometry(void) {
+    printf("Testing cache geometry and LRU...\n");
+    
+    // Non-power-of-two set count takes the divide/modulo decode path
+    Cache* cache = cache_create(CACHE_SET_ASSOC, 3 * 64 * 2, 64, 2);
+    assert(cache != NULL);
+    assert(cache->num_sets == 3);
+    assert(!cache->pow2_index);
+    
+    // Three lines mapping to set 0: the least recently used one is evicted
+    uint64_t a = 0, b = 3 * 64, c = 6 * 64;
+    cache_access(cache, a, false);
+    cache_access(cache, b, false);
+    cache_access(cache, a, false);      // a is now most recent
+    cache_access(cache, c, false);      // evicts b
+    assert(cache_access(cache, a, false) == cache->hit_time);
+    assert(cache_access(cache, b, false) == cache->miss_penalty);
+    cache_destroy(cache);
+    
+    // Power-of-two geometry uses shift/mask and a line-aligned store
+    cache = cache_create(CACHE_SET_ASSOC, 32 * KiB, 64, 8);
+    assert(cache != NULL);
+    assert(cache->pow2_index);
+    assert(((uintptr_t)cache->store % CACHE_LINE_SIZE) == 0);
+    cache_destroy(cache);
+    
+    // Wide sets go through the vector way search when one is available
+    cache = cache_create(CACHE_FULL_ASSOC, 16 * 64, 64, 16);
+    assert(cache != NULL && cache->num_sets == 1);
+    for (uint64_t line = 0; line < 16; line++) {
+        cache_access(cache, line * 64, false);
+    }
+    cache_access(cache, 0, false);          // line 1 becomes LRU
+    cache_access(cache, 16 * 64, false);    // evicts line 1
+    assert(cache_access(cache, 0, false) == cache->hit_time);
+    assert(cache_access(cache, 15 * 64, false) == cache->hit_time);
+    assert(cache_access(cache, 1 * 64, false) == cache->miss_penalty);
+    cache_destroy(cache);
+    
+    printf("Cache geometry test PASSED\n");
+}
+
+void test_cache_batch(void) {
+    printf("Testing batched cache replay...\n");
+    
+    enum { N = 4096 };
+    static uint64_t addrs[N];
+    static uint32_t lat[N];
+    uint64_t x = 12345;
+    for (int i = 0; i < N; i++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        addrs[i] = (x >> 20) % (256 * KiB);
+    }
+    
+    // Batch replay matches per-access calls exactly
+    Cache* ref = cache_create(CACHE_SET_ASSOC, 8 * KiB, 64, 4);
+    Cache* batch = cache_create(CACHE_SET_ASSOC, 8 * KiB, 64, 4);
+    uint64_t total = cache_access_batch(batch, addrs, NULL, N, lat);
+    uint64_t expected = 0;
+    for (int i = 0; i < N; i++) {
+        int l = cache_access(ref, addrs[i], false);
+        assert(lat[i] == (uint32_t)l);
+        expected += l;
+    }
+    assert(total == expected);
+    assert(batch->hits == ref->hits && batch->accesses == ref->accesses);
+    
+    // Hierarchy replay forwards exactly the L1 misses to L2
+    Cache* l1 = cache_create(CACHE_SET_ASSOC, 4 * KiB, 64, 4);
+    Cache* l2 = cache_create(CACHE_SET_ASSOC, 32 * KiB, 64, 8);
+    cache_hierarchy_batch(l1, l2, addrs, NULL, N, lat);
+    assert(l2->accesses == l1->misses);
+    for (int i = 0; i < N; i++) {
+        assert(lat[i] == (uint32_t)l1->hit_time ||
+               lat[i] == (uint32_t)(l1->miss_penalty + l2->hit_time) ||
+               lat[i] == (uint32_t)(l1->miss_penalty + l2->miss_penalty));
+    }
+    
+    cache_destroy(ref);
+    cache_destroy(batch);
+    cache_destroy(l1);
+    cache_destroy(l2);
+    
+    printf("Batched cache replay test PASSED\n");
+}
+
+void test_sweep(void) {
+    printf("Testing parameter sweep...\n");
+    
+    CacheConfig configs[] = {
+        {CACHE_DIRECT_MAPPED, 4 * KiB, 64, 1},
+        {CACHE_SET_ASSOC, 8 * KiB, 64, 4},
+        {CACHE_FULL_ASSOC, 8 * KiB, 64, 128},
+    };
+    AccessPattern patterns[] = { PATTERN_RANDOM, PATTERN_STRIDED };
+    
+    // Results must not depend on the thread count or schedule
+    Sweep* serial = sweep_create(NULL, 7);
+    Sweep* parallel = sweep_create(NULL, 7);
+    assert(sweep_add_cache_matrix(serial, configs, 3, patterns, 2, 20000) == 6);
+    assert(sweep_add_cache_matrix(parallel, configs, 3, patterns, 2, 20000) == 6);
+    assert(sweep_run(serial, 1) == 0);
+    assert(sweep_run(parallel, 4) == 0);
+    
+    for (size_t i = 0; i < serial->job_count; i++) {
+        assert(serial->jobs[i].events == 20000);
+        assert(serial->jobs[i].seed == parallel->jobs[i].seed);
+        assert(serial->jobs[i].hits == parallel->jobs[i].hits);
+    }
+    
+    // Predictor jobs need a branch trace
+    assert(sweep_add_predictor(serial, PREDICTOR_BIMODAL, 12, 4096) < 0);
+    
+    sweep_destroy(serial);
+    sweep_destroy(parallel);
+    
+    printf("Parameter sweep test PASSED\n");
+}
+
+void test_predecode(void) {
+    printf("Testing predecode cache...\n");
+    
+    CPU* cpu = cpu_create(64 * KiB);
+    assert(cpu != NULL && cpu->predecode != NULL);
+    
+    // add r1, r2, r3 ; mov r4, r1 ; jmp 0x1000 ; nop
+    uint8_t program[] = {
+        INST_ADD, 0x12, 0x30,
+        INST_MOV, 0x41, 0x00,
+        INST_JMP, 0x00, 0x00, 0x10, 0, 0, 0, 0, 0, 0,
+        INST_NOP, 0x00, 0x00,
+    };
+    cpu_load_program(cpu, program, sizeof(program), 0x1000);
+    
+    // Blocks end at the first control transfer
+    const DecodedBlock* block = predecode_lookup(cpu->predecode, 0x1000);
+    assert(block != NULL && block->count == 3);
+    assert(block->insts[0].type == INST_ADD && block->insts[0].rd == 1);
+    assert(block->insts[0].rs1 == 2 && block->insts[0].rs2 == 3);
+    assert(block->insts[2].type == INST_JMP && block->insts[2].imm == 0x1000);
+    assert(block->end_pc == 0x1000 + 16);
+    assert(predecode_lookup(cpu->predecode, 0x1000) == block);
+    assert(cpu->predecode->hits == 1 && cpu->predecode->misses == 1);
+    
+    // Stores off code pages leave blocks alone, stores on them drop them
+    predecode_invalidate(cpu->predecode, 0x8000, 8);
+    assert(block->valid);
+    predecode_invalidate(cpu->predecode, 0x1004, 1);
+    assert(!block->valid);
+    assert(predecode_lookup(cpu->predecode, 0x1000)->count == 3);
+    
+    // Nothing past the end of memory
+    assert(predecode_lookup(cpu->predecode, 64 * KiB) == NULL);
+    
+    // The pipeline loops on the block without re-decoding it; the one
+    // extra miss is the wrong-path fetch past the jmp
+    cpu_reset(cpu);
+    cpu->pc = 0x1000;
+    uint64_t misses = cpu->predecode->misses;
+    uint64_t hits = cpu->predecode->hits;
+    cpu_run(cpu, 200);
+    assert(cpu->predecode->misses - misses <= 2);
+    assert(cpu->predecode->hits - hits >= 10);
+    
+    cpu_destroy(cpu);
+    
+    printf("Predecode cache test PASSED\n");
+}
+
+static uint32_t emit(uint8_t* buf, InstructionType type, InstructionFormat format,
+                     uint8_t rd, uint8_t rs1, uint8_t rs2, uint64_t value) {
+    DecodedInstruction inst = { .type = type, .format = format,
+                                .rd = rd, .rs1 = rs1, .rs2 = rs2,
+                                .imm = value, .address = value };
+    return encode_instruction(inst, buf);
+}
+
+// r0 = n, r3 = 1; loop: r2 += r0; r0 -= r3; jnz loop; [0x110] = r2; hlt
+static uint32_t build_sum_program(uint8_t* buf, uint64_t base) {
+    uint32_t n = 0;
+    n += emit(buf + n, INST_LD, FORMAT_M, 0, 0, 0, 0x100);
+    n += emit(buf + n, INST_LD, FORMAT_M, 3, 0, 0, 0x108);
+    uint64_t loop = base + n;
+    n += emit(buf + n, INST_ADD, FORMAT_R, 2, 2, 0, 0);
+    n += emit(buf + n, INST_SUB, FORMAT_R, 0, 0, 3, 0);
+    n += emit(buf + n, INST_JNZ, FORMAT_J, 0, 0, 0, loop);
+    n += emit(buf + n, INST_ST, FORMAT_M, 2, 0, 0, 0x110);
+    n += emit(buf + n, INST_HLT, FORMAT_S, 0, 0, 0, 0);
+    return n;
+}
+
+static void load_sum_program(CPU* cpu, uint64_t count) {
+    uint8_t program[64];
+    cpu_reset(cpu);
+    memset(cpu->registers, 0, sizeof(cpu->registers));
+    gmem_store64(cpu->memory, 0x100, count);
+    gmem_store64(cpu->memory, 0x108, 1);
+    gmem_store64(cpu->memory, 0x110, 0);
+    cpu_load_program(cpu, program, build_sum_program(program, 0x1000), 0x1000);
+}
+
+static uint64_t sum_result(CPU* cpu) {
+    return gmem_load64(cpu->memory, 0x110);
+}
+
+void test_fast_forward(void) {
+    printf("Testing functional fast-forward...\n");
+    
+    CPU* cpu = cpu_create(64 * KiB);
+    
+    // Detailed reference run
+    load_sum_program(cpu, 10);
+    cpu_run(cpu, 2000);
+    assert(cpu->halted);
+    assert(cpu->registers[2] == 55 && sum_result(cpu) == 55);
+    uint64_t halt_pc = cpu->pc;
+    
+    // Functional only, on every dispatch engine: 2 loads, 10 iterations
+    // of 3, the store
+    DispatchMode modes[] = { DISPATCH_SWITCH, DISPATCH_TABLE, DISPATCH_THREADED };
+    for (size_t m = 0; m < ARRAY_SIZE(modes); m++) {
+        load_sum_program(cpu, 10);
+        cpu->dispatch = modes[m];
+        assert(cpu_fast_forward(cpu, 0, NO_STOP_PC, WARM_NONE) == 33);
+        assert(cpu->pc == halt_pc);
+        assert(cpu->registers[2] == 55 && sum_result(cpu) == 55);
+        assert(cpu->cycles == 0);
+    }
+    cpu->dispatch = dispatch_default_mode();
+    
+    // Hand off to detail at an instruction count, warming without
+    // touching the statistics
+    load_sum_program(cpu, 10);
+    uint64_t accesses = cpu->l1_cache->accesses;
+    assert(cpu_fast_forward(cpu, 14, NO_STOP_PC, WARM_CACHES | WARM_PREDICTOR) == 14);
+    assert(cpu->l1_cache->accesses == accesses);
+    assert(cpu->registers[0] == 6 && cpu->registers[2] == 34);
+    cpu_run(cpu, 2000);
+    assert(cpu->registers[2] == 55 && sum_result(cpu) == 55);
+    
+    // Hand off at a PC, and back from detail to functional mid-run
+    load_sum_program(cpu, 10);
+    assert(cpu_fast_forward(cpu, 0, 0x1000 + 22, WARM_NONE) == 2);
+    cpu_run(cpu, 40);
+    cpu_fast_forward(cpu, 0, NO_STOP_PC, WARM_NONE);
+    assert(cpu->pc == halt_pc);
+    assert(cpu->registers[2] == 55 && sum_result(cpu) == 55);
+    
+    // Sampled run over a long loop
+    load_sum_program(cpu, 100000);
+    SamplingConfig config = { .fast_forward = 10000, .warmup_cycles = 50,
+                              .detail_cycles = 200, .samples = 5,
+                              .warm = WARM_CACHES | WARM_PREDICTOR };
+    SamplingStats stats;
+    assert(cpu_run_sampled(cpu, &config, &stats) == 5);
+    assert(stats.functional_instructions == 50000);
+    assert(stats.detailed_instructions > 0 && stats.cpi >= 1.0);
+    
+    cpu_destroy(cpu);
+    
+    printf("Functional fast-forward test PASSED\n");
+}
+
+void test_tomasulo(void) {
+    printf("Testing out-of-order core...\n");
+    
+    CPU* cpu = cpu_create(64 * KiB);
+    
+    // In-order reference
+    load_sum_program(cpu, 100);
+    while (!cpu->halted) cpu_step(cpu);
+    cpu_drain_pipeline(cpu);
+    assert(sum_result(cpu) == 5050);
+    uint64_t inorder_cycles = cpu->cycles;
+    uint64_t halt_pc = cpu->pc;
+    
+    OoOConfig config = { .rob_size = 64, .rs_count = 16, .dispatch_width = 4,
+                         .issue_width = 4, .commit_width = 4 };
+    OoOConfig bad = config;
+    bad.rob_size = 0;
+    assert(tomasulo_create(cpu, &bad) == NULL);
+    tomasulo_destroy(cpu->ooo);
+    cpu->ooo = tomasulo_create(cpu, &config);
+    assert(cpu->ooo != NULL);
+    
+    // Same program, same result, fewer cycles; 2 loads, 100 x 3, store, hlt
+    load_sum_program(cpu, 100);
+    while (!cpu->halted || cpu->ooo->rob_count > 0) tomasulo_step(cpu->ooo);
+    assert(cpu->registers[2] == 5050 && sum_result(cpu) == 5050);
+    assert(cpu->pc == halt_pc);
+    assert(cpu->instructions == 304 && cpu->ooo->committed == 304);
+    assert(cpu->ooo->squashed > 0 && cpu->ooo->mispredicts > 0);
+    assert(cpu->cycles < inorder_cycles);
+    
+    // A load behind a store to the same address sees the stored value
+    uint8_t program[64];
+    uint32_t n = 0;
+    uint64_t value = 21;
+    load_sum_program(cpu, 0);
+    gmem_store64(cpu->memory, 0x100, value);
+    n += emit(program + n, INST_LD, FORMAT_M, 0, 0, 0, 0x100);
+    n += emit(program + n, INST_ST, FORMAT_M, 0, 0, 0, 0x118);
+    n += emit(program + n, INST_LD, FORMAT_M, 1, 0, 0, 0x118);
+    n += emit(program + n, INST_ADD, FORMAT_R, 4, 1, 1, 0);
+    n += emit(program + n, INST_HLT, FORMAT_S, 0, 0, 0, 0);
+    cpu_load_program(cpu, program, n, 0x1000);
+    tomasulo_run(cpu->ooo, 200);
+    assert(cpu->registers[4] == 42);
+    
+    // A miss longer than the completion wheel still takes its full latency
+    int penalty = cpu->l1_cache->miss_penalty;
+    cpu->l1_cache->miss_penalty = 1000;
+    n = 0;
+    load_sum_program(cpu, 0);
+    gmem_store64(cpu->memory, 0x3000, value);
+    n += emit(program + n, INST_LD, FORMAT_M, 5, 0, 0, 0x3000);
+    n += emit(program + n, INST_ADD, FORMAT_R, 6, 5, 5, 0);
+    n += emit(program + n, INST_HLT, FORMAT_S, 0, 0, 0, 0);
+    cpu_load_program(cpu, program, n, 0x1000);
+    cpu->registers[6] = 0;
+    tomasulo_run(cpu->ooo, 900);
+    assert(cpu->registers[6] == 0);
+    tomasulo_run(cpu->ooo, 200);
+    assert(cpu->registers[6] == 42);
+    cpu->l1_cache->miss_penalty = penalty;
+    
+    // Drain mid-run hands off to functional mode
+    load_sum_program(cpu, 10);
+    tomasulo_run(cpu->ooo, 25);
+    cpu_fast_forward(cpu, 0, NO_STOP_PC, WARM_NONE);
+    assert(cpu->ooo->rob_count == 0);
+    assert(cpu->registers[2] == 55 && sum_result(cpu) == 55);
+    
+    tomasulo_print_stats(cpu->ooo);
+    cpu_destroy(cpu);
+    
+    printf("Out-of-order core test PASSED\n");
+}
+
+void test_multicore(void) {
+    printf("Testing multicore system...\n");
+    
+    MulticoreConfig config = {
+        .cores = 4, .threads = 2, .quantum = 50,
+        .l2 = { CACHE_SET_ASSOC, 256 * KiB, 64, 16 },
+        .l2_banks = 4, .l2_latency = 10, .memory_latency = 100,
+    };
+    MulticoreConfig bad = config;
+    bad.l2_banks = 3;
+    assert(multicore_create(64 * KiB, &bad) == NULL);
+    
+    // Every core runs the sum program over the same shared data and stores
+    // to the line they all read, so each store invalidates the others
+    uint8_t program[64];
+    uint64_t count = 10, one = 1;
+    uint32_t size = build_sum_program(program, 0x1000);
+    uint64_t cycles[2];
+    
+    for (int run = 0; run < 2; run++) {
+        config.threads = run + 1;
+        MulticoreSystem* sys = multicore_create(64 * KiB, &config);
+        assert(sys != NULL);
+        
+        gmem_store64(sys->memory, 0x100, count);
+        gmem_store64(sys->memory, 0x108, one);
+        assert(multicore_load_program(sys, program, size, 0x1000) == 0);
+        
+        cycles[run] = multicore_run(sys, 100000);
+        assert(cycles[run] % config.quantum == 0 && cycles[run] < 100000);
+        assert(sys->threads_used == config.threads);
+        
+        uint64_t invalidations = 0;
+        for (int c = 0; c < config.cores; c++) {
+            assert(sys->cores[c]->halted);
+            assert(sys->cores[c]->registers[2] == 55);
+            invalidations += sys->contexts[c].invalidations;
+        }
+        assert(sum_result(sys->cores[0]) == 55);
+        assert(invalidations > 0);
+        
+        // The directory lists only cores whose L1 still holds the line
+        DirectoryEntry* dir = &sys->directory[0x110 >> sys->line_shift];
+        assert(dir->state == MESI_MODIFIED || dir->state == MESI_SHARED);
+        
+        if (run == 1) multicore_print_stats(sys);
+        multicore_destroy(sys);
+    }
+    assert(cycles[0] == cycles[1]);
+    
+    // A line read into E and then written comes from the writer's L1
+    MulticoreSystem* sys = multicore_create(64 * KiB, &config);
+    assert(sys != NULL);
+    multicore_access(sys, 0, 0x2000, false);
+    assert(sys->directory[0x2000 >> sys->line_shift].state == MESI_EXCLUSIVE);
+    multicore_access(sys, 0, 0x2000, true);
+    uint64_t transfers = sys->contexts[1].transfers;
+    int latency = multicore_access(sys, 1, 0x2000, false);
+    assert(sys->contexts[1].transfers == transfers + 1);
+    assert(latency == sys->cores[1]->l1_cache->hit_time + 2 * config.l2_latency);
+    multicore_destroy(sys);
+    
+    printf("Multicore system test PASSED\n");
+}
+
+void test_profiler(void) {
+    printf("Testing profiler...\n");
+    
+    Profiler* prof = profiler_create();
+    assert(prof != NULL);
+    
+    // Attribution records are found again by PC
+    profiler_pc(prof, 0x1010)->stalls += 2;
+    profiler_pc(prof, 0x2010)->flushes++;
+    profiler_pc(prof, 0x1010)->mem_cycles += 5;
+    assert(prof->pc_count == 2);
+    assert(profiler_pc(prof, 0x1010)->stalls == 2);
+    
+    const char* path = "/tmp/spectre_profile_test.json";
+    assert(profiler_export(prof, path) == 0);
+    FILE* f = fopen(path, "r");
+    assert(f != NULL);
+    char buf[4096];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    remove(path);
+    assert(strstr(buf, "\"residency\"") && strstr(buf, "\"pc\": 4112"));
+    profiler_destroy(prof);
+    
+#if ENABLE_PROFILER
+    // Built in: the pipeline hooks fill the CPU's profiler
+    CPU* cpu = cpu_create(64 * KiB);
+    load_sum_program(cpu, 10);
+    cpu_run(cpu, 2000);
+    assert(cpu->prof->calls[STAGE_FETCH] == cpu->prof->calls[STAGE_COMMIT]);
+    assert(cpu->prof->calls[STAGE_FETCH] > 0 && cpu->prof->calls[STAGE_FETCH] < 2000);
+    assert(cpu->prof->calls[PROF_CACHE] > 0 && cpu->prof->pc_count > 0);
+    assert(cpu->prof->residency[STAGE_DECODE][1] > 0);
+    cpu_destroy(cpu);
+#endif
+    
+    printf("Profiler test PASSED\n");
+}
+
 void test_branch_predictor(void) {
     printf("Testing branch predictor...\n");
     
@@ -51,6 +496,261 @@ void test_branch_predictor(void) {
     printf("Branch predictor test PASSED\n");
 }
 
+void test_branch_replay(void) {
+    printf("Testing branch trace replay...\n");
+
+    // Per iteration: a random branch, one that copies it, and a loop
+    // back-edge taken 7 times out of 8
+    size_t n = 30000;
+    BranchRecord* trace = (BranchRecord*)calloc(n, sizeof(BranchRecord));
+    assert(trace != NULL);
+    uint64_t state = 7;
+    bool last = false;
+    for (size_t i = 0; i < n; i++) {
+        switch (i % 3) {
+            case 0:
+                trace[i].pc = 0x3000;
+                last = splitmix64(&state) & 1;
+                trace[i].taken = last;
+                break;
+            case 1:
+                trace[i].pc = 0x2000;
+                trace[i].taken = last;
+                break;
+            default:
+                trace[i].pc = 0x1000;
+                trace[i].taken = (i / 3) % 8 != 7;
+                break;
+        }
+        trace[i].target = trace[i].pc + 0x40;
+        trace[i].kind = BRANCH_CONDITIONAL;
+    }
+
+    BranchPredictor* bimodal = bp_create(PREDICTOR_BIMODAL, 12, 1000);
+    BranchPredictor* tage = bp_create(PREDICTOR_TAGE, 64, 4096);
+    BranchPredictor* perceptron = bp_create(PREDICTOR_PERCEPTRON, 32, 4096);
+    assert(bimodal && tage && perceptron);
+    assert(bimodal->pht_size == 1024);
+
+    uint64_t base = bp_replay_batch(bimodal, trace, n);
+    uint64_t tage_correct = bp_replay_batch(tage, trace, n);
+    uint64_t perceptron_correct = bp_replay_batch(perceptron, trace, n);
+    assert(bimodal->total == n && bimodal->correct == base);
+    assert(tage_correct > base + n / 8);
+    assert(perceptron_correct > base + n / 8);
+
+    // The per-branch interface trains identically
+    BranchPredictor* stepped = bp_create(PREDICTOR_TAGE, 64, 4096);
+    assert(stepped != NULL);
+    for (size_t i = 0; i < n; i++) {
+        bool predicted = bp_predict(stepped, trace[i].pc);
+        bp_update(stepped, trace[i].pc, trace[i].taken, predicted);
+    }
+    assert(stepped->correct == tage_correct);
+
+    // Calls from two sites into one function: the RAS gets every return
+    BranchRecord calls[400];
+    for (int i = 0; i < 400; i += 2) {
+        uint64_t site = (i / 2) % 2 ? 0x200 : 0x100;
+        calls[i] = (BranchRecord){ .pc = site, .target = 0x800, .taken = true,
+                                   .kind = BRANCH_CALL, .size = 8 };
+        calls[i + 1] = (BranchRecord){ .pc = 0x900, .target = site + 8, .taken = true,
+                                       .kind = BRANCH_RETURN };
+    }
+    BranchPredictor* targets = bp_create(PREDICTOR_BIMODAL, 12, 4096);
+    assert(targets != NULL);
+    bp_replay_batch(targets, calls, 400);
+    assert(targets->total == 0);
+    assert(targets->target_total == 400);
+    assert(targets->target_correct == 400 - 2);
+
+    bp_print_stats(tage);
+    bp_destroy(targets);
+    bp_destroy(stepped);
+    bp_destroy(perceptron);
+    bp_destroy(tage);
+    bp_destroy(bimodal);
+    free(trace);
+
+    printf("Branch trace replay test PASSED\n");
+}
+
+void test_trace(void) {
+    printf("Testing trace files...\n");
+
+    const char* path = "test_trace.bin";
+    enum { FETCHES = 5000, ACCESSES = 3000, BRANCHES = 2500 };
+    static uint64_t pcs[FETCHES], addrs[ACCESSES];
+    static uint8_t writes[ACCESSES];
+    static BranchRecord branches[BRANCHES];
+    uint64_t state = 99;
+    for (int i = 0; i < FETCHES; i++) pcs[i] = 0x1000 + (splitmix64(&state) % 64) * 4;
+    for (int i = 0; i < ACCESSES; i++) {
+        addrs[i] = i % 7 ? addrs[MAX(i - 1, 0)] + 8 : splitmix64(&state) >> 20;
+        writes[i] = i % 3 == 0;
+    }
+    for (int i = 0; i < BRANCHES; i++) {
+        uint64_t pc = 0x2000 + (splitmix64(&state) % 256) * 8;
+        branches[i] = (BranchRecord){ .pc = pc, .target = pc - 0x40 + i % 3,
+                                      .taken = i % 5 != 0, .kind = i % 4, .size = 10 };
+    }
+
+    // Small blocks so every stream spans several, interleaved in the file
+    TraceWriter* writer = trace_writer_create(path, 1000, TRACE_CODEC_VARINT);
+    assert(writer != NULL);
+    for (int i = 0; i < FETCHES; i++) {
+        trace_write_fetch(writer, pcs[i]);
+        if (i < ACCESSES) trace_write_mem(writer, addrs[i], writes[i]);
+        if (i < BRANCHES) trace_write_branch(writer, &branches[i]);
+    }
+    assert(trace_writer_close(writer) == 0);
+
+    TraceReader* reader = trace_open(path);
+    assert(reader != NULL);
+    assert(reader->header.counts[TRACE_FETCH] == FETCHES);
+    assert(reader->header.counts[TRACE_MEM] == ACCESSES);
+    assert(reader->header.counts[TRACE_BRANCH] == BRANCHES);
+    assert(reader->block_count[TRACE_FETCH] == 5 && reader->block_count[TRACE_BRANCH] == 3);
+
+    TraceCursor cursor;
+    size_t n, seen = 0;
+    assert(trace_cursor_init(&cursor, reader, TRACE_MEM) == 0);
+    while ((n = trace_next_block(&cursor)) > 0) {
+        for (size_t i = 0; i < n; i++, seen++) {
+            assert(cursor.addrs[i] == addrs[seen] && cursor.is_write[i] == writes[seen]);
+        }
+    }
+    assert(seen == ACCESSES);
+    trace_cursor_destroy(&cursor);
+
+    seen = 0;
+    assert(trace_cursor_init(&cursor, reader, TRACE_BRANCH) == 0);
+    while ((n = trace_next_block(&cursor)) > 0) {
+        for (size_t i = 0; i < n; i++, seen++) {
+            const BranchRecord* r = &cursor.branches[i];
+            assert(r->pc == branches[seen].pc && r->target == branches[seen].target);
+            assert(r->taken == branches[seen].taken && r->kind == branches[seen].kind);
+            assert(r->size == branches[seen].size);
+        }
+    }
+    assert(seen == BRANCHES);
+    trace_cursor_destroy(&cursor);
+
+    // Sweeps give the same results from the file as from the arrays
+    SweepTrace arrays = { .addrs = addrs, .is_write = writes, .addr_count = ACCESSES,
+                          .branches = branches, .branch_count = BRANCHES };
+    SweepTrace file = { .file = reader };
+    CacheConfig config = { CACHE_SET_ASSOC, 8 * KiB, 64, 4 };
+    Sweep* from_arrays = sweep_create(&arrays, 1);
+    Sweep* from_file = sweep_create(&file, 1);
+    assert(sweep_add_cache(from_arrays, config, PATTERN_TRACE, 0) == 0);
+    assert(sweep_add_cache(from_file, config, PATTERN_TRACE, 0) == 0);
+    assert(sweep_add_predictor(from_arrays, PREDICTOR_TAGE, 32, 4096) == 1);
+    assert(sweep_add_predictor(from_file, PREDICTOR_TAGE, 32, 4096) == 1);
+    assert(sweep_run(from_arrays, 1) == 0 && sweep_run(from_file, 2) == 0);
+    for (int j = 0; j < 2; j++) {
+        assert(!from_file->jobs[j].failed);
+        assert(from_file->jobs[j].events == from_arrays->jobs[j].events);
+        assert(from_file->jobs[j].hits == from_arrays->jobs[j].hits);
+    }
+    assert(from_file->jobs[0].cycles == from_arrays->jobs[0].cycles);
+    sweep_destroy(from_arrays);
+    sweep_destroy(from_file);
+    trace_close(reader);
+
+    // Capture from the pipeline: 2 loads, 10 loop branches, the store
+    CPU* cpu = cpu_create(64 * KiB);
+    load_sum_program(cpu, 10);
+    cpu->trace = trace_writer_create(path, 0, TRACE_CODEC_VARINT);
+    assert(cpu->trace != NULL);
+    cpu_run(cpu, 2000);
+    assert(cpu->halted);
+    assert(trace_writer_close(cpu->trace) == 0);
+    cpu->trace = NULL;
+
+    reader = trace_open(path);
+    assert(reader != NULL);
+    assert(reader->header.counts[TRACE_FETCH] >= 33);
+    assert(reader->header.counts[TRACE_MEM] == 3);
+    assert(reader->header.counts[TRACE_BRANCH] == 10);
+    assert(trace_cursor_init(&cursor, reader, TRACE_BRANCH) == 0);
+    assert(trace_next_block(&cursor) == 10);
+    int taken = 0;
+    for (int i = 0; i < 10; i++) {
+        taken += cursor.branches[i].taken;
+        assert(cursor.branches[i].kind == BRANCH_CONDITIONAL);
+    }
+    assert(taken == 9);
+    trace_cursor_destroy(&cursor);
+    trace_close(reader);
+    cpu_destroy(cpu);
+
+    // Anything else is rejected
+    FILE* f = fopen(path, "wb");
+    assert(f != NULL);
+    fputs("not a trace, just some bytes to fill a header out with", f);
+    fclose(f);
+    assert(trace_open(path) == NULL);
+    remove(path);
+
+    // A failed write drops later records instead of overrunning the block
+    writer = trace_writer_create("/dev/full", 16, TRACE_CODEC_VARINT);
+    assert(writer != NULL);
+    for (int i = 0; i < 100000; i++) {
+        trace_write_fetch(writer, pcs[i % FETCHES]);
+        trace_write_mem(writer, addrs[i % ACCESSES], writes[i % ACCESSES]);
+        trace_write_branch(writer, &branches[i % BRANCHES]);
+    }
+    assert(writer->failed);
+    assert(writer->pending[TRACE_FETCH] < 16 && writer->pending[TRACE_BRANCH] < 16);
+    assert(trace_writer_close(writer) != 0);
+
+    printf("Trace file test PASSED\n");
+}
+
+void test_guest_memory(void) {
+    printf("Testing sparse guest memory...\n");
+
+    // A large guest costs nothing until it is written
+    GuestMemory* mem = gmem_create(64ULL * GiB);
+    assert(mem != NULL);
+    assert(mem->resident_pages == 0);
+    assert(gmem_load64(mem, 0) == 0);
+    assert(gmem_load64(mem, 64ULL * GiB - 8) == 0);
+    gmem_store64(mem, 0x1000, 0);
+    assert(mem->resident_pages == 0);
+
+    gmem_store64(mem, 40ULL * GiB, 0x1234);
+    assert(mem->resident_pages == 1);
+    assert(gmem_load64(mem, 40ULL * GiB) == 0x1234);
+
+    // Unaligned accesses may straddle two pages
+    uint64_t addr = 3 * PAGE_SIZE - 3;
+    gmem_store64(mem, addr, 0x1122334455667788ULL);
+    assert(mem->resident_pages == 3);
+    assert(gmem_load64(mem, addr) == 0x1122334455667788ULL);
+    uint8_t bytes[4];
+    gmem_read(mem, 3 * PAGE_SIZE, bytes, sizeof(bytes));
+    assert(bytes[0] == 0x55 && bytes[3] == 0x22);
+
+    // Past the end reads as zero and writes are dropped
+    gmem_write(mem, 64ULL * GiB - 2, "abcd", 4);
+    gmem_read(mem, 64ULL * GiB - 2, bytes, sizeof(bytes));
+    assert(bytes[0] == 'a' && bytes[1] == 'b' && bytes[2] == 0 && bytes[3] == 0);
+    uint64_t resident = mem->resident_pages;
+
+    // Discarding only frees whole pages
+    gmem_discard(mem, 2 * PAGE_SIZE, 2 * PAGE_SIZE - 1);
+    assert(mem->resident_pages == resident - 1);
+    assert(gmem_load64(mem, addr) == 0x1122334455667788ULL >> 24 << 24);
+    gmem_discard(mem, 0, 64ULL * GiB);
+    assert(mem->resident_pages == 0);
+    assert(gmem_load64(mem, 40ULL * GiB) == 0);
+    gmem_destroy(mem);
+
+    printf("Sparse guest memory test PASSED\n");
+}
+
 void test_scheduler(void) {
     printf("Testing scheduler...\n");
     
@@ -66,8 +766,8 @@ void test_scheduler(void) {
     
     assert(sched.process_count == 5);
     
-    // Run scheduler for some ticks
-    for (int i = 0; i < 100; i++) {
+    // Long enough for each level to get a turn, with a priority boost
+    for (int i = 0; i < 2 * SCHEDULER_BOOST_TICKS; i++) {
         scheduler_tick(&sched);
     }
     
@@ -82,10 +782,157 @@ void test_scheduler(void) {
     for (int i = 0; i < sched.process_count; i++) {
         pcb_destroy(sched.processes[i]);
     }
+    scheduler_destroy(&sched);
     
     printf("Scheduler test PASSED\n");
 }
 
+void test_mlfq(void) {
+    printf("Testing MLFQ levels and boost...\n");
+
+    Scheduler* sched = (Scheduler*)malloc(sizeof(Scheduler));
+    assert(sched != NULL);
+    scheduler_init(sched);
+
+    // Highest level first, FIFO within a level, demoted after a full quantum
+    PCB* low = pcb_create(sched->next_pid++, NULL);
+    PCB* a = pcb_create(sched->next_pid++, NULL);
+    PCB* b = pcb_create(sched->next_pid++, NULL);
+    low->priority = 5;
+    a->priority = 0;
+    b->priority = 0;
+    a->quantum = b->quantum = low->quantum = 2;
+    scheduler_add_process(sched, low);
+    scheduler_add_process(sched, a);
+    scheduler_add_process(sched, b);
+    assert(sched->cpus[0].ready_bitmap == ((1u << 0) | (1u << 5)));
+
+    scheduler_tick(sched);
+    assert(sched->cpus[0].current == a);
+    scheduler_tick(sched);
+    scheduler_tick(sched);
+    assert(sched->cpus[0].current == b);
+    assert(scheduler_priority(sched, a) == 1);
+    scheduler_tick(sched);
+    scheduler_tick(sched);
+    assert(sched->cpus[0].current == a);
+    assert(sched->cpus[0].ready_bitmap == ((1u << 1) | (1u << 5)));
+
+    // Removing a queued process leaves the rest of its level intact
+    scheduler_remove_process(sched, b);
+    scheduler_remove_process(sched, low);
+    assert(sched->cpus[0].ready_bitmap == 0);
+    scheduler_remove_process(sched, a);
+    assert(sched->cpus[0].current == NULL);
+    pcb_destroy(low);
+    pcb_destroy(a);
+    pcb_destroy(b);
+    scheduler_destroy(sched);
+    free(sched);
+
+    // Two processes with quanta longer than the boost period would keep a
+    // demoted one off the CPU for tens of thousands of ticks without a boost
+    sched = (Scheduler*)malloc(sizeof(Scheduler));
+    assert(sched != NULL);
+    scheduler_init(sched);
+    PCB* hog = pcb_create(sched->next_pid++, NULL);
+    hog->priority = MLFQ_LEVELS - 1;
+    hog->quantum = 10;
+    PCB* busy[2];
+    for (int i = 0; i < 2; i++) {
+        busy[i] = pcb_create(sched->next_pid++, NULL);
+        busy[i]->priority = 0;
+        busy[i]->quantum = SCHEDULER_BOOST_TICKS * 3 / 2;
+        scheduler_add_process(sched, busy[i]);
+    }
+    scheduler_add_process(sched, hog);
+    for (int i = 0; i < 4 * SCHEDULER_BOOST_TICKS; i++) {
+        scheduler_tick(sched);
+    }
+    assert(hog->cpu_time > 0);
+    assert(sched->boost_epoch == 4);
+
+    for (int i = 0; i < sched->process_count; i++) {
+        pcb_destroy(sched->processes[i]);
+    }
+    scheduler_destroy(sched);
+    free(sched);
+
+    printf("MLFQ test PASSED\n");
+}
+
+void test_smp_scheduler(void) {
+    printf("Testing SMP scheduler...\n");
+
+    Scheduler* sched = (Scheduler*)malloc(sizeof(Scheduler));
+    assert(sched != NULL);
+    scheduler_init(sched);
+    assert(scheduler_set_cpus(sched, 4) == 0);
+    assert(scheduler_set_cpus(sched, SCHED_MAX_CPUS + 1) == -1);
+
+    // New processes spread over the least loaded CPUs
+    PCB* pcbs[8];
+    for (int i = 0; i < 8; i++) {
+        pcbs[i] = pcb_create(sched->next_pid++, NULL);
+        pcbs[i]->quantum = 5;
+        scheduler_add_process(sched, pcbs[i]);
+    }
+    for (int cpu = 0; cpu < 4; cpu++) {
+        assert(sched->cpus[cpu].nr_ready == 2);
+    }
+    assert(scheduler_set_cpus(sched, 2) == -1);
+
+    scheduler_tick(sched);
+    for (int cpu = 0; cpu < 4; cpu++) {
+        assert(sched->cpus[cpu].current != NULL);
+    }
+
+    // Emptying CPU 3 makes it steal from the busiest queue instead of idling
+    for (int i = 0; i < 8; i++) {
+        if (pcbs[i]->cpu == 3) scheduler_remove_process(sched, pcbs[i]);
+    }
+    assert(sched->cpus[3].current == NULL && sched->cpus[3].nr_ready == 0);
+    scheduler_tick(sched);
+    assert(sched->cpus[3].current != NULL);
+    assert(sched->cpus[3].steals == 1 && sched->migrations == 1);
+    PCB* stolen = sched->cpus[3].current;
+    assert(stolen->migrations == 1 && stolen->migration_penalty > 0);
+
+    // A process pinned to CPU 0 is never stolen and stays there
+    PCB* pinned = pcb_create(sched->next_pid++, NULL);
+    pinned->affinity = 1ULL << 0;
+    scheduler_add_process(sched, pinned);
+    assert(pinned->cpu == 0);
+    for (int i = 0; i < 200; i++) {
+        scheduler_tick(sched);
+        assert(pinned->cpu == 0);
+    }
+    assert(pinned->cpu_time > 0);
+    assert(sched->cpus[3].migration_ticks >= SCHEDULER_MIGRATION_TICKS);
+
+    // Narrowing the affinity of a queued process moves it immediately
+    PCB* mover = NULL;
+    for (int i = 0; i < 8 && !mover; i++) {
+        if (pcbs[i]->queued && pcbs[i]->cpu != 2) mover = pcbs[i];
+    }
+    assert(mover != NULL);
+    scheduler_set_affinity(sched, mover, 1ULL << 2);
+    assert(mover->cpu == 2 && mover->queued);
+
+    assert(scheduler_latency_percentile(sched, 0.5) <=
+           scheduler_latency_percentile(sched, 0.99));
+    assert(scheduler_latency_percentile(sched, 1.0) == sched->max_latency);
+    scheduler_print_stats(sched);
+
+    for (int i = 0; i < sched->process_count; i++) {
+        pcb_destroy(sched->processes[i]);
+    }
+    scheduler_destroy(sched);
+    free(sched);
+
+    printf("SMP scheduler test PASSED\n");
+}
+
 void test_memory_manager(void) {
     printf("Testing memory manager...\n");
     
@@ -116,6 +963,639 @@ void test_memory_manager(void) {
     printf("Memory manager test PASSED\n");
 }
 
+void test_page_tables(void) {
+    printf("Testing page tables and TLBs...\n");
+
+    MemoryManager* mm = mm_create(64 * MiB);
+    assert(mm != NULL);
+
+    // First touch walks all four levels, the second hits the L1 TLB
+    uint64_t base1 = mm_allocate_pages(mm, 1, 4);
+    assert(base1 != 0);
+    assert(mm_translate_address(mm, 1, 0x1234) == base1 + 0x1234);
+    assert(mm->tlb_misses == 1 && mm->walk_levels == PT_LEVELS);
+    assert(mm_translate_address(mm, 1, 0x1ff8) == base1 + 0x1ff8);
+    assert(mm->tlb_hits == 1 && mm->l1_tlb.hits == 1);
+    assert(mm->page_faults == 0);
+
+    // The same virtual page in another address space is a different entry
+    uint64_t base2 = mm_allocate_pages(mm, 2, 4);
+    assert(mm_translate_address(mm, 2, 0x1234) == base2 + 0x1234);
+    assert(mm->tlb_misses == 2);
+
+    // Runs of 2MB or more are mapped with huge pages, one level shorter
+    uint64_t base3 = mm_allocate_pages(mm, 3, 2 * PT_ENTRIES);
+    assert(base3 % HUGE_PAGE_SIZE == 0);
+    assert(mm->huge_pages == 2);
+    uint64_t levels = mm->walk_levels;
+    assert(mm_translate_address(mm, 3, 0x323456) == base3 + 0x323456);
+    assert(mm->walk_levels - levels == PT_LEVELS - 1);
+    assert(mm_translate_address(mm, 3, 0x3fffff) == base3 + 0x3fffff);
+    assert(mm->tlb_misses == 3);
+
+    // More pages than the L1 holds still hit in the L2
+    mm_allocate_pages(mm, 4, 256);
+    for (uint64_t page = 0; page < 256; page++) {
+        mm_translate_address(mm, 4, page * PAGE_SIZE);
+    }
+    uint64_t misses = mm->tlb_misses;
+    for (uint64_t page = 0; page < 256; page++) {
+        mm_translate_address(mm, 4, page * PAGE_SIZE);
+    }
+    assert(mm->tlb_misses == misses);
+    assert(mm->l2_tlb.hits >= 256 - DEFAULT_TLB_L1_ENTRIES);
+
+    // Freeing flushes the PID's translations; touching it again faults
+    mm_free_pages(mm, 1);
+    assert(mm_translate_address(mm, 1, 0x1234) != 0);
+    assert(mm->page_faults == 1);
+
+    for (uint32_t pid = 1; pid <= 4; pid++) {
+        mm_free_pages(mm, pid);
+    }
+    assert(mm->free_pages == mm->total_pages - 1);
+    assert(mm->huge_pages == 0 && mm->table_count == 0);
+    mm_destroy(mm);
+
+    printf("Page table test PASSED\n");
+}
+
+void test_buddy_allocator(void) {
+    printf("Testing buddy page allocator...\n");
+
+    MemoryManager* mm = mm_create(64 * MiB);
+    assert(mm != NULL);
+    double initial = mm_fragmentation(mm);
+    uint64_t free_pages = mm->free_pages;
+
+    // Odd sizes take exactly what they ask for
+    uint64_t a = mm_allocate_pages(mm, 1, 3);
+    uint64_t b = mm_allocate_pages(mm, 2, 1000);
+    assert(a != 0 && b != 0);
+    assert(mm->free_pages == free_pages - 1003);
+    assert(mm_translate_address(mm, 1, 2 * PAGE_SIZE) == a + 2 * PAGE_SIZE);
+    assert(mm_translate_address(mm, 2, 999 * PAGE_SIZE) == b + 999 * PAGE_SIZE);
+
+    // A demand fault refills the PID's frame cache in one batch
+    uint64_t fault = mm_translate_address(mm, 5, 0x100000);
+    assert(fault != 0);
+    assert(mm_space(mm, 5, false)->cache.count == (1u << FRAME_CACHE_BATCH_ORDER) - 1);
+    assert(mm->live_count == 3 && mm->space_capacity < MAX_PROCESSES);
+    assert(mm->free_pages == free_pages - 1004);
+
+    // An unmapped frame is reused by the PID's next fault
+    assert(mm_unmap_page(mm, 5, 0x100000) == 0);
+    assert(mm_unmap_page(mm, 5, 0x100000) == -1);
+    assert(mm_space(mm, 5, false)->cache.count == 1u << FRAME_CACHE_BATCH_ORDER);
+    assert(mm_translate_address(mm, 5, 0x200000) == fault);
+
+    // Huge mappings stay whole
+    uint64_t huge = mm->huge_pages;
+    mm_allocate_pages(mm, 3, PT_ENTRIES);
+    assert(mm->huge_pages == huge + 1);
+    assert(mm_unmap_page(mm, 3, 0x1000) == -1);
+
+    // Single frames scattered through memory cannot back huge pages
+    assert(mm_fragmentation(mm) > initial);
+
+    // Everything coalesces back once freed
+    for (uint32_t pid = 1; pid <= 5; pid++) {
+        mm_free_pages(mm, pid);
+    }
+    assert(mm->free_pages == free_pages);
+    assert(mm_space(mm, 5, false) == NULL && mm->live_count == 0);
+    assert(mm_fragmentation(mm) == initial);
+    assert(mm->buddy.blocks[13] == 1);   // frames 8192-16383
+
+    mm_print_stats(mm);
+    mm_destroy(mm);
+
+    // Frames parked in other PIDs' caches go back to the buddy lists when
+    // an allocation would otherwise fail
+    mm = mm_create(64 * PAGE_SIZE);
+    assert(mm != NULL);
+    for (uint32_t pid = 1; pid <= 3; pid++) {
+        assert(mm_translate_address(mm, pid, 0) != 0);
+        assert(mm_unmap_page(mm, pid, 0) == 0);
+    }
+    assert(mm->cached_frames == 3u << FRAME_CACHE_BATCH_ORDER);
+    assert(mm_allocate_pages(mm, 4, 32) != 0);
+    assert(mm->cached_frames == 0);
+
+    // Every free frame backs a demand fault, however the caches hold them
+    uint64_t left = mm->free_pages;
+    for (uint32_t pid = 10; pid < 10 + left; pid++) {
+        assert(mm_translate_address(mm, pid, 0) != 0);
+    }
+    assert(mm->free_pages == 0);
+    mm_destroy(mm);
+
+    printf("Buddy allocator test PASSED\n");
+}
+
+void test_copy_on_write(void) {
+    printf("Testing copy-on-write fork...\n");
+
+    MemoryManager* mm = mm_create(64 * MiB);
+    assert(mm != NULL);
+    uint64_t free_pages = mm->free_pages;
+    double initial = mm_fragmentation(mm);
+
+    // A fork shares every frame
+    uint64_t base = mm_allocate_pages(mm, 1, 4);
+    assert(mm_translate_write(mm, 1, 0x10) == base + 0x10);
+    gmem_write(mm->physical_memory, base, "parent", 7);
+    assert(mm_fork(mm, 1, 2) == 0);
+    assert(mm->free_pages == free_pages - 4);
+    assert(mm_translate_address(mm, 2, 0x10) == base + 0x10);
+    assert(mm_translate_address(mm, 2, 3 * PAGE_SIZE) == base + 3 * PAGE_SIZE);
+
+    // The first write to a shared page copies it, after a read has
+    // cached the shared translation
+    uint64_t copy = mm_translate_write(mm, 2, 0x10) - 0x10;
+    assert(copy != base && mm->cow_copies == 1);
+    assert(mm->free_pages == free_pages - 5);
+    char buf[8];
+    gmem_read(mm->physical_memory, copy, buf, 7);
+    assert(strcmp(buf, "parent") == 0);
+    gmem_write(mm->physical_memory, copy, "child", 6);
+    gmem_read(mm->physical_memory, mm_translate_address(mm, 1, 0), buf, 7);
+    assert(strcmp(buf, "parent") == 0);
+    assert(mm_translate_write(mm, 2, 0x20) == copy + 0x20);
+
+    // The last mapping left just regains write access
+    assert(mm_translate_write(mm, 1, 0) == base);
+    assert(mm->cow_faults == 2 && mm->cow_copies == 1);
+
+    // Unmapping a shared page keeps it for the other side
+    assert(mm_unmap_page(mm, 2, PAGE_SIZE) == 0);
+    assert(mm_translate_address(mm, 1, PAGE_SIZE) == base + PAGE_SIZE);
+    assert(mm->free_pages == free_pages - 5);
+
+    // A write into a shared huge page splits it and copies one 4KB page
+    uint64_t huge_base = mm_allocate_pages(mm, 3, PT_ENTRIES);
+    uint64_t huge = mm->huge_pages;
+    assert(mm_fork(mm, 3, 4) == 0);
+    assert(mm->huge_pages == huge + 1);
+    assert(mm_translate_address(mm, 4, 0x5000) == huge_base + 0x5000);
+    assert(mm_translate_write(mm, 4, 0x5000) != huge_base + 0x5000);
+    assert(mm->huge_pages == huge && mm->cow_copies == 2);
+    assert(mm_translate_address(mm, 4, 0x6000) == huge_base + 0x6000);
+    assert(mm_translate_write(mm, 3, 0x100000) != huge_base + 0x100000);
+    assert(mm_translate_write(mm, 3, 0x5000) == huge_base + 0x5000);
+    assert(mm->cow_copies == 3 && mm->huge_pages == huge - 1);
+
+    // Reserved pages cost nothing until touched
+    uint64_t used = mm->free_pages;
+    uint64_t vaddr;
+    assert(mm_reserve_pages(mm, 5, 100000, &vaddr) == 0);
+    assert(mm->free_pages == used);
+    assert(mm_translate_write(mm, 5, vaddr + 777 * PAGE_SIZE) != 0);
+    assert(mm->free_pages == used - 1);
+
+    for (uint32_t pid = 1; pid <= 5; pid++) {
+        mm_free_pages(mm, pid);
+    }
+    assert(mm->free_pages == free_pages);
+    assert(mm_fragmentation(mm) == initial);
+    mm_destroy(mm);
+
+    // Forked processes only cost page tables
+    Microkernel* kernel = kernel_create(64 * MiB);
+    assert(kernel != NULL);
+    uint32_t pid = kernel_create_process(kernel, NULL);
+    PCB* pcb = kernel_find_process(kernel, pid);
+    vfs_create_file(kernel->filesystem, "shared.txt", 16);
+    uint64_t fd = syscall_invoke(kernel, pcb, SYS_OPEN, (uint64_t)"shared.txt", 0, 0, 0);
+    free_pages = kernel->mm->free_pages;
+    for (int i = 0; i < 2000; i++) {
+        assert(syscall_invoke(kernel, pcb, SYS_FORK, 0, 0, 0, 0) != (uint64_t)-1);
+    }
+    assert(kernel->mm->free_pages == free_pages);
+    PCB* child = kernel_find_process(kernel, pid + 2000);
+    assert(child != NULL && child->open_files[fd] != pcb->open_files[fd]);
+    assert(child->open_files[fd] != -1);
+    uint64_t region = syscall_invoke(kernel, child, SYS_MMAP, 0, 3 * PAGE_SIZE + 1, 0, 0);
+    assert(region != (uint64_t)-1 && region % PAGE_SIZE == 0);
+    assert(kernel->mm->free_pages == free_pages);
+    kernel_destroy(kernel);
+
+    printf("Copy-on-write test PASSED\n");
+}
+
+void test_swap(void) {
+    printf("Testing page replacement and swap...\n");
+
+    SwapPolicy policies[2] = {SWAP_CLOCK, SWAP_WSCLOCK};
+    for (int p = 0; p < 2; p++) {
+        MemoryManager* mm = mm_create(1 * MiB);
+        VFS* vfs = vfs_create();
+        assert(mm != NULL && vfs != NULL);
+        uint64_t free_pages = mm->free_pages;
+        assert(mm_enable_swap(mm, vfs, "swap", 1024, policies[p]) == 0);
+        assert(mm_enable_swap(mm, vfs, "swap2", 1024, policies[p]) == -1);
+
+        // Twice as many dirty pages as frames: the rest go to swap
+        for (uint64_t page = 0; page < 512; page++) {
+            uint64_t paddr = mm_translate_write(mm, 1, page * PAGE_SIZE);
+            assert(paddr != 0);
+            gmem_store64(mm->physical_memory, paddr, page * 7 + 1);
+        }
+        SwapArea* swap = mm->swap;
+        assert(swap->evictions >= 512 - free_pages);
+        assert(swap->swap_outs > 0 && swap->writes < swap->swap_outs);
+
+        // Pages only read hold nothing and are dropped, not written
+        uint64_t outs = swap->swap_outs;
+        for (uint64_t page = 1000; page < 1400; page++) {
+            assert(mm_translate_address(mm, 1, page * PAGE_SIZE) != 0);
+        }
+        assert(swap->dropped > 0);
+        assert(gmem_load64(mm->physical_memory, mm_translate_address(mm, 1, 1000 * PAGE_SIZE)) == 0);
+
+        // Everything reads back, from swap where it has to
+        for (uint64_t page = 0; page < 512; page++) {
+            uint64_t paddr = mm_translate_address(mm, 1, page * PAGE_SIZE);
+            assert(paddr != 0);
+            assert(gmem_load64(mm->physical_memory, paddr) == page * 7 + 1);
+        }
+        assert(swap->swap_ins > 0 && swap->swap_outs >= outs);
+        assert(mm_working_set(mm, 1, swap->window) <= free_pages);
+
+        // A fork shares swapped-out pages through their slots. Shared
+        // frames cannot be evicted, so free some first.
+        for (uint64_t page = 384; page < 512; page++) {
+            mm_unmap_page(mm, 1, page * PAGE_SIZE);
+        }
+        assert(mm_fork(mm, 1, 2) == 0);
+        uint64_t paddr = mm_translate_write(mm, 2, 5 * PAGE_SIZE);
+        assert(gmem_load64(mm->physical_memory, paddr) == 5 * 7 + 1);
+        gmem_store64(mm->physical_memory, paddr, 99);
+        for (uint64_t page = 0; page < 384; page++) {
+            uint64_t expect = page * 7 + 1;
+            assert(gmem_load64(mm->physical_memory, mm_translate_address(mm, 1, page * PAGE_SIZE)) == expect);
+            expect = page == 5 ? 99 : expect;
+            assert(gmem_load64(mm->physical_memory, mm_translate_address(mm, 2, page * PAGE_SIZE)) == expect);
+        }
+
+        // Freeing both sides returns every frame and slot
+        mm_swap_flush(mm);
+        mm_free_pages(mm, 1);
+        mm_free_pages(mm, 2);
+        assert(swap->slots_used == 0);
+        assert(mm->free_pages == free_pages);
+        mm_print_stats(mm);
+        mm_destroy(mm);
+        vfs_destroy(vfs);
+    }
+
+    // Forks racing pages queued for write-back: random writes, reads, forks
+    // and frees over far more pages than frames read back what was written
+    for (int p = 0; p < 2; p++) {
+        for (uint64_t run = 1; run <= 8; run++) {
+            MemoryManager* mm = mm_create(64 * PAGE_SIZE);
+            VFS* vfs = vfs_create();
+            assert(mm != NULL && vfs != NULL);
+            assert(mm_enable_swap(mm, vfs, "swap", 1024, policies[p]) == 0);
+
+            uint64_t shadow[8][32] = {{0}};
+            uint64_t seed = run;
+            for (int op = 0; op < 4000; op++) {
+                uint64_t r = splitmix64(&seed);
+                uint32_t pid = r % 8;
+                uint32_t page = (r >> 8) % 32;
+                uint32_t kind = (r >> 16) % 100;
+                if (kind < 45) {
+                    uint64_t paddr = mm_translate_write(mm, pid, (uint64_t)page * PAGE_SIZE);
+                    assert(paddr != 0);
+                    gmem_store64(mm->physical_memory, paddr, r);
+                    shadow[pid][page] = r;
+                } else if (kind < 95) {
+                    uint64_t paddr = mm_translate_address(mm, pid, (uint64_t)page * PAGE_SIZE);
+                    assert(paddr != 0);
+                    assert(gmem_load64(mm->physical_memory, paddr) == shadow[pid][page]);
+                } else if (kind < 98) {
+                    uint32_t child = (r >> 24) % 8;
+                    if (child == pid) continue;
+                    assert(mm_fork(mm, pid, child) == 0);
+                    memcpy(shadow[child], shadow[pid], sizeof(shadow[pid]));
+                } else {
+                    mm_free_pages(mm, pid);
+                    memset(shadow[pid], 0, sizeof(shadow[pid]));
+                }
+            }
+            mm_destroy(mm);
+            vfs_destroy(vfs);
+        }
+    }
+
+    printf("Swap test PASSED\n");
+}
+
+#define IPC_THREAD_MSGS 20000
+
+typedef struct {
+    MessageQueue* mq;
+    uint32_t id;
+    uint64_t sum;
+} IpcWorker;
+
+static void* ipc_producer(void* arg) {
+    IpcWorker* w = (IpcWorker*)arg;
+    for (uint32_t i = 1; i <= IPC_THREAD_MSGS; i++) {
+        Message msg = {0};
+        msg.src_pid = w->id;
+        msg.msg_id = i;
+        assert(mq_send(w->mq, &msg, MQ_WAIT_FOREVER) == 0);
+    }
+    return NULL;
+}
+
+static void* ipc_consumer(void* arg) {
+    IpcWorker* w = (IpcWorker*)arg;
+    Message msgs[8];
+    uint32_t last = 0;
+    for (uint32_t got = 0; got < IPC_THREAD_MSGS;) {
+        int n = mq_receive_batch(w->mq, msgs, MIN(8, IPC_THREAD_MSGS - got), MQ_WAIT_FOREVER);
+        for (int i = 0; i < n; i++) {
+            // A single producer's messages arrive in order
+            if (w->mq->mode == MQ_SPSC) assert(msgs[i].msg_id == last + 1);
+            last = msgs[i].msg_id;
+            w->sum += msgs[i].msg_id;
+        }
+        got += n;
+    }
+    return NULL;
+}
+
+void test_ipc(void) {
+    printf("Testing lock-free message queues...\n");
+
+    // FIFO order and a full queue that does not block
+    MessageQueue* mq = mq_create(8, MQ_SPSC);
+    assert(mq != NULL);
+    Message batch[16] = {0};
+    for (int i = 0; i < 16; i++) {
+        batch[i].msg_id = i;
+    }
+    assert(mq_send_batch(mq, batch, 10, 0) == 8);
+    assert(mq_send(mq, &batch[8], 0) == -1);
+
+    uint64_t start = get_time_us();
+    assert(mq_send(mq, &batch[8], 20) == -1);
+    assert(get_time_us() - start >= 15000);
+
+    Message out[16];
+    assert(mq_receive_batch(mq, out, 16, 0) == 8);
+    for (int i = 0; i < 8; i++) {
+        assert(out[i].msg_id == (uint32_t)i);
+    }
+    assert(mq_receive(mq, out, 0) == -1);
+    mq_destroy(mq);
+
+    // Threads on both ends: nothing is lost or delivered twice
+    for (int mode = MQ_SPSC; mode <= MQ_MPMC; mode++) {
+        int threads = mode == MQ_SPSC ? 1 : 4;
+        mq = mq_create(64, (MQMode)mode);
+        IpcWorker producers[4], consumers[4];
+        pthread_t tids[8];
+        for (int t = 0; t < threads; t++) {
+            producers[t] = (IpcWorker){mq, t + 1, 0};
+            consumers[t] = (IpcWorker){mq, t + 1, 0};
+            pthread_create(&tids[t], NULL, ipc_producer, &producers[t]);
+            pthread_create(&tids[threads + t], NULL, ipc_consumer, &consumers[t]);
+        }
+
+        uint64_t sum = 0;
+        for (int t = 0; t < 2 * threads; t++) {
+            pthread_join(tids[t], NULL);
+        }
+        for (int t = 0; t < threads; t++) {
+            sum += consumers[t].sum;
+        }
+        assert(sum == (uint64_t)threads * IPC_THREAD_MSGS * (IPC_THREAD_MSGS + 1) / 2);
+        printf("%s: %lu sender waits, %lu receiver waits\n", mode == MQ_SPSC ? "SPSC" : "MPMC",
+               mq->send_waits, mq->receive_waits);
+        mq_destroy(mq);
+    }
+
+    // Small payloads travel inline, large ones are granted without a copy
+    Microkernel* kernel = kernel_create(16 * MiB);
+    assert(kernel != NULL);
+    int qid = kernel_create_queue(kernel, MQ_MPMC);
+    assert(qid >= 0);
+
+    Message msg = {0};
+    char small[] = "ping";
+    msg_set_payload(&msg, small, sizeof(small));
+    assert(!(msg.flags & MSG_GRANT));
+    assert(kernel_send_message(kernel, qid, &msg) == 0);
+
+    char* large = (char*)malloc(4096);
+    memset(large, 'x', 4096);
+    msg_set_payload(&msg, large, 4096);
+    assert(msg.flags & MSG_GRANT);
+    assert(kernel_send_message(kernel, qid, &msg) == 0);
+
+    small[0] = 'P';
+    assert(kernel_receive_message(kernel, qid, &msg, 0) == 0);
+    assert(strcmp((char*)msg_payload(&msg), "ping") == 0);
+    assert(kernel_receive_message(kernel, qid, &msg, 0) == 0);
+    assert(msg_payload(&msg) == large && msg.size == 4096);
+    free(msg.data);
+
+    // A granted buffer left queued is freed with the queue
+    large = (char*)malloc(4096);
+    msg_set_payload(&msg, large, 4096);
+    assert(kernel_send_message(kernel, qid, &msg) == 0);
+    kernel_destroy(kernel);
+
+    printf("IPC test PASSED\n");
+}
+
+static void count_timer(Microkernel* kernel, void* arg) {
+    uint64_t* fired = (uint64_t*)arg;
+    if (++*fired == 10000) kernel->running = false;
+}
+
+void test_event_clock(void) {
+    printf("Testing event-driven kernel clock...\n");
+    
+    // Skipping quiet ticks gives exactly what ticking one at a time does
+    Scheduler* ticked = (Scheduler*)malloc(sizeof(Scheduler));
+    Scheduler* skipped = (Scheduler*)malloc(sizeof(Scheduler));
+    assert(ticked != NULL && skipped != NULL);
+    Scheduler* scheds[2] = {ticked, skipped};
+    for (int s = 0; s < 2; s++) {
+        scheduler_init(scheds[s]);
+        scheduler_set_cpus(scheds[s], 4);
+        for (uint32_t pid = 1; pid <= 6; pid++) {
+            PCB* pcb = pcb_create(pid, NULL);
+            pcb->priority = pid % 3;
+            pcb->quantum = 7 + 13 * pid;
+            if (pid == 6) pcb->affinity = 1;
+            scheduler_add_process(scheds[s], pcb);
+        }
+    }
+    for (int t = 0; t < 5000; t++) {
+        scheduler_tick(ticked);
+    }
+    scheduler_advance(skipped, 5000);
+    
+    assert(skipped->system_time == ticked->system_time);
+    assert(skipped->boost_epoch == ticked->boost_epoch);
+    assert(skipped->skipped_ticks > 4000);
+    for (int i = 0; i < 6; i++) {
+        assert(skipped->processes[i]->cpu_time == ticked->processes[i]->cpu_time);
+        assert(skipped->processes[i]->quantum_remaining == ticked->processes[i]->quantum_remaining);
+    }
+    for (int cpu = 0; cpu < 4; cpu++) {
+        assert(skipped->cpus[cpu].busy_ticks == ticked->cpus[cpu].busy_ticks);
+        assert(skipped->cpus[cpu].migration_ticks == ticked->cpus[cpu].migration_ticks);
+        assert(skipped->cpus[cpu].idle_ticks == ticked->cpus[cpu].idle_ticks);
+        assert(skipped->cpus[cpu].dispatches == ticked->cpus[cpu].dispatches);
+    }
+    for (int s = 0; s < 2; s++) {
+        for (int i = 0; i < scheds[s]->process_count; i++) {
+            pcb_destroy(scheds[s]->processes[i]);
+        }
+        scheduler_destroy(scheds[s]);
+        free(scheds[s]);
+    }
+    
+    Microkernel* kernel = kernel_create(16 * MiB);
+    assert(kernel != NULL);
+    uint32_t sleeper = kernel_create_process(kernel, NULL);
+    uint32_t waiter = kernel_create_process(kernel, NULL);
+    PCB* sleep_pcb = kernel_find_process(kernel, sleeper);
+    PCB* wait_pcb = kernel_find_process(kernel, waiter);
+    
+    // A sleep wakes on its tick
+    assert(kernel_sleep_process(kernel, sleeper, 1000) == 0);
+    assert(sleep_pcb->state == PROC_BLOCKED);
+    kernel_advance(kernel, 999);
+    assert(sleep_pcb->state == PROC_BLOCKED);
+    kernel_advance(kernel, 1);
+    assert(sleep_pcb->state == PROC_READY && sleep_pcb->wakeups == 1);
+    kernel_advance(kernel, 1);
+    assert(sleep_pcb->state == PROC_RUNNING);
+    
+    // A message wakes its waiter; an expired timeout wakes it without one,
+    // and the first wait's timeout is stale by then
+    int qid = kernel_create_queue(kernel, MQ_MPMC);
+    assert(kernel_wait_message(kernel, qid, waiter, 50) == 1);
+    kernel_advance(kernel, 10);
+    assert(wait_pcb->state == PROC_BLOCKED);
+    Message msg = {0};
+    kernel_send_message(kernel, qid, &msg);
+    assert(kernel_wait_message(kernel, qid, sleeper, MQ_WAIT_FOREVER) == 0);
+    kernel_advance(kernel, 2);
+    assert(wait_pcb->state != PROC_BLOCKED && wait_pcb->wait_queue == -1);
+    assert(kernel_receive_message(kernel, qid, &msg, 0) == 0);
+    
+    assert(kernel_wait_message(kernel, qid, waiter, 30) == 1);
+    kernel_advance(kernel, 29);
+    assert(wait_pcb->state == PROC_BLOCKED);
+    kernel_advance(kernel, 1);
+    assert(wait_pcb->state != PROC_BLOCKED && kernel->queue_waiters[qid] == NULL);
+    assert(wait_pcb->wakeups == 2);
+    
+    // With everything asleep, a million ticks are just the timer's events
+    kernel_sleep_process(kernel, sleeper, 2000000);
+    kernel_sleep_process(kernel, waiter, 2000000);
+    uint64_t fired = 0;
+    assert(kernel_add_timer(kernel, 100, 100, count_timer, &fired) == 0);
+    uint64_t now = kernel->scheduler->system_time;
+    uint64_t start = get_time_us();
+    kernel_advance(kernel, 2000000);
+    assert(fired == 10000);
+    assert(kernel->scheduler->system_time == now + 1000000);
+    assert(get_time_us() - start < 1000000);
+    
+    // Realtime pacing holds the clock to wall time
+    kernel_set_realtime(kernel, true);
+    start = get_time_us();
+    kernel_advance(kernel, 100);
+    assert(get_time_us() - start >= 100 * KERNEL_REALTIME_TICK_US);
+    assert(fired == 10001);
+    
+    kernel_destroy(kernel);
+    
+    printf("Event clock test PASSED\n");
+}
+
+void test_syscalls(void) {
+    printf("Testing system calls...\n");
+    
+    Microkernel* kernel = kernel_create(16 * MiB);
+    assert(kernel != NULL);
+    uint32_t pid = kernel_create_process(kernel, NULL);
+    PCB* pcb = kernel_find_process(kernel, pid);
+    
+    // Direct calls
+    assert(syscall_invoke(kernel, pcb, SYS_GETPID, 0, 0, 0, 0) == pid);
+    assert(syscall_invoke(kernel, pcb, SYS_MAX, 0, 0, 0, 0) == (uint64_t)-1);
+    assert(syscall_invoke(kernel, pcb, SYS_IOCTL, 0, 0, 0, 0) == (uint64_t)-1);
+    vfs_create_file(kernel->filesystem, "log.txt", 0);
+    uint64_t fd = syscall_invoke(kernel, pcb, SYS_OPEN, (uint64_t)"log.txt", 0, 0, 0);
+    assert(fd < MAX_FILES);
+    
+    // A batch of writes runs in one SYS_RING_ENTER
+    assert(syscall_ring_setup(pcb, 6) == 0);
+    SyscallRing* ring = pcb->ring;
+    assert(ring->mask == 7);
+    char line[] = "syscall\n";
+    for (int i = 0; i < 8; i++) {
+        assert(syscall_ring_submit(ring, SYS_WRITE, (uint64_t)line, fd, strlen(line), 0, 100 + i) == 0);
+    }
+    assert(syscall_ring_submit(ring, SYS_WRITE, (uint64_t)line, fd, strlen(line), 0, 108) == -1);
+    assert(syscall_invoke(kernel, pcb, SYS_RING_ENTER, 0, 0, 0, 0) == 8);
+    
+    SyscallCompletion done[16];
+    assert(syscall_ring_reap(ring, done, 16) == 8);
+    for (int i = 0; i < 8; i++) {
+        assert(done[i].user_data == 100 + (uint64_t)i);
+        assert(done[i].result == strlen(line));
+    }
+    assert(syscall_ring_reap(ring, done, 16) == 0);
+    VFile* file = kernel->filesystem->files[kernel->filesystem->fds[pcb->open_files[fd]].file];
+    assert(file->size == 8 * strlen(line));
+    assert(kernel->syscall_stats[SYS_WRITE].calls == 8);
+    assert(kernel->syscall_stats[SYS_WRITE].batched == 8);
+    assert(kernel->syscall_stats[SYS_RING_ENTER].calls == 1);
+    
+    // A full completion queue holds the rest back until it is reaped
+    for (int i = 0; i < 8; i++) {
+        syscall_ring_submit(ring, SYS_GETPID, 0, 0, 0, 0, i);
+    }
+    assert(syscall_ring_drain(kernel, pcb) == 8);
+    for (int i = 0; i < 2; i++) {
+        syscall_ring_submit(ring, SYS_GETPID, 0, 0, 0, 0, 8 + i);
+    }
+    assert(syscall_ring_drain(kernel, pcb) == 0);
+    assert(ring->overflows == 1);
+    assert(syscall_ring_reap(ring, done, 4) == 4 && done[3].user_data == 3);
+    assert(syscall_ring_drain(kernel, pcb) == 2);
+    assert(syscall_ring_reap(ring, done, 16) == 6 && done[5].user_data == 9);
+    assert(done[5].result == pid);
+    
+    // A call that blocks ends the batch; the rest wait for the next entry
+    syscall_ring_submit(ring, SYS_SLEEP, 10, 0, 0, 0, 0);
+    syscall_ring_submit(ring, SYS_GETPID, 0, 0, 0, 0, 1);
+    syscall_ring_submit(ring, SYS_RING_ENTER, 0, 0, 0, 0, 2);
+    assert(syscall_ring_drain(kernel, pcb) == 1);
+    assert(pcb->state == PROC_BLOCKED);
+    kernel_advance(kernel, 20);
+    assert(pcb->state != PROC_BLOCKED);
+    assert(syscall_ring_drain(kernel, pcb) == 2);
+    assert(syscall_ring_reap(ring, done, 16) == 3);
+    assert(done[1].result == pid && done[2].result == (uint64_t)-1);
+    
+    kernel_destroy(kernel);
+    
+    printf("System call test PASSED\n");
+}
+
 void test_vfs(void) {
     printf("Testing virtual filesystem...\n");
     
@@ -126,22 +1606,90 @@ void test_vfs(void) {
     int fd = vfs_create_file(vfs, "test.txt", 1024);
     assert(fd >= 0);
     
-    // Open the file
+    // Open the file: a second descriptor with its own offset
     int open_fd = vfs_open_file(vfs, "test.txt");
-    assert(open_fd == fd);
+    assert(open_fd >= 0 && open_fd != fd);
     
     // Write to file
     char data[] = "Hello, World!";
     int written = vfs_write_file(vfs, fd, data, strlen(data));
-    assert(written == strlen(data));
+    assert(written == (int)strlen(data));
     
     // Read from file
     char buffer[100];
-    int read = vfs_read_file(vfs, fd, buffer, sizeof(buffer));
-    assert(read == strlen(data));
+    int read = vfs_read_file(vfs, open_fd, buffer, sizeof(buffer));
+    assert(read == sizeof(buffer));
     assert(strcmp(buffer, data) == 0);
     
+    // Offsets move independently; reads stop at the end of the file
+    assert(vfs_read_file(vfs, fd, buffer, 5) == 5);
+    assert(memcmp(buffer, "\0\0\0\0\0", 5) == 0);
+    assert(vfs_seek(vfs, open_fd, -4, SEEK_END) == 1020);
+    assert(vfs_read_file(vfs, open_fd, buffer, sizeof(buffer)) == 4);
+    assert(vfs_read_file(vfs, open_fd, buffer, sizeof(buffer)) == 0);
+    
+    // Writing past the end leaves a hole of zeros
+    assert(vfs_seek(vfs, fd, 3 * VFS_CHUNK_SIZE, SEEK_SET) == 3 * VFS_CHUNK_SIZE);
+    assert(vfs_write_file(vfs, fd, data, strlen(data)) == (int)strlen(data));
+    VFile* file = vfs->files[vfs->fds[fd].file];
+    assert(file->size == 3 * VFS_CHUNK_SIZE + strlen(data));
+    assert(file->chunk_count == 2);
+    vfs_seek(vfs, open_fd, 2 * VFS_CHUNK_SIZE, SEEK_SET);
+    assert(vfs_read_file(vfs, open_fd, buffer, 1) == 1 && buffer[0] == 0);
+    
+    // Growing never moves data already written
+    int log = vfs_create_file(vfs, "big.log", 0);
+    char line[1000];
+    memset(line, 'x', sizeof(line));
+    vfs_write_file(vfs, log, line, sizeof(line));
+    VFile* log_file = vfs->files[vfs->fds[log].file];
+    uint8_t* first = log_file->chunks[0];
+    for (int i = 0; i < 10000; i++) {
+        assert(vfs_write_file(vfs, log, line, sizeof(line)) == sizeof(line));
+    }
+    assert(log_file->chunks[0] == first);
+    assert(log_file->size == 10001 * sizeof(line));
     vfs_list_files(vfs);
+    
+    // Descriptors are reused once closed
+    assert(vfs_close_file(vfs, open_fd) == 0);
+    assert(vfs_close_file(vfs, open_fd) == -1);
+    assert(vfs_read_file(vfs, open_fd, buffer, 1) == -1);
+    assert(vfs_open_file(vfs, "test.txt") == open_fd);
+    
+    // The name index grows past the old 128-file limit
+    char name[MAX_NAME_LEN];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "file%d", i);
+        assert(vfs_create_file(vfs, name, i) >= 0);
+    }
+    assert(vfs_create_file(vfs, "file500", 0) == -1);
+    int f = vfs_open_file(vfs, "file999");
+    assert(f >= 0 && vfs->files[vfs->fds[f].file]->size == 999);
+    assert(vfs_open_file(vfs, "missing") == -1);
+    
+    // mmap hands the file's chunks to guest memory without a copy
+    MemoryManager* mm = mm_create(16 * MiB);
+    uint64_t vaddr = 0;
+    assert(vfs_mmap(vfs, mm, 7, fd, 4 * VFS_CHUNK_SIZE, 1, &vaddr) == -1);
+    assert(vfs_mmap(vfs, mm, 7, fd, 5, VFS_CHUNK_SIZE, &vaddr) == -1);
+    assert(vfs_mmap(vfs, mm, 7, fd, 0, file->size, &vaddr) == 0);
+    uint64_t paddr = mm_translate_address(mm, 7, vaddr + 3 * VFS_CHUNK_SIZE);
+    assert(paddr != 0);
+    gmem_read(mm->physical_memory, paddr, buffer, strlen(data) + 1);
+    assert(memcmp(buffer, data, strlen(data)) == 0 && buffer[strlen(data)] == 0);
+    
+    gmem_write(mm->physical_memory, paddr, "J", 1);
+    vfs_seek(vfs, open_fd, 3 * VFS_CHUNK_SIZE, SEEK_SET);
+    vfs_read_file(vfs, open_fd, buffer, 5);
+    assert(memcmp(buffer, "Jello", 5) == 0);
+    assert(mm->physical_memory->shared_pages == 4 && file->chunk_count == 4);
+    
+    mm_free_pages(mm, 7);
+    assert(mm->physical_memory->shared_pages == 0);
+    assert(file->chunks[3][0] == 'J');
+    mm_destroy(mm);
+    
     vfs_destroy(vfs);
     
     printf("VFS test PASSED\n");
@@ -171,6 +1719,426 @@ void test_rtos(void) {
     printf("RTOS test PASSED\n");
 }
 
+static uint32_t wheel_counts[4];
+static void wheel_fire_a(void) { wheel_counts[0]++; }
+static void wheel_fire_b(void) { wheel_counts[1]++; }
+static void wheel_fire_c(void) { wheel_counts[2]++; }
+static void wheel_fire_d(void) { wheel_counts[3]++; }
+
+static uint32_t run_log[4];
+static uint32_t run_count;
+static void log_task(void* arg) { run_log[run_count++] = (uint32_t)(uintptr_t)arg; }
+
+void test_rtos_scheduling(void) {
+    printf("Testing RTOS policies and timer wheel...\n");
+
+    // Each timer fires on exactly its tick, at every wheel level and past the top span
+    TimerWheel wheel;
+    VirtualTimer timers[4];
+    void (*fire[4])(void) = {wheel_fire_a, wheel_fire_b, wheel_fire_c, wheel_fire_d};
+    uint64_t compare[4] = {3, 100, 70000, (1ULL << 25) + 5};
+    timer_wheel_init(&wheel);
+    for (int i = 0; i < 4; i++) {
+        timer_init(&timers[i], 1, i == 0);
+        timer_wheel_attach(&wheel, &timers[i]);
+        timer_set_callback(&timers[i], fire[i]);
+        timer_start(&timers[i], compare[i]);
+    }
+    assert(wheel.armed == 4);
+
+    timer_wheel_advance(&wheel, 99);
+    assert(wheel_counts[0] == 33 && wheel_counts[1] == 0);
+    assert(timer_get_value(&timers[1]) == 99);
+    timer_wheel_advance(&wheel, 1);
+    assert(wheel_counts[1] == 1 && !timer_is_running(&timers[1]));
+
+    timer_wheel_advance(&wheel, 69899);
+    assert(wheel_counts[2] == 0);
+    timer_wheel_advance(&wheel, 1);
+    assert(wheel_counts[2] == 1 && wheel_counts[0] == 70000 / 3);
+
+    timer_stop(&timers[0]);
+    assert(timer_get_value(&timers[0]) == 70000 % 3);
+    timer_wheel_advance(&wheel, (1ULL << 25) + 4 - 70000);
+    assert(wheel_counts[3] == 0);
+    timer_wheel_advance(&wheel, 1);
+    assert(wheel_counts[3] == 1 && wheel_counts[0] == 70000 / 3);
+    assert(wheel.armed == 0);
+
+    // 87.5% utilization is past the Liu & Layland bound, yet response times
+    // (with one job of blocking, as tasks run to completion) meet every deadline
+    RTOS* rtos = rtos_create();
+    assert(rtos != NULL);
+    rtos_create_task(rtos, NULL, NULL, PRIO_HIGH, 10, 5);
+    rtos_create_task(rtos, NULL, NULL, PRIO_NORMAL, 20, 5);
+    rtos_create_task(rtos, NULL, NULL, PRIO_LOW, 40, 5);
+    assert(rtos_schedulable(rtos));
+    assert(rtos_response_time(rtos, 1) == 10);
+    assert(rtos_response_time(rtos, 2) == 20);
+    assert(rtos_response_time(rtos, 3) == 20);
+    rtos_set_policy(rtos, RTOS_EDF);
+    assert(rtos_schedulable(rtos));
+    rtos_destroy(rtos);
+
+    // A 10 ms job started just before the 10 ms task's release sinks it
+    // under both policies
+    rtos = rtos_create();
+    rtos_create_task(rtos, NULL, NULL, PRIO_HIGH, 10, 2);
+    rtos_create_task(rtos, NULL, NULL, PRIO_LOW, 50, 10);
+    assert(!rtos_schedulable(rtos));
+    assert(rtos_response_time(rtos, 1) == UINT32_MAX);
+    rtos_set_policy(rtos, RTOS_EDF);
+    assert(!rtos_schedulable(rtos));
+    rtos_destroy(rtos);
+
+    // Fixed priority runs by priority, EDF by deadline
+    for (int edf = 0; edf < 2; edf++) {
+        rtos = rtos_create();
+        rtos_create_task(rtos, log_task, (void*)1, PRIO_LOW, 100000, 0);
+        rtos_create_task(rtos, log_task, (void*)2, PRIO_HIGH, 300000, 0);
+        rtos_create_task(rtos, log_task, (void*)3, PRIO_NORMAL, 200000, 0);
+        if (edf) rtos_set_policy(rtos, RTOS_EDF);
+
+        run_count = 0;
+        for (int i = 0; i < 4; i++) {
+            rtos_schedule(rtos);
+        }
+        assert(run_count == 3);
+        if (edf) {
+            assert(run_log[0] == 1 && run_log[1] == 3 && run_log[2] == 2);
+        } else {
+            assert(run_log[0] == 2 && run_log[1] == 3 && run_log[2] == 1);
+        }
+        assert(rtos->idle_time == 1);
+        rtos_destroy(rtos);
+    }
+
+    printf("RTOS scheduling test PASSED\n");
+}
+
+void test_tickless_idle(void) {
+    printf("Testing tickless idle...\n");
+
+    assert(pm_deepest_state(0) == POWER_RUN);
+    assert(pm_deepest_state(PM_IDLE_WAKEUP_US) == POWER_IDLE);
+    assert(pm_deepest_state(PM_DEEP_SLEEP_WAKEUP_US - 1) == POWER_SLEEP);
+    assert(pm_deepest_state(UINT64_MAX) == POWER_DEEP_SLEEP);
+
+    RTOS* rtos = rtos_create();
+    PowerManager* pm = pm_create();
+    assert(rtos != NULL && pm != NULL);
+    rtos_set_tickless(rtos, true, pm);
+    uint32_t id = rtos_create_task(rtos, NULL, NULL, PRIO_NORMAL, 20, 1);
+
+    // The next wake-up is the earlier of a release and a timer expiry
+    rtos_schedule(rtos);
+    assert(rtos_next_wakeup(rtos) == rtos->tasks[id - 1].next_run);
+    timer_start(&rtos->timers[0], 5);
+    assert(rtos_next_wakeup(rtos) == rtos->wheel_origin + rtos->wheel.now + 5);
+    timer_stop(&rtos->timers[0]);
+
+    // Every call either runs a job or sleeps to the next release: no polling
+    uint64_t start = get_time_ms();
+    while (get_time_ms() - start < 200) {
+        rtos_schedule(rtos);
+        rtos_idle(rtos);
+    }
+    RTTask* task = &rtos->tasks[id - 1];
+    assert(task->executions >= 9 && task->misses == 0);
+    assert(rtos->schedule_calls <= 2 * task->executions + 2);
+    assert(rtos->sleeps >= task->executions - 1);
+    assert(pm->state == POWER_RUN);
+    assert(pm->state_entries[POWER_DEEP_SLEEP] >= task->executions - 1);
+    assert(pm->time_in_state[POWER_DEEP_SLEEP] >= 150);
+    assert(task->energy > 0 && task->energy <= pm->total_energy);
+
+    rtos_print_stats(rtos);
+    pm_destroy(pm);
+    rtos_destroy(rtos);
+
+    printf("Tickless idle test PASSED\n");
+}
+
+void test_rtos_fleet(void) {
+    printf("Testing RTOS fleet...\n");
+
+    // Virtual time never waits on the host, and the same seed gives the
+    // same fleet however many threads step it
+    RTOSFleet* serial = fleet_create(64, 42, NULL, NULL);
+    RTOSFleet* parallel = fleet_create(64, 42, NULL, NULL);
+    assert(serial != NULL && parallel != NULL);
+
+    uint64_t start = get_time_ms();
+    assert(fleet_run(serial, 30000, 1) == 0);
+    assert(fleet_run(parallel, 30000, 4) == 0);
+    assert(get_time_ms() - start < 30000);
+
+    assert(serial->executions > 64 * 30 * 4);
+    assert(serial->executions == parallel->executions);
+    assert(serial->misses == parallel->misses);
+    assert(serial->energy == parallel->energy);
+    assert(serial->nodes_missing == parallel->nodes_missing);
+    for (uint32_t i = 0; i < 64; i++) {
+        assert(serial->nodes[i].clock_us == 30000000);
+        assert(serial->nodes[i].sensors[0].temperature == parallel->nodes[i].sensors[0].temperature);
+    }
+
+    // Long reports block the sampler on some nodes only, and nodes sleep
+    // deep between jobs
+    assert(serial->misses > 0 && serial->nodes_missing < 64);
+    assert(serial->power[0].time_in_state[POWER_DEEP_SLEEP] > serial->power[0].time_in_state[POWER_RUN]);
+
+    // Other seeds give other nodes
+    RTOSFleet* other = fleet_create(64, 7, NULL, NULL);
+    assert(other != NULL);
+    assert(fleet_run(other, 30000, 0) == 0);
+    assert(other->energy != serial->energy);
+
+    fleet_print_stats(parallel);
+    fleet_destroy(serial);
+    fleet_destroy(parallel);
+    fleet_destroy(other);
+
+    printf("RTOS fleet test PASSED\n");
+}
+
+void test_sensor_bank(void) {
+    printf("Testing sensor bank and stream...\n");
+
+    // Every kernel matches the scalar one, padding lanes and all
+    SensorBank* scalar = sensor_bank_create(1003, 9);
+    SensorBank* fast = sensor_bank_create(1003, 9);
+    assert(scalar != NULL && fast != NULL);
+    assert(scalar->stride == 1008);
+    assert(sensor_bank_set_kernel(scalar, "scalar") == 0);
+    assert(sensor_bank_set_kernel(scalar, "mmx") == -1);
+    printf("Bank kernel: %s\n", fast->kernel);
+
+    for (uint64_t t = 0; t < 20; t++) {
+        sensor_bank_generate(scalar, t * 3600 * 1000);
+        sensor_bank_generate(fast, t * 3600 * 1000);
+        for (uint32_t i = 0; i < scalar->count; i++) {
+            assert(fabsf(scalar->temperature[i] - fast->temperature[i]) < 1e-4f);
+            assert(fabsf(scalar->humidity[i] - fast->humidity[i]) < 1e-4f);
+            assert(fabsf(scalar->pressure[i] - fast->pressure[i]) < 1e-3f);
+            assert(fabsf(scalar->acceleration[2][i] - fast->acceleration[2][i]) < 1e-5f);
+            assert(abs((int)scalar->light_level[i] - (int)fast->light_level[i]) <= 1);
+        }
+    }
+
+    // Readings follow the daily cycle within the noise band
+    float day = (float)fmod(19 * 3600.0, 86400.0) / 86400.0f;
+    double noise_sum = 0.0;
+    uint32_t moving = 0;
+    for (uint32_t i = 0; i < scalar->count; i++) {
+        float cycle = sinf(2 * M_PI * (day + scalar->phase[i]));
+        float noise = scalar->temperature[i] - (20.0f + 10.0f * cycle);
+        assert(fabsf(noise) <= 0.5f + 1e-4f);
+        noise_sum += noise;
+        assert(scalar->humidity[i] >= 0.0f && scalar->humidity[i] <= 100.0f);
+        assert(scalar->light_level[i] <= 1050);
+        moving += fabsf(scalar->acceleration[0][i]) > 0.01f;
+    }
+    assert(fabs(noise_sum / scalar->count) < 0.05);
+
+    // An hour between samples is well past the 5 s movement period
+    assert(moving > scalar->count / 2);
+
+    VirtualSensor view;
+    sensor_bank_read(scalar, 7, &view);
+    assert(view.temperature == scalar->temperature[7] && view.light_level == scalar->light_level[7]);
+    sensor_bank_destroy(scalar);
+    sensor_bank_destroy(fast);
+
+    // Windowed min/max/mean and edge-triggered crossings, nothing buffered
+    SensorStream* stream = sensor_stream_create(2, 4, 0.0f, 10.0f);
+    assert(stream != NULL);
+    float samples[6][2] = {{1, 5}, {12, 6}, {13, 7}, {2, -1}, {11, 4}, {3, 4}};
+    for (int k = 0; k < 4; k++) {
+        sensor_stream_push(stream, samples[k]);
+    }
+    assert(stream->windows == 1 && stream->filled == 0);
+    assert(stream->window_min[0] == 1 && stream->window_max[0] == 13 && stream->window_mean[0] == 7);
+    assert(stream->window_min[1] == -1 && stream->window_max[1] == 7 && stream->window_mean[1] == 4.25f);
+    assert(stream->crossings[0] == 1 && stream->crossings[1] == 1);
+    sensor_stream_push(stream, samples[4]);
+    sensor_stream_push(stream, samples[5]);
+    assert(stream->crossings[0] == 2 && stream->total_crossings == 3);
+    assert(stream->windows == 1 && stream->filled == 2 && stream->min[0] == 3);
+    sensor_stream_destroy(stream);
+
+    // Wide enough for whole vectors plus a tail: same answers as by hand
+    stream = sensor_stream_create(21, 3, -0.5f, 0.5f);
+    assert(stream != NULL);
+    printf("Stream kernel: %s\n", stream->kernel);
+    uint32_t expected[21] = {0};
+    int32_t zones[21] = {0};
+    float low[21], high[21];
+    uint64_t state = 5;
+    for (int k = 0; k < 9; k++) {
+        float values[21];
+        for (int i = 0; i < 21; i++) {
+            values[i] = (float)(splitmix64(&state) % 1000) / 500.0f - 1.0f;
+            low[i] = k % 3 == 0 || values[i] < low[i] ? values[i] : low[i];
+            high[i] = k % 3 == 0 || values[i] > high[i] ? values[i] : high[i];
+            int32_t zone = (values[i] > 0.5f) - (values[i] < -0.5f);
+            expected[i] += zone != 0 && zone != zones[i];
+            zones[i] = zone;
+        }
+        sensor_stream_push(stream, values);
+    }
+    uint64_t total = 0;
+    for (int i = 0; i < 21; i++) {
+        assert(stream->crossings[i] == expected[i]);
+        assert(stream->window_min[i] == low[i] && stream->window_max[i] == high[i]);
+        total += expected[i];
+    }
+    assert(stream->windows == 3 && stream->total_crossings == total);
+    sensor_stream_destroy(stream);
+
+    printf("Sensor bank test PASSED\n");
+}
+
+#define HAL_STREAM_BYTES 60000
+#define HAL_DMA_CHUNK 1000
+#define HAL_EDGES 4000
+
+typedef struct {
+    RTOS* rtos;
+    bool done;
+} HalLine;
+
+typedef struct {
+    VirtualUART* uart;
+    uint8_t* data;
+    uint32_t offset;
+} HalReceiver;
+
+static uint32_t hal_edges[2];
+
+static void hal_gpio_callback(uint32_t pin, uint32_t value) {
+    assert(pin == 3 && value <= 1);
+    hal_edges[value]++;
+}
+
+// Next chunk as soon as one completes, from inside uart_dma_service
+static void hal_rx_complete(UARTDMA* desc, void* arg) {
+    HalReceiver* rx = (HalReceiver*)arg;
+    rx->offset += desc->length;
+    if (rx->offset < HAL_STREAM_BYTES) {
+        desc->buffer = rx->data + rx->offset;
+        assert(uart_dma_rx(rx->uart, desc) == 0);
+    }
+}
+
+// The other end of the wire: streams bytes in, checks what comes out and
+// toggles an input pin, never waiting on the scheduler
+static void* hal_line_thread(void* arg) {
+    HalLine* line = (HalLine*)arg;
+    VirtualUART* uart = &line->rtos->uart;
+    uint8_t chunk[97];
+    uint32_t sent = 0, received = 0, edges = 0;
+
+    while (sent < HAL_STREAM_BYTES || received < HAL_STREAM_BYTES || edges < HAL_EDGES) {
+        uint32_t n = MIN((uint32_t)sizeof(chunk), HAL_STREAM_BYTES - sent);
+        for (uint32_t i = 0; i < n; i++) {
+            chunk[i] = (uint8_t)((sent + i) * 7);
+        }
+        uint32_t moved = uart_line_send(uart, chunk, n);
+        sent += moved;
+
+        n = uart_line_receive(uart, chunk, sizeof(chunk));
+        for (uint32_t i = 0; i < n; i++) {
+            assert(chunk[i] == (uint8_t)((received + i) * 13));
+        }
+        received += n;
+        moved += n;
+
+        if (edges < HAL_EDGES) {
+            edges++;
+            gpio_drive(&line->rtos->gpio, 3, edges & 1);
+        }
+        if (moved == 0) sched_yield();
+    }
+    __atomic_store_n(&line->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+void test_peripheral_rings(void) {
+    printf("Testing peripheral rings...\n");
+
+    // Capacity rounds up; a full ring takes what fits and counts the rest
+    SPSCRing ring;
+    uint32_t values[12], out[12];
+    for (uint32_t i = 0; i < 12; i++) values[i] = i;
+    assert(spsc_ring_init(&ring, 5, sizeof(uint32_t)) == 0);
+    assert(ring.mask == 7);
+    assert(spsc_ring_push(&ring, values, 6) == 6);
+    assert(spsc_ring_pop(&ring, out, 4) == 4 && out[3] == 3);
+    assert(spsc_ring_push(&ring, values + 6, 6) == 6);    // wraps
+    assert(spsc_ring_push(&ring, values, 1) == 0 && ring.dropped == 1);
+    assert(spsc_ring_count(&ring) == 8);
+    assert(spsc_ring_pop(&ring, out, 12) == 8);
+    for (uint32_t i = 0; i < 8; i++) assert(out[i] == i + 4);
+    spsc_ring_destroy(&ring);
+
+    RTOS* rtos = rtos_create();
+    assert(rtos != NULL);
+    assert(uart_configure(&rtos->uart, 3000000, 0, 64) == -1);
+    assert(uart_configure(&rtos->uart, 3000000, 64, 48) == 0);
+    assert(rtos->uart.tx.mask == 63);
+    rtos->gpio.callback = hal_gpio_callback;
+    rtos->gpio.interrupt_mask = (1 << 3) | (1 << 5);
+
+    // Interrupts wait for the scheduler; writing the same level is no edge
+    gpio_set_direction(&rtos->gpio, 5, true);
+    gpio_write(&rtos->gpio, 5, true);
+    gpio_write(&rtos->gpio, 5, true);
+    gpio_drive(&rtos->gpio, 5, false);    // an output: not ours to drive
+    assert(gpio_read(&rtos->gpio, 5) && rtos->gpio.delivered == 0);
+    gpio_set_direction(&rtos->gpio, 5, false);
+    rtos->gpio.callback = NULL;
+    assert(gpio_dispatch(&rtos->gpio) == 1);
+    rtos->gpio.callback = hal_gpio_callback;
+
+    // Both directions through DMA while another thread plays the line
+    static uint8_t tx_data[HAL_STREAM_BYTES], rx_data[HAL_STREAM_BYTES];
+    for (uint32_t i = 0; i < HAL_STREAM_BYTES; i++) tx_data[i] = (uint8_t)(i * 13);
+    UARTDMA tx = { .buffer = tx_data, .length = HAL_STREAM_BYTES };
+    UARTDMA rx = { .buffer = rx_data, .length = HAL_DMA_CHUNK, .complete = hal_rx_complete };
+    HalReceiver receiver = { .uart = &rtos->uart, .data = rx_data };
+    rx.arg = &receiver;
+    assert(uart_dma_tx(&rtos->uart, &tx) == 0);
+    assert(uart_dma_rx(&rtos->uart, &rx) == 0);
+
+    HalLine line = { .rtos = rtos };
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, hal_line_thread, &line) == 0);
+    while (!__atomic_load_n(&line.done, __ATOMIC_ACQUIRE) || !tx.done ||
+           receiver.offset < HAL_STREAM_BYTES) {
+        uint64_t moved = rtos->uart.dma_completed;
+        rtos_schedule(rtos);
+        if (rtos->uart.dma_completed == moved) sched_yield();
+    }
+    pthread_join(thread, NULL);
+    rtos_schedule(rtos);
+
+    for (uint32_t i = 0; i < HAL_STREAM_BYTES; i++) {
+        assert(rx_data[i] == (uint8_t)(i * 7));
+    }
+    assert(rtos->uart.dma_completed == 1 + HAL_STREAM_BYTES / HAL_DMA_CHUNK);
+
+    // Every edge was either delivered, in order of arrival, or dropped
+    printf("GPIO edges: %u rising, %u falling delivered, %lu dropped\n",
+           hal_edges[1], hal_edges[0], rtos->gpio.events.dropped);
+    assert(hal_edges[0] + hal_edges[1] + rtos->gpio.events.dropped == HAL_EDGES);
+    assert(rtos->gpio.delivered == 1 + hal_edges[0] + hal_edges[1]);
+    assert(!gpio_read(&rtos->gpio, 3));
+    rtos_destroy(rtos);
+
+    printf("Peripheral rings test PASSED\n");
+}
+
 void test_power_management(void) {
     printf("Testing power management...\n");
     
@@ -197,16 +2165,236 @@ void test_power_management(void) {
     printf("Power management test PASSED\n");
 }
 
+static uint64_t snapshot_ticks;
+
+static void snapshot_timer(Microkernel* kernel, void* arg) {
+    assert(arg == kernel);
+    snapshot_ticks++;
+}
+
+void test_snapshot(void) {
+    printf("Testing snapshots...\n");
+    const char* path = "/tmp/spectre_snapshot_test.snap";
+
+    // A CPU mid-program
+    CPU* cpu = cpu_create(64 * KiB);
+    load_sum_program(cpu, 1000);
+    cpu_run(cpu, 500);
+    assert(!cpu->halted);
+
+    // A kernel with a fork, a mapped file, swapped pages, queued messages
+    // and a timer
+    Microkernel* kernel = kernel_create(1 * MiB);
+    assert(kernel != NULL);
+    uint32_t pid = kernel_create_process(kernel, NULL);
+    uint32_t child = kernel_fork_process(kernel, pid);
+    assert(child != 0);
+    VFS* fs = kernel->filesystem;
+    int fd = vfs_create_file(fs, "snap.txt", 0);
+    char text[] = "checkpoint";
+    assert(vfs_write_file(fs, fd, text, sizeof(text)) == sizeof(text));
+    uint64_t mapped;
+    assert(vfs_mmap(fs, kernel->mm, pid, fd, 0, PAGE_SIZE, &mapped) == 0);
+    assert(mm_enable_swap(kernel->mm, fs, "swap", 1024, SWAP_CLOCK) == 0);
+    for (uint64_t page = 0; page < 512; page++) {
+        uint64_t paddr = mm_translate_write(kernel->mm, pid, (1000 + page) * PAGE_SIZE);
+        gmem_store64(kernel->mm->physical_memory, paddr, page * 7 + 1);
+    }
+    assert(kernel->mm->swap->swap_outs > 0);
+    int qid = kernel_create_queue(kernel, MQ_MPMC);
+    Message msg = {0};
+    msg_set_payload(&msg, "inline", 7);
+    assert(kernel_send_message(kernel, qid, &msg) == 0);
+    char* granted = (char*)malloc(4 * MSG_INLINE_SIZE);
+    memset(granted, 'g', 4 * MSG_INLINE_SIZE);
+    msg_set_payload(&msg, granted, 4 * MSG_INLINE_SIZE);
+    assert(kernel_send_message(kernel, qid, &msg) == 0);
+    assert(kernel_add_timer(kernel, 10, 10, snapshot_timer, kernel) == 0);
+    assert(kernel_sleep_process(kernel, child, 500) == 0);
+    kernel_advance(kernel, 100);
+
+    // An RTOS node on a virtual clock, partway through its schedule
+    RTOS* rtos = rtos_create();
+    PowerManager* pm = pm_create();
+    assert(rtos != NULL && pm != NULL);
+    rtos_set_virtual_clock(rtos, 0);
+    rtos_seed(rtos, 42);
+    rtos_set_tickless(rtos, true, pm);
+    fleet_sensor_node(rtos, 0, NULL);
+    rtos_advance(rtos, 3000);
+
+    SnapshotWriter* writer = snapshot_create(path);
+    assert(writer != NULL);
+    assert(cpu_snapshot(writer, cpu) == 0);
+    assert(kernel_snapshot(writer, kernel) == 0);
+    assert(rtos_snapshot(writer, rtos) == 0);
+    assert(snapshot_finish(writer) == 0);
+
+    // One open restores two independent CPUs; guest memory stays in the
+    // file until written
+    Snapshot* snap = snapshot_open(path);
+    assert(snap != NULL);
+    CPU* copy = cpu_restore(snap, 0);
+    CPU* twin = cpu_restore(snap, 0);
+    assert(copy != NULL && twin != NULL);
+    assert(cpu_restore(snap, 1) == NULL);
+    assert(copy->pc == cpu->pc && copy->cycles == cpu->cycles);
+    assert(memcmp(copy->registers, cpu->registers, sizeof(cpu->registers)) == 0);
+    assert(copy->l1_cache->hits == cpu->l1_cache->hits);
+    assert(copy->bp->total == cpu->bp->total);
+    assert(copy->memory->resident_pages == 0 && copy->memory->shared_pages > 0);
+    gmem_store64(copy->memory, 0x100, 5);
+    assert(gmem_load64(twin->memory, 0x100) == 1000);
+    gmem_store64(copy->memory, 0x100, 1000);
+    gmem_store64(twin->memory, 0x108, 5);
+    assert(gmem_load64(copy->memory, 0x108) != 5);
+    cpu_destroy(twin);
+
+    cpu_run(cpu, 100000);
+    cpu_run(copy, 100000);
+    assert(cpu->halted && copy->halted);
+    assert(copy->pc == cpu->pc && copy->cycles == cpu->cycles);
+    assert(memcmp(copy->registers, cpu->registers, sizeof(cpu->registers)) == 0);
+    assert(sum_result(copy) == sum_result(cpu) && sum_result(cpu) == 500500);
+    assert(copy->l1_cache->misses == cpu->l1_cache->misses);
+    assert(copy->bp->correct == cpu->bp->correct);
+
+    // The kernel comes back with its processes, files, swap and queues
+    Microkernel* restored = kernel_restore(snap, 0);
+    assert(restored != NULL);
+    assert(restored->scheduler->process_count == kernel->scheduler->process_count);
+    assert(restored->scheduler->system_time == kernel->scheduler->system_time);
+    PCB* sleeper = kernel_find_process(restored, child);
+    assert(sleeper != NULL && sleeper->state == PROC_BLOCKED);
+    for (uint64_t page = 0; page < 512; page += 37) {
+        uint64_t vaddr = (1000 + page) * PAGE_SIZE;
+        uint64_t paddr = mm_translate_address(restored->mm, pid, vaddr);
+        assert(paddr != 0 && gmem_load64(restored->mm->physical_memory, paddr) == page * 7 + 1);
+    }
+    char buf[sizeof(text)];
+    gmem_read(restored->mm->physical_memory, mm_translate_address(restored->mm, pid, mapped),
+              buf, sizeof(buf));
+    assert(strcmp(buf, text) == 0);
+
+    // The mapping still writes through to the restored file
+    gmem_write(restored->mm->physical_memory, mm_translate_write(restored->mm, pid, mapped), "restored", 9);
+    int rfd = vfs_open_file(restored->filesystem, "snap.txt");
+    assert(rfd >= 0 && vfs_read_file(restored->filesystem, rfd, buf, sizeof(buf)) == sizeof(buf));
+    assert(strcmp(buf, "restored") == 0);
+    fd = vfs_open_file(fs, "snap.txt");
+    assert(vfs_read_file(fs, fd, buf, sizeof(buf)) == sizeof(buf) && strcmp(buf, text) == 0);
+    
+    // A second kernel from the same handle sees neither write
+    Microkernel* sibling = kernel_restore(snap, 0);
+    assert(sibling != NULL);
+    gmem_read(sibling->mm->physical_memory, mm_translate_address(sibling->mm, pid, mapped),
+              buf, sizeof(buf));
+    assert(strcmp(buf, text) == 0);
+    uint64_t first = mm_translate_write(restored->mm, pid, 1000 * PAGE_SIZE);
+    gmem_store64(restored->mm->physical_memory, first, 99);
+    assert(gmem_load64(sibling->mm->physical_memory,
+                       mm_translate_address(sibling->mm, pid, 1000 * PAGE_SIZE)) == 1);
+    gmem_store64(restored->mm->physical_memory, first, 1);
+    kernel_destroy(sibling);
+
+    assert(kernel_receive_message(restored, qid, &msg, 0) == 0);
+    assert(strcmp((char*)msg.inline_data, "inline") == 0);
+    assert(kernel_receive_message(restored, qid, &msg, 0) == 0);
+    assert((msg.flags & MSG_GRANT) && msg.data != granted);
+    assert(msg.size == 4 * MSG_INLINE_SIZE && ((char*)msg.data)[msg.size - 1] == 'g');
+    free(msg.data);
+
+    // Both kernels run on alike, each timer firing for its own kernel
+    uint64_t ticks = snapshot_ticks;
+    kernel_advance(kernel, 1000);
+    kernel_advance(restored, 1000);
+    assert(snapshot_ticks == ticks + 200);
+    assert(restored->scheduler->system_time == kernel->scheduler->system_time);
+    assert(restored->events_dispatched == kernel->events_dispatched);
+    for (int i = 0; i < kernel->scheduler->process_count; i++) {
+        PCB* a = kernel->scheduler->processes[i];
+        PCB* b = restored->scheduler->processes[i];
+        assert(a->pid == b->pid && a->state == b->state && a->cpu_time == b->cpu_time);
+    }
+
+    // The RTOS node keeps its schedule, sensors and power state
+    RTOS* node = rtos_restore(snap, 0);
+    assert(node != NULL && node->pm != NULL && node->pm != pm);
+    assert(node->clock_us == rtos->clock_us);
+    rtos_advance(rtos, 5000);
+    rtos_advance(node, 5000);
+    assert(node->clock_us == rtos->clock_us);
+    for (uint32_t i = 0; i < rtos->task_count; i++) {
+        assert(node->tasks[i].executions == rtos->tasks[i].executions);
+        assert(node->tasks[i].misses == rtos->tasks[i].misses);
+        assert(node->tasks[i].energy == rtos->tasks[i].energy);
+    }
+    assert(node->sensors[0].temperature == rtos->sensors[0].temperature);
+    assert(node->pm->total_energy == pm->total_energy);
+
+    PowerManager* node_pm = node->pm;
+    rtos_destroy(node);
+    pm_destroy(node_pm);
+    kernel_destroy(restored);
+    cpu_destroy(copy);
+    snapshot_close(snap);
+
+    // Another build's snapshot, or none at all, is refused
+    assert(snapshot_open("/tmp/spectre_snapshot_missing.snap") == NULL);
+    FILE* file = fopen(path, "r+b");
+    assert(file != NULL);
+    fseek(file, offsetof(SnapshotHeader, build), SEEK_SET);
+    int byte = fgetc(file);
+    fseek(file, offsetof(SnapshotHeader, build), SEEK_SET);
+    fputc(byte ^ 1, file);
+    fclose(file);
+    assert(snapshot_open(path) == NULL);
+    remove(path);
+
+    rtos_destroy(rtos);
+    pm_destroy(pm);
+    kernel_destroy(kernel);
+    cpu_destroy(cpu);
+
+    printf("Snapshot test PASSED\n");
+}
+
 void run_all_tests(void) {
     printf("=== Running Unit Tests ===\n");
     
     test_cache();
+    test_cache_geometry();
+    test_cache_batch();
+    test_sweep();
+    test_predecode();
+    test_fast_forward();
+    test_tomasulo();
+    test_multicore();
+    test_profiler();
     test_branch_predictor();
+    test_branch_replay();
+    test_trace();
+    test_guest_memory();
     test_scheduler();
+    test_mlfq();
+    test_smp_scheduler();
     test_memory_manager();
+    test_page_tables();
+    test_buddy_allocator();
+    test_copy_on_write();
+    test_swap();
+    test_ipc();
+    test_event_clock();
+    test_syscalls();
     test_vfs();
     test_rtos();
+    test_rtos_scheduling();
+    test_tickless_idle();
+    test_rtos_fleet();
+    test_sensor_bank();
+    test_peripheral_rings();
     test_power_management();
+    test_snapshot();
     
     printf("\n=== All tests PASSED ===\n");
 }